@@ -4,10 +4,12 @@ echo Building USB Application DLL...
 :: Set compile environment
 set CC=gcc
 set DLL_NAME=USB_G2X.dll
+:: Minimum compiled log level (0=TRACE,1=DEBUG,2=INFO,3=WARN,4=ERROR,5=none)
+if "%LOG_MIN_LEVEL%"=="" set LOG_MIN_LEVEL=1
 
 :: Compile DLL
 echo Compiling DLL...
-%CC% -shared -o %DLL_NAME% usb_application.c usb_middleware.c usb_device.c usb_protocol.c usb_log.c usb_spi.c usb_bootloader.c usb_power.c usb_gpio.c usb_i2s.c usb_i2c.c usb_pwm.c usb_uart.c usb_audil.c -DUSB_API_EXPORTS -DBUILDING_DLL -I. -lsetupapi
+%CC% -shared -o %DLL_NAME% usb_application.c usb_middleware.c usb_device.c usb_protocol.c usb_log.c usb_ring.c usb_ring_file.c usb_sim.c usb_capture.c usb_frame.c usb_replay.c usb_spi.c usb_bootloader.c usb_power.c usb_gpio.c usb_i2s.c usb_i2c.c usb_pwm.c usb_uart.c usb_audil.c -DUSB_API_EXPORTS -DBUILDING_DLL -DUSB_LOG_MIN_LEVEL=%LOG_MIN_LEVEL% -I. -lsetupapi
 
 :: Check compilation result
 if %errorlevel% neq 0 (
@@ -9,6 +9,9 @@ COMPILER=${CC:-gcc}
 CFLAGS=${CFLAGS:-"-O2 -fPIC -I."}
 LDFLAGS=${LDFLAGS:-"-shared"}
 LIBS=${LIBS:-"-ldl -lpthread"}
+# 编译期最低日志级别(0=TRACE,1=DEBUG,2=INFO,3=WARN,4=ERROR,5=全部编译掉)
+# 默认1：逐包TRACE日志不编译进库，调试解析时用 LOG_MIN_LEVEL=0 ./build_so.sh
+LOG_MIN_LEVEL=${LOG_MIN_LEVEL:-1}
 TARGET=USB_G2X.so
 # 源文件清单（保持与项目一致，如有新增 .c 记得补充）
 SRCS=(
@@ -17,6 +20,12 @@ SRCS=(
   usb_device.c
   usb_protocol.c
   usb_log.c
+  usb_ring.c
+  usb_ring_file.c
+  usb_sim.c
+  usb_capture.c
+  usb_frame.c
+  usb_replay.c
   usb_spi.c
   usb_bootloader.c
   usb_power.c
@@ -30,10 +39,11 @@ SRCS=(
 
 usage() {
   cat <<EOF
-Usage: $0 [build|clean|rebuild]
+Usage: $0 [build|clean|rebuild|test]
   build    直接用 gcc 编译并生成 USB_G2X.so (默认)，不依赖 Makefile
   clean    清理构建产物（删除 USB_G2X.so）
   rebuild  先清理再重新编译
+  test     编译并运行环形缓冲区压力测试 usb_ring_stress
 EOF
 }
 
@@ -41,7 +51,7 @@ cmd=${1:-build}
 case "$cmd" in
   build)
     echo "[BUILD] $TARGET"
-    if "$COMPILER" $CFLAGS $LDFLAGS -o "$TARGET" "${SRCS[@]}" $LIBS; then
+    if "$COMPILER" $CFLAGS -DUSB_LOG_MIN_LEVEL="$LOG_MIN_LEVEL" $LDFLAGS -o "$TARGET" "${SRCS[@]}" $LIBS; then
       echo "[SUCCESS] Build succeeded: $TARGET"
     else
       rc=$?
@@ -51,7 +61,12 @@ case "$cmd" in
     ;;
   clean)
     echo "[CLEAN] $TARGET"
-    rm -f -- "$TARGET"
+    rm -f -- "$TARGET" usb_ring_stress
+    ;;
+  test)
+    echo "[BUILD] usb_ring_stress"
+    "$COMPILER" -O2 -I. -o usb_ring_stress usb_ring_stress.c usb_ring.c -lpthread
+    ./usb_ring_stress
     ;;
   rebuild)
     "$0" clean
@@ -89,6 +89,30 @@ static inline DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds) {
     return WAIT_OBJECT_0;
 }
 
+// Condition variable -> pthread cond，等待时释放并重新获取CRITICAL_SECTION
+typedef pthread_cond_t CONDITION_VARIABLE;
+
+static inline void InitializeConditionVariable(CONDITION_VARIABLE* cv) {
+    pthread_cond_init(cv, NULL);
+}
+static inline BOOL SleepConditionVariableCS(CONDITION_VARIABLE* cv, CRITICAL_SECTION* cs, DWORD dwMilliseconds) {
+    if (dwMilliseconds == INFINITE) {
+        return pthread_cond_wait(cv, cs) == 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += dwMilliseconds / 1000;
+    ts.tv_nsec += (dwMilliseconds % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) { ts.tv_sec += 1; ts.tv_nsec -= 1000000000; }
+    return pthread_cond_timedwait(cv, cs, &ts) == 0;
+}
+static inline void WakeConditionVariable(CONDITION_VARIABLE* cv) {
+    pthread_cond_signal(cv);
+}
+static inline void WakeAllConditionVariable(CONDITION_VARIABLE* cv) {
+    pthread_cond_broadcast(cv);
+}
+
 static inline BOOL TerminateThread(HANDLE hThread, DWORD dwExitCode) {
     (void)dwExitCode;
 #if defined(__linux__)
@@ -221,6 +221,8 @@ def main():
             # 启动队列
 
             queue_start_result = usb_application.SPI_StartQueue(serial_param, SPIIndex)
+            # 发送循环使用句柄接口，省去每次调用按序列号查找设备
+            dev_handle = usb_application.USB_GetHandle(serial_param)
 
             print()
 
@@ -233,7 +235,7 @@ def main():
                     print(f"启动SPI队列失败，错误代码: {queue_start_result}")
                     return
                 T1 = time.time()
-                usb_application.GPIO_scan_Write(serial_param, key_gpio_index, 0)   # 下压按键
+                usb_application.GPIO_scan_WriteH(dev_handle, key_gpio_index, 0)   # 下压按键
                 # time.sleep(0.1)
                 # 使用队列控制的图像发送
                 image_index = 0
@@ -245,7 +247,7 @@ def main():
                     max_retries = 3  #重试次数
                     retry_count = 0
                     while retry_count <= max_retries:
-                        ret = usb_application.SPI_Queue_WriteBytes(serial_param, SPIIndex, images[image_index], len(images[image_index]))
+                        ret = usb_application.SPI_Queue_WriteBytesH(dev_handle, SPIIndex, images[image_index], len(images[image_index]))
                         if ret == 0:
                             sent_count += 1
                             break
@@ -260,7 +262,7 @@ def main():
                     image_index += 1
                     if image_index >= len(images):
                         image_index = 0  # 循环使用图像
-                usb_application.GPIO_Write(serial_param, key_gpio_index, 1)  # 抬起按键
+                usb_application.GPIO_WriteH(dev_handle, key_gpio_index, 1)  # 抬起按键
                 print(f'发送完成，总用时: {time.time() - T1:.3f}秒，成功发送: {sent_count}/{total_images} 张图像')
                 for i in images[-5:]:
                     usb_application.SPI_WriteBytes(serial_param, SPIIndex,i,len(i))
@@ -0,0 +1,542 @@
+"""
+模拟设备压测脚本 - 不需要硬件
+使用USB_SetTransport("sim")切换到进程内模拟设备，先检查STATUS/GPIO/PWM/固件信息应答，
+再分别用同步、异步、共用事件线程三种读取模式接收SPI从机数据，校验数据连续性并输出吞吐量，
+再用4个SPI索引同时上报数据，分别读取并校验各索引的数据连续性，
+再用分帧采集按96x240帧接收并校验帧内容和序号，用落盘采集写文件并校验文件内容，再用SPI_WriteBulk推送约4MB的图像并由模拟设备校验拆帧后的数据，最后对比逐帧等应答与滑动窗口两种方式的SPI队列写入速率
+"""
+
+import ctypes
+import os
+import sys
+import tempfile
+import time
+
+SPI_INDEX = 0
+RATE_UNLIMITED = 0xFFFFFFFF
+PATTERN_PERIOD = 251   # 模拟设备数据内容为模251递增的计数
+MAX_PROTOCOL_TYPES = 13
+LATENCY_BUCKETS = 24
+LATENCY_NAMES = ("SPI_GetQueueStatus", "GPIO_Read", "PWM_GetResult")
+
+
+class DeviceInfo(ctypes.Structure):
+    _fields_ = [
+        ("serial", ctypes.c_char * 64),
+        ("description", ctypes.c_char * 128),
+        ("manufacturer", ctypes.c_char * 128),
+        ("vendor_id", ctypes.c_ushort),
+        ("product_id", ctypes.c_ushort),
+        ("device_id", ctypes.c_int),
+    ]
+
+
+class SimConfig(ctypes.Structure):
+    _fields_ = [
+        ("device_count", ctypes.c_int),
+        ("spi_bytes_per_sec", ctypes.c_uint),
+        ("spi_packet_size", ctypes.c_uint),
+        ("current_bytes_per_sec", ctypes.c_uint),
+        ("current_packet_size", ctypes.c_uint),
+        ("uart_bytes_per_sec", ctypes.c_uint),
+        ("uart_packet_size", ctypes.c_uint),
+        ("garbage_every", ctypes.c_uint),
+        ("garbage_len", ctypes.c_uint),
+        ("drop_reply_every", ctypes.c_uint),
+        ("reply_delay_us", ctypes.c_uint),
+        ("queue_capacity", ctypes.c_uint),
+        ("queue_drain_per_sec", ctypes.c_uint),
+        ("uart_loopback", ctypes.c_int),
+        ("spi_index_count", ctypes.c_uint),
+    ]
+
+
+class SpiConfig(ctypes.Structure):
+    _fields_ = [
+        ("Mode", ctypes.c_char),
+        ("Master", ctypes.c_char),
+        ("CPOL", ctypes.c_char),
+        ("CPHA", ctypes.c_char),
+        ("LSBFirst", ctypes.c_char),
+        ("SelPolarity", ctypes.c_char),
+        ("ClockSpeedHz", ctypes.c_uint),
+    ]
+
+
+class SimStats(ctypes.Structure):
+    _fields_ = [
+        ("out_frames", ctypes.c_ulonglong),
+        ("out_bytes", ctypes.c_ulonglong),
+        ("bad_frames", ctypes.c_ulonglong),
+        ("in_bytes", ctypes.c_ulonglong),
+        ("stream_bytes", ctypes.c_ulonglong),
+        ("stream_overruns", ctypes.c_ulonglong),
+        ("replies", ctypes.c_ulonglong),
+        ("dropped_replies", ctypes.c_ulonglong),
+        ("spi_write_bytes", ctypes.c_ulonglong),
+        ("spi_write_breaks", ctypes.c_ulonglong),
+    ]
+
+
+class LatencyHist(ctypes.Structure):
+    _fields_ = [
+        ("count", ctypes.c_ulonglong),
+        ("total_us", ctypes.c_ulonglong),
+        ("max_us", ctypes.c_ulonglong),
+        ("buckets", ctypes.c_ulonglong * LATENCY_BUCKETS),
+    ]
+
+
+class DeviceStats(ctypes.Structure):
+    _fields_ = [
+        ("rx_bytes", ctypes.c_ulonglong * MAX_PROTOCOL_TYPES),
+        ("rx_packets", ctypes.c_ulonglong * MAX_PROTOCOL_TYPES),
+        ("tx_bytes", ctypes.c_ulonglong * MAX_PROTOCOL_TYPES),
+        ("tx_packets", ctypes.c_ulonglong * MAX_PROTOCOL_TYPES),
+        ("ring_high_water", ctypes.c_ulonglong * MAX_PROTOCOL_TYPES),
+        ("rx_transfers", ctypes.c_ulonglong),
+        ("rx_transfer_bytes", ctypes.c_ulonglong),
+        ("rx_timeouts", ctypes.c_ulonglong),
+        ("rx_errors", ctypes.c_ulonglong),
+        ("tx_transfers", ctypes.c_ulonglong),
+        ("tx_timeouts", ctypes.c_ulonglong),
+        ("tx_errors", ctypes.c_ulonglong),
+        ("resync_count", ctypes.c_ulonglong),
+        ("skipped_bytes", ctypes.c_ulonglong),
+        ("latency", LatencyHist * len(LATENCY_NAMES)),
+    ]
+
+
+def latency_percentile(hist, p):
+    """直方图按2的幂分桶，返回p分位所在桶的上界(us)"""
+    target = hist.count * p
+    seen = 0
+    for i, n in enumerate(hist.buckets):
+        seen += n
+        if n and seen >= target:
+            return 1 << (i + 1)
+    return 0
+
+
+class FirmwareInfo(ctypes.Structure):
+    _fields_ = [
+        ("DllName", ctypes.c_char * 32),
+        ("DllBuildDate", ctypes.c_char * 32),
+        ("DllVersion", ctypes.c_int),
+        ("FirmwareName", ctypes.c_char * 32),
+        ("FirmwareBuildDate", ctypes.c_char * 32),
+        ("HardwareVersion", ctypes.c_int),
+        ("FirmwareVersion", ctypes.c_int),
+        ("SerialNumber", ctypes.c_int * 3),
+        ("Functions", ctypes.c_int),
+    ]
+
+
+class PwmResult(ctypes.Structure):
+    _fields_ = [
+        ("frequency", ctypes.c_uint32),
+        ("duty_cycle", ctypes.c_uint32),
+        ("period_us", ctypes.c_uint32),
+        ("pulse_width_us", ctypes.c_uint32),
+    ]
+
+
+def load_library():
+    name = "USB_G2X.dll" if sys.platform.startswith("win") else "USB_G2X.so"
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), name)
+    print(f"正在加载: {path}")
+    return ctypes.CDLL(path)
+
+
+def make_config(spi_rate=0, garbage_every=0):
+    config = SimConfig()
+    config.device_count = 1
+    config.spi_bytes_per_sec = spi_rate
+    config.spi_packet_size = 4096
+    config.current_packet_size = 256
+    config.uart_packet_size = 64
+    config.garbage_every = garbage_every
+    config.garbage_len = 16
+    config.queue_capacity = 8
+    config.queue_drain_per_sec = 1000
+    config.uart_loopback = 1
+    return config
+
+
+class QueueStats(ctypes.Structure):
+    _fields_ = [
+        ("sent", ctypes.c_ulonglong),
+        ("accepted", ctypes.c_ulonglong),
+        ("rejected", ctypes.c_ulonglong),
+        ("timeouts", ctypes.c_ulonglong),
+        ("window_waits", ctypes.c_ulonglong),
+        ("depth_queries", ctypes.c_ulonglong),
+        ("in_flight", ctypes.c_int),
+        ("last_depth", ctypes.c_int),
+    ]
+
+
+class FrameConfig(ctypes.Structure):
+    _fields_ = [
+        ("frame_size", ctypes.c_uint),
+        ("max_frame_size", ctypes.c_uint),
+        ("frame_count", ctypes.c_uint),
+        ("sync_len", ctypes.c_uint),
+        ("sync", ctypes.c_ubyte * 16),
+        ("overflow_policy", ctypes.c_int),
+    ]
+
+
+class FrameInfo(ctypes.Structure):
+    _fields_ = [
+        ("sequence", ctypes.c_ulonglong),
+        ("timestamp_us", ctypes.c_ulonglong),
+        ("length", ctypes.c_uint),
+        ("reserved", ctypes.c_uint),
+    ]
+
+
+class FrameStats(ctypes.Structure):
+    _fields_ = [
+        ("frames", ctypes.c_ulonglong),
+        ("delivered", ctypes.c_ulonglong),
+        ("dropped_frames", ctypes.c_ulonglong),
+        ("oversize_frames", ctypes.c_ulonglong),
+        ("sync_losses", ctypes.c_ulonglong),
+        ("skipped_bytes", ctypes.c_ulonglong),
+        ("queued", ctypes.c_uint),
+        ("free_frames", ctypes.c_uint),
+    ]
+
+
+class FileOptions(ctypes.Structure):
+    _fields_ = [
+        ("block_size", ctypes.c_uint),
+        ("rotate_bytes", ctypes.c_ulonglong),
+        ("direct_io", ctypes.c_int),
+    ]
+
+
+class FileStats(ctypes.Structure):
+    _fields_ = [
+        ("bytes_written", ctypes.c_ulonglong),
+        ("lost_bytes", ctypes.c_ulonglong),
+        ("elapsed_us", ctypes.c_ulonglong),
+        ("bytes_per_sec", ctypes.c_ulonglong),
+        ("backlog", ctypes.c_uint),
+        ("backlog_high", ctypes.c_uint),
+        ("files", ctypes.c_uint),
+        ("direct_io", ctypes.c_int),
+        ("active", ctypes.c_int),
+        ("error", ctypes.c_int),
+    ]
+
+
+def open_first_device(usb):
+    devices = (DeviceInfo * 10)()
+    count = usb.USB_ScanDevices(devices, 10)
+    if count <= 0:
+        raise RuntimeError(f"未找到模拟设备: {count}")
+    serial = devices[0].serial
+    ret = usb.USB_OpenDevice(serial)
+    if ret < 0:
+        raise RuntimeError(f"打开设备失败: {ret}")
+    return serial
+
+
+def check_replies(usb):
+    usb.USB_SimConfigure(ctypes.byref(make_config()))
+    serial = open_first_device(usb)
+    print(f"\n[应答检查] 设备: {serial.decode()}")
+
+    info = FirmwareInfo()
+    func_str = ctypes.create_string_buffer(256)
+    ret = usb.USB_GetDeviceInfo(serial, ctypes.byref(info), func_str)
+    print(f"  USB_GetDeviceInfo: ret={ret}, 固件={info.FirmwareName.decode()}, 编译时间={info.FirmwareBuildDate.decode()}")
+
+    usb.GPIO_Write(serial, 3, 1)
+    level = ctypes.c_uint8(0xFF)
+    ret = usb.GPIO_Read(serial, 3, ctypes.byref(level))
+    print(f"  GPIO_Read: ret={ret}, level={level.value} (期望1)")
+
+    buf = (ctypes.c_ubyte * 1024)()
+    ret = usb.SPI_Queue_WriteBytes(serial, SPI_INDEX, buf, len(buf))
+    depth = usb.SPI_GetQueueStatus(serial, SPI_INDEX)
+    print(f"  SPI_Queue_WriteBytes: ret={ret}, 队列深度={depth}")
+
+    result = PwmResult()
+    ret = usb.PWM_GetResult(serial, 1, ctypes.byref(result))
+    print(f"  PWM_GetResult: ret={ret}, 频率={result.frequency}Hz, 占空比={result.duty_cycle / 100:.2f}%")
+
+    t0 = time.perf_counter()
+    n = 1000
+    for _ in range(n):
+        usb.SPI_GetQueueStatus(serial, SPI_INDEX)
+    elapsed = time.perf_counter() - t0
+    print(f"  命令往返: {n}次, 平均 {elapsed / n * 1e6:.1f} us")
+
+
+    stats = DeviceStats()
+    usb.USB_GetStats(serial, ctypes.byref(stats))
+    print(f"  统计: OUT传输 {stats.tx_transfers} 次, IN传输 {stats.rx_transfers} 次, 失步 {stats.resync_count} 次")
+    for name, hist in zip(LATENCY_NAMES, stats.latency):
+        if hist.count:
+            print(f"  {name}: {hist.count}次, 平均 {hist.total_us / hist.count:.1f} us, "
+                  f"p50<{latency_percentile(hist, 0.5)} us, p99<{latency_percentile(hist, 0.99)} us, 最大 {hist.max_us} us")
+
+    usb.USB_CloseDevice(serial)
+
+
+def bench_read(usb, mode, seconds, spi_rate, garbage_every):
+    usb.USB_SetReadMode(mode, 0, 0)
+    usb.USB_SimConfigure(ctypes.byref(make_config(spi_rate, garbage_every)))
+    serial = open_first_device(usb)
+
+    chunk = 1024 * 1024
+    buf = (ctypes.c_ubyte * chunk)()
+    expected = None
+    total = 0
+    gaps = 0
+    t0 = time.perf_counter()
+    while time.perf_counter() - t0 < seconds:
+        n = usb.SPI_SlaveReadBytesTimeout(serial, SPI_INDEX, buf, chunk, chunk, 100)
+        if n <= 0:
+            continue
+        data = ctypes.string_at(buf, n)
+        # 缓冲区溢出丢弃旧数据时计数会出现断点
+        if expected is not None and data[0] != expected:
+            gaps += 1
+        expected = (data[-1] + 1) % PATTERN_PERIOD
+        total += n
+    elapsed = time.perf_counter() - t0
+    usb.USB_CloseDevice(serial)
+
+    stats = SimStats()
+    usb.USB_SimGetStats(ctypes.byref(stats))
+    name = ("同步", "异步", "共用事件线程")[mode]
+    print(f"  {name:>6}: {total / elapsed / 1e6:8.1f} MB/s, 读取 {total} 字节, 断点 {gaps} 次")
+    return stats
+
+
+def bench_spi_indexes(usb, seconds, spi_rate, index_count):
+    usb.USB_SetReadMode(1, 0, 0)
+    config = make_config(0, 16)
+    config.spi_index_count = index_count
+    usb.USB_SimConfigure(ctypes.byref(config))
+    serial = open_first_device(usb)
+    # 先初始化各索引建立各自的缓冲区，再开始产生数据
+    spi_config = SpiConfig(Master=b"\x00", ClockSpeedHz=25000000)
+    for index in range(index_count):
+        usb.SPI_Init(serial, index, ctypes.byref(spi_config))
+    config.spi_bytes_per_sec = spi_rate
+    usb.USB_SimConfigure(ctypes.byref(config))
+
+    chunk = 256 * 1024
+    buf = (ctypes.c_ubyte * chunk)()
+    expected = [None] * index_count
+    totals = [0] * index_count
+    gaps = [0] * index_count
+    t0 = time.perf_counter()
+    while time.perf_counter() - t0 < seconds:
+        for index in range(index_count):
+            n = usb.SPI_SlaveReadBytesTimeout(serial, index, buf, chunk, 1, 10)
+            if n <= 0:
+                continue
+            data = ctypes.string_at(buf, n)
+            # 各索引的数据各自是连续的计数，混入其他索引的数据就会出现断点
+            if expected[index] is not None and data[0] != expected[index]:
+                gaps[index] += 1
+            if data[-1] != (data[0] + n - 1) % PATTERN_PERIOD:
+                gaps[index] += 1
+            expected[index] = (data[-1] + 1) % PATTERN_PERIOD
+            totals[index] += n
+    elapsed = time.perf_counter() - t0
+    usb.USB_CloseDevice(serial)
+    for index in range(index_count):
+        print(f"  索引{index}: {totals[index] / elapsed / 1e6:8.1f} MB/s, 读取 {totals[index]} 字节, 断点 {gaps[index]} 次")
+
+
+def bench_frames(usb, seconds, spi_rate, frame_size):
+    usb.USB_SetReadMode(1, 0, 0)
+    usb.USB_SimConfigure(ctypes.byref(make_config(spi_rate, 16)))
+    serial = open_first_device(usb)
+    config = FrameConfig()
+    config.frame_size = frame_size
+    config.frame_count = 64
+    ret = usb.SPI_StartFrameCapture(serial, SPI_INDEX, ctypes.byref(config))
+    if ret != 0:
+        print(f"  开始分帧采集失败: {ret}")
+        usb.USB_CloseDevice(serial)
+        return
+
+    buf = (ctypes.c_ubyte * frame_size)()
+    info = FrameInfo()
+    frames = 0
+    bad = 0
+    seq_gaps = 0
+    last = None
+    t0 = time.perf_counter()
+    while time.perf_counter() - t0 < seconds:
+        n = usb.SPI_ReadFrame(serial, SPI_INDEX, buf, frame_size, ctypes.byref(info), 100)
+        if n <= 0:
+            continue
+        data = ctypes.string_at(buf, n)
+        # 帧内计数连续；序号连续时与上一帧也连续
+        if n != frame_size or data[-1] != (data[0] + n - 1) % PATTERN_PERIOD:
+            bad += 1
+        if last is not None:
+            if info.sequence != last[0] + 1:
+                seq_gaps += 1
+            elif data[0] != (last[1] + 1) % PATTERN_PERIOD:
+                bad += 1
+        last = (info.sequence, data[-1])
+        frames += 1
+    elapsed = time.perf_counter() - t0
+    stats = FrameStats()
+    usb.SPI_GetFrameStats(serial, SPI_INDEX, ctypes.byref(stats))
+    usb.SPI_StopFrameCapture(serial, SPI_INDEX)
+    usb.USB_CloseDevice(serial)
+    print(f"  {frames / elapsed:8.0f} 帧/秒, {frames * frame_size / elapsed / 1e6:6.1f} MB/s, 内容错误 {bad} 帧, "
+          f"序号间断 {seq_gaps} 次, 丢弃 {stats.dropped_frames} 帧")
+
+
+def bench_capture_file(usb, seconds, spi_rate):
+    usb.USB_SetReadMode(1, 0, 0)
+    usb.USB_SimConfigure(ctypes.byref(make_config(spi_rate, 16)))
+    serial = open_first_device(usb)
+    path = os.path.join(tempfile.gettempdir(), "sim_spi_capture.bin")
+    options = FileOptions()
+    options.direct_io = 1
+    ret = usb.SPI_StartCaptureToFile(serial, SPI_INDEX, path.encode(), ctypes.byref(options))
+    if ret != 0:
+        print(f"  开始落盘失败: {ret}")
+        usb.USB_CloseDevice(serial)
+        return
+    time.sleep(seconds)
+    usb.SPI_StopCaptureToFile(serial, SPI_INDEX)
+    stats = FileStats()
+    usb.SPI_GetCaptureToFileStats(serial, SPI_INDEX, ctypes.byref(stats))
+    usb.USB_CloseDevice(serial)
+
+    # 文件内容应是连续的模251计数
+    gaps = 0
+    expected = None
+    with open(path, "rb") as f:
+        while True:
+            data = f.read(PATTERN_PERIOD * 4096)
+            if not data:
+                break
+            if expected is not None and data[0] != expected:
+                gaps += 1
+            pattern = bytes((data[0] + i) % PATTERN_PERIOD for i in range(PATTERN_PERIOD)) * 4096
+            if data != pattern[:len(data)]:
+                gaps += 1
+            expected = (data[-1] + 1) % PATTERN_PERIOD
+    os.remove(path)
+    print(f"  {stats.bytes_per_sec / 1e6:8.1f} MB/s, 写入 {stats.bytes_written} 字节, 丢失 {stats.lost_bytes} 字节, "
+          f"最大积压 {stats.backlog_high} 字节, 直接I/O {'是' if stats.direct_io else '否'}, 断点 {gaps} 次")
+
+
+def bench_bulk_write(usb, mode, image_size, count):
+    usb.USB_SetReadMode(mode, 0, 0)
+    usb.USB_SimConfigure(ctypes.byref(make_config()))
+    serial = open_first_device(usb)
+    # 模拟设备按模251计数校验SPI写入数据，图像长度取251的倍数使相邻两次写入也接续
+    image = (ctypes.c_ubyte * image_size).from_buffer_copy(
+        bytes(range(PATTERN_PERIOD)) * (image_size // PATTERN_PERIOD))
+    before = SimStats()
+    usb.USB_SimGetStats(ctypes.byref(before))
+    failed = 0
+    t0 = time.perf_counter()
+    for _ in range(count):
+        if usb.SPI_WriteBulk(serial, SPI_INDEX, image, image_size) != image_size:
+            failed += 1
+    elapsed = time.perf_counter() - t0
+    usb.USB_CloseDevice(serial)
+    stats = SimStats()
+    usb.USB_SimGetStats(ctypes.byref(stats))
+    name = ("同步", "异步", "共用事件线程")[mode]
+    print(f"  {name:>6}: {count * image_size / elapsed / 1e6:8.1f} MB/s, 每幅 {elapsed / count * 1e3:.2f} ms, "
+          f"失败 {failed} 次, 设备收到 {stats.spi_write_bytes - before.spi_write_bytes} 字节 / "
+          f"{stats.out_frames - before.out_frames} 帧, 数据断点 {stats.spi_write_breaks - before.spi_write_breaks} 次, "
+          f"坏帧 {stats.bad_frames - before.bad_frames} 次")
+
+
+def bench_queue_write(usb, window, capacity, frames, frame_size, reply_delay_us):
+    usb.USB_SetReadMode(0, 0, 0)
+    config = make_config()
+    config.reply_delay_us = reply_delay_us
+    config.queue_capacity = 32
+    config.queue_drain_per_sec = 20000
+    usb.USB_SimConfigure(ctypes.byref(config))
+    serial = open_first_device(usb)
+    usb.SPI_Queue_SetWindow(serial, window, capacity)
+
+    buf = (ctypes.c_ubyte * frame_size)()
+    rejected = 0
+    t0 = time.perf_counter()
+    for _ in range(frames):
+        ret = usb.SPI_Queue_WriteBytes(serial, SPI_INDEX, buf, frame_size)
+        if ret != 0:
+            rejected += 1
+    failed = usb.SPI_Queue_Drain(serial, 1000)
+    elapsed = time.perf_counter() - t0
+    if window > 1:
+        rejected = failed
+    stats = QueueStats()
+    usb.SPI_Queue_GetStats(serial, ctypes.byref(stats))
+    usb.USB_CloseDevice(serial)
+
+    name = "逐帧等应答" if window <= 1 else f"窗口{window}"
+    print(f"  {name:>8}: {frames / elapsed:8.0f} 帧/秒, {frames * frame_size / elapsed / 1e6:6.1f} MB/s, "
+          f"被拒 {rejected} 帧, 深度查询 {stats.depth_queries} 次, 窗口满等待 {stats.window_waits} 次")
+
+
+def main():
+    usb = load_library()
+    usb.USB_SimConfigure.argtypes = [ctypes.POINTER(SimConfig)]
+    usb.USB_SimGetStats.argtypes = [ctypes.POINTER(SimStats)]
+    usb.USB_SimGetStats.restype = None
+
+    ret = usb.USB_SetTransport(b"sim")
+    if ret != 0:
+        print(f"切换到模拟设备失败: {ret}")
+        return
+
+    check_replies(usb)
+
+    seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 2.0
+    # 不限速时读取方跟不上必然丢数据(断点)；限速且注入无效数据时应当没有断点
+    for spi_rate, garbage_every in ((RATE_UNLIMITED, 0), (100 * 1000 * 1000, 16)):
+        rate_str = "不限速" if spi_rate == RATE_UNLIMITED else f"{spi_rate / 1e6:.0f} MB/s"
+        print(f"\n[SPI读取吞吐] 每次{seconds}秒, 速率{rate_str}, 无效数据每{garbage_every or '-'}包")
+        for mode in (0, 1, 2):
+            stats = bench_read(usb, mode, seconds, spi_rate, garbage_every)
+        print(f"  模拟设备: 发出 {stats.in_bytes} 字节, 数据流溢出 {stats.stream_overruns} 次")
+
+    index_count = 4
+    print(f"\n[SPI多索引] {seconds}秒, 速率100 MB/s, {index_count}个索引轮流上报")
+    bench_spi_indexes(usb, seconds, 100 * 1000 * 1000, index_count)
+
+    frame_size = 96 * 240
+    print(f"\n[SPI分帧采集] {seconds}秒, 速率100 MB/s, 帧长{frame_size}字节")
+    bench_frames(usb, seconds, 100 * 1000 * 1000, frame_size)
+
+    print(f"\n[SPI落盘采集] {seconds}秒, 速率100 MB/s")
+    bench_capture_file(usb, seconds, 100 * 1000 * 1000)
+
+    image_size = PATTERN_PERIOD * 16384
+    print(f"\n[SPI大块写入] {image_size}字节/幅 x 20幅")
+    for mode in (0, 1):
+        bench_bulk_write(usb, mode, image_size, 20)
+
+    reply_delay_us = 300
+    print(f"\n[SPI队列写入] 2000帧x4096字节, 应答延迟{reply_delay_us} us, 设备队列32帧, 每秒消耗20000帧")
+    for window in (1, 8):
+        bench_queue_write(usb, window, 32, 2000, 4096, reply_delay_us)
+
+    usb.USB_Cleanup()
+
+
+if __name__ == "__main__":
+    main()
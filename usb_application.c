@@ -19,8 +19,6 @@
 #endif
 
 
-extern void debug_printf(const char *format, ...);
-
 #define VENDOR_ID   0xCCDD          // 设备VID
 #define PRODUCT_ID  0xAABB          // 设备PID
 
@@ -95,23 +93,17 @@ static int get_stm32_firmware_info(const char* serial, stm32_firmware_info_t* st
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     cmd_header.total_packets = 1;
-    unsigned char* cmd_buffer = NULL;
-    int cmd_size = build_protocol_frame(&cmd_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (cmd_size <= 0 || !cmd_buffer) {
-        debug_printf("构建命令包失败");
-        return USB_ERROR_OTHER;
-    }
-    int write_result = usb_middleware_write_data(device_id, cmd_buffer, cmd_size);
-    free(cmd_buffer);
+    int write_result = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (write_result < 0) {
         debug_printf("发送获取固件信息命令失败: %d", write_result);
         return write_result;
     }
     
-    Sleep(100);  
     unsigned char response_buffer[256] = {0};
-    int response_len = usb_middleware_read_data(device_id, response_buffer, sizeof(response_buffer));
     int expected_size = sizeof(GENERIC_CMD_HEADER) + sizeof(stm32_firmware_info_t);
+    // 最多等待100ms，响应到达即返回
+    int response_len = usb_middleware_read_data_timeout(device_id, response_buffer, sizeof(response_buffer),
+                                                        expected_size, 100);
     if (response_len < expected_size) {
         debug_printf("从STM32设备读取固件信息失败或数据不完整: %d, 期望: %d", response_len, expected_size);
         strcpy(stm32_info->FirmwareName, "G2X_FW");
@@ -164,6 +156,18 @@ WINAPI int USB_OpenDevice(const char* serial) {
 }
 
 
+WINAPI int USB_OpenDeviceEx(const char* serial, const usb_open_options_t* options) {
+    debug_printf("按选项打开设备: %s", serial ? serial : "第一个可用设备");
+    int device_id = usb_middleware_open_device_ex(serial, options);
+    if (device_id >= 0) {
+        debug_printf("成功打开设备，ID: %d", device_id);
+    } else {
+        debug_printf("打开设备失败: %d", device_id);
+    }
+    return device_id;
+}
+
+
 WINAPI int USB_CloseDevice(const char* serial) {
     if (!serial) {
         debug_printf("关闭设备失败: 序列号参数为空");
@@ -184,6 +188,12 @@ WINAPI int USB_CloseDevice(const char* serial) {
     return ret;
 }
 
+WINAPI void USB_Cleanup(void) {
+    usb_middleware_cleanup();
+    usb_capture_stop();
+    usb_log_shutdown();
+}
+
 
 WINAPI int USB_FindDeviceBySerial(const char* serial) {
     if (!serial) {
@@ -201,6 +211,21 @@ WINAPI int USB_FindDeviceBySerial(const char* serial) {
 }
 
 
+WINAPI usb_handle_t USB_GetHandle(const char* serial) {
+    if (!serial) {
+        debug_printf("序列号参数为空");
+        return USB_ERROR_INVALID_PARAM;
+    }
+    // 设备ID本身就是 代数*MAX_DEVICES+槽位，直接作为句柄
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("获取句柄失败: 设备未打开 %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return device_id;
+}
+
+
 WINAPI int USB_IsDeviceOpen(int device_id) {
     int is_open = usb_middleware_is_device_open(device_id);
     debug_printf("设备 %d 状态: %s", device_id, is_open ? "已打开" : "未打开");
@@ -288,18 +313,178 @@ WINAPI int USB_GetDeviceInfo(const char* serial, PDEVICE_INFO dev_info, char* fu
 
 
 
+WINAPI int USB_SetReadMode(int mode, int transfer_count, int transfer_size) {
+    int ret = usb_middleware_set_read_mode(mode, transfer_count, transfer_size);
+    if (ret != USB_SUCCESS) {
+        debug_printf("设置读取模式失败: mode=%d", mode);
+    }
+    return ret;
+}
+
+WINAPI void USB_SetSpiMirrorBuffer(int enable) {
+    debug_printf("SPI镜像缓冲区: %s", enable ? "启用" : "禁用");
+    usb_middleware_set_spi_mirror(enable);
+}
+
+WINAPI int USB_GetResyncStats(const char* serial, unsigned long long* skipped_bytes, unsigned long long* resync_count) {
+    if (!serial) {
+        debug_printf("获取失步统计失败: 序列号参数为空");
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("获取失步统计失败: 未找到设备 %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return usb_middleware_get_resync_stats(device_id, skipped_bytes, resync_count);
+}
+
+WINAPI int USB_SetOverflowPolicy(const char* serial, int protocol, int policy, int timeout_ms) {
+    if (!serial) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return usb_middleware_set_overflow_policy(device_id, protocol, policy, timeout_ms);
+}
+
+WINAPI int USB_GetRingStats(const char* serial, int protocol, ring_buffer_stats_t* stats) {
+    if (!serial || !stats) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return usb_middleware_get_ring_stats(device_id, protocol, stats);
+}
+
+WINAPI int USB_GetStats(const char* serial, USB_STATS* stats) {
+    if (!serial || !stats) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return usb_middleware_get_stats(device_id, stats);
+}
+
+WINAPI int USB_ResetStats(const char* serial) {
+    if (!serial) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return usb_middleware_reset_stats(device_id);
+}
+
+WINAPI int USB_BeginBatch(const char* serial) {
+    if (!serial) {
+        debug_printf("开始合并发送失败: 序列号参数为空");
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("开始合并发送失败: 未找到设备 %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return usb_middleware_begin_batch(device_id);
+}
+
+WINAPI int USB_FlushBatch(const char* serial) {
+    if (!serial) {
+        debug_printf("合并发送失败: 序列号参数为空");
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(serial);
+    if (device_id < 0) {
+        debug_printf("合并发送失败: 未找到设备 %s", serial);
+        return USB_ERROR_NOT_FOUND;
+    }
+    int ret = usb_middleware_flush_batch(device_id);
+    return ret < 0 ? ret : USB_SUCCESS;
+}
+
+WINAPI int USB_SetBatchWindow(int window_ms, int max_bytes) {
+    int ret = usb_middleware_set_batch_window(window_ms, max_bytes);
+    if (ret != USB_SUCCESS) {
+        debug_printf("设置命令合并窗口失败: window_ms=%d", window_ms);
+    }
+    return ret;
+}
+
+WINAPI int USB_SetTransport(const char* name) {
+    int ret = usb_middleware_set_transport(name);
+    if (ret != USB_SUCCESS) {
+        debug_printf("切换传输后端失败: %s, 错误码: %d", name ? name : "(null)", ret);
+    }
+    return ret;
+}
+
+WINAPI int USB_SimConfigure(const usb_sim_config_t* config) {
+    return usb_sim_configure(config);
+}
+
+WINAPI void USB_SimGetStats(usb_sim_stats_t* stats) {
+    usb_sim_get_stats(stats);
+}
+
+WINAPI int USB_StartCapture(const char* path, unsigned int buffer_size) {
+    int ret = usb_middleware_start_capture(path, buffer_size);
+    if (ret != USB_SUCCESS) {
+        debug_printf("开始录制失败: %s, 错误码: %d", path ? path : "(null)", ret);
+    }
+    return ret;
+}
+
+WINAPI void USB_StopCapture(void) {
+    usb_middleware_stop_capture();
+}
+
+WINAPI void USB_GetCaptureStats(usb_capture_stats_t* stats) {
+    usb_capture_get_stats(stats);
+}
+
+WINAPI int USB_ReplayConfigure(const char* path, int speed, int loop) {
+    return usb_replay_configure(path, speed, loop);
+}
+
+WINAPI void USB_ReplayGetStats(usb_replay_stats_t* stats) {
+    usb_replay_get_stats(stats);
+}
+
 WINAPI void USB_SetLogging(int enable) {
     debug_printf("设置USB调试日志: %s", enable ? "启用" : "禁用");
     USB_SetLog(enable);
 }
 
+WINAPI void USB_SetLogLevel(int level) {
+    usb_log_set_level(level);
+}
+
+WINAPI unsigned long long USB_GetLogDropCount(void) {
+    return usb_log_dropped();
+}
+
 #ifndef _WIN32
 __attribute__((constructor)) static void so_ctor(void) {
     usb_middleware_init();
 }
 
+// 卸载时持有加载器锁，不能等待线程退出，只通知停止；完整清理由USB_Cleanup完成
 __attribute__((destructor)) static void so_dtor(void) {
-    usb_middleware_cleanup();
+    usb_middleware_detach();
+    usb_capture_detach();
+    usb_log_detach();
 }
 #endif
 
@@ -311,8 +496,14 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
             usb_middleware_init();
             break;
         case DLL_PROCESS_DETACH:
-            // 清理中间层
-            usb_middleware_cleanup();
+            // 进程退出时其他线程已被终止，什么都不做；FreeLibrary时持有加载器锁，
+            // 等待线程退出会死锁，只通知停止。完整清理由卸载前的USB_Cleanup完成
+            if (lpvReserved) {
+                break;
+            }
+            usb_middleware_detach();
+            usb_capture_detach();
+            usb_log_detach();
             break;
     }
     return TRUE;
@@ -7,6 +7,9 @@ extern "C" {
 
 #include <stdint.h>
 #include "usb_middleware.h"
+#include "usb_sim.h"
+#include "usb_capture.h"
+#include "usb_replay.h"
 
 #define USB_SUCCESS             0    // 成功
 #define USB_ERROR_NOT_FOUND    -1    // 设备未找到
@@ -48,15 +51,46 @@ typedef struct _DEVICE_INFO {
 
 
 
+// 设备句柄：由USB_GetHandle获得，编码了设备槽位和槽位代数，xxxH接口凭它直接定位设备，
+// 不再每次按序列号查找；设备关闭后句柄失效(调用返回错误)，重新打开后须重新获取
+typedef int usb_handle_t;
+#define USB_INVALID_HANDLE     (-1)
+
+// 设备统计：各协议收发字节/包数、缓冲区最高水位、批量传输超时/错误、失步次数和命令往返延迟直方图
+typedef usb_device_stats_t USB_STATS;
+
 // ==================== 设备管理接口 ====================
 WINAPI int USB_ScanDevices(device_info_t* devices, int max_devices); // 扫描设备
 WINAPI int USB_OpenDevice(const char* serial); // 打开设备
+WINAPI int USB_OpenDeviceEx(const char* serial, const usb_open_options_t* options); // 按选项打开设备(各协议缓冲区大小、是否预分配)
 WINAPI int USB_CloseDevice(const char* serial); // 关闭设备
+WINAPI void USB_Cleanup(void); // 关闭所有设备并停止库内线程，卸载库(FreeLibrary/dlclose)或退出进程前调用，之后不能再使用本库
 WINAPI int USB_FindDeviceBySerial(const char* serial); // 通过序列号查找设备
+WINAPI usb_handle_t USB_GetHandle(const char* serial); // 获取已打开设备的句柄，失败返回USB_ERROR_NOT_FOUND
 WINAPI int USB_IsDeviceOpen(int device_id); // 检查设备是否打开
 WINAPI int USB_GetDeviceCount(void); // 获取设备数量
 WINAPI int USB_GetDeviceInfo(const char* serial, PDEVICE_INFO dev_info, char* func_str); // 获取设备信息
 WINAPI void USB_SetLogging(int enable);  // 设置日志输出
+WINAPI void USB_SetLogLevel(int level); // 设置日志最低级别(0=TRACE,1=DEBUG,2=INFO,3=WARN,4=ERROR,5=关闭)
+WINAPI unsigned long long USB_GetLogDropCount(void); // 日志队列满而丢弃的消息数
+WINAPI int USB_SetReadMode(int mode, int transfer_count, int transfer_size); // 设置之后打开设备的读取模式(0=同步,1=异步,2=异步且所有设备共用一个事件线程)
+WINAPI void USB_SetSpiMirrorBuffer(int enable); // SPI缓冲区是否使用镜像映射(1=开启,默认)
+WINAPI int USB_BeginBatch(const char* serial); // 开始合并：之后的命令拼进同一次USB传输
+WINAPI int USB_FlushBatch(const char* serial); // 发出合并的命令并结束合并
+WINAPI int USB_SetBatchWindow(int window_ms, int max_bytes); // 自动合并窗口(0=关闭)和单次合并上限(默认512字节)
+WINAPI int USB_SetTransport(const char* name); // 切换传输后端: "libusb"(默认)、"sim"(模拟设备)或"replay"(回放录制文件)，须在打开设备前调用
+WINAPI int USB_SimConfigure(const usb_sim_config_t* config); // 配置模拟设备(数据流速率、错误注入等)
+WINAPI void USB_SimGetStats(usb_sim_stats_t* stats); // 模拟设备收发统计
+WINAPI int USB_StartCapture(const char* path, unsigned int buffer_size); // 开始录制批量IN/OUT传输到文件，buffer_size=0为默认8MB
+WINAPI void USB_StopCapture(void); // 停止录制，写完缓冲区后关闭文件
+WINAPI void USB_GetCaptureStats(usb_capture_stats_t* stats); // 录制统计(记录数、丢弃数、文件字节数)
+WINAPI int USB_ReplayConfigure(const char* path, int speed, int loop); // 设置回放文件，speed: 0=尽快,1=原始间隔；之后USB_SetTransport("replay")
+WINAPI void USB_ReplayGetStats(usb_replay_stats_t* stats); // 回放统计
+WINAPI int USB_SetOverflowPolicy(const char* serial, int protocol, int policy, int timeout_ms); // 缓冲区写满时的处理(0=丢旧,1=丢新,2=阻塞超时,3=背压)，protocol为协议类型；2/3只用于同步读取模式
+WINAPI int USB_GetRingStats(const char* serial, int protocol, ring_buffer_stats_t* stats); // 缓冲区写入/丢弃计数
+WINAPI int USB_GetStats(const char* serial, USB_STATS* stats); // 获取设备统计
+WINAPI int USB_ResetStats(const char* serial); // 设备统计和缓冲区计数清零
+WINAPI int USB_GetResyncStats(const char* serial, unsigned long long* skipped_bytes, unsigned long long* resync_count); // 获取协议失步统计
 #ifdef __cplusplus
 }
 #endif
@@ -219,6 +219,8 @@ WINAPI int AudioStart(const char* target_serial, const char* wav_file_path, int
         goto cleanup;
     }
     debug_printf("I2S队列启动成功");
+    // 播放循环里逐块发送、查询队列，先取句柄省去每次按序列号查找
+    usb_handle_t handle = USB_GetHandle(target_serial);
 
     debug_printf("开始播放WAV文件: %s", wav_file_path);
     debug_printf("采样率: %d Hz, 音频块数: %d", sample_rate, chunk_count);
@@ -228,7 +230,7 @@ WINAPI int AudioStart(const char* target_serial, const char* wav_file_path, int
     unsigned int initial_chunks = (chunk_count < 8) ? chunk_count : 8;
     debug_printf("预填充音频队列 (前%d个音频块)...", initial_chunks);
     for (unsigned int i = 0; i < initial_chunks; i++) {
-        int write_ret = I2S_Queue_WriteBytes(target_serial, 1, audio_chunks[i], CHUNK_SIZE);
+        int write_ret = I2S_Queue_WriteBytesH(handle, 1, audio_chunks[i], CHUNK_SIZE);
         // 调用进度回调
         if (g_audio_progress_callback) {
             g_audio_progress_callback(i + 1, chunk_count, g_audio_user_data);
@@ -242,7 +244,7 @@ WINAPI int AudioStart(const char* target_serial, const char* wav_file_path, int
         for (unsigned int i = initial_chunks; i < chunk_count; i++) {
             // 检查队列状态，如果大于7就等待
             while (1) {
-                int queue_status = I2S_GetQueueStatus(target_serial, 1);
+                int queue_status = I2S_GetQueueStatusH(handle, 1);
                 if (queue_status >= 0 && queue_status <= 7) {
                     break; // 队列有空间，可以发送
                 } else if (queue_status > 7) {
@@ -253,7 +255,7 @@ WINAPI int AudioStart(const char* target_serial, const char* wav_file_path, int
                 }
             }
             // 发送音频块
-            int write_ret = I2S_Queue_WriteBytes(target_serial, 1, audio_chunks[i], CHUNK_SIZE);
+            int write_ret = I2S_Queue_WriteBytesH(handle, 1, audio_chunks[i], CHUNK_SIZE);
             // 调用进度回调
             if (g_audio_progress_callback) {
                 g_audio_progress_callback(i + 1, chunk_count, g_audio_user_data);
@@ -272,7 +274,7 @@ WINAPI int AudioStart(const char* target_serial, const char* wav_file_path, int
     debug_printf("等待WAV音频播放完成...");
     int empty_count = 0;
     while (empty_count < 3) {
-        int queue_status = I2S_GetQueueStatus(target_serial, 1);
+        int queue_status = I2S_GetQueueStatusH(handle, 1);
         if (queue_status == 0) {
             empty_count++;
         } else {
@@ -531,20 +533,22 @@ WINAPI int AudioStartDual(const char* target_serial, const DUAL_AUDIO_CONFIG* co
         goto cleanup_dual;
     }
     debug_printf("I2S队列启动成功");
+    // 播放循环里逐块发送、查询队列，先取句柄省去每次按序列号查找
+    usb_handle_t handle = USB_GetHandle(target_serial);
     debug_printf("开始播放双路合成音频");
     debug_printf("采样率: %d Hz, 音频块数: %d", left_sample_rate, chunk_count);
 
     unsigned int initial_chunks = (chunk_count < 8) ? chunk_count : 8;
     debug_printf("预填充音频队列 (前%d个音频块)...", initial_chunks);
     for (unsigned int i = 0; i < initial_chunks; i++) {
-        I2S_Queue_WriteBytes(target_serial, 1, audio_chunks[i], CHUNK_SIZE);
+        I2S_Queue_WriteBytesH(handle, 1, audio_chunks[i], CHUNK_SIZE);
     }
     unsigned int remaining_chunks = chunk_count - initial_chunks;
     if (remaining_chunks > 0) {
         debug_printf("发送剩余的 %d 个音频块...", remaining_chunks);
         for (unsigned int i = initial_chunks; i < chunk_count; i++) {
             while (1) {
-                int queue_status = I2S_GetQueueStatus(target_serial, 1);
+                int queue_status = I2S_GetQueueStatusH(handle, 1);
                 if (queue_status >= 0 && queue_status <= 7) {
                     break;
                 } else if (queue_status > 7) {
@@ -555,7 +559,7 @@ WINAPI int AudioStartDual(const char* target_serial, const DUAL_AUDIO_CONFIG* co
                 }
             }
             
-            int write_ret = I2S_Queue_WriteBytes(target_serial, 1, audio_chunks[i], CHUNK_SIZE);
+            int write_ret = I2S_Queue_WriteBytesH(handle, 1, audio_chunks[i], CHUNK_SIZE);
             if (write_ret == 0) {
                 if ((i + 1) % 50 == 0 || i == chunk_count - 1) {
                     debug_printf("成功发送第 %d 个音频块", i + 1);
@@ -568,7 +572,7 @@ WINAPI int AudioStartDual(const char* target_serial, const DUAL_AUDIO_CONFIG* co
     debug_printf("等待双路音频播放完成...");
     int empty_count = 0;
     while (empty_count < 3) {
-        int queue_status = I2S_GetQueueStatus(target_serial, 1);
+        int queue_status = I2S_GetQueueStatusH(handle, 1);
         if (queue_status == 0) {
             empty_count++;
         } else {
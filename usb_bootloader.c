@@ -8,7 +8,7 @@
 
 
 
-extern void debug_printf(const char *format, ...);
+#define BOOTLOADER_RESPONSE_TIMEOUT_MS  100000   // 等待1字节应答的超时
 
 
 int Bootloader_StartWrite(const char* target_serial, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen) {
@@ -30,15 +30,7 @@ int Bootloader_StartWrite(const char* target_serial, int SPIIndex, unsigned char
     cmd_header.param_count = 0;                // 参数数量，开始写操作不需要额外参数
     cmd_header.data_len = WriteLen;            // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
     return SPI_SUCCESS;
 }
 
@@ -61,27 +53,15 @@ int Bootloader_WriteBytes(const char* target_serial, int SPIIndex, unsigned char
     cmd_header.param_count = 0;                // 参数数量，写操作不需要额外参数
     cmd_header.data_len = WriteLen;            // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
 
 
 
 
     unsigned char response_buffer[1];
-    int max_loops = 100000;
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_spi_data(device_id, response_buffer, 1);
-        if (actual_read > 0) {
-            return response_buffer[0]; // 有数据立即返回，无数据则返回-1  读取10000次
-        }
-       Sleep(1);
+    int actual_read = usb_middleware_read_spi_data_timeout(device_id, response_buffer, 1, 1, BOOTLOADER_RESPONSE_TIMEOUT_MS);
+    if (actual_read > 0) {
+        return response_buffer[0]; // 有数据立即返回
     }
 
     return SPI_ERROR_IO; // 读取失败
@@ -113,17 +93,8 @@ int Bootloader_SwitchRun(const char* target_serial, int SPIIndex, unsigned char*
     // 发送启动模式标识 (0xA5A5A5A5 = BOOT_MODE_APPLICATION)
     uint32_t boot_mode = 0xA5A5A5A5;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   (unsigned char*)&boot_mode, sizeof(boot_mode));
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    
     debug_printf("发送切换到应用程序运行模式命令");
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, &boot_mode, sizeof(boot_mode));
     return (ret >= 0) ? SPI_SUCCESS : SPI_ERROR_IO;
 }
 
@@ -149,17 +120,8 @@ int Bootloader_SwitchBoot(const char* target_serial, int SPIIndex, unsigned char
     // 发送启动模式标识 (0x5A5A5A5A = BOOT_MODE_BOOTLOADER)
     uint32_t boot_mode = 0x5A5A5A5A;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   (unsigned char*)&boot_mode, sizeof(boot_mode));
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    
     debug_printf("发送切换到Bootloader模式命令");
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, &boot_mode, sizeof(boot_mode));
     return (ret >= 0) ? SPI_SUCCESS : SPI_ERROR_IO;
 }
 
@@ -182,15 +144,7 @@ int Bootloader_Reset(const char* target_serial, int SPIIndex, unsigned char* pWr
     cmd_header.param_count = 0;                // 参数数量，复位操作不需要额外参数
     cmd_header.data_len = WriteLen;            // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
     return SPI_SUCCESS;
 }
 
@@ -0,0 +1,269 @@
+/**
+ * @file usb_capture.c
+ * @brief USB批量传输录制
+ * 记录写入g_cap_buf(容量2的幂)，head/tail为单调递增的字节计数。
+ * 生产者在g_cap_lock内整条拷入；写入线程把[tail, head)中连续的一段在锁外写文件，写完才推进tail，
+ * 所以写文件期间生产者不会覆盖这段数据。
+ */
+
+#include "usb_capture.h"
+#include "usb_clock.h"
+#include "usb_device.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#endif
+
+#define CAPTURE_MIN_BUFFER   (64 * 1024)
+#define CAPTURE_IDLE_WAIT_MS 100
+
+int g_usb_capture_active = 0;
+
+static int g_cap_lock_ready = 0;
+static CRITICAL_SECTION g_cap_lock;
+static CONDITION_VARIABLE g_cap_cond;
+static unsigned char* g_cap_buf = NULL;
+static unsigned int g_cap_size = 0;
+static unsigned long long g_cap_head = 0;
+static unsigned long long g_cap_tail = 0;
+static unsigned long long g_cap_start_us = 0;
+static int g_cap_writer_waiting = 0;
+static int g_cap_stop = 0;
+static HANDLE g_cap_thread = NULL;
+static FILE* g_cap_file = NULL;
+static usb_capture_stats_t g_cap_stats;
+
+// 拷入环形缓冲区，调用方持有g_cap_lock且已确认空间足够
+static void capture_copy_in(const void* data, unsigned int length) {
+    if (length == 0) {
+        return;
+    }
+    unsigned int offset = (unsigned int)(g_cap_head & (g_cap_size - 1));
+    unsigned int first = g_cap_size - offset;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(g_cap_buf + offset, data, first);
+    memcpy(g_cap_buf, (const unsigned char*)data + first, length - first);
+    g_cap_head += length;
+}
+
+static DWORD WINAPI capture_writer_thread_func(LPVOID lpParameter) {
+    (void)lpParameter;
+    EnterCriticalSection(&g_cap_lock);
+    for (;;) {
+        while (g_cap_head == g_cap_tail && !g_cap_stop) {
+            g_cap_writer_waiting = 1;
+            SleepConditionVariableCS(&g_cap_cond, &g_cap_lock, CAPTURE_IDLE_WAIT_MS);
+            g_cap_writer_waiting = 0;
+        }
+        if (g_cap_head == g_cap_tail) {
+            break;
+        }
+        unsigned int offset = (unsigned int)(g_cap_tail & (g_cap_size - 1));
+        unsigned long long pending = g_cap_head - g_cap_tail;
+        unsigned int chunk = g_cap_size - offset;
+        if (pending < chunk) {
+            chunk = (unsigned int)pending;
+        }
+        int write_error = g_cap_stats.write_error;
+        LeaveCriticalSection(&g_cap_lock);
+
+        size_t written = 0;
+        if (!write_error) {
+            written = fwrite(g_cap_buf + offset, 1, chunk, g_cap_file);
+        }
+
+        EnterCriticalSection(&g_cap_lock);
+        g_cap_stats.file_bytes += written;
+        if (!write_error && written != chunk) {
+            // 磁盘满等错误：之后的数据只从缓冲区丢弃，保证收发路径不受影响
+            g_cap_stats.write_error = 1;
+            debug_printf("录制文件写入失败，停止写入: 已写%llu字节", g_cap_stats.file_bytes);
+        }
+        g_cap_tail += chunk;
+    }
+    LeaveCriticalSection(&g_cap_lock);
+    return 0;
+}
+
+void usb_capture_init(void) {
+    if (g_cap_lock_ready) {
+        return;
+    }
+    InitializeCriticalSection(&g_cap_lock);
+    InitializeConditionVariable(&g_cap_cond);
+    g_cap_lock_ready = 1;
+}
+
+// 整个启动过程持有g_cap_lock，并发的开始录制只有一个能成功；
+// 停止录制在等待写入线程期间g_cap_buf仍非空，这段时间内开始录制同样返回已在录制
+static int capture_start_locked(const char* path, unsigned int buffer_size) {
+    if (g_cap_thread || g_cap_buf) {
+        debug_printf("开始录制失败: 已在录制");
+        return USB_ERROR_ACCESS;
+    }
+
+    unsigned int size = CAPTURE_MIN_BUFFER;
+    unsigned int want = buffer_size ? buffer_size : USB_CAPTURE_DEFAULT_BUFFER;
+    while (size < want && size < 0x80000000u) {
+        size <<= 1;
+    }
+    unsigned char* buf = (unsigned char*)malloc(size);
+    if (!buf) {
+        return USB_ERROR_OTHER;
+    }
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        debug_printf("无法创建录制文件: %s", path);
+        free(buf);
+        return USB_ERROR_ACCESS;
+    }
+    usb_capture_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, USB_CAPTURE_MAGIC, sizeof(USB_CAPTURE_MAGIC));
+    header.version = USB_CAPTURE_VERSION;
+    header.header_size = sizeof(header);
+    header.start_time_us = usb_wall_time_us();
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        fclose(fp);
+        free(buf);
+        return USB_ERROR_IO;
+    }
+
+    g_cap_buf = buf;
+    g_cap_size = size;
+    g_cap_head = 0;
+    g_cap_tail = 0;
+    g_cap_stop = 0;
+    g_cap_file = fp;
+    memset(&g_cap_stats, 0, sizeof(g_cap_stats));
+    g_cap_stats.file_bytes = sizeof(header);
+    g_cap_start_us = usb_now_us();
+
+    // 写入线程一开始就要拿g_cap_lock，等本函数返回后才真正运行
+    g_cap_thread = CreateThread(NULL, 0, capture_writer_thread_func, NULL, 0, NULL);
+    if (!g_cap_thread) {
+        g_cap_buf = NULL;
+        g_cap_file = NULL;
+        fclose(fp);
+        free(buf);
+        return USB_ERROR_OTHER;
+    }
+    __atomic_store_n(&g_usb_capture_active, 1, __ATOMIC_RELEASE);
+    debug_printf("开始录制USB传输: %s, 缓冲区%u字节", path, size);
+    return USB_SUCCESS;
+}
+
+int usb_capture_start(const char* path, unsigned int buffer_size) {
+    if (!path || !path[0]) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    if (!g_cap_lock_ready) {
+        return USB_ERROR_OTHER;
+    }
+    EnterCriticalSection(&g_cap_lock);
+    int ret = capture_start_locked(path, buffer_size);
+    LeaveCriticalSection(&g_cap_lock);
+    return ret;
+}
+
+void usb_capture_stop(void) {
+    if (!g_cap_lock_ready) {
+        return;
+    }
+    // 在锁内取走线程句柄，并发的停止只有一个会去等待
+    EnterCriticalSection(&g_cap_lock);
+    HANDLE thread = g_cap_thread;
+    g_cap_thread = NULL;
+    if (thread) {
+        __atomic_store_n(&g_usb_capture_active, 0, __ATOMIC_RELEASE);
+        g_cap_stop = 1;
+        WakeConditionVariable(&g_cap_cond);
+    }
+    LeaveCriticalSection(&g_cap_lock);
+    if (!thread) {
+        return;
+    }
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    EnterCriticalSection(&g_cap_lock);
+    unsigned char* buf = g_cap_buf;
+    FILE* fp = g_cap_file;
+    g_cap_buf = NULL;
+    g_cap_file = NULL;
+    LeaveCriticalSection(&g_cap_lock);
+    free(buf);
+    if (fp) {
+        fclose(fp);
+    }
+    debug_printf("停止录制: %llu条记录, %llu字节, 丢弃%llu条",
+                 g_cap_stats.records, g_cap_stats.bytes, g_cap_stats.dropped_records);
+}
+
+void usb_capture_detach(void) {
+    if (!g_cap_lock_ready) {
+        return;
+    }
+    __atomic_store_n(&g_usb_capture_active, 0, __ATOMIC_RELEASE);
+    EnterCriticalSection(&g_cap_lock);
+    if (g_cap_thread) {
+        g_cap_stop = 1;
+        WakeConditionVariable(&g_cap_cond);
+    }
+    LeaveCriticalSection(&g_cap_lock);
+}
+
+void usb_capture_record(int type, int slot, const void* data, unsigned int length) {
+    if (!usb_capture_active() || (length > 0 && !data)) {
+        return;
+    }
+    EnterCriticalSection(&g_cap_lock);
+    // 已开始停止录制的不再接收，写入线程退出后就不会有记录残留在缓冲区
+    if (!g_cap_buf || g_cap_stop) {
+        LeaveCriticalSection(&g_cap_lock);
+        return;
+    }
+    unsigned long long need = (unsigned long long)sizeof(usb_capture_record_t) + length;
+    if (need > g_cap_size - (g_cap_head - g_cap_tail)) {
+        g_cap_stats.dropped_records++;
+        g_cap_stats.dropped_bytes += length;
+        LeaveCriticalSection(&g_cap_lock);
+        return;
+    }
+    usb_capture_record_t record;
+    record.time_us = usb_now_us() - g_cap_start_us;
+    record.length = length;
+    record.type = (uint8_t)type;
+    record.slot = (uint8_t)slot;
+    record.reserved = 0;
+    capture_copy_in(&record, sizeof(record));
+    capture_copy_in(data, length);
+    g_cap_stats.records++;
+    g_cap_stats.bytes += length;
+    if (g_cap_writer_waiting) {
+        WakeConditionVariable(&g_cap_cond);
+    }
+    LeaveCriticalSection(&g_cap_lock);
+}
+
+void usb_capture_get_stats(usb_capture_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    if (!g_cap_lock_ready) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    EnterCriticalSection(&g_cap_lock);
+    *stats = g_cap_stats;
+    LeaveCriticalSection(&g_cap_lock);
+    stats->active = usb_capture_active();
+}
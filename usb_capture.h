@@ -0,0 +1,86 @@
+/**
+ * @file usb_capture.h
+ * @brief USB批量传输录制
+ * 把每次批量IN/OUT传输的原始字节连同单调时钟时间戳写入二进制文件，
+ * 调用线程只把记录拷进内存环形缓冲区，由后台线程写文件；缓冲区满时丢弃整条记录并计数，不阻塞收发。
+ * 录下的文件可用replay后端(usb_replay.h)原样送回解析器，复现现场数据或做解析吞吐测试。
+ *
+ * 文件格式(小端)：文件头usb_capture_file_header_t，之后是连续的记录，
+ * 每条记录为usb_capture_record_t加length字节数据。
+ */
+
+#ifndef USB_CAPTURE_H
+#define USB_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define USB_CAPTURE_MAGIC           "G2XCAP1"
+#define USB_CAPTURE_VERSION         1
+#define USB_CAPTURE_DEFAULT_BUFFER  (8 * 1024 * 1024)
+
+// 记录类型
+#define USB_CAPTURE_IN      0    // 批量IN传输收到的数据(即交给解析器的数据)
+#define USB_CAPTURE_OUT     1    // 批量OUT传输发出的数据
+#define USB_CAPTURE_DEVICE  2    // 设备打开，数据为序列号(不含结尾0)
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];                  // USB_CAPTURE_MAGIC
+    uint32_t version;
+    uint32_t header_size;           // 文件头长度，便于以后扩展
+    uint64_t start_time_us;         // 开始录制时的系统时间(1970年起的微秒)
+} usb_capture_file_header_t;
+
+typedef struct {
+    uint64_t time_us;               // 相对开始录制的单调时钟微秒数
+    uint32_t length;                // 后面的数据字节数
+    uint8_t type;                   // USB_CAPTURE_xxx
+    uint8_t slot;                   // 中间层设备槽位，同一文件内标识设备
+    uint16_t reserved;
+} usb_capture_record_t;
+#pragma pack(pop)
+
+typedef struct {
+    unsigned long long records;         // 写入缓冲区的记录数
+    unsigned long long bytes;           // 写入缓冲区的数据字节数(不含记录头)
+    unsigned long long dropped_records; // 缓冲区满丢弃的记录数
+    unsigned long long dropped_bytes;
+    unsigned long long file_bytes;      // 已写入文件的字节数(含文件头和记录头)
+    int active;                         // 1=正在录制
+    int write_error;                    // 写文件失败后不再写入，直到下次开始录制
+} usb_capture_stats_t;
+
+// 正在录制，供收发路径内联判断
+extern int g_usb_capture_active;
+
+static inline int usb_capture_active(void) {
+    return __atomic_load_n(&g_usb_capture_active, __ATOMIC_RELAXED);
+}
+
+// 初始化录制用的锁，由中间层初始化调用一次
+void usb_capture_init(void);
+
+// 开始录制到path(覆盖已有文件)，buffer_size为内存缓冲区大小，0=默认
+int usb_capture_start(const char* path, unsigned int buffer_size);
+
+// 写完缓冲区中的记录后关闭文件
+void usb_capture_stop(void);
+
+// 只通知写入线程写完缓冲区后退出，不等待也不释放，供DllMain/析构函数使用
+void usb_capture_detach(void);
+
+// 记录一次传输，未在录制时直接返回；多线程可同时调用
+void usb_capture_record(int type, int slot, const void* data, unsigned int length);
+
+void usb_capture_get_stats(usb_capture_stats_t* stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_CAPTURE_H
@@ -0,0 +1,56 @@
+/**
+ * @file usb_clock.h
+ * @brief 微秒时钟
+ * usb_now_us为单调时钟，用于超时、延迟统计和录制/帧时间戳；
+ * usb_wall_time_us为系统时间(1970年起的微秒)，只用于日志和录制文件头这类需要绝对时间的地方。
+ */
+
+#ifndef USB_CLOCK_H
+#define USB_CLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+static inline unsigned long long usb_now_us(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000ULL +
+           (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000ULL / (unsigned long long)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)(ts.tv_nsec / 1000);
+#endif
+}
+
+static inline unsigned long long usb_wall_time_us(void) {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (t - 116444736000000000ULL) / 10;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000ULL + (unsigned long long)tv.tv_usec;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_CLOCK_H
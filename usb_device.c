@@ -6,6 +6,8 @@
 #define _GNU_SOURCE 1
 #include "usb_device.h"
 #include "usb_log.h"
+#include "usb_sim.h"
+#include "usb_replay.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -40,6 +42,17 @@ typedef int (*libusb_get_string_descriptor_ascii_t)(void*, unsigned char, unsign
 typedef void* (*libusb_get_device_t)(void*);
 typedef int (*libusb_open_t)(void*, void**);
 
+// 异步接口
+typedef struct {
+    long tv_sec;
+    long tv_usec;
+} usb_timeval_t;
+typedef usb_transfer_t* (*libusb_alloc_transfer_t)(int);
+typedef void (*libusb_free_transfer_t)(usb_transfer_t*);
+typedef int (*libusb_submit_transfer_t)(usb_transfer_t*);
+typedef int (*libusb_cancel_transfer_t)(usb_transfer_t*);
+typedef int (*libusb_handle_events_timeout_completed_t)(void*, usb_timeval_t*, int*);
+
 // 函数指针
 static libusb_init_t p_libusb_init;
 static libusb_exit_t p_libusb_exit;
@@ -54,9 +67,16 @@ static libusb_get_device_descriptor_t p_libusb_get_device_descriptor;
 static libusb_get_string_descriptor_ascii_t p_libusb_get_string_descriptor_ascii;
 static libusb_get_device_t p_libusb_get_device;
 static libusb_open_t p_libusb_open;
+static libusb_alloc_transfer_t p_libusb_alloc_transfer;
+static libusb_free_transfer_t p_libusb_free_transfer;
+static libusb_submit_transfer_t p_libusb_submit_transfer;
+static libusb_cancel_transfer_t p_libusb_cancel_transfer;
+static libusb_handle_events_timeout_completed_t p_libusb_handle_events_timeout_completed;
 
-// 初始化USB设备层
-int usb_device_init(void) {
+static int libusb_backend_async_supported(void);
+
+// 初始化libusb后端
+static int libusb_backend_init(void) {
     debug_printf("正在初始化USB设备层...");
     
     if (g_is_initialized) {
@@ -146,6 +166,11 @@ int usb_device_init(void) {
     p_libusb_get_string_descriptor_ascii = (libusb_get_string_descriptor_ascii_t)GetProcAddress(hLibusbDll, "libusb_get_string_descriptor_ascii");
     p_libusb_get_device = (libusb_get_device_t)GetProcAddress(hLibusbDll, "libusb_get_device");
     p_libusb_open = (libusb_open_t)GetProcAddress(hLibusbDll, "libusb_open");
+    p_libusb_alloc_transfer = (libusb_alloc_transfer_t)GetProcAddress(hLibusbDll, "libusb_alloc_transfer");
+    p_libusb_free_transfer = (libusb_free_transfer_t)GetProcAddress(hLibusbDll, "libusb_free_transfer");
+    p_libusb_submit_transfer = (libusb_submit_transfer_t)GetProcAddress(hLibusbDll, "libusb_submit_transfer");
+    p_libusb_cancel_transfer = (libusb_cancel_transfer_t)GetProcAddress(hLibusbDll, "libusb_cancel_transfer");
+    p_libusb_handle_events_timeout_completed = (libusb_handle_events_timeout_completed_t)GetProcAddress(hLibusbDll, "libusb_handle_events_timeout_completed");
     #else
     p_libusb_init = (libusb_init_t)dlsym(hLibusbDll, "libusb_init");
     p_libusb_exit = (libusb_exit_t)dlsym(hLibusbDll, "libusb_exit");
@@ -160,6 +185,11 @@ int usb_device_init(void) {
     p_libusb_get_string_descriptor_ascii = (libusb_get_string_descriptor_ascii_t)dlsym(hLibusbDll, "libusb_get_string_descriptor_ascii");
     p_libusb_get_device = (libusb_get_device_t)dlsym(hLibusbDll, "libusb_get_device");
     p_libusb_open = (libusb_open_t)dlsym(hLibusbDll, "libusb_open");
+    p_libusb_alloc_transfer = (libusb_alloc_transfer_t)dlsym(hLibusbDll, "libusb_alloc_transfer");
+    p_libusb_free_transfer = (libusb_free_transfer_t)dlsym(hLibusbDll, "libusb_free_transfer");
+    p_libusb_submit_transfer = (libusb_submit_transfer_t)dlsym(hLibusbDll, "libusb_submit_transfer");
+    p_libusb_cancel_transfer = (libusb_cancel_transfer_t)dlsym(hLibusbDll, "libusb_cancel_transfer");
+    p_libusb_handle_events_timeout_completed = (libusb_handle_events_timeout_completed_t)dlsym(hLibusbDll, "libusb_handle_events_timeout_completed");
     #endif
     
     if (!p_libusb_init || !p_libusb_exit || !p_libusb_open_device_with_vid_pid || !p_libusb_close ||
@@ -176,6 +206,10 @@ int usb_device_init(void) {
         return USB_ERROR_OTHER;
     }
     debug_printf("成功获取所有函数指针");
+    // 异步接口是可选的，缺失时中间层退回同步读取
+    if (!libusb_backend_async_supported()) {
+        debug_printf("libusb异步接口不可用，仅支持同步传输");
+    }
 
     // 初始化libusb
     debug_printf("正在初始化libusb...");
@@ -196,8 +230,8 @@ int usb_device_init(void) {
     return USB_SUCCESS;
 }
 
-// 清理USB设备层
-void usb_device_cleanup(void) {
+// 清理libusb后端
+static void libusb_backend_cleanup(void) {
     if (!g_is_initialized) {
         return;
     }
@@ -217,7 +251,7 @@ void usb_device_cleanup(void) {
     g_is_initialized = 0;
 }
 
-int usb_device_get_device_list(void* ctx, void*** device_list) {
+static int libusb_backend_get_device_list(void* ctx, void*** device_list) {
     if (!g_is_initialized || !device_list) {
         debug_printf("获取设备列表失败: 未初始化或参数无效");
         return -1;
@@ -227,12 +261,12 @@ int usb_device_get_device_list(void* ctx, void*** device_list) {
     return count;
 }
 
-void usb_device_free_device_list(void** list, int unref_devices) {
+static void libusb_backend_free_device_list(void** list, int unref_devices) {
     if (g_is_initialized && list) {
         p_libusb_free_device_list(list, unref_devices);
     }
 }
-int usb_device_get_device_descriptor(void* dev, usb_device_descriptor* desc) {
+static int libusb_backend_get_device_descriptor(void* dev, usb_device_descriptor* desc) {
     if (!g_is_initialized || !dev || !desc) {
         debug_printf("获取设备描述符失败: 未初始化或参数无效");
         return -1;
@@ -246,7 +280,7 @@ int usb_device_get_device_descriptor(void* dev, usb_device_descriptor* desc) {
     return ret;
 }
 
-int usb_device_open(void* dev, void** handle) {
+static int libusb_backend_open(void* dev, void** handle) {
     if (!g_is_initialized || !dev || !handle) {
         debug_printf("打开设备失败: 未初始化或参数无效");
         return -1;
@@ -259,13 +293,13 @@ int usb_device_open(void* dev, void** handle) {
 }
 
 // 关闭设备
-void usb_device_close(void* handle) {
+static void libusb_backend_close(void* handle) {
     if (g_is_initialized && handle) {
         p_libusb_close(handle);
     }
 }
 
-int usb_device_get_string_descriptor_ascii(void* handle, uint8_t desc_index, unsigned char* data, int length) {
+static int libusb_backend_get_string_descriptor_ascii(void* handle, uint8_t desc_index, unsigned char* data, int length) {
     if (!g_is_initialized || !handle || !data || length <= 0) {
         debug_printf("获取字符串描述符失败: 未初始化或参数无效");
         return -1;
@@ -277,7 +311,7 @@ int usb_device_get_string_descriptor_ascii(void* handle, uint8_t desc_index, uns
     return ret;
 }
 
-int usb_device_claim_interface(void* handle, int interface_number) {
+static int libusb_backend_claim_interface(void* handle, int interface_number) {
     if (!g_is_initialized || !handle) {
         return -1;
     }
@@ -285,7 +319,7 @@ int usb_device_claim_interface(void* handle, int interface_number) {
     return ret;
 }
 
-int usb_device_release_interface(void* handle, int interface_number) {
+static int libusb_backend_release_interface(void* handle, int interface_number) {
     if (!g_is_initialized || !handle) {
         return -1;
     }
@@ -293,7 +327,7 @@ int usb_device_release_interface(void* handle, int interface_number) {
     return ret;
 }
 
-int usb_device_bulk_transfer(void* handle, unsigned char endpoint, unsigned char* data, int length, int* transferred, unsigned int timeout) {
+static int libusb_backend_bulk_transfer(void* handle, unsigned char endpoint, unsigned char* data, int length, int* transferred, unsigned int timeout) {
     if (!g_is_initialized || !handle || !data || length <= 0 || !transferred) {
         debug_printf("批量传输失败: 参数无效");
         return -1;
@@ -305,16 +339,228 @@ int usb_device_bulk_transfer(void* handle, unsigned char endpoint, unsigned char
     return ret;
 }
 
-void* usb_device_get_device(void* handle) {
+static void* libusb_backend_get_device(void* handle) {
     if (!g_is_initialized || !handle) {
         return NULL;
     }
     return p_libusb_get_device(handle);
 }
 
-void* usb_device_open_device_with_vid_pid(void* ctx, unsigned short vid, unsigned short pid) {
+static void* libusb_backend_open_device_with_vid_pid(void* ctx, unsigned short vid, unsigned short pid) {
     if (!g_is_initialized) {
         return NULL;
     }
     return p_libusb_open_device_with_vid_pid(ctx ? ctx : g_libusb_context, vid, pid);
 }
+
+static int libusb_backend_async_supported(void) {
+    return p_libusb_alloc_transfer && p_libusb_free_transfer && p_libusb_submit_transfer &&
+           p_libusb_cancel_transfer && p_libusb_handle_events_timeout_completed;
+}
+
+static usb_transfer_t* libusb_backend_alloc_transfer(int iso_packets) {
+    if (!g_is_initialized || !libusb_backend_async_supported()) {
+        return NULL;
+    }
+    return p_libusb_alloc_transfer(iso_packets);
+}
+
+static void libusb_backend_free_transfer(usb_transfer_t* transfer) {
+    if (g_is_initialized && transfer && p_libusb_free_transfer) {
+        p_libusb_free_transfer(transfer);
+    }
+}
+
+void usb_device_fill_bulk_transfer(usb_transfer_t* transfer, void* handle, unsigned char endpoint,
+                                   unsigned char* buffer, int length, usb_transfer_cb_fn callback,
+                                   void* user_data, unsigned int timeout) {
+    if (!transfer) {
+        return;
+    }
+    transfer->dev_handle = handle;
+    transfer->endpoint = endpoint;
+    transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+    transfer->timeout = timeout;
+    transfer->buffer = buffer;
+    transfer->length = length;
+    transfer->user_data = user_data;
+    transfer->callback = callback;
+}
+
+static int libusb_backend_submit_transfer(usb_transfer_t* transfer) {
+    if (!g_is_initialized || !transfer || !p_libusb_submit_transfer) {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    return p_libusb_submit_transfer(transfer);
+}
+
+static int libusb_backend_cancel_transfer(usb_transfer_t* transfer) {
+    if (!g_is_initialized || !transfer || !p_libusb_cancel_transfer) {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    return p_libusb_cancel_transfer(transfer);
+}
+
+static int libusb_backend_handle_events_timeout(void* ctx, int timeout_ms, int* completed) {
+    if (!g_is_initialized || !p_libusb_handle_events_timeout_completed) {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    usb_timeval_t tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    return p_libusb_handle_events_timeout_completed(ctx ? ctx : g_libusb_context, &tv, completed);
+}
+
+static const usb_transport_t g_libusb_transport = {
+    "libusb",
+    libusb_backend_init,
+    libusb_backend_cleanup,
+    libusb_backend_get_device_list,
+    libusb_backend_free_device_list,
+    libusb_backend_get_device_descriptor,
+    libusb_backend_open,
+    libusb_backend_close,
+    libusb_backend_get_string_descriptor_ascii,
+    libusb_backend_claim_interface,
+    libusb_backend_release_interface,
+    libusb_backend_bulk_transfer,
+    libusb_backend_get_device,
+    libusb_backend_open_device_with_vid_pid,
+    libusb_backend_async_supported,
+    libusb_backend_alloc_transfer,
+    libusb_backend_free_transfer,
+    libusb_backend_submit_transfer,
+    libusb_backend_cancel_transfer,
+    libusb_backend_handle_events_timeout,
+};
+
+// ==================== 传输后端转发 ====================
+static const usb_transport_t* g_transport = NULL;   // NULL=尚未选择，init时决定
+static int g_transport_active = 0;                  // 后端已init，不允许切换
+
+const usb_transport_t* usb_device_find_transport(const char* name) {
+    if (!name) {
+        return NULL;
+    }
+    if (strcmp(name, "libusb") == 0) {
+        return &g_libusb_transport;
+    }
+    if (strcmp(name, "sim") == 0) {
+        return usb_sim_transport();
+    }
+    if (strcmp(name, "replay") == 0) {
+        return usb_replay_transport();
+    }
+    return NULL;
+}
+
+int usb_device_set_transport(const usb_transport_t* transport) {
+    if (g_transport_active) {
+        debug_printf("切换传输后端失败: 设备层已初始化");
+        return USB_ERROR_ACCESS;
+    }
+    g_transport = transport;
+    return USB_SUCCESS;
+}
+
+const usb_transport_t* usb_device_get_transport(void) {
+    return g_transport ? g_transport : &g_libusb_transport;
+}
+
+int usb_device_init(void) {
+    if (g_transport_active) {
+        return USB_SUCCESS;
+    }
+    if (!g_transport) {
+        const char* env = getenv("USB_G2X_TRANSPORT");
+        g_transport = usb_device_find_transport(env);
+        if (env && !g_transport) {
+            debug_printf("未知的传输后端: %s，使用libusb", env);
+        }
+        if (!g_transport) {
+            g_transport = &g_libusb_transport;
+        }
+    }
+    debug_printf("传输后端: %s", g_transport->name);
+    int ret = g_transport->init();
+    if (ret == USB_SUCCESS) {
+        g_transport_active = 1;
+    }
+    return ret;
+}
+
+void usb_device_cleanup(void) {
+    if (!g_transport_active) {
+        return;
+    }
+    g_transport->cleanup();
+    g_transport_active = 0;
+}
+
+int usb_device_get_device_list(void* ctx, void*** device_list) {
+    return usb_device_get_transport()->get_device_list(ctx, device_list);
+}
+
+void usb_device_free_device_list(void** list, int unref_devices) {
+    usb_device_get_transport()->free_device_list(list, unref_devices);
+}
+
+int usb_device_get_device_descriptor(void* dev, usb_device_descriptor* desc) {
+    return usb_device_get_transport()->get_device_descriptor(dev, desc);
+}
+
+int usb_device_open(void* dev, void** handle) {
+    return usb_device_get_transport()->open(dev, handle);
+}
+
+void usb_device_close(void* handle) {
+    usb_device_get_transport()->close(handle);
+}
+
+int usb_device_get_string_descriptor_ascii(void* handle, uint8_t desc_index, unsigned char* data, int length) {
+    return usb_device_get_transport()->get_string_descriptor_ascii(handle, desc_index, data, length);
+}
+
+int usb_device_claim_interface(void* handle, int interface_number) {
+    return usb_device_get_transport()->claim_interface(handle, interface_number);
+}
+
+int usb_device_release_interface(void* handle, int interface_number) {
+    return usb_device_get_transport()->release_interface(handle, interface_number);
+}
+
+int usb_device_bulk_transfer(void* handle, unsigned char endpoint, unsigned char* data, int length, int* transferred, unsigned int timeout) {
+    return usb_device_get_transport()->bulk_transfer(handle, endpoint, data, length, transferred, timeout);
+}
+
+void* usb_device_get_device(void* handle) {
+    return usb_device_get_transport()->get_device(handle);
+}
+
+void* usb_device_open_device_with_vid_pid(void* ctx, unsigned short vid, unsigned short pid) {
+    return usb_device_get_transport()->open_device_with_vid_pid(ctx, vid, pid);
+}
+
+int usb_device_async_supported(void) {
+    return usb_device_get_transport()->async_supported();
+}
+
+usb_transfer_t* usb_device_alloc_transfer(int iso_packets) {
+    return usb_device_get_transport()->alloc_transfer(iso_packets);
+}
+
+void usb_device_free_transfer(usb_transfer_t* transfer) {
+    usb_device_get_transport()->free_transfer(transfer);
+}
+
+int usb_device_submit_transfer(usb_transfer_t* transfer) {
+    return usb_device_get_transport()->submit_transfer(transfer);
+}
+
+int usb_device_cancel_transfer(usb_transfer_t* transfer) {
+    return usb_device_get_transport()->cancel_transfer(transfer);
+}
+
+int usb_device_handle_events_timeout(void* ctx, int timeout_ms, int* completed) {
+    return usb_device_get_transport()->handle_events_timeout(ctx, timeout_ms, completed);
+}
@@ -23,8 +23,28 @@ extern "C" {
 
 #define LIBUSB_SUCCESS         0
 #define LIBUSB_ERROR_IO       -1
+#define LIBUSB_ERROR_NO_DEVICE -4
 #define LIBUSB_ERROR_TIMEOUT  -7
 #define LIBUSB_ERROR_NOT_FOUND -5
+#define LIBUSB_ERROR_NOT_SUPPORTED -12
+
+// libusb异步传输相关定义
+#define LIBUSB_TRANSFER_TYPE_BULK  2
+
+#define LIBUSB_TRANSFER_COMPLETED  0
+#define LIBUSB_TRANSFER_ERROR      1
+#define LIBUSB_TRANSFER_TIMED_OUT  2
+#define LIBUSB_TRANSFER_CANCELLED  3
+#define LIBUSB_TRANSFER_STALL      4
+#define LIBUSB_TRANSFER_NO_DEVICE  5
+#define LIBUSB_TRANSFER_OVERFLOW   6
+
+// libusb回调的调用约定(Windows下为WINAPI)
+#ifdef _WIN32
+#define USB_LIBUSB_CALL __stdcall
+#else
+#define USB_LIBUSB_CALL
+#endif
 
 
 #define USB_SUCCESS            0    // 成功
@@ -51,6 +71,25 @@ typedef struct {
     unsigned char  bNumConfigurations;
 } usb_device_descriptor;
 
+typedef struct usb_transfer usb_transfer_t;
+typedef void (USB_LIBUSB_CALL *usb_transfer_cb_fn)(usb_transfer_t* transfer);
+
+// 与libusb的struct libusb_transfer内存布局保持一致
+struct usb_transfer {
+    void* dev_handle;
+    uint8_t flags;
+    unsigned char endpoint;
+    unsigned char type;
+    unsigned int timeout;
+    int status;
+    int length;
+    int actual_length;
+    usb_transfer_cb_fn callback;
+    void* user_data;
+    unsigned char* buffer;
+    int num_iso_packets;
+};
+
 
 int usb_device_init(void);
 void usb_device_cleanup(void);
@@ -66,6 +105,52 @@ int usb_device_bulk_transfer(void* handle, unsigned char endpoint, unsigned char
 void* usb_device_get_device(void* handle);
 void* usb_device_open_device_with_vid_pid(void* ctx, unsigned short vid, unsigned short pid);
 
+// ==================== 异步传输接口 ====================
+// 加载的libusb不带异步接口时返回0
+int usb_device_async_supported(void);
+usb_transfer_t* usb_device_alloc_transfer(int iso_packets);
+void usb_device_free_transfer(usb_transfer_t* transfer);
+void usb_device_fill_bulk_transfer(usb_transfer_t* transfer, void* handle, unsigned char endpoint,
+                                   unsigned char* buffer, int length, usb_transfer_cb_fn callback,
+                                   void* user_data, unsigned int timeout);
+int usb_device_submit_transfer(usb_transfer_t* transfer);
+int usb_device_cancel_transfer(usb_transfer_t* transfer);
+// 处理一次libusb事件，completed非空时在*completed变为非0后提前返回
+int usb_device_handle_events_timeout(void* ctx, int timeout_ms, int* completed);
+
+// ==================== 传输后端 ====================
+// usb_device_*都经由当前后端转发：默认libusb，另有进程内模拟设备(usb_sim.c)；
+// 各函数语义与同名usb_device_*一致，后端自行处理未初始化和参数检查
+typedef struct {
+    const char* name;
+    int (*init)(void);
+    void (*cleanup)(void);
+    int (*get_device_list)(void* ctx, void*** device_list);
+    void (*free_device_list)(void** list, int unref_devices);
+    int (*get_device_descriptor)(void* dev, usb_device_descriptor* desc);
+    int (*open)(void* dev, void** handle);
+    void (*close)(void* handle);
+    int (*get_string_descriptor_ascii)(void* handle, uint8_t desc_index, unsigned char* data, int length);
+    int (*claim_interface)(void* handle, int interface_number);
+    int (*release_interface)(void* handle, int interface_number);
+    int (*bulk_transfer)(void* handle, unsigned char endpoint, unsigned char* data, int length, int* transferred, unsigned int timeout);
+    void* (*get_device)(void* handle);
+    void* (*open_device_with_vid_pid)(void* ctx, unsigned short vid, unsigned short pid);
+    int (*async_supported)(void);
+    usb_transfer_t* (*alloc_transfer)(int iso_packets);
+    void (*free_transfer)(usb_transfer_t* transfer);
+    int (*submit_transfer)(usb_transfer_t* transfer);
+    int (*cancel_transfer)(usb_transfer_t* transfer);
+    int (*handle_events_timeout)(void* ctx, int timeout_ms, int* completed);
+} usb_transport_t;
+
+// 选择后端，只能在usb_device_init之前(或cleanup之后)调用，NULL表示默认的libusb。
+// 未显式选择时，usb_device_init按环境变量USB_G2X_TRANSPORT选择("libusb"/"sim"/"replay")
+int usb_device_set_transport(const usb_transport_t* transport);
+const usb_transport_t* usb_device_get_transport(void);
+// 按名字查找内置后端，未知名字返回NULL
+const usb_transport_t* usb_device_find_transport(const char* name);
+
 // libusb上下文管理
 extern void* g_libusb_context;
 extern int g_is_initialized;
@@ -0,0 +1,333 @@
+/**
+ * @file usb_frame.c
+ * @brief 按帧重组的数据采集
+ * 帧池是一块count*capacity的连续内存，帧号在空闲栈和待读队列之间流转，两者都在lock内修改。
+ * 写入方自己持有正在填充的帧(cur)，往里拷数据不进锁；cur为-1时该帧只计长度，结束时记为丢弃。
+ * 同步字用KMP逐字节匹配，匹配位置为0时先用memchr跳到下一个可能的同步字开头，帧内数据整段拷贝。
+ */
+
+#include "usb_frame.h"
+#include "usb_clock.h"
+#include "usb_middleware.h"
+#include "usb_log.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#endif
+
+#define FRAME_DEFAULT_MAX_SIZE  (64 * 1024)
+#define FRAME_POOL_MAX_BYTES    (1024u * 1024u * 1024u)
+
+struct usb_frame_capture {
+    usb_frame_config_t config;
+    unsigned int capacity;          // 每帧的缓冲区大小
+    unsigned char* pool;
+    usb_frame_info_t* info;         // 各帧完成时的信息
+    int* free_list;                 // 空闲帧栈
+    unsigned int free_count;
+    int* ready;                     // 待读帧队列
+    unsigned int ready_head;
+    unsigned int ready_count;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE ready_cond;
+    unsigned int waiters;
+    int closed;
+    usb_frame_stats_t stats;        // lock内修改
+    unsigned long long next_seq;    // lock内修改
+
+    // 以下只由写入方使用
+    int cur;                        // 正在填充的帧号，-1=该帧将被丢弃
+    unsigned int cur_len;           // 当前帧已收到的字节数(丢弃时也计数)
+    int filling;                    // 1=在帧内，0=在找同步字
+    int expect_sync;                // 刚结束一个固定长度帧，紧接着应是同步字
+    unsigned int match;             // 同步字已匹配的字节数
+    unsigned long long hunt_bytes;  // 这次找同步消耗的字节(含最后匹配上的同步字)
+    unsigned int fail[USB_FRAME_SYNC_MAX];  // KMP失配表
+};
+
+usb_frame_capture_t* usb_frame_create(const usb_frame_config_t* config) {
+    if (!config || config->sync_len > USB_FRAME_SYNC_MAX) {
+        return NULL;
+    }
+    if (config->sync_len == 0 && config->frame_size == 0) {
+        debug_printf("分帧配置无效: 没有同步字时必须指定帧长");
+        return NULL;
+    }
+    if (config->sync_len > 0 && config->frame_size > 0 && config->frame_size <= config->sync_len) {
+        debug_printf("分帧配置无效: 帧长%u不大于同步字长度%u", config->frame_size, config->sync_len);
+        return NULL;
+    }
+    unsigned int capacity = config->frame_size;
+    if (capacity == 0) {
+        capacity = config->max_frame_size ? config->max_frame_size : FRAME_DEFAULT_MAX_SIZE;
+        if (capacity <= config->sync_len) {
+            return NULL;
+        }
+    }
+    unsigned int count = config->frame_count ? config->frame_count : USB_FRAME_DEFAULT_COUNT;
+    if ((unsigned long long)count * capacity > FRAME_POOL_MAX_BYTES) {
+        debug_printf("帧池过大: %u帧 x %u字节", count, capacity);
+        return NULL;
+    }
+
+    usb_frame_capture_t* fc = (usb_frame_capture_t*)calloc(1, sizeof(*fc));
+    if (!fc) {
+        return NULL;
+    }
+    fc->pool = (unsigned char*)malloc((size_t)count * capacity);
+    fc->info = (usb_frame_info_t*)calloc(count, sizeof(usb_frame_info_t));
+    fc->free_list = (int*)malloc(count * sizeof(int));
+    fc->ready = (int*)malloc(count * sizeof(int));
+    if (!fc->pool || !fc->info || !fc->free_list || !fc->ready) {
+        free(fc->pool);
+        free(fc->info);
+        free(fc->free_list);
+        free(fc->ready);
+        free(fc);
+        return NULL;
+    }
+    fc->config = *config;
+    fc->config.frame_count = count;
+    fc->capacity = capacity;
+    for (unsigned int i = 0; i < count; i++) {
+        fc->free_list[i] = (int)(count - 1 - i);
+    }
+    fc->free_count = count;
+    fc->cur = -1;
+
+    // fail[i]为sync[0..i]最长的相同真前缀和真后缀长度
+    for (unsigned int i = 1, k = 0; i < config->sync_len; i++) {
+        while (k > 0 && config->sync[i] != config->sync[k]) {
+            k = fc->fail[k - 1];
+        }
+        if (config->sync[i] == config->sync[k]) {
+            k++;
+        }
+        fc->fail[i] = k;
+    }
+    InitializeCriticalSection(&fc->lock);
+    InitializeConditionVariable(&fc->ready_cond);
+    return fc;
+}
+
+void usb_frame_destroy(usb_frame_capture_t* fc) {
+    if (!fc) {
+        return;
+    }
+    DeleteCriticalSection(&fc->lock);
+#ifndef _WIN32
+    pthread_cond_destroy(&fc->ready_cond);
+#endif
+    free(fc->pool);
+    free(fc->info);
+    free(fc->free_list);
+    free(fc->ready);
+    free(fc);
+}
+
+void usb_frame_shutdown(usb_frame_capture_t* fc) {
+    EnterCriticalSection(&fc->lock);
+    fc->closed = 1;
+    WakeAllConditionVariable(&fc->ready_cond);
+    LeaveCriticalSection(&fc->lock);
+}
+
+// 取一个空闲帧开始填充；帧池用完时按策略挤掉最旧的待读帧，或让这一帧只计数
+static void frame_begin(usb_frame_capture_t* fc) {
+    int idx = -1;
+    EnterCriticalSection(&fc->lock);
+    if (fc->free_count > 0) {
+        idx = fc->free_list[--fc->free_count];
+    } else if (fc->config.overflow_policy != RING_OVERFLOW_DROP_NEWEST && fc->ready_count > 0) {
+        idx = fc->ready[fc->ready_head];
+        fc->ready_head = (fc->ready_head + 1) % fc->config.frame_count;
+        fc->ready_count--;
+        fc->stats.dropped_frames++;
+    }
+    LeaveCriticalSection(&fc->lock);
+    fc->cur = idx;
+    fc->cur_len = 0;
+    fc->filling = 1;
+}
+
+// 超出缓冲区的部分不拷贝，只计长度，结束时按超长丢弃
+static void frame_append(usb_frame_capture_t* fc, const unsigned char* data, unsigned int length) {
+    if (fc->cur >= 0 && fc->cur_len < fc->capacity) {
+        unsigned int room = fc->capacity - fc->cur_len;
+        memcpy(fc->pool + (size_t)fc->cur * fc->capacity + fc->cur_len, data, length < room ? length : room);
+    }
+    fc->cur_len += length;
+}
+
+static void frame_end(usb_frame_capture_t* fc, unsigned int length) {
+    int idx = fc->cur;
+    EnterCriticalSection(&fc->lock);
+    unsigned long long seq = fc->next_seq++;
+    fc->stats.frames++;
+    if (idx < 0) {
+        fc->stats.dropped_frames++;
+    } else if (length > fc->capacity) {
+        fc->stats.oversize_frames++;
+        fc->free_list[fc->free_count++] = idx;
+    } else {
+        fc->info[idx].sequence = seq;
+        fc->info[idx].timestamp_us = usb_now_us();
+        fc->info[idx].length = length;
+        fc->info[idx].reserved = 0;
+        fc->ready[(fc->ready_head + fc->ready_count) % fc->config.frame_count] = idx;
+        fc->ready_count++;
+        if (fc->waiters) {
+            WakeConditionVariable(&fc->ready_cond);
+        }
+    }
+    LeaveCriticalSection(&fc->lock);
+    fc->cur = -1;
+    fc->cur_len = 0;
+    fc->filling = 0;
+}
+
+// 一段不含同步字的数据：在变长帧内就拷进帧，否则算作找同步时跳过的字节
+static void scan_consume(usb_frame_capture_t* fc, const unsigned char* data, unsigned int length, int mismatch) {
+    if (mismatch && fc->expect_sync) {
+        fc->expect_sync = 0;
+        EnterCriticalSection(&fc->lock);
+        fc->stats.sync_losses++;
+        LeaveCriticalSection(&fc->lock);
+    }
+    if (fc->filling) {
+        frame_append(fc, data, length);
+    } else {
+        fc->hunt_bytes += length;
+    }
+}
+
+// 刚匹配上一个完整的同步字(已经交给scan_consume)
+static void on_sync(usb_frame_capture_t* fc) {
+    unsigned int sync_len = fc->config.sync_len;
+    if (fc->filling) {
+        // 变长帧到此结束，末尾的同步字属于下一帧
+        frame_end(fc, fc->cur_len - sync_len);
+    } else {
+        if (fc->hunt_bytes > sync_len) {
+            EnterCriticalSection(&fc->lock);
+            fc->stats.skipped_bytes += fc->hunt_bytes - sync_len;
+            LeaveCriticalSection(&fc->lock);
+        }
+        fc->hunt_bytes = 0;
+        fc->expect_sync = 0;
+    }
+    frame_begin(fc);
+    frame_append(fc, fc->config.sync, sync_len);
+}
+
+void usb_frame_feed(usb_frame_capture_t* fc, const unsigned char* data, unsigned int length) {
+    const unsigned int sync_len = fc->config.sync_len;
+    const unsigned int frame_size = fc->config.frame_size;
+    while (length > 0) {
+        if (frame_size > 0 && (sync_len == 0 || fc->filling)) {
+            // 固定长度帧内不找同步字，整段拷贝
+            if (!fc->filling) {
+                frame_begin(fc);
+            }
+            unsigned int n = frame_size - fc->cur_len;
+            if (n > length) {
+                n = length;
+            }
+            frame_append(fc, data, n);
+            data += n;
+            length -= n;
+            if (fc->cur_len == frame_size) {
+                frame_end(fc, frame_size);
+                fc->expect_sync = sync_len > 0;
+                fc->match = 0;
+            }
+            continue;
+        }
+
+        if (fc->match == 0) {
+            const unsigned char* p = (const unsigned char*)memchr(data, fc->config.sync[0], length);
+            unsigned int n = p ? (unsigned int)(p - data) : length;
+            if (n > 0) {
+                scan_consume(fc, data, n, 1);
+                data += n;
+                length -= n;
+                continue;
+            }
+        }
+
+        unsigned char b = *data;
+        unsigned int before = fc->match;
+        unsigned int m = before;
+        while (m > 0 && fc->config.sync[m] != b) {
+            m = fc->fail[m - 1];
+        }
+        if (fc->config.sync[m] == b) {
+            m++;
+        }
+        fc->match = m;
+        scan_consume(fc, data, 1, m != before + 1);
+        data++;
+        length--;
+        if (m == sync_len) {
+            fc->match = 0;
+            on_sync(fc);
+        }
+    }
+}
+
+int usb_frame_read(usb_frame_capture_t* fc, unsigned char* data, int length, usb_frame_info_t* info, int timeout_ms) {
+    if (!fc || (length > 0 && !data) || length < 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    unsigned long long deadline = usb_now_us() / 1000 + (unsigned long long)(timeout_ms > 0 ? timeout_ms : 0);
+    EnterCriticalSection(&fc->lock);
+    while (fc->ready_count == 0 && !fc->closed) {
+        DWORD wait_ms = INFINITE;
+        if (timeout_ms >= 0) {
+            unsigned long long now = usb_now_us() / 1000;
+            if (now >= deadline) {
+                break;
+            }
+            wait_ms = (DWORD)(deadline - now);
+        }
+        fc->waiters++;
+        SleepConditionVariableCS(&fc->ready_cond, &fc->lock, wait_ms);
+        fc->waiters--;
+    }
+    if (fc->ready_count == 0) {
+        int ret = fc->closed ? USB_ERROR_NOT_FOUND : USB_ERROR_TIMEOUT;
+        LeaveCriticalSection(&fc->lock);
+        return ret;
+    }
+    int idx = fc->ready[fc->ready_head];
+    fc->ready_head = (fc->ready_head + 1) % fc->config.frame_count;
+    fc->ready_count--;
+    usb_frame_info_t frame_info = fc->info[idx];
+    LeaveCriticalSection(&fc->lock);
+
+    // 已从待读队列取出，写入方不会再动这一帧，锁外拷贝
+    int copy = (int)frame_info.length < length ? (int)frame_info.length : length;
+    if (copy > 0) {
+        memcpy(data, fc->pool + (size_t)idx * fc->capacity, copy);
+    }
+
+    EnterCriticalSection(&fc->lock);
+    fc->free_list[fc->free_count++] = idx;
+    fc->stats.delivered++;
+    LeaveCriticalSection(&fc->lock);
+    if (info) {
+        *info = frame_info;
+    }
+    return copy;
+}
+
+void usb_frame_get_stats(usb_frame_capture_t* fc, usb_frame_stats_t* stats) {
+    EnterCriticalSection(&fc->lock);
+    *stats = fc->stats;
+    stats->queued = fc->ready_count;
+    stats->free_frames = fc->free_count;
+    LeaveCriticalSection(&fc->lock);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file usb_frame.h
+ * @brief 按帧重组的数据采集
+ * 把连续的字节流切成完整的帧放进预分配的帧池，再按完成顺序排队交给读取方。
+ * 帧边界可以是固定长度、同步字开头的固定长度，或两个同步字之间的变长数据。
+ * 写入方(解析线程)只在取空闲帧和交付完整帧时进锁；帧池用完时按溢出策略丢弃最旧的待读帧或新帧，
+ * 每个完整帧(含丢弃的)依次分配序号，读取方据序号间隔就能知道丢了哪些帧。
+ */
+
+#ifndef USB_FRAME_H
+#define USB_FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define USB_FRAME_SYNC_MAX         16
+#define USB_FRAME_DEFAULT_COUNT    32
+
+typedef struct {
+    unsigned int frame_size;        // 帧长(含同步字)；有同步字时0表示帧到下一个同步字为止
+    unsigned int max_frame_size;    // 变长帧的最大长度，超过的帧丢弃；0=64KB。固定帧长时不用
+    unsigned int frame_count;       // 帧池中的帧数，0=USB_FRAME_DEFAULT_COUNT
+    unsigned int sync_len;          // 同步字长度，0=不找同步字，从采集开始按帧长切分
+    unsigned char sync[USB_FRAME_SYNC_MAX];
+    int overflow_policy;            // 帧池用完时：RING_OVERFLOW_DROP_OLDEST丢弃最旧的待读帧(默认)，
+                                    // RING_OVERFLOW_DROP_NEWEST丢弃新帧
+} usb_frame_config_t;
+
+typedef struct {
+    unsigned long long sequence;    // 帧序号，从0开始，丢弃的帧也占序号
+    unsigned long long timestamp_us;// 帧最后一个字节到达时的单调时钟微秒数
+    unsigned int length;            // 帧长度
+    unsigned int reserved;
+} usb_frame_info_t;
+
+typedef struct {
+    unsigned long long frames;          // 重组出的完整帧(含丢弃的)
+    unsigned long long delivered;       // 已被读走的帧
+    unsigned long long dropped_frames;  // 帧池用完丢弃的帧
+    unsigned long long oversize_frames; // 超过最大长度丢弃的变长帧
+    unsigned long long sync_losses;     // 帧后面紧跟的不是同步字，重新找同步的次数
+    unsigned long long skipped_bytes;   // 找同步时跳过的字节
+    unsigned int queued;                // 当前待读帧数
+    unsigned int free_frames;           // 当前空闲帧数
+} usb_frame_stats_t;
+
+typedef struct usb_frame_capture usb_frame_capture_t;
+
+// 按配置分配帧池，失败返回NULL
+usb_frame_capture_t* usb_frame_create(const usb_frame_config_t* config);
+
+// 调用前写入方和读取方都已退出
+void usb_frame_destroy(usb_frame_capture_t* fc);
+
+// 唤醒等待中的读取方并让之后的读取立即返回
+void usb_frame_shutdown(usb_frame_capture_t* fc);
+
+// 写入一段数据，只能由一个线程调用
+void usb_frame_feed(usb_frame_capture_t* fc, const unsigned char* data, unsigned int length);
+
+// 等待一个完整帧，拷贝最多length字节到data，返回拷贝的字节数；
+// 超时返回USB_ERROR_TIMEOUT，已关闭返回USB_ERROR_NOT_FOUND。timeout_ms<0为一直等待
+int usb_frame_read(usb_frame_capture_t* fc, unsigned char* data, int length, usb_frame_info_t* info, int timeout_ms);
+
+void usb_frame_get_stats(usb_frame_capture_t* fc, usb_frame_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_FRAME_H
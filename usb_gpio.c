@@ -6,7 +6,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "usb_log.h"
+#include "usb_clock.h"
 
+#define GPIO_SCAN_TIMEOUT_MS  2000   // 等待IIC回复的超时
 
 WINAPI int GPIO_SetOutput(const char* target_serial, int GPIOIndex, uint8_t pull_mode) {
     debug_printf("GPIO_SetOutput开始执行");
@@ -25,13 +27,7 @@ WINAPI int GPIO_SetOutput(const char* target_serial, int GPIOIndex, uint8_t pull
     cmd_header.device_index = (uint8_t)GPIOIndex;
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &pull_mode, sizeof(uint8_t), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &pull_mode, sizeof(uint8_t), NULL, 0);
     debug_printf("GPIO设置输出结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
 }
@@ -55,14 +51,7 @@ WINAPI int GPIO_SetOpenDrain(const char* target_serial, int GPIOIndex, uint8_t p
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &pull_mode, sizeof(uint8_t), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &pull_mode, sizeof(uint8_t), NULL, 0);
     
     debug_printf("GPIO设置开漏输出结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -87,14 +76,7 @@ WINAPI int GPIO_SetInput(const char* target_serial, int GPIOIndex, uint8_t pull_
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &pull_mode, sizeof(uint8_t), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &pull_mode, sizeof(uint8_t), NULL, 0);
     
     debug_printf("GPIO设置输入结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -110,6 +92,11 @@ WINAPI int GPIO_Write(const char* target_serial, int GPIOIndex, uint8_t WriteVal
         debug_printf("设备未打开: %s", target_serial);
         return USB_ERROR_OTHER;
     }
+    return GPIO_WriteH(device_id, GPIOIndex, WriteValue);
+}
+
+WINAPI int GPIO_WriteH(usb_handle_t handle, int GPIOIndex, uint8_t WriteValue) {
+    int device_id = handle;
     
     GENERIC_CMD_HEADER cmd_header;
     cmd_header.protocol_type = PROTOCOL_GPIO;
@@ -118,13 +105,7 @@ WINAPI int GPIO_Write(const char* target_serial, int GPIOIndex, uint8_t WriteVal
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &WriteValue, sizeof(uint8_t), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &WriteValue, sizeof(uint8_t), NULL, 0);
     debug_printf("GPIO写入结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
 }
@@ -139,6 +120,11 @@ WINAPI int GPIO_scan_Write(const char* target_serial, int GPIOIndex, uint8_t Wri
         debug_printf("设备未打开: %s", target_serial);
         return USB_ERROR_OTHER;
     }
+    return GPIO_scan_WriteH(device_id, GPIOIndex, WriteValue);
+}
+
+WINAPI int GPIO_scan_WriteH(usb_handle_t handle, int GPIOIndex, uint8_t WriteValue) {
+    int device_id = handle;
     
     GENERIC_CMD_HEADER cmd_header;
     cmd_header.protocol_type = PROTOCOL_GPIO;
@@ -146,30 +132,25 @@ WINAPI int GPIO_scan_Write(const char* target_serial, int GPIOIndex, uint8_t Wri
     cmd_header.device_index = (uint8_t)GPIOIndex;
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &WriteValue, sizeof(uint8_t), NULL, 0);
-    if (total_len < 0) {
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_STATUS, GPIO_SCAN_MODE_WRITE, (uint8_t)GPIOIndex);
+    if (request < 0) {
         return USB_ERROR_OTHER;
     }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);  //下压
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &WriteValue, sizeof(uint8_t), NULL, 0);  //下压
     debug_printf("--GPIO_scan_Write: %d", ret);
+    if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
+        return USB_ERROR_OTHER;
+    }
     unsigned char response_buffer[16];  
-    int max_loops =2000;
 
-    //下压之后等IIC回复，通过USB读取状态
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_status_data(device_id, response_buffer, sizeof(response_buffer));
-        if (actual_read >= sizeof(GENERIC_CMD_HEADER) + 1) {  // 包含协议头+状态数据
-            GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)response_buffer;
-            if (header->protocol_type == PROTOCOL_STATUS && 
-                header->cmd_id == GPIO_SCAN_MODE_WRITE ) {
-                uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
-                Sleep(50);
-                return queue_status;
-            }
-        }
-        Sleep(1);
+    //下压之后等IIC回复
+    int actual_read = usb_middleware_request_wait(device_id, request, response_buffer, sizeof(response_buffer),
+                                                  GPIO_SCAN_TIMEOUT_MS);
+    if (actual_read >= (int)sizeof(GENERIC_CMD_HEADER) + 1) {  // 包含协议头+状态数据
+        uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
+        Sleep(50);
+        return queue_status;
     }
 
     debug_printf("GPIO没有收到IIC响应");
@@ -186,6 +167,16 @@ WINAPI int GPIO_Read(const char* target_serial, int GPIOIndex, uint8_t* level) {
         debug_printf("设备未打开: %s", target_serial);
         return USB_ERROR_OTHER;
     }
+    return GPIO_ReadH(device_id, GPIOIndex, level);
+}
+
+WINAPI int GPIO_ReadH(usb_handle_t handle, int GPIOIndex, uint8_t* level) {
+    if (!level) {
+        debug_printf("参数无效: level=%p", level);
+        return USB_ERROR_INVALID_PARAM;
+    }
+    int device_id = handle;
+    unsigned long long start_us = usb_now_us();
 
     // 发送读取命令
     GENERIC_CMD_HEADER cmd_header;
@@ -194,19 +185,16 @@ WINAPI int GPIO_Read(const char* target_serial, int GPIOIndex, uint8_t* level) {
     cmd_header.device_index = (uint8_t)GPIOIndex;
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         return USB_ERROR_OTHER;
     }
 
     // 从数组等待电平值（中间层在解析线程写入）
     int wait_ret = usb_middleware_wait_gpio_level(device_id, GPIOIndex, level, 2000);
+    if (wait_ret == USB_SUCCESS) {
+        usb_middleware_record_latency(device_id, USB_LATENCY_GPIO_READ, start_us);
+    }
     return wait_ret;
 }
 
@@ -229,12 +217,6 @@ WINAPI int USB_device_reset(const char* target_serial) {
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     uint8_t reset_value = 1;
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &reset_value, sizeof(uint8_t), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &reset_value, sizeof(uint8_t), NULL, 0);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
 }
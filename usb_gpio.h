@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include "usb_application.h"
 
 
 
@@ -30,6 +31,11 @@ int GPIO_Read(const char* target_serial, int GPIOIndex, uint8_t* level);
 //扫描写入GPIO，需要等待IIC响应，才返回
 int GPIO_scan_Write(const char* target_serial, int GPIOIndex, uint8_t WriteValue);
 
+//句柄版本：参数和返回值同上，用USB_GetHandle获得的句柄代替序列号，省去每次调用的查找
+int GPIO_WriteH(usb_handle_t handle, int GPIOIndex, uint8_t WriteValue);
+int GPIO_ReadH(usb_handle_t handle, int GPIOIndex, uint8_t* level);
+int GPIO_scan_WriteH(usb_handle_t handle, int GPIOIndex, uint8_t WriteValue);
+
 //复位STM32
 int USB_device_reset(const char* target_serial);
 
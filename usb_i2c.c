@@ -40,14 +40,7 @@ WINAPI int IIC_Init(const char* target_serial, int i2c_index, PIIC_CONFIG config
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, (unsigned char*)config, sizeof(IIC_CONFIG), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, config, sizeof(IIC_CONFIG), NULL, 0);
     
     debug_printf("IIC初始化结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -103,18 +96,9 @@ WINAPI int IIC_WriteBytes(const char* target_serial, int i2c_index,
     cmd_header.param_count = 0;
     cmd_header.data_len = (uint16_t)write_data_size;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, (unsigned char*)write_data, write_data_size);
-    
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, write_data, write_data_size);
     free(write_data);
     
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
-    
     debug_printf("IIC写入结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
 }
\ No newline at end of file
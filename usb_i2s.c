@@ -7,6 +7,10 @@
 #include <string.h>
 
 #include "usb_log.h"
+
+#define I2S_PLAY_TIMEOUT_MS    5000   // 等待音频队列写入响应的超时
+#define I2S_STATUS_TIMEOUT_MS  1000   // 等待队列状态响应的超时
+
 int I2S_Init(const char* target_serial, int I2SIndex, PI2S_CONFIG pConfig) {
     if (!target_serial || !pConfig) {
         debug_printf("参数无效: target_serial=%p, pConfig=%p", target_serial, pConfig);
@@ -27,16 +31,7 @@ int I2S_Init(const char* target_serial, int I2SIndex, PI2S_CONFIG pConfig) {
     cmd_header.param_count = 1;                    // 参数数量：1个
     cmd_header.data_len = 0;                       // 数据部分长度为0
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   (unsigned char*)pConfig, sizeof(I2S_CONFIG), 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return I2S_ERROR_OTHER;
-    }
-
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, pConfig, sizeof(I2S_CONFIG), NULL, 0);
     if (ret < 0) {
         debug_printf("发送I2S初始化命令失败: %d", ret);
         return I2S_ERROR_IO;
@@ -57,6 +52,15 @@ int I2S_Queue_WriteBytes(const char* target_serial, int I2SIndex, unsigned char*
         debug_printf("设备未打开: %s", target_serial);
         return I2S_ERROR_OTHER;
     }
+    return I2S_Queue_WriteBytesH(device_id, I2SIndex, pWriteBuffer, WriteLen);
+}
+
+int I2S_Queue_WriteBytesH(usb_handle_t handle, int I2SIndex, unsigned char* pWriteBuffer, int WriteLen) {
+    if (!pWriteBuffer || WriteLen <= 0) {
+        debug_printf("参数无效: pWriteBuffer=%p, WriteLen=%d", pWriteBuffer, WriteLen);
+        return I2S_ERROR_INVALID_PARAM;
+    }
+    int device_id = handle;
 
     GENERIC_CMD_HEADER cmd_header;
     cmd_header.protocol_type = PROTOCOL_AUDIO;      // 音频协议
@@ -65,32 +69,25 @@ int I2S_Queue_WriteBytes(const char* target_serial, int I2SIndex, unsigned char*
     cmd_header.param_count = 0;                    // 参数数量，写操作不需要额外参数
     cmd_header.data_len = WriteLen;                // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
+
+    // 先登记再发送，应答由解析线程直接交回，不会被其他命令取走
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_STATUS, AUDIO_CMD_PLAY, (uint8_t)I2SIndex);
+    if (request < 0) {
         return I2S_ERROR_OTHER;
     }
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
+    if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
+        debug_printf("发送音频队列写入命令失败: %d", ret);
+        return I2S_ERROR_IO;
+    }
 
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
-
-
-    
-    // 使用专用状态缓冲区读取响应，支持完整协议头
     unsigned char response_buffer[16];  // 足够容纳完整状态响应
-    int max_loops = 10000000;
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_status_data(device_id, response_buffer, sizeof(response_buffer));
-        if (actual_read >= sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
-            GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)response_buffer;
-            if (header->protocol_type == PROTOCOL_STATUS && 
-                header->cmd_id == AUDIO_CMD_PLAY) {
-                uint8_t audio_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
-                return audio_status;
-            }
-        }
+    int actual_read = usb_middleware_request_wait(device_id, request, response_buffer, sizeof(response_buffer),
+                                                  I2S_PLAY_TIMEOUT_MS);
+    if (actual_read >= (int)sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
+        uint8_t audio_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
+        return audio_status;
     }
     
     debug_printf("音频队列写入失败，未收到响应");
@@ -108,6 +105,11 @@ int I2S_GetQueueStatus(const char* target_serial, int I2SIndex) {
         debug_printf("设备未打开: %s", target_serial);
         return I2S_ERROR_OTHER;
     }
+    return I2S_GetQueueStatusH(device_id, I2SIndex);
+}
+
+int I2S_GetQueueStatusH(usb_handle_t handle, int I2SIndex) {
+    int device_id = handle;
 
     // 组包协议头
     GENERIC_CMD_HEADER cmd_header;
@@ -117,34 +119,24 @@ int I2S_GetQueueStatus(const char* target_serial, int I2SIndex) {
     cmd_header.param_count = 0;                    // 无参数
     cmd_header.data_len = 0;                       // 无数据
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   NULL, 0);
-    if (total_len < 0) {
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_STATUS, AUDIO_CMD_STATUS, (uint8_t)I2SIndex);
+    if (request < 0) {
         return I2S_ERROR_OTHER;
     }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     
     if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
         debug_printf("发送I2S队列状态查询命令失败: %d", ret);
         return I2S_ERROR_IO;
     }
 
     unsigned char response_buffer[16];  
-    int max_loops = 1000000;
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_status_data(device_id, response_buffer, sizeof(response_buffer));
-        if (actual_read >= sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
-            GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)response_buffer;
-            if (header->protocol_type == PROTOCOL_STATUS && 
-                header->cmd_id == AUDIO_CMD_STATUS) {
-                uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
-                return queue_status;
-            }
-        }
+    int actual_read = usb_middleware_request_wait(device_id, request, response_buffer, sizeof(response_buffer),
+                                                  I2S_STATUS_TIMEOUT_MS);
+    if (actual_read >= (int)sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
+        uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
+        return queue_status;
     }
     
     debug_printf("音频队列状态查询失败，未收到响应");
@@ -170,16 +162,7 @@ int I2S_StartQueue(const char* target_serial, int I2SIndex) {
     cmd_header.param_count = 0;                    // 无参数
     cmd_header.data_len = 0;                       // 无数据
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return I2S_ERROR_OTHER;
-    }
-
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送I2S队列启动命令失败: %d", ret);
         return I2S_ERROR_IO;
@@ -207,16 +190,7 @@ int I2S_StopQueue(const char* target_serial, int I2SIndex) {
     cmd_header.param_count = 0;                    // 无参数
     cmd_header.data_len = 0;                       // 无数据
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return I2S_ERROR_OTHER;
-    }
-
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送I2S队列停止命令失败: %d", ret);
         return I2S_ERROR_IO;
@@ -244,16 +218,7 @@ int I2S_SetVolume(const char* target_serial, int I2SIndex, unsigned char volume)
     cmd_header.param_count = 1;                    // 参数数量：1个
     cmd_header.data_len = 0;                       // 数据部分长度为0
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   &volume, sizeof(unsigned char), 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return I2S_ERROR_OTHER;
-    }
-
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &volume, sizeof(unsigned char), NULL, 0);
     if (ret < 0) {
         debug_printf("发送I2S音量控制命令失败: %d", ret);
         return I2S_ERROR_IO;
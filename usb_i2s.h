@@ -31,6 +31,11 @@ WINAPI int I2S_Queue_WriteBytes(const char* target_serial, int I2SIndex, unsigne
 
 WINAPI int I2S_GetQueueStatus(const char* target_serial, int I2SIndex);
 
+// 句柄版本：参数和返回值同上，用USB_GetHandle获得的句柄代替序列号，省去每次调用的查找
+WINAPI int I2S_Queue_WriteBytesH(usb_handle_t handle, int I2SIndex, unsigned char* pWriteBuffer, int WriteLen);
+
+WINAPI int I2S_GetQueueStatusH(usb_handle_t handle, int I2SIndex);
+
 WINAPI int I2S_StartQueue(const char* target_serial, int I2SIndex);
 
 WINAPI int I2S_StopQueue(const char* target_serial, int I2SIndex);
@@ -1,59 +1,301 @@
-
-
 #include "usb_log.h"
+#include "usb_clock.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define LOG_FILE_NAME    "usb_debug.log"
+#define LOG_QUEUE_SIZE   1024    // 队列条数(2的幂)，约256KB
+#define LOG_TEXT_SIZE    232     // 单条消息正文上限，超出截断
+#define LOG_IDLE_WAIT_MS 200     // 写入线程空闲时的最长睡眠
+
+// 有界多生产者队列的一格：seq==pos表示可写，seq==pos+1表示已写好待取
+typedef struct {
+    unsigned int seq;
+    int level;
+    unsigned int thread_id;
+    unsigned long long time_us;      // 1970年起的微秒数
+    char text[LOG_TEXT_SIZE];
+} log_entry_t;
+
+int g_usb_log_level = USB_DEBUG_ENABLE == 0 ? USB_LOG_DEBUG : USB_LOG_OFF; // 默认禁用日志
 
+static log_entry_t g_log_queue[LOG_QUEUE_SIZE];
+static unsigned int g_log_enqueue_pos = 0;
+static unsigned int g_log_dequeue_pos = 0;      // 只由写入线程使用
+static unsigned long long g_log_dropped = 0;
 
-static int g_log_enabled = 0; // 默认禁用日志
+// 启停只在g_log_control自旋锁内进行
+static int g_log_control = 0;
+static int g_log_queue_ready = 0;
+static int g_log_running = 0;
+static int g_log_thread_stop = 0;
+static HANDLE g_log_thread = NULL;
+static FILE* g_log_file = NULL;
+static CRITICAL_SECTION g_log_wake_lock;
+static CONDITION_VARIABLE g_log_wake_cond;
+static int g_log_writer_idle = 0;
+
+static const char* const g_log_level_names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+
+static unsigned int log_thread_id(void) {
+#ifdef _WIN32
+    return (unsigned int)GetCurrentThreadId();
+#elif defined(SYS_gettid)
+    return (unsigned int)syscall(SYS_gettid);
+#else
+    return (unsigned int)(size_t)pthread_self();
+#endif
+}
+
+static void log_control_lock(void) {
+    while (__atomic_exchange_n(&g_log_control, 1, __ATOMIC_ACQUIRE)) {
+        Sleep(0);
+    }
+}
+
+static void log_control_unlock(void) {
+    __atomic_store_n(&g_log_control, 0, __ATOMIC_RELEASE);
+}
+
+static void log_write_entry(const log_entry_t* entry) {
+    static time_t last_sec = (time_t)-1;
+    static char time_str[24];
+    time_t sec = (time_t)(entry->time_us / 1000000ULL);
+    if (sec != last_sec) {
+        struct tm* tm_info = localtime(&sec);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
+        last_sec = sec;
+    }
+    int level = entry->level < USB_LOG_TRACE || entry->level > USB_LOG_ERROR ? USB_LOG_DEBUG : entry->level;
+    fprintf(g_log_file, "[%s.%06u] [%s] [%u] %s\n", time_str, (unsigned int)(entry->time_us % 1000000ULL),
+            g_log_level_names[level], entry->thread_id, entry->text);
+}
+
+// 写出队列中所有已就绪的消息，返回写出的条数
+static int log_drain(void) {
+    int count = 0;
+    for (;;) {
+        log_entry_t* entry = &g_log_queue[g_log_dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+        unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (seq != g_log_dequeue_pos + 1) {
+            break;
+        }
+        if (g_log_file) {
+            log_write_entry(entry);
+        }
+        __atomic_store_n(&entry->seq, g_log_dequeue_pos + LOG_QUEUE_SIZE, __ATOMIC_RELEASE);
+        g_log_dequeue_pos++;
+        count++;
+    }
+    return count;
+}
+
+static int log_queue_empty(void) {
+    const log_entry_t* entry = &g_log_queue[g_log_dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+    return __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != g_log_dequeue_pos + 1;
+}
+
+static DWORD WINAPI log_writer_thread_func(LPVOID lpParameter) {
+    (void)lpParameter;
+    unsigned long long reported_drops = __atomic_load_n(&g_log_dropped, __ATOMIC_RELAXED);
+    for (;;) {
+        int stop = __atomic_load_n(&g_log_thread_stop, __ATOMIC_ACQUIRE);
+        int written = log_drain();
+        unsigned long long drops = __atomic_load_n(&g_log_dropped, __ATOMIC_RELAXED);
+        if (drops != reported_drops && g_log_file) {
+            log_entry_t note;
+            memset(&note, 0, sizeof(note));
+            note.level = USB_LOG_WARN;
+            note.thread_id = log_thread_id();
+            note.time_us = usb_wall_time_us();
+            snprintf(note.text, sizeof(note.text), "日志队列已满，丢弃%llu条消息", drops - reported_drops);
+            log_write_entry(&note);
+            reported_drops = drops;
+            written++;
+        }
+        if (written > 0 && g_log_file) {
+            fflush(g_log_file);
+        }
+        if (stop) {
+            break;
+        }
+        if (written > 0) {
+            continue;
+        }
+        // 与生产者"先发布再检查g_log_writer_idle"配对，保证不会漏掉唤醒
+        EnterCriticalSection(&g_log_wake_lock);
+        __atomic_store_n(&g_log_writer_idle, 1, __ATOMIC_SEQ_CST);
+        if (log_queue_empty() && !__atomic_load_n(&g_log_thread_stop, __ATOMIC_ACQUIRE)) {
+            SleepConditionVariableCS(&g_log_wake_cond, &g_log_wake_lock, LOG_IDLE_WAIT_MS);
+        }
+        __atomic_store_n(&g_log_writer_idle, 0, __ATOMIC_RELAXED);
+        LeaveCriticalSection(&g_log_wake_lock);
+    }
+    return 0;
+}
+
+static void log_wake_writer(void) {
+    EnterCriticalSection(&g_log_wake_lock);
+    WakeConditionVariable(&g_log_wake_cond);
+    LeaveCriticalSection(&g_log_wake_lock);
+}
+
+// 打开文件并启动写入线程，调用方持有g_log_control
+static void log_start_locked(void) {
+    if (g_log_running) {
+        return;
+    }
+    if (!g_log_queue_ready) {
+        for (unsigned int i = 0; i < LOG_QUEUE_SIZE; i++) {
+            g_log_queue[i].seq = i;
+        }
+        InitializeCriticalSection(&g_log_wake_lock);
+        InitializeConditionVariable(&g_log_wake_cond);
+        g_log_queue_ready = 1;
+    }
+    if (!g_log_file) {
+        g_log_file = fopen(LOG_FILE_NAME, "a");
+    }
+    g_log_thread_stop = 0;
+    g_log_thread = CreateThread(NULL, 0, log_writer_thread_func, NULL, 0, NULL);
+    __atomic_store_n(&g_log_running, g_log_thread != NULL, __ATOMIC_RELEASE);
+}
+
+static void log_stop_locked(void) {
+    if (g_log_running) {
+        __atomic_store_n(&g_log_thread_stop, 1, __ATOMIC_RELEASE);
+        log_wake_writer();
+        WaitForSingleObject(g_log_thread, INFINITE);
+        CloseHandle(g_log_thread);
+        g_log_thread = NULL;
+        __atomic_store_n(&g_log_running, 0, __ATOMIC_RELEASE);
+    }
+    if (g_log_file) {
+        fclose(g_log_file);
+        g_log_file = NULL;
+    }
+}
+
+static void log_vwrite(int level, const char* format, va_list args) {
+    if (!__atomic_load_n(&g_log_running, __ATOMIC_ACQUIRE)) {
+        log_control_lock();
+        log_start_locked();
+        log_control_unlock();
+        if (!g_log_running) {
+            return;
+        }
+    }
+
+    unsigned int pos = __atomic_load_n(&g_log_enqueue_pos, __ATOMIC_RELAXED);
+    log_entry_t* entry;
+    for (;;) {
+        entry = &g_log_queue[pos & (LOG_QUEUE_SIZE - 1)];
+        unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&g_log_enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // 队列满：丢弃新消息，由写入线程补记丢弃条数
+            __atomic_fetch_add(&g_log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&g_log_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    entry->level = level;
+    entry->thread_id = log_thread_id();
+    entry->time_us = usb_wall_time_us();
+    vsnprintf(entry->text, sizeof(entry->text), format, args);
+    __atomic_store_n(&entry->seq, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_log_writer_idle, __ATOMIC_RELAXED)) {
+        log_wake_writer();
+    }
+}
+
+void usb_log_write(int level, const char* format, ...) {
+    if (!usb_log_enabled(level)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    log_vwrite(level, format, args);
+    va_end(args);
+}
+
+void (debug_printf)(const char* format, ...) {
+    if (!usb_log_enabled(USB_LOG_DEBUG)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    log_vwrite(USB_LOG_DEBUG, format, args);
+    va_end(args);
+}
+
+void usb_log_set_level(int level) {
+    if (level < USB_LOG_TRACE) {
+        level = USB_LOG_TRACE;
+    }
+    if (level > USB_LOG_OFF) {
+        level = USB_LOG_OFF;
+    }
+    log_control_lock();
+    if (level < USB_LOG_OFF) {
+        log_start_locked();
+    }
+    __atomic_store_n(&g_usb_log_level, level, __ATOMIC_RELAXED);
+    log_control_unlock();
+}
+
+int usb_log_get_level(void) {
+    return __atomic_load_n(&g_usb_log_level, __ATOMIC_RELAXED);
+}
 
  //1=开启日志，0=关闭日志
 void USB_SetLog(int enable) {
-    g_log_enabled = enable ? 1 : 0;
     if (enable) {
-        FILE* fp = fopen("usb_debug.log", "a");
-        if (fp) {
-            time_t now = time(NULL);
-            struct tm* tm_info = localtime(&now);
-            char time_str[26];
-            strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-            
-            fprintf(fp, "[%s] USB日志已启用\n", time_str);
-            fclose(fp);
-        }
-    } else {
-        if (g_log_enabled) {  
-            FILE* fp = fopen("usb_debug.log", "a");
-            if (fp) {
-                time_t now = time(NULL);
-                struct tm* tm_info = localtime(&now);
-                char time_str[26];
-                strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-                
-                fprintf(fp, "[%s] USB日志即将禁用\n", time_str);
-                fclose(fp);
-            }
-        }
+        usb_log_set_level(USB_LOG_DEBUG);
+        usb_log_write(USB_LOG_INFO, "USB日志已启用");
+    } else if (USB_DEBUG_ENABLE != 0 && usb_log_get_level() < USB_LOG_OFF) {
+        usb_log_write(USB_LOG_INFO, "USB日志即将禁用");
+        usb_log_set_level(USB_LOG_OFF);
+        // 写完已排队的消息后关闭文件，之后再开启时重新打开
+        log_control_lock();
+        log_stop_locked();
+        log_control_unlock();
     }
 }
 
+unsigned long long usb_log_dropped(void) {
+    return __atomic_load_n(&g_log_dropped, __ATOMIC_RELAXED);
+}
 
-void debug_printf(const char* format, ...) {
-    if (USB_DEBUG_ENABLE == 0 || g_log_enabled) {
-        FILE* fp = fopen("usb_debug.log", "a");
-        if (fp) {
-            time_t now = time(NULL);
-            struct tm* tm_info = localtime(&now);
-            char time_str[26];
-            strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-            fprintf(fp, "[%s] ", time_str);
-            va_list args;
-            va_start(args, format);
-            vfprintf(fp, format, args);
-            fprintf(fp, "\n");
-            va_end(args);
-            fclose(fp);
-        }
+void usb_log_shutdown(void) {
+    log_control_lock();
+    log_stop_locked();
+    log_control_unlock();
+}
+
+// 卸载时持有加载器锁，不能等写入线程退出：只通知它写完剩余消息后自行结束，文件留给进程退出时关闭
+void usb_log_detach(void) {
+    if (!__atomic_load_n(&g_log_running, __ATOMIC_ACQUIRE)) {
+        return;
     }
+    __atomic_store_n(&g_log_thread_stop, 1, __ATOMIC_RELEASE);
+    log_wake_writer();
 }
@@ -1,6 +1,8 @@
 /**
  * @file usb_log.h
  * @brief USB日志系统接口
+ * 调用线程只把格式化好的消息放进有界无锁队列，由后台线程写入usb_debug.log(文件句柄常开)。
+ * 队列满时丢弃新消息并计数；低于当前级别的消息在格式化之前就返回。
  */
 
 #ifndef USB_LOG_H
@@ -17,8 +19,57 @@ extern "C" {
 // 调试开关，0=开启日志，1=关闭日志
 #define USB_DEBUG_ENABLE 1
 
+// 日志级别
+#define USB_LOG_TRACE   0    // 逐包跟踪
+#define USB_LOG_DEBUG   1    // 调试(debug_printf)
+#define USB_LOG_INFO    2
+#define USB_LOG_WARN    3
+#define USB_LOG_ERROR   4
+#define USB_LOG_OFF     5
+
+// 编译期最低级别，由构建脚本用-DUSB_LOG_MIN_LEVEL=n指定；低于它的LOG_xxx调用整体编译掉
+#ifndef USB_LOG_MIN_LEVEL
+#define USB_LOG_MIN_LEVEL USB_LOG_TRACE
+#endif
+
+// 当前最低输出级别，只用于下面的快速判断，修改请调用usb_log_set_level
+extern int g_usb_log_level;
+
+static inline int usb_log_enabled(int level) {
+    return level >= __atomic_load_n(&g_usb_log_level, __ATOMIC_RELAXED);
+}
+
+//1=开启日志(DEBUG级别)，0=关闭日志
 void USB_SetLog(int enable);
+void usb_log_set_level(int level);
+int usb_log_get_level(void);
+void usb_log_write(int level, const char* format, ...);
+// 等同于usb_log_write(USB_LOG_DEBUG, ...)
 void debug_printf(const char* format, ...);
+// 队列满而丢弃的消息数
+unsigned long long usb_log_dropped(void);
+// 写完队列中剩余的消息，停止后台线程并关闭文件
+void usb_log_shutdown(void);
+// 只通知写入线程退出，不等待也不关闭文件，供DllMain/析构函数使用
+void usb_log_detach(void);
+
+// 带级别的日志宏：级别低于USB_LOG_MIN_LEVEL时条件为常量假，参数不求值也不产生调用；
+// 否则先内联判断运行期级别，再调用usb_log_write
+#define USB_LOG_AT(level, ...) \
+    do { \
+        if ((level) >= USB_LOG_MIN_LEVEL && usb_log_enabled(level)) { \
+            usb_log_write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_TRACE(...) USB_LOG_AT(USB_LOG_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) USB_LOG_AT(USB_LOG_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  USB_LOG_AT(USB_LOG_INFO, __VA_ARGS__)
+#define LOG_WARN(...)  USB_LOG_AT(USB_LOG_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) USB_LOG_AT(USB_LOG_ERROR, __VA_ARGS__)
+
+// 已有的debug_printf调用同样按DEBUG级别内联判断
+#define debug_printf(...) LOG_DEBUG(__VA_ARGS__)
 
 #ifdef __cplusplus
 }
@@ -2,9 +2,12 @@
 #include "usb_device.h"
 #include "usb_log.h"
 #include "usb_protocol.h"
+#include "usb_capture.h"
+#include "usb_clock.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -12,19 +15,79 @@
 #endif
 #include <time.h>
 #include "usb_log.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define MAX_DEVICES 10
-#define SPI_BUFFER_SIZE (10 * 1024 * 1024)    // SPI专用缓冲区
+#define SPI_BUFFER_SIZE (16 * 1024 * 1024)    // SPI专用缓冲区(环形缓冲区容量须为2的幂)
 #define POWER_BUFFER_SIZE (512 * 1024)       // 电源数据缓冲区 
 #define PWM_BUFFER_SIZE (4 * 1024)           // PWM专用缓冲区
 #define UART_BUFFER_SIZE (64 * 1024)         // UART专用缓冲区
 #define RAW_BUFFER_SIZE (512 * 1024)         //  原始数据临时缓冲区
 #define STATUS_BUFFER_SIZE (16 * 1024)       // 状态响应缓冲区
 
+// 设备统计计数，各线程直接原子累加
+#define STAT_ADD(device, field, n) \
+    __atomic_fetch_add(&(device)->stats.field, (unsigned long long)(n), __ATOMIC_RELAXED)
+
 static device_handle_t g_devices[MAX_DEVICES];
 static int g_device_count = 0;
-static int g_next_device_id = 0;
 static int g_initialized = 0;
+static int g_read_mode = USB_READ_MODE_SYNC;
+static int g_spi_mirror_enabled = 1;
+static int g_async_transfer_count = USB_ASYNC_DEFAULT_TRANSFERS;
+static int g_async_transfer_size = USB_ASYNC_DEFAULT_TRANSFER_SIZE;
+
+// 命令合并：自动窗口到期由g_batch_thread发送，设备扫描与唤醒都在g_batch_lock内
+static int g_batch_window_ms = 0;
+static int g_batch_max_bytes = USB_BATCH_DEFAULT_BYTES;
+static CRITICAL_SECTION g_batch_lock;
+static CONDITION_VARIABLE g_batch_cond;
+static HANDLE g_batch_thread = NULL;
+static int g_batch_thread_stop = 0;
+
+// device_id = 代数 * MAX_DEVICES + 槽位，按id直接定位槽位；槽位每关闭一次代数加1，旧id随之失效
+static unsigned int g_slot_generation[MAX_DEVICES];
+// 各槽位正在执行的接口调用数，关闭设备等它归零后才释放槽位里的资源；不放在device_handle_t里，关闭时清零槽位不影响它
+static int g_device_refs[MAX_DEVICES];
+// 序列号散列索引(开放寻址，值为槽位+1，0为空)。打开/关闭在g_device_lock内重建，
+// 查找不加锁：g_serial_index_seq为奇数表示正在重建，前后不一致则重试
+#define SERIAL_INDEX_SIZE 32
+static unsigned char g_serial_index[SERIAL_INDEX_SIZE];
+static unsigned int g_serial_index_seq = 0;
+static CRITICAL_SECTION g_device_lock;
+
+// USB_READ_MODE_SHARED：第一个设备打开时启动事件线程，最后一个关闭时停止
+static CRITICAL_SECTION g_event_lock;
+static HANDLE g_event_thread = NULL;
+static int g_event_thread_stop = 0;
+static int g_event_users = 0;
+
+// 异步读取时每个挂起的IN传输
+typedef struct {
+    device_handle_t* device;
+    usb_transfer_t* transfer;
+    unsigned char* buffer;
+    int done;                  // 已完成，等待按顺序交给解析器
+} rx_urb_t;
+
+// 大块写入时每个挂起的OUT传输
+typedef struct {
+    usb_transfer_t* transfer;
+    unsigned char* stage;      // 组包区：帧头、帧尾和不足整包的数据在这里拼接
+    int length;
+    int done;                  // 回调中置1
+} tx_urb_t;
+
+// 一次大块写入的发送状态：异步时按提交顺序环形使用tx_urb_t，urbs为NULL时逐段同步发送
+typedef struct {
+    device_handle_t* device;
+    tx_urb_t* urbs;
+    int next;                  // 下一个提交的传输
+    int in_flight;
+    int error;
+} tx_pipe_t;
 
 #define RX_CACHE_INITIAL_CAPACITY (64 * 1024)
 #define RX_CACHE_MAX_CAPACITY (1024 * 1024)
@@ -66,6 +129,30 @@ static int is_valid_protocol_header(const GENERIC_CMD_HEADER* header) {
     return 1;
 }
 
+// 在data中查找第一个protocol_type落在合法范围内的字节，返回其偏移；找不到返回len
+static unsigned int find_header_candidate(const unsigned char* data, unsigned int len) {
+    unsigned int i = 0;
+#if defined(__SSE2__)
+    // 有符号比较: (PROTOCOL_SPI-1) < b < (PROTOCOL_PWM+1)，0x80以上的字节为负数，自然被排除
+    const __m128i lower = _mm_set1_epi8((char)(PROTOCOL_SPI - 1));
+    const __m128i upper = _mm_set1_epi8((char)(PROTOCOL_PWM + 1));
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hit = _mm_and_si128(_mm_cmpgt_epi8(v, lower), _mm_cmplt_epi8(v, upper));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return i + (unsigned int)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (data[i] >= PROTOCOL_SPI && data[i] <= PROTOCOL_PWM) {
+            return i;
+        }
+    }
+    return len;
+}
+
 static DWORD WINAPI usb_device_read_thread_func(LPVOID lpParameter) {
     device_handle_t* device = (device_handle_t*)lpParameter;
     unsigned char temp_buffer[8192];  // 增加缓冲区大小以适应大数据包
@@ -77,8 +164,14 @@ static DWORD WINAPI usb_device_read_thread_func(LPVOID lpParameter) {
         } else if (ret == -7) {
             // debug_printf("读取超时");
             // Sleep(1);
-        } else {
+            // libusb超时时actual_length仍是已收到的字节数，不能丢弃
+            if (actual_length > 0) {
+                parse_and_dispatch_protocol_data(device, temp_buffer, actual_length);
+            }
+            STAT_ADD(device, rx_timeouts, 1);
+        } else if (ret != 0) {
             debug_printf("读取错误: %d", ret);
+            STAT_ADD(device, rx_errors, 1);
             Sleep(100);
         }
     }
@@ -86,707 +179,2625 @@ static DWORD WINAPI usb_device_read_thread_func(LPVOID lpParameter) {
     return 0;
 }
 
-void parse_and_dispatch_protocol_data(device_handle_t* device, unsigned char* raw_data, int length) {
-    if (!device || !raw_data || length <= 0) {
-        return;
-    }
+static void USB_LIBUSB_CALL rx_urb_callback(usb_transfer_t* transfer);
 
-    if (device->rx_cache_size > RX_CACHE_MAX_CAPACITY) {
-        device->rx_cache_size = 0;
+static int rx_urb_submit(device_handle_t* device, rx_urb_t* urb) {
+    usb_device_fill_bulk_transfer(urb->transfer, device->libusb_handle, 0x81, urb->buffer,
+                                  device->rx_urb_size, rx_urb_callback, urb, 1000);
+    int ret = usb_device_submit_transfer(urb->transfer);
+    if (ret != 0) {
+        debug_printf("提交异步读取失败: %d", ret);
+        return ret;
+    }
+    __atomic_add_fetch(&device->rx_urbs_in_flight, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// 在libusb事件处理线程中调用；传输按提交顺序完成，这里也严格按顺序交给解析器
+static void USB_LIBUSB_CALL rx_urb_callback(usb_transfer_t* transfer) {
+    rx_urb_t* urb = (rx_urb_t*)transfer->user_data;
+    device_handle_t* device = urb->device;
+    rx_urb_t* urbs = (rx_urb_t*)device->rx_urbs;
+
+    int returned = 0;
+    urb->done = 1;
+    while (urbs[device->rx_urb_next].done) {
+        rx_urb_t* cur = &urbs[device->rx_urb_next];
+        usb_transfer_t* t = cur->transfer;
+        cur->done = 0;
+        if (t->status == LIBUSB_TRANSFER_COMPLETED) {
+            if (t->actual_length > 0) {
+                parse_and_dispatch_protocol_data(device, cur->buffer, t->actual_length);
+            }
+        } else if (t->status == LIBUSB_TRANSFER_TIMED_OUT) {
+            // 超时前已收到的部分数据与同步读取一样交给解析器
+            if (t->actual_length > 0) {
+                parse_and_dispatch_protocol_data(device, cur->buffer, t->actual_length);
+            }
+            STAT_ADD(device, rx_timeouts, 1);
+        } else if (t->status != LIBUSB_TRANSFER_CANCELLED) {
+            debug_printf("异步读取错误: status=%d", t->status);
+            STAT_ADD(device, rx_errors, 1);
+            device->rx_pipeline_error = 1;
+        }
+        int resubmit = !device->stop_thread && !device->rx_pipeline_error &&
+                       t->status != LIBUSB_TRANSFER_CANCELLED && t->status != LIBUSB_TRANSFER_NO_DEVICE;
+        device->rx_urb_next = (device->rx_urb_next + 1) % device->rx_urb_count;
+        // 先重提交再减计数，避免关闭流程误判为已全部返回
+        if (resubmit && rx_urb_submit(device, cur) != 0) {
+            device->rx_pipeline_error = 1;
+        }
+        returned++;
+    }
+    // 减计数必须是最后一次访问device：计数归零后关闭流程随时可能释放传输数组
+    if (returned > 0) {
+        __atomic_sub_fetch(&device->rx_urbs_in_flight, returned, __ATOMIC_SEQ_CST);
     }
+}
 
-    if (ensure_rx_cache_capacity(device, device->rx_cache_size + (unsigned int)length) != USB_SUCCESS) {
-        device->rx_cache_size = 0;
+static void rx_urbs_free(device_handle_t* device) {
+    rx_urb_t* urbs = (rx_urb_t*)device->rx_urbs;
+    if (!urbs) {
         return;
     }
+    for (int i = 0; i < device->rx_urb_count; i++) {
+        usb_device_free_transfer(urbs[i].transfer);
+        free(urbs[i].buffer);
+    }
+    free(urbs);
+    device->rx_urbs = NULL;
+    device->rx_urb_count = 0;
+}
 
-    memcpy(device->rx_cache + device->rx_cache_size, raw_data, (size_t)length);
-    device->rx_cache_size += (unsigned int)length;
-
-    while (device->rx_cache_size >= sizeof(GENERIC_CMD_HEADER)) {
-        GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)device->rx_cache;
-        if (!is_valid_protocol_header(header)) {
-            memmove(device->rx_cache, device->rx_cache + 1, device->rx_cache_size - 1);
-            device->rx_cache_size -= 1;
-            continue;
-        }
-
-        unsigned int packet_size = (unsigned int)sizeof(GENERIC_CMD_HEADER) + (unsigned int)header->data_len;
-        if (packet_size < sizeof(GENERIC_CMD_HEADER)) {
-            memmove(device->rx_cache, device->rx_cache + 1, device->rx_cache_size - 1);
-            device->rx_cache_size -= 1;
-            continue;
+static int rx_urbs_alloc(device_handle_t* device, int count, int size) {
+    rx_urb_t* urbs = (rx_urb_t*)calloc((size_t)count, sizeof(rx_urb_t));
+    if (!urbs) {
+        return USB_ERROR_OTHER;
+    }
+    device->rx_urbs = urbs;
+    device->rx_urb_count = count;
+    device->rx_urb_size = size;
+    device->rx_urb_next = 0;
+    device->rx_urbs_in_flight = 0;
+    device->rx_pipeline_error = 0;
+    for (int i = 0; i < count; i++) {
+        urbs[i].device = device;
+        urbs[i].transfer = usb_device_alloc_transfer(0);
+        urbs[i].buffer = (unsigned char*)malloc((size_t)size);
+        if (!urbs[i].transfer || !urbs[i].buffer) {
+            rx_urbs_free(device);
+            return USB_ERROR_OTHER;
         }
+    }
+    return USB_SUCCESS;
+}
 
-        if (device->rx_cache_size < packet_size) {
+// 从rx_urb_next开始按顺序提交全部传输
+static void rx_urbs_submit_all(device_handle_t* device) {
+    rx_urb_t* urbs = (rx_urb_t*)device->rx_urbs;
+    for (int i = 0; i < device->rx_urb_count; i++) {
+        rx_urb_t* urb = &urbs[(device->rx_urb_next + i) % device->rx_urb_count];
+        if (rx_urb_submit(device, urb) != 0) {
+            device->rx_pipeline_error = 1;
             break;
         }
+    }
+}
 
-        unsigned char* packet_base = device->rx_cache;
-
-        if (header->protocol_type == PROTOCOL_SPI) {
-            unsigned char* spi_data = packet_base + sizeof(GENERIC_CMD_HEADER);
-            int spi_data_len = header->data_len;
-            EnterCriticalSection(&device->protocol_buffers[PROTOCOL_SPI].cs);
-            write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_SPI], spi_data, spi_data_len);
-            LeaveCriticalSection(&device->protocol_buffers[PROTOCOL_SPI].cs);
-        } else if (header->protocol_type == PROTOCOL_STATUS) {
-            unsigned char* status_data = packet_base;
-            int status_data_len = (int)packet_size;
-
-            debug_printf("收到状态响应: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
-                        header->protocol_type, header->cmd_id, header->device_index, status_data_len);
-
-            EnterCriticalSection(&device->protocol_buffers[PROTOCOL_STATUS].cs);
-            write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_STATUS], status_data, status_data_len);
-            LeaveCriticalSection(&device->protocol_buffers[PROTOCOL_STATUS].cs);
-        } else if (header->protocol_type == PROTOCOL_PWM) {
-            unsigned char* pwm_data = packet_base;
-            int pwm_data_len = (int)packet_size;
-
-            debug_printf("收到PWM响应: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
-                        header->protocol_type, header->cmd_id, header->device_index, pwm_data_len);
-
-            EnterCriticalSection(&device->protocol_buffers[PROTOCOL_PWM].cs);
-            write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_PWM], pwm_data, pwm_data_len);
-            LeaveCriticalSection(&device->protocol_buffers[PROTOCOL_PWM].cs);
-        } else if (header->protocol_type == PROTOCOL_UART) {
-            unsigned char* uart_data = packet_base + sizeof(GENERIC_CMD_HEADER);
-            int uart_data_len = header->data_len;
-
-            debug_printf("收到UART数据: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
-                        header->protocol_type, header->cmd_id, header->device_index, uart_data_len);
-
-            EnterCriticalSection(&device->protocol_buffers[PROTOCOL_UART].cs);
-            write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_UART], uart_data, uart_data_len);
-            LeaveCriticalSection(&device->protocol_buffers[PROTOCOL_UART].cs);
-
-            debug_printf("分发UART数据: %d字节, cmd_id=%d, device_index=%d", uart_data_len, header->cmd_id, header->device_index);
-        } else if (header->protocol_type == PROTOCOL_GPIO) {
-            if (header->cmd_id == GPIO_DIR_READ && header->data_len >= 1) {
-                unsigned char level = *(packet_base + sizeof(GENERIC_CMD_HEADER));
-                unsigned int idx = header->device_index;
-                if (idx < 256) {
-                    device->gpio_level[idx] = level;
-                    device->gpio_level_valid[idx] = 1;
-                }
-            }
-        } else if (header->protocol_type == PROTOCOL_GET_FIRMWARE_INFO) {
-            unsigned char* firmware_data = packet_base;
-            int firmware_data_len = (int)packet_size;
-
-            debug_printf("收到固件信息响应: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
-                        header->protocol_type, header->cmd_id, header->device_index, firmware_data_len);
-
-            EnterCriticalSection(&device->raw_buffer.cs);
-            write_to_ring_buffer(&device->raw_buffer, firmware_data, firmware_data_len);
-            LeaveCriticalSection(&device->raw_buffer.cs);
+static DWORD WINAPI usb_device_async_read_thread_func(LPVOID lpParameter) {
+    device_handle_t* device = (device_handle_t*)lpParameter;
+    rx_urbs_submit_all(device);
+    while (!device->stop_thread) {
+        usb_device_handle_events_timeout(NULL, 100, NULL);
+        if (device->rx_pipeline_error && __atomic_load_n(&device->rx_urbs_in_flight, __ATOMIC_SEQ_CST) == 0) {
+            Sleep(100);
+            device->rx_pipeline_error = 0;
+            rx_urbs_submit_all(device);
+        }
+    }
 
-            debug_printf("分发固件信息数据: %d字节, cmd_id=%d, device_index=%d", firmware_data_len, header->cmd_id, header->device_index);
-        } else if (header->protocol_type == PROTOCOL_CURRENT) {
-            unsigned char* current_data = packet_base + sizeof(GENERIC_CMD_HEADER);
-            int current_data_len = header->data_len;
+    rx_urb_t* urbs = (rx_urb_t*)device->rx_urbs;
+    for (int i = 0; i < device->rx_urb_count; i++) {
+        usb_device_cancel_transfer(urbs[i].transfer);
+    }
+    // 取消的传输总会返回；在途的传输归libusb所有，全部返回前不能释放
+    while (__atomic_load_n(&device->rx_urbs_in_flight, __ATOMIC_SEQ_CST) > 0) {
+        usb_device_handle_events_timeout(NULL, 100, NULL);
+    }
+    return 0;
+}
 
-            debug_printf("收到电流数据: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
-                        header->protocol_type, header->cmd_id, header->device_index, current_data_len);
+static unsigned long long monotonic_ms(void);
 
-            EnterCriticalSection(&device->protocol_buffers[PROTOCOL_POWER].cs);
-            int before_size = device->protocol_buffers[PROTOCOL_POWER].data_size;
-            write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_POWER], current_data, current_data_len);
-            int after_size = device->protocol_buffers[PROTOCOL_POWER].data_size;
-            LeaveCriticalSection(&device->protocol_buffers[PROTOCOL_POWER].cs);
+// 一个线程处理所有设备的libusb事件，并负责出错设备的重新提交
+static DWORD WINAPI event_loop_thread_func(LPVOID lpParameter) {
+    (void)lpParameter;
+    while (!__atomic_load_n(&g_event_thread_stop, __ATOMIC_ACQUIRE)) {
+        usb_device_handle_events_timeout(NULL, 100, NULL);
 
-            debug_printf("分发电流数据: %d字节, cmd_id=%d, device_index=%d, 缓冲区: %d->%d", 
-                        current_data_len, header->cmd_id, header->device_index, before_size, after_size);
-        } else {
-            debug_printf("收到非SPI协议数据: protocol_type=%d, cmd_id=%d", header->protocol_type, header->cmd_id);
+        unsigned long long now = monotonic_ms();
+        EnterCriticalSection(&g_event_lock);
+        for (int i = 0; i < MAX_DEVICES; i++) {
+            device_handle_t* device = &g_devices[i];
+            if (!device->rx_event_attached || !device->rx_pipeline_error ||
+                __atomic_load_n(&device->rx_urbs_in_flight, __ATOMIC_SEQ_CST) > 0) {
+                continue;
+            }
+            if (!device->rx_retry_at) {
+                device->rx_retry_at = now + 100;
+            } else if (now >= device->rx_retry_at) {
+                device->rx_retry_at = 0;
+                device->rx_pipeline_error = 0;
+                rx_urbs_submit_all(device);
+            }
         }
+        LeaveCriticalSection(&g_event_lock);
+    }
+    return 0;
+}
 
-        if (device->rx_cache_size == packet_size) {
-            device->rx_cache_size = 0;
-            break;
+static int event_loop_attach(device_handle_t* device) {
+    EnterCriticalSection(&g_event_lock);
+    if (!g_event_thread) {
+        g_event_thread_stop = 0;
+        g_event_thread = CreateThread(NULL, 0, event_loop_thread_func, NULL, 0, NULL);
+        if (!g_event_thread) {
+            LeaveCriticalSection(&g_event_lock);
+            return USB_ERROR_OTHER;
         }
-        memmove(device->rx_cache, device->rx_cache + packet_size, device->rx_cache_size - packet_size);
-        device->rx_cache_size -= packet_size;
+        debug_printf("共用事件线程已启动");
     }
+    g_event_users++;
+    device->rx_retry_at = 0;
+    device->rx_event_attached = 1;
+    LeaveCriticalSection(&g_event_lock);
+    rx_urbs_submit_all(device);
+    return USB_SUCCESS;
 }
 
-void write_to_ring_buffer(ring_buffer_t* rb, unsigned char* data, int length) {
-    if (rb->data_size + length > rb->size) {
-        int discard = (rb->data_size + length) - rb->size;
-        rb->read_pos = (rb->read_pos + discard) % rb->size;
-        rb->data_size -= discard;
+// 取消设备的全部传输并等事件线程把它们交还；不再有设备使用时停止事件线程
+static void event_loop_detach(device_handle_t* device) {
+    EnterCriticalSection(&g_event_lock);
+    device->stop_thread = TRUE;
+    device->rx_event_attached = 0;
+    LeaveCriticalSection(&g_event_lock);
+
+    rx_urb_t* urbs = (rx_urb_t*)device->rx_urbs;
+    for (int i = 0; i < device->rx_urb_count; i++) {
+        usb_device_cancel_transfer(urbs[i].transfer);
     }
-    if (rb->write_pos + length <= rb->size) {
-        memcpy(rb->buffer + rb->write_pos, data, length);
-    } else {
-        int first_part = rb->size - rb->write_pos;
-        memcpy(rb->buffer + rb->write_pos, data, first_part);
-        memcpy(rb->buffer, data + first_part, length - first_part);
+    while (__atomic_load_n(&device->rx_urbs_in_flight, __ATOMIC_SEQ_CST) > 0) {
+        Sleep(1);
+    }
+
+    HANDLE thread = NULL;
+    EnterCriticalSection(&g_event_lock);
+    if (--g_event_users == 0) {
+        __atomic_store_n(&g_event_thread_stop, 1, __ATOMIC_RELEASE);
+        thread = g_event_thread;
+        g_event_thread = NULL;
+    }
+    LeaveCriticalSection(&g_event_lock);
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        debug_printf("共用事件线程已停止");
     }
-    rb->write_pos = (rb->write_pos + length) % rb->size;
-    rb->data_size += length;
 }
 
-int usb_middleware_init(void) {
-    if (g_initialized) {
-        return USB_SUCCESS;
+static int find_slot_by_device_id(int device_id) {
+    if (device_id < 0) {
+        return -1;
     }
-    
-    memset(g_devices, 0, sizeof(g_devices));
-    g_device_count = 0;
-    g_next_device_id = 0;
-    
-    int ret = usb_device_init();
-    if (ret < 0) {
-        debug_printf("USB设备层初始化失败: %d", ret);
-        return USB_ERROR_OTHER;
+    int slot = device_id % MAX_DEVICES;
+    if (g_devices[slot].device_id == device_id && g_devices[slot].state == DEVICE_STATE_OPEN) {
+        return slot;
     }
-    
-    g_initialized = 1;
-    debug_printf("USB中间层初始化成功");
-    return USB_SUCCESS;
+    return -1;
 }
 
-void usb_middleware_cleanup(void) {
-    if (!g_initialized) {
-        return;
+// 按id找到已打开的设备并登记一次引用，失败返回-1。先登记再检查状态，与关闭时"先置CLOSING再等引用归零"配对：
+// 要么关闭方看到这次引用而等待，要么这里看到CLOSING而放弃
+static int device_acquire(int device_id) {
+    if (device_id < 0) {
+        return -1;
     }
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].state == DEVICE_STATE_OPEN) {
-            usb_middleware_close_device(g_devices[i].device_id);
-        }
+    int slot = device_id % MAX_DEVICES;
+    __atomic_add_fetch(&g_device_refs[slot], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_devices[slot].device_id, __ATOMIC_SEQ_CST) == device_id &&
+        __atomic_load_n(&g_devices[slot].state, __ATOMIC_SEQ_CST) == DEVICE_STATE_OPEN) {
+        return slot;
     }
-    
-    usb_device_cleanup();
-    
-    memset(g_devices, 0, sizeof(g_devices));
-    g_device_count = 0;
-    g_next_device_id = 0;
-    g_initialized = 0;
-    
-    debug_printf("USB中间层清理完成");
+    __atomic_sub_fetch(&g_device_refs[slot], 1, __ATOMIC_RELEASE);
+    return -1;
 }
 
-int usb_middleware_scan_devices(device_info_t* devices, int max_devices) {
-    if (!g_initialized || !devices || max_devices <= 0) {
-        return 0;
+static void device_release(int* slot) {
+    if (*slot >= 0) {
+        __atomic_sub_fetch(&g_device_refs[*slot], 1, __ATOMIC_RELEASE);
     }
-    
-    void** device_list = NULL;
-    int cnt = usb_device_get_device_list(g_libusb_context, &device_list);
-    if (cnt < 0) {
-        debug_printf("获取设备列表失败: %d", cnt);
-        return 0;
+}
+
+// 接口函数用DEVICE_REF int slot = device_acquire(device_id)取得槽位，任何路径返回时自动释放引用
+#define DEVICE_REF __attribute__((cleanup(device_release)))
+
+static unsigned int serial_hash(const char* serial) {
+    unsigned int h = 2166136261u;   // FNV-1a
+    while (*serial) {
+        h ^= (unsigned char)*serial++;
+        h *= 16777619u;
     }
-    
-    int device_count = 0;
-    
-    for (int i = 0; i < cnt && device_count < max_devices; i++) {
-        void* dev = device_list[i];
-        usb_device_descriptor desc;
-        
-        if (usb_device_get_device_descriptor(dev, &desc) != 0) {
+    return h;
+}
+
+// 按当前已打开的设备重建序列号索引，调用方持有g_device_lock
+static void serial_index_rebuild(void) {
+    __atomic_add_fetch(&g_serial_index_seq, 1, __ATOMIC_SEQ_CST);
+    memset(g_serial_index, 0, sizeof(g_serial_index));
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (g_devices[i].state != DEVICE_STATE_OPEN) {
             continue;
         }
-        
-        if (desc.idVendor == 0xCCDD && desc.idProduct == 0xAABB) {
-            memset(&devices[device_count], 0, sizeof(device_info_t));
-            int found_in_opened = 0;
-            for (int j = 0; j < MAX_DEVICES; j++) {
-                if (g_devices[j].state == DEVICE_STATE_OPEN && g_devices[j].libusb_handle) {
-                    void* opened_dev = usb_device_get_device(g_devices[j].libusb_handle);
-                    if (opened_dev == dev) {
-                        strncpy(devices[device_count].serial, g_devices[j].serial, sizeof(devices[device_count].serial) - 1);
-                        strncpy(devices[device_count].description, "USB Device (Open)", sizeof(devices[device_count].description) - 1);
-                        strncpy(devices[device_count].manufacturer, "USB Device (Open)", sizeof(devices[device_count].manufacturer) - 1);
-                        found_in_opened = 1;
-                        debug_printf("找到已打开设备，序列号: %s", g_devices[j].serial);
-                        break;
-                    }
-                }
-            }
-            
-            if (!found_in_opened) {
-                void* handle = NULL;
-                int open_result = usb_device_open(dev, &handle);
-                if (open_result == 0 && handle != NULL) {
-                    if (desc.iSerialNumber > 0) {
-                        unsigned char serial_buffer[64] = {0};
-                        if (usb_device_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial_buffer, sizeof(serial_buffer)) > 0) {
-                            strncpy(devices[device_count].serial, (char*)serial_buffer, sizeof(devices[device_count].serial) - 1);
-                        }
-                    }
-                    
-                    if (desc.iProduct > 0) {
-                        unsigned char desc_buffer[256] = {0};
-                        if (usb_device_get_string_descriptor_ascii(handle, desc.iProduct, desc_buffer, sizeof(desc_buffer)) > 0) {
-                            strncpy(devices[device_count].description, (char*)desc_buffer, sizeof(devices[device_count].description) - 1);
-                        }
-                    }
-                    
-                    if (desc.iManufacturer > 0) {
-                        unsigned char manufacturer_buffer[256] = {0};
-                        if (usb_device_get_string_descriptor_ascii(handle, desc.iManufacturer, manufacturer_buffer, sizeof(manufacturer_buffer)) > 0) {
-                            strncpy(devices[device_count].manufacturer, (char*)manufacturer_buffer, sizeof(devices[device_count].manufacturer) - 1);
-                        }
-                    }
-                    
-                    usb_device_close(handle);
-                } else {
-                    snprintf(devices[device_count].serial, sizeof(devices[device_count].serial), "DEVICE_%04X_%04X", desc.idVendor, desc.idProduct);
-                    strncpy(devices[device_count].description, "USB Device (Access Denied)", sizeof(devices[device_count].description) - 1);
-                    strncpy(devices[device_count].manufacturer, "Unknown", sizeof(devices[device_count].manufacturer) - 1);
-                }
-            }
-            devices[device_count].vendor_id = desc.idVendor;
-            devices[device_count].product_id = desc.idProduct;
-            devices[device_count].device_id = device_count;
-            device_count++;
+        unsigned int pos = g_devices[i].serial_hash & (SERIAL_INDEX_SIZE - 1);
+        while (g_serial_index[pos]) {
+            pos = (pos + 1) & (SERIAL_INDEX_SIZE - 1);
         }
+        g_serial_index[pos] = (unsigned char)(i + 1);
     }
-    usb_device_free_device_list(device_list, 1);
-    debug_printf("扫描到 %d 个USB设备", device_count);
-    return device_count;
+    __atomic_add_fetch(&g_serial_index_seq, 1, __ATOMIC_SEQ_CST);
 }
 
-int usb_middleware_open_device(const char* serial) {
-    if (!g_initialized) {
-        debug_printf("USB中间层未初始化");
-        return USB_ERROR_OTHER;
-    }
-    
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].state == DEVICE_STATE_CLOSED) {
-            slot = i;
-            break;
-        }
-    }
-    
-    if (slot == -1) {
-        debug_printf("设备槽已满");
-        return USB_ERROR_OTHER;
-    }
-    
-    void** device_list = NULL;
-    int cnt = usb_device_get_device_list(g_libusb_context, &device_list);
-    if (cnt < 0) {
-        debug_printf("获取设备列表失败: %d", cnt);
-        return USB_ERROR_OTHER;
-    }
-    
-    void* device_handle = NULL;
-    
-    for (int i = 0; i < cnt; i++) {
-        void* dev = device_list[i];
-        usb_device_descriptor desc;
-        
-        if (usb_device_get_device_descriptor(dev, &desc) != 0) {
+static unsigned long long monotonic_ms(void) {
+#ifdef _WIN32
+    return (unsigned long long)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + (unsigned long long)(ts.tv_nsec / 1000000);
+#endif
+}
+
+// 把应答交给最早登记的、protocol/cmd_id/device_index都相同的请求，成功返回1；
+// 索引不同的请求不会被完成，否则一个通道的应答会被另一个通道的等待者拿走
+static int pending_complete(device_handle_t* device, const GENERIC_CMD_HEADER* header,
+                            const unsigned char* packet_base, unsigned int packet_size) {
+    int found = -1;
+    EnterCriticalSection(&device->pending_lock);
+    for (int i = 0; i < USB_MAX_PENDING_REQUESTS; i++) {
+        pending_request_t* req = &device->pending[i];
+        if (!req->in_use || req->completed || req->protocol != header->protocol_type ||
+            req->cmd_id != header->cmd_id || req->device_index != header->device_index) {
             continue;
         }
-        
-        if (desc.idVendor == 0xCCDD && desc.idProduct == 0xAABB) {
-            if (serial) {
-                void* temp_handle = NULL;
-                if (usb_device_open(dev, &temp_handle) == 0) {
-                    unsigned char serial_buffer[64] = {0};
-                    if (usb_device_get_string_descriptor_ascii(temp_handle, desc.iSerialNumber, serial_buffer, sizeof(serial_buffer)) > 0) {
-                        if (strcmp((char*)serial_buffer, serial) == 0) {
-                            // 找到目标设备
-                            device_handle = temp_handle;
-                            break;
-                        }
-                    }
-                    usb_device_close(temp_handle);
-                }
-            } else {
-                // 打开第一个可用设备
-                if (usb_device_open(dev, &device_handle) == 0) {
-                    break;
-                }
-            }
+        if (found < 0 || req->seq < device->pending[found].seq) {
+            found = i;
         }
     }
-    
-    usb_device_free_device_list(device_list, 1);
-    
-    if (!device_handle) {
-        debug_printf("打开设备失败: %s", serial ? serial : "NULL");
-        return USB_ERROR_ACCESS;
+    if (found >= 0) {
+        pending_request_t* req = &device->pending[found];
+        unsigned int copy_len = packet_size < USB_PENDING_RESPONSE_MAX ? packet_size : USB_PENDING_RESPONSE_MAX;
+        memcpy(req->response, packet_base, copy_len);
+        req->response_len = (int)copy_len;
+        req->completed = 1;
+        WakeAllConditionVariable(&device->pending_cond);
     }
-    
-    if (usb_device_claim_interface(device_handle, 0) != 0) {
+    LeaveCriticalSection(&device->pending_lock);
+    return found >= 0;
+}
+
+static void pending_init(device_handle_t* device) {
+    memset(device->pending, 0, sizeof(device->pending));
+    device->pending_seq = 0;
+    device->pending_count = 0;
+    device->pending_waiters = 0;
+    device->pending_closed = 0;
+    InitializeCriticalSection(&device->pending_lock);
+    InitializeConditionVariable(&device->pending_cond);
+}
+
+// 唤醒所有等待应答的线程，之后开始的等待也立即返回
+static void pending_wake(device_handle_t* device) {
+    EnterCriticalSection(&device->pending_lock);
+    device->pending_closed = 1;
+    WakeAllConditionVariable(&device->pending_cond);
+    LeaveCriticalSection(&device->pending_lock);
+}
+
+// 唤醒所有等待应答的线程，等它们退出后释放锁
+static void pending_shutdown(device_handle_t* device) {
+    pending_wake(device);
+    while (__atomic_load_n(&device->pending_waiters, __ATOMIC_ACQUIRE)) {
+        Sleep(1);
+    }
+    DeleteCriticalSection(&device->pending_lock);
+#ifndef _WIN32
+    pthread_cond_destroy(&device->pending_cond);
+#endif
+}
+
+static void queue_window_init(device_handle_t* device) {
+    device->qw_window = 1;
+    device->qw_capacity = 0;
+    device->qw_head = 0;
+    device->qw_count = 0;
+    device->qw_frames = 0;
+    device->qw_query_pending = 0;
+    memset(device->qw_depth, 0, sizeof(device->qw_depth));
+    memset(device->qw_inflight, 0, sizeof(device->qw_inflight));
+    device->qw_failed = 0;
+    memset(&device->qw_stats, 0, sizeof(device->qw_stats));
+    InitializeCriticalSection(&device->qw_lock);
+    device->qw_ready = 1;
+}
+
+// 在pending_shutdown之后调用：窗口写入线程的等待已被唤醒，之后按id查找都会失败，
+// 拿到一次qw_lock说明它已退出
+static void queue_window_shutdown(device_handle_t* device) {
+    if (!device->qw_ready) {
+        return;
+    }
+    EnterCriticalSection(&device->qw_lock);
+    device->qw_ready = 0;
+    LeaveCriticalSection(&device->qw_lock);
+    DeleteCriticalSection(&device->qw_lock);
+}
+
+static void spi_frames_init(device_handle_t* device) {
+    device->spi_frames = NULL;
+    device->spi_frame_index = 0;
+    device->spi_frame_feeding = 0;
+    device->spi_frame_users = 0;
+    InitializeCriticalSection(&device->frame_lock);
+}
+
+// 摘下spi_frames后等解析线程和读取方都离开再释放
+// 停止分帧采集，spi_index<0时不论索引；正在采集的是其他索引时不停止，返回-1
+static int spi_frames_stop(device_handle_t* device, int spi_index) {
+    EnterCriticalSection(&device->frame_lock);
+    usb_frame_capture_t* fc = device->spi_frames;
+    if (fc && spi_index >= 0 && device->spi_frame_index != spi_index) {
+        LeaveCriticalSection(&device->frame_lock);
+        return -1;
+    }
+    __atomic_store_n(&device->spi_frames, NULL, __ATOMIC_SEQ_CST);
+    LeaveCriticalSection(&device->frame_lock);
+    if (!fc) {
+        return 0;
+    }
+    usb_frame_shutdown(fc);
+    while (__atomic_load_n(&device->spi_frame_feeding, __ATOMIC_SEQ_CST) ||
+           __atomic_load_n(&device->spi_frame_users, __ATOMIC_ACQUIRE)) {
+        Sleep(1);
+    }
+    usb_frame_destroy(fc);
+    return 0;
+}
+
+// 关闭设备时唤醒等帧的线程，帧池留到spi_frames_shutdown再释放
+static void spi_frames_wake(device_handle_t* device) {
+    EnterCriticalSection(&device->frame_lock);
+    if (device->spi_frames) {
+        usb_frame_shutdown(device->spi_frames);
+    }
+    LeaveCriticalSection(&device->frame_lock);
+}
+
+static void spi_frames_shutdown(device_handle_t* device) {
+    spi_frames_stop(device, -1);
+    DeleteCriticalSection(&device->frame_lock);
+}
+
+static void spi_file_init(device_handle_t* device) {
+    device->spi_file = NULL;
+    device->spi_file_index = -1;
+    memset(&device->spi_file_stats, 0, sizeof(device->spi_file_stats));
+    InitializeCriticalSection(&device->file_lock);
+}
+
+// 在解析线程停止后调用，落盘线程已因缓冲区关闭而写完剩余数据
+static void spi_file_shutdown(device_handle_t* device) {
+    if (device->spi_file) {
+        usb_ring_file_stop(device->spi_file, NULL);
+        device->spi_file = NULL;
+    }
+    DeleteCriticalSection(&device->file_lock);
+}
+
+// SPI索引对应的缓冲区：索引0和超出范围的索引为protocol_buffers[PROTOCOL_SPI]；
+// create为0时还没建立的索引也返回它，为1时建立该索引的缓冲区。建立可以与解析线程并发，用CAS发布
+static ring_buffer_t* spi_ring(device_handle_t* device, int index, int create) {
+    ring_buffer_t* shared = &device->protocol_buffers[PROTOCOL_SPI];
+    if (index <= 0 || index >= USB_SPI_RING_INDEXES) {
+        return shared;
+    }
+    ring_buffer_t* rb = __atomic_load_n(&device->spi_rings[index], __ATOMIC_ACQUIRE);
+    if (rb || !create) {
+        return rb ? rb : shared;
+    }
+    rb = (ring_buffer_t*)calloc(1, sizeof(ring_buffer_t));
+    if (!rb) {
+        return shared;
+    }
+    if (ring_buffer_init_lazy(rb, device->spi_ring_size, device->spi_ring_mirrored) != 0) {
+        free(rb);
+        return shared;
+    }
+    // 沿用索引0缓冲区的溢出策略
+    ring_buffer_set_overflow_policy(rb, shared->overflow_policy, shared->block_timeout_ms);
+    ring_buffer_t* expected = NULL;
+    if (!__atomic_compare_exchange_n(&device->spi_rings[index], &expected, rb, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+        ring_buffer_free(rb);
+        free(rb);
+        return expected;
+    }
+    // 与关闭并发时spi_rings_shutdown可能没看到这个缓冲区，自己关掉，等待它的读取不会一直睡下去
+    if (__atomic_load_n(&device->state, __ATOMIC_SEQ_CST) != DEVICE_STATE_OPEN) {
+        ring_buffer_shutdown(rb);
+    }
+    debug_printf("建立SPI索引%d的缓冲区: %s", index, device->serial);
+    return rb;
+}
+
+static void spi_rings_shutdown(device_handle_t* device) {
+    for (int i = 1; i < USB_SPI_RING_INDEXES; i++) {
+        if (device->spi_rings[i]) {
+            ring_buffer_shutdown(device->spi_rings[i]);
+        }
+    }
+}
+
+static void spi_rings_free(device_handle_t* device) {
+    for (int i = 1; i < USB_SPI_RING_INDEXES; i++) {
+        if (device->spi_rings[i]) {
+            ring_buffer_free(device->spi_rings[i]);
+            free(device->spi_rings[i]);
+            device->spi_rings[i] = NULL;
+        }
+    }
+}
+
+// 该SPI索引在分帧采集时交给重组，返回0表示照常写入字节缓冲区
+static int spi_frames_feed(device_handle_t* device, uint8_t index, const unsigned char* data, int length) {
+    __atomic_store_n(&device->spi_frame_feeding, 1, __ATOMIC_SEQ_CST);
+    usb_frame_capture_t* fc = __atomic_load_n(&device->spi_frames, __ATOMIC_SEQ_CST);
+    int fed = fc && device->spi_frame_index == index;
+    if (fed && length > 0) {
+        usb_frame_feed(fc, data, (unsigned int)length);
+    }
+    __atomic_store_n(&device->spi_frame_feeding, 0, __ATOMIC_RELEASE);
+    return fed;
+}
+
+// 调用方持有tx_lock
+static int tx_send_locked(device_handle_t* device, unsigned char* data, int length) {
+    int transferred = 0;
+    int ret = usb_device_bulk_transfer(device->libusb_handle, 0x01, data, length, &transferred, 1000);
+    STAT_ADD(device, tx_transfers, 1);
+    if (ret < 0) {
+        debug_printf("写入数据失败: %d", ret);
+        if (ret == -7) {
+            STAT_ADD(device, tx_timeouts, 1);
+        } else {
+            STAT_ADD(device, tx_errors, 1);
+        }
+        return USB_ERROR_IO;
+    }
+    if (usb_capture_active()) {
+        usb_capture_record(USB_CAPTURE_OUT, (int)(device - g_devices), data, (unsigned int)transferred);
+    }
+    return transferred;
+}
+
+// 调用方持有tx_lock
+static int tx_flush_locked(device_handle_t* device) {
+    int length = device->tx_batch_len;
+    device->tx_batch_len = 0;
+    device->tx_batch_deadline = 0;
+    if (length <= 0) {
+        return 0;
+    }
+    return tx_send_locked(device, device->tx_batch, length);
+}
+
+// 按当前合并设置发送或暂存一帧，调用方持有tx_lock；
+// 新开始一个自动合并窗口时*start_window置1，调用方释放锁后唤醒发送线程
+static int tx_submit_locked(device_handle_t* device, unsigned char* data, int length, int* start_window) {
+    int ret;
+    if (!device->tx_batch_active && g_batch_window_ms <= 0) {
+        // 未合并：先发出窗口关闭前残留的帧，保持发送顺序
+        ret = tx_flush_locked(device);
+        if (ret >= 0) {
+            ret = tx_send_locked(device, data, length);
+        }
+    } else if (length > g_batch_max_bytes) {
+        // 超过合并上限的大帧(如SPI数据)直接发送，之前的合并帧先发
+        ret = tx_flush_locked(device);
+        if (ret >= 0) {
+            ret = tx_send_locked(device, data, length);
+        }
+    } else {
+        ret = 0;
+        if (device->tx_batch_len + length > g_batch_max_bytes) {
+            ret = tx_flush_locked(device);
+        }
+        if (ret >= 0) {
+            memcpy(device->tx_batch + device->tx_batch_len, data, length);
+            device->tx_batch_len += length;
+            ret = length;
+            if (device->tx_batch_len == g_batch_max_bytes) {
+                int flushed = tx_flush_locked(device);
+                if (flushed < 0) {
+                    ret = flushed;
+                }
+            } else if (!device->tx_batch_active && device->tx_batch_deadline == 0) {
+                device->tx_batch_deadline = monotonic_ms() + (unsigned long long)g_batch_window_ms;
+                *start_window = 1;
+            }
+        }
+    }
+    return ret;
+}
+
+// 大帧分段发送，数据不拼接：帧头和数据开头凑满整包放进tx_frame，中间整包部分直接从调用方内存发送，
+// 剩余数据和帧尾再放进tx_frame。除最后一段外都是512字节的整数倍，设备端看到的包序列与整帧发送相同。
+// 调用方持有tx_lock且已清空合并缓冲区
+static int tx_send_scattered_locked(device_handle_t* device, const GENERIC_CMD_HEADER* cmd_header,
+                                    const void* param_data, size_t param_len,
+                                    const unsigned char* data, size_t data_len) {
+    int prefix_len = build_protocol_frame_prefix(device->tx_frame, USB_TX_FRAME_SIZE, cmd_header,
+                                                 param_data, param_len);
+    if (prefix_len < 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    size_t head = (USB_TX_PACKET_SIZE - (size_t)prefix_len % USB_TX_PACKET_SIZE) % USB_TX_PACKET_SIZE;
+    if (head > data_len) {
+        head = data_len;
+    }
+    memcpy(device->tx_frame + prefix_len, data, head);
+    size_t middle = (data_len - head) / USB_TX_PACKET_SIZE * USB_TX_PACKET_SIZE;
+    size_t tail = data_len - head - middle;
+    int total = 0;
+
+    int ret = tx_send_locked(device, device->tx_frame, prefix_len + (int)head);
+    if (ret < 0) {
+        return ret;
+    }
+    total += ret;
+    if (middle > 0) {
+        ret = tx_send_locked(device, (unsigned char*)data + head, (int)middle);
+        if (ret < 0) {
+            return ret;
+        }
+        total += ret;
+    }
+    memcpy(device->tx_frame, data + head + middle, tail);
+    int trailer_len = build_protocol_frame_trailer(device->tx_frame + tail);
+    ret = tx_send_locked(device, device->tx_frame, (int)tail + trailer_len);
+    if (ret < 0) {
+        return ret;
+    }
+    return total + ret;
+}
+
+static void USB_LIBUSB_CALL tx_urb_callback(usb_transfer_t* transfer) {
+    tx_urb_t* urb = (tx_urb_t*)transfer->user_data;
+    __atomic_store_n(&urb->done, 1, __ATOMIC_RELEASE);
+}
+
+static void tx_urbs_free(device_handle_t* device) {
+    tx_urb_t* urbs = (tx_urb_t*)device->tx_urbs;
+    if (urbs) {
+        for (int i = 0; i < USB_TX_PIPELINE_DEPTH; i++) {
+            if (urbs[i].transfer) {
+                usb_device_free_transfer(urbs[i].transfer);
+            }
+        }
+        free(urbs);
+    }
+    free(device->tx_stage);
+    device->tx_urbs = NULL;
+    device->tx_stage = NULL;
+}
+
+// 第一次大块写入时分配，之后一直复用；不支持异步或分配失败时返回NULL，退回同步发送
+static tx_urb_t* tx_urbs_get(device_handle_t* device) {
+    if (device->tx_urbs) {
+        return (tx_urb_t*)device->tx_urbs;
+    }
+    if (!usb_device_async_supported()) {
+        return NULL;
+    }
+    device->tx_urbs = calloc(USB_TX_PIPELINE_DEPTH, sizeof(tx_urb_t));
+    device->tx_stage = (unsigned char*)malloc(USB_TX_PIPELINE_DEPTH * USB_TX_STAGE_SIZE);
+    tx_urb_t* urbs = (tx_urb_t*)device->tx_urbs;
+    if (!urbs || !device->tx_stage) {
+        tx_urbs_free(device);
+        return NULL;
+    }
+    for (int i = 0; i < USB_TX_PIPELINE_DEPTH; i++) {
+        urbs[i].transfer = usb_device_alloc_transfer(0);
+        urbs[i].stage = device->tx_stage + i * USB_TX_STAGE_SIZE;
+        if (!urbs[i].transfer) {
+            tx_urbs_free(device);
+            return NULL;
+        }
+    }
+    return urbs;
+}
+
+// 等最早提交的传输完成并检查结果；同一端点的传输按提交顺序完成
+static void tx_pipe_reap(tx_pipe_t* pipe) {
+    device_handle_t* device = pipe->device;
+    tx_urb_t* urb = &pipe->urbs[(pipe->next - pipe->in_flight + USB_TX_PIPELINE_DEPTH) % USB_TX_PIPELINE_DEPTH];
+    while (!__atomic_load_n(&urb->done, __ATOMIC_ACQUIRE)) {
+        usb_device_handle_events_timeout(NULL, 100, &urb->done);
+    }
+    pipe->in_flight--;
+    usb_transfer_t* t = urb->transfer;
+    STAT_ADD(device, tx_transfers, 1);
+    if (t->status != LIBUSB_TRANSFER_COMPLETED || t->actual_length != urb->length) {
+        if (t->status == LIBUSB_TRANSFER_CANCELLED) {
+            return;
+        }
+        debug_printf("大块写入失败: status=%d, 写入%d/%d字节", t->status, t->actual_length, urb->length);
+        if (t->status == LIBUSB_TRANSFER_TIMED_OUT) {
+            STAT_ADD(device, tx_timeouts, 1);
+        } else {
+            STAT_ADD(device, tx_errors, 1);
+        }
+        pipe->error = 1;
+        return;
+    }
+    if (usb_capture_active()) {
+        usb_capture_record(USB_CAPTURE_OUT, (int)(device - g_devices), t->buffer, (unsigned int)t->actual_length);
+    }
+}
+
+// 下一个传输的组包区，传输都在途时先等最早的一个完成
+static unsigned char* tx_pipe_stage(tx_pipe_t* pipe) {
+    if (!pipe->urbs) {
+        return pipe->device->tx_frame;
+    }
+    if (pipe->in_flight == USB_TX_PIPELINE_DEPTH) {
+        tx_pipe_reap(pipe);
+    }
+    return pipe->urbs[pipe->next].stage;
+}
+
+static void tx_pipe_send(tx_pipe_t* pipe, unsigned char* data, int length) {
+    if (pipe->error) {
+        return;
+    }
+    if (!pipe->urbs) {
+        if (tx_send_locked(pipe->device, data, length) < 0) {
+            pipe->error = 1;
+        }
+        return;
+    }
+    if (pipe->in_flight == USB_TX_PIPELINE_DEPTH) {
+        tx_pipe_reap(pipe);
+        if (pipe->error) {
+            return;
+        }
+    }
+    tx_urb_t* urb = &pipe->urbs[pipe->next];
+    urb->length = length;
+    urb->done = 0;
+    usb_device_fill_bulk_transfer(urb->transfer, pipe->device->libusb_handle, 0x01, data, length,
+                                  tx_urb_callback, urb, 1000);
+    int ret = usb_device_submit_transfer(urb->transfer);
+    if (ret != 0) {
+        debug_printf("提交异步写入失败: %d", ret);
+        STAT_ADD(pipe->device, tx_errors, 1);
+        pipe->error = 1;
+        return;
+    }
+    pipe->next = (pipe->next + 1) % USB_TX_PIPELINE_DEPTH;
+    pipe->in_flight++;
+}
+
+// 等全部挂起的传输返回，出错时先取消还没完成的
+static int tx_pipe_finish(tx_pipe_t* pipe) {
+    if (pipe->urbs) {
+        if (pipe->error) {
+            for (int i = 0; i < pipe->in_flight; i++) {
+                int index = (pipe->next - pipe->in_flight + i + USB_TX_PIPELINE_DEPTH) % USB_TX_PIPELINE_DEPTH;
+                usb_device_cancel_transfer(pipe->urbs[index].transfer);
+            }
+        }
+        while (pipe->in_flight > 0) {
+            tx_pipe_reap(pipe);
+        }
+    }
+    return pipe->error ? USB_ERROR_IO : USB_SUCCESS;
+}
+
+// 按USB_SEGMENT_DATA_MAX拆帧发送。与tx_send_scattered_locked相同，整包部分直接从调用方内存发送；
+// 上一帧剩余的数据和帧尾与下一帧的帧头、开头数据在组包区拼成整包，因此除最后一次外每次传输都是整包。
+// 调用方持有tx_lock且已清空合并缓冲区
+static int tx_send_segmented_locked(device_handle_t* device, const GENERIC_CMD_HEADER* cmd_header,
+                                    const unsigned char* data, size_t data_len) {
+    tx_pipe_t pipe = { device, tx_urbs_get(device), 0, 0, 0 };
+    unsigned char* stage = tx_pipe_stage(&pipe);
+    int staged = 0;
+    size_t offset = 0;
+    while (offset < data_len && !pipe.error) {
+        size_t seg_len = data_len - offset;
+        if (seg_len > USB_SEGMENT_DATA_MAX) {
+            seg_len = USB_SEGMENT_DATA_MAX;
+        }
+        const unsigned char* seg = data + offset;
+        GENERIC_CMD_HEADER header = *cmd_header;
+        header.param_count = 0;
+        header.data_len = (uint16_t)seg_len;
+        int frame_len = protocol_frame_prepare(&header, 0, seg_len);
+        staged += build_protocol_frame_prefix(stage + staged, USB_TX_STAGE_SIZE - staged, &header, NULL, 0);
+
+        size_t head = (USB_TX_PACKET_SIZE - (size_t)staged % USB_TX_PACKET_SIZE) % USB_TX_PACKET_SIZE;
+        if (head > seg_len) {
+            head = seg_len;
+        }
+        memcpy(stage + staged, seg, head);
+        staged += (int)head;
+        size_t middle = (seg_len - head) / USB_TX_PACKET_SIZE * USB_TX_PACKET_SIZE;
+        if (middle > 0) {
+            tx_pipe_send(&pipe, stage, staged);
+            tx_pipe_send(&pipe, (unsigned char*)seg + head, (int)middle);
+            stage = tx_pipe_stage(&pipe);
+            staged = 0;
+        }
+        size_t tail = seg_len - head - middle;
+        memcpy(stage + staged, seg + head + middle, tail);
+        staged += (int)tail;
+        staged += build_protocol_frame_trailer(stage + staged);
+
+        if (header.protocol_type < MAX_PROTOCOL_TYPES) {
+            STAT_ADD(device, tx_packets[header.protocol_type], 1);
+            STAT_ADD(device, tx_bytes[header.protocol_type], frame_len);
+        }
+        offset += seg_len;
+    }
+    if (staged > 0) {
+        tx_pipe_send(&pipe, stage, staged);
+    }
+    return tx_pipe_finish(&pipe);
+}
+
+static void tx_kick_flusher(void) {
+    EnterCriticalSection(&g_batch_lock);
+    WakeConditionVariable(&g_batch_cond);
+    LeaveCriticalSection(&g_batch_lock);
+}
+
+static void tx_init(device_handle_t* device) {
+    device->tx_batch = (unsigned char*)malloc(USB_BATCH_MAX_BYTES);
+    device->tx_frame = (unsigned char*)malloc(USB_TX_FRAME_SIZE);
+    device->tx_batch_len = 0;
+    device->tx_batch_active = 0;
+    device->tx_batch_deadline = 0;
+    device->tx_urbs = NULL;
+    device->tx_stage = NULL;
+    InitializeCriticalSection(&device->tx_lock);
+    device->tx_ready = 1;
+}
+
+// 发出残留的合并帧后释放；与自动发送线程的扫描互斥
+static void tx_shutdown(device_handle_t* device) {
+    if (!device->tx_ready) {
+        return;
+    }
+    EnterCriticalSection(&g_batch_lock);
+    EnterCriticalSection(&device->tx_lock);
+    (void)tx_flush_locked(device);
+    device->tx_ready = 0;
+    LeaveCriticalSection(&device->tx_lock);
+    LeaveCriticalSection(&g_batch_lock);
+    DeleteCriticalSection(&device->tx_lock);
+    tx_urbs_free(device);
+    free(device->tx_batch);
+    device->tx_batch = NULL;
+    free(device->tx_frame);
+    device->tx_frame = NULL;
+}
+
+static DWORD WINAPI batch_flush_thread_func(LPVOID lpParameter) {
+    (void)lpParameter;
+    EnterCriticalSection(&g_batch_lock);
+    while (!g_batch_thread_stop) {
+        unsigned long long now = monotonic_ms();
+        unsigned long long next = 0;
+        for (int i = 0; i < MAX_DEVICES; i++) {
+            device_handle_t* device = &g_devices[i];
+            if (device->state != DEVICE_STATE_OPEN || !device->tx_ready) {
+                continue;
+            }
+            EnterCriticalSection(&device->tx_lock);
+            if (device->tx_batch_len > 0 && !device->tx_batch_active && device->tx_batch_deadline) {
+                if (device->tx_batch_deadline <= now) {
+                    (void)tx_flush_locked(device);
+                } else if (next == 0 || device->tx_batch_deadline < next) {
+                    next = device->tx_batch_deadline;
+                }
+            }
+            LeaveCriticalSection(&device->tx_lock);
+        }
+        DWORD wait_ms = INFINITE;
+        if (next) {
+            now = monotonic_ms();
+            wait_ms = next > now ? (DWORD)(next - now) : 0;
+        }
+        if (wait_ms) {
+            SleepConditionVariableCS(&g_batch_cond, &g_batch_lock, wait_ms);
+        }
+    }
+    LeaveCriticalSection(&g_batch_lock);
+    return 0;
+}
+
+static void dispatch_protocol_packet(device_handle_t* device, const GENERIC_CMD_HEADER* header,
+                                     unsigned char* packet_base, unsigned int packet_size) {
+    if (header->protocol_type < MAX_PROTOCOL_TYPES) {
+        STAT_ADD(device, rx_packets[header->protocol_type], 1);
+        STAT_ADD(device, rx_bytes[header->protocol_type], header->data_len);
+    }
+    if ((header->protocol_type == PROTOCOL_STATUS || header->protocol_type == PROTOCOL_PWM) &&
+        __atomic_load_n(&device->pending_count, __ATOMIC_ACQUIRE) > 0 &&
+        pending_complete(device, header, packet_base, packet_size)) {
+        return;
+    }
+
+    if (header->protocol_type == PROTOCOL_SPI) {
+        unsigned char* spi_data = packet_base + sizeof(GENERIC_CMD_HEADER);
+        int spi_data_len = header->data_len;
+        if (!__atomic_load_n(&device->spi_frames, __ATOMIC_RELAXED) ||
+            !spi_frames_feed(device, header->device_index, spi_data, spi_data_len)) {
+            write_to_ring_buffer(spi_ring(device, header->device_index, 0), spi_data, spi_data_len);
+        }
+    } else if (header->protocol_type == PROTOCOL_STATUS) {
+        unsigned char* status_data = packet_base;
+        int status_data_len = (int)packet_size;
+
+        LOG_TRACE("收到状态响应: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
+                    header->protocol_type, header->cmd_id, header->device_index, status_data_len);
+        write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_STATUS], status_data, status_data_len);
+    } else if (header->protocol_type == PROTOCOL_PWM) {
+        unsigned char* pwm_data = packet_base;
+        int pwm_data_len = (int)packet_size;
+
+        LOG_TRACE("收到PWM响应: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
+                    header->protocol_type, header->cmd_id, header->device_index, pwm_data_len);
+        write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_PWM], pwm_data, pwm_data_len);
+    } else if (header->protocol_type == PROTOCOL_UART) {
+        unsigned char* uart_data = packet_base + sizeof(GENERIC_CMD_HEADER);
+        int uart_data_len = header->data_len;
+
+        LOG_TRACE("收到UART数据: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
+                    header->protocol_type, header->cmd_id, header->device_index, uart_data_len);
+        write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_UART], uart_data, uart_data_len);
+
+        LOG_TRACE("分发UART数据: %d字节, cmd_id=%d, device_index=%d", uart_data_len, header->cmd_id, header->device_index);
+    } else if (header->protocol_type == PROTOCOL_GPIO) {
+        if (header->cmd_id == GPIO_DIR_READ && header->data_len >= 1) {
+            unsigned char level = *(packet_base + sizeof(GENERIC_CMD_HEADER));
+            unsigned int idx = header->device_index;
+            if (idx < 256) {
+                device->gpio_level[idx] = level;
+                device->gpio_level_valid[idx] = 1;
+            }
+        }
+    } else if (header->protocol_type == PROTOCOL_GET_FIRMWARE_INFO) {
+        unsigned char* firmware_data = packet_base;
+        int firmware_data_len = (int)packet_size;
+
+        LOG_TRACE("收到固件信息响应: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
+                    header->protocol_type, header->cmd_id, header->device_index, firmware_data_len);
+        write_to_ring_buffer(&device->raw_buffer, firmware_data, firmware_data_len);
+
+        LOG_TRACE("分发固件信息数据: %d字节, cmd_id=%d, device_index=%d", firmware_data_len, header->cmd_id, header->device_index);
+    } else if (header->protocol_type == PROTOCOL_CURRENT) {
+        unsigned char* current_data = packet_base + sizeof(GENERIC_CMD_HEADER);
+        int current_data_len = header->data_len;
+
+        LOG_TRACE("收到电流数据: protocol_type=%d, cmd_id=%d, device_index=%d, data_len=%d", 
+                    header->protocol_type, header->cmd_id, header->device_index, current_data_len);
+        unsigned int before_size = ring_buffer_available(&device->protocol_buffers[PROTOCOL_POWER]);
+        write_to_ring_buffer(&device->protocol_buffers[PROTOCOL_POWER], current_data, current_data_len);
+        unsigned int after_size = ring_buffer_available(&device->protocol_buffers[PROTOCOL_POWER]);
+
+        LOG_TRACE("分发电流数据: %d字节, cmd_id=%d, device_index=%d, 缓冲区: %u->%u", 
+                    current_data_len, header->cmd_id, header->device_index, before_size, after_size);
+    } else {
+        LOG_TRACE("收到非SPI协议数据: protocol_type=%d, cmd_id=%d", header->protocol_type, header->cmd_id);
+    }
+}
+
+// 从data开头连续解析并分发完整的协议包，返回已消费的字节数(含跳过的无效字节)，
+// 末尾不完整的包不消费
+static unsigned int parse_protocol_packets(device_handle_t* device, unsigned char* data, unsigned int avail) {
+    unsigned int offset = 0;
+    unsigned int skipped = 0;
+    unsigned int resyncs = 0;
+    while (avail - offset >= sizeof(GENERIC_CMD_HEADER)) {
+        GENERIC_CMD_HEADER header;
+        memcpy(&header, data + offset, sizeof(GENERIC_CMD_HEADER));
+        if (!is_valid_protocol_header(&header)) {
+            // 失步：批量扫描到下一个可能的协议头，而不是逐字节memmove
+            unsigned int next = offset + 1 + find_header_candidate(data + offset + 1, avail - offset - 1);
+            skipped += next - offset;
+            resyncs++;
+            offset = next;
+            continue;
+        }
+
+        unsigned int packet_size = (unsigned int)sizeof(GENERIC_CMD_HEADER) + (unsigned int)header.data_len;
+        if (avail - offset < packet_size) {
+            break;
+        }
+
+        dispatch_protocol_packet(device, &header, data + offset, packet_size);
+        offset += packet_size;
+    }
+
+    if (skipped > 0) {
+        __atomic_fetch_add(&device->rx_skipped_bytes, skipped, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&device->rx_resync_count, resyncs, __ATOMIC_RELAXED);
+        LOG_WARN("协议失步: 跳过%u字节无效数据, 重同步%u次, 累计跳过%llu字节",
+                     skipped, resyncs, device->rx_skipped_bytes);
+    }
+    return offset;
+}
+
+// 追加到rx_cache尾部；只有尾部空间不足时才把未消费数据搬回开头
+static int rx_cache_append(device_handle_t* device, const unsigned char* data, unsigned int length) {
+    if (length == 0) {
+        return USB_SUCCESS;
+    }
+    if (device->rx_cache_size + length > device->rx_cache_capacity) {
+        unsigned int pending = device->rx_cache_size - device->rx_cache_head;
+        if (device->rx_cache_head > 0) {
+            memmove(device->rx_cache, device->rx_cache + device->rx_cache_head, pending);
+            device->rx_cache_head = 0;
+            device->rx_cache_size = pending;
+        }
+        if (ensure_rx_cache_capacity(device, device->rx_cache_size + length) != USB_SUCCESS) {
+            device->rx_cache_head = 0;
+            device->rx_cache_size = 0;
+            return USB_ERROR_OTHER;
+        }
+    }
+    memcpy(device->rx_cache + device->rx_cache_size, data, length);
+    device->rx_cache_size += length;
+    return USB_SUCCESS;
+}
+
+void parse_and_dispatch_protocol_data(device_handle_t* device, unsigned char* raw_data, int length) {
+    if (!device || !raw_data || length <= 0) {
+        return;
+    }
+    if (usb_capture_active()) {
+        usb_capture_record(USB_CAPTURE_IN, (int)(device - g_devices), raw_data, (unsigned int)length);
+    }
+
+    if (device->rx_cache_size > RX_CACHE_MAX_CAPACITY) {
+        device->rx_cache_head = 0;
+        device->rx_cache_size = 0;
+    }
+
+    unsigned int len = (unsigned int)length;
+    unsigned int pos = 0;
+    STAT_ADD(device, rx_transfers, 1);
+    STAT_ADD(device, rx_transfer_bytes, len);
+
+    // rx_cache里有上次残留的半包：只补齐这一个包需要的字节
+    if (device->rx_cache_size > device->rx_cache_head) {
+        unsigned int pending = device->rx_cache_size - device->rx_cache_head;
+        if (pending < sizeof(GENERIC_CMD_HEADER)) {
+            unsigned int need = (unsigned int)sizeof(GENERIC_CMD_HEADER) - pending;
+            if (need > len) {
+                need = len;
+            }
+            if (rx_cache_append(device, raw_data, need) != USB_SUCCESS) {
+                return;
+            }
+            pos = need;
+            pending += need;
+        }
+        if (pending >= sizeof(GENERIC_CMD_HEADER)) {
+            GENERIC_CMD_HEADER header;
+            memcpy(&header, device->rx_cache + device->rx_cache_head, sizeof(GENERIC_CMD_HEADER));
+            unsigned int packet_size = (unsigned int)sizeof(GENERIC_CMD_HEADER) + (unsigned int)header.data_len;
+            unsigned int need = len - pos;
+            if (is_valid_protocol_header(&header) && pending < packet_size && packet_size - pending < need) {
+                need = packet_size - pending;
+            }
+            // 残留数据已失步时need为剩余全部数据，交给完整解析去重同步
+            if (rx_cache_append(device, raw_data + pos, need) != USB_SUCCESS) {
+                return;
+            }
+            pos += need;
+        }
+
+        device->rx_cache_head += parse_protocol_packets(device, device->rx_cache + device->rx_cache_head,
+                                                        device->rx_cache_size - device->rx_cache_head);
+        if (device->rx_cache_head < device->rx_cache_size) {
+            // 仍是半包，说明本次数据已全部并入缓存
+            return;
+        }
+        device->rx_cache_head = 0;
+        device->rx_cache_size = 0;
+    }
+
+    // 缓存为空：完整落在本次接收数据内的包直接分发，不经过rx_cache
+    pos += parse_protocol_packets(device, raw_data + pos, len - pos);
+    if (pos < len) {
+        (void)rx_cache_append(device, raw_data + pos, len - pos);
+    }
+}
+
+int usb_middleware_init(void) {
+    if (g_initialized) {
+        return USB_SUCCESS;
+    }
+    
+    memset(g_devices, 0, sizeof(g_devices));
+    memset(g_serial_index, 0, sizeof(g_serial_index));
+    g_device_count = 0;
+    usb_capture_init();
+    
+    int ret = usb_device_init();
+    if (ret < 0) {
+        debug_printf("USB设备层初始化失败: %d", ret);
+        return USB_ERROR_OTHER;
+    }
+    
+    InitializeCriticalSection(&g_batch_lock);
+    InitializeConditionVariable(&g_batch_cond);
+    InitializeCriticalSection(&g_event_lock);
+    InitializeCriticalSection(&g_device_lock);
+    g_initialized = 1;
+    debug_printf("USB中间层初始化成功");
+    return USB_SUCCESS;
+}
+
+void usb_middleware_cleanup(void) {
+    if (!g_initialized) {
+        return;
+    }
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (g_devices[i].state == DEVICE_STATE_OPEN) {
+            usb_middleware_close_device(g_devices[i].device_id);
+        }
+    }
+    
+    if (g_batch_thread) {
+        EnterCriticalSection(&g_batch_lock);
+        g_batch_thread_stop = 1;
+        WakeConditionVariable(&g_batch_cond);
+        LeaveCriticalSection(&g_batch_lock);
+        WaitForSingleObject(g_batch_thread, INFINITE);
+        CloseHandle(g_batch_thread);
+        g_batch_thread = NULL;
+    }
+    g_batch_window_ms = 0;
+    g_batch_max_bytes = USB_BATCH_DEFAULT_BYTES;
+    DeleteCriticalSection(&g_batch_lock);
+#ifndef _WIN32
+    pthread_cond_destroy(&g_batch_cond);
+#endif
+    DeleteCriticalSection(&g_event_lock);
+    DeleteCriticalSection(&g_device_lock);
+
+    usb_device_cleanup();
+    
+    memset(g_devices, 0, sizeof(g_devices));
+    memset(g_serial_index, 0, sizeof(g_serial_index));
+    g_device_count = 0;
+    g_initialized = 0;
+    
+    debug_printf("USB中间层清理完成");
+}
+
+void usb_middleware_detach(void) {
+    if (!g_initialized) {
+        return;
+    }
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (g_devices[i].state != DEVICE_STATE_CLOSED) {
+            g_devices[i].stop_thread = TRUE;
+        }
+    }
+    __atomic_store_n(&g_event_thread_stop, 1, __ATOMIC_RELEASE);
+    EnterCriticalSection(&g_batch_lock);
+    g_batch_thread_stop = 1;
+    WakeConditionVariable(&g_batch_cond);
+    LeaveCriticalSection(&g_batch_lock);
+}
+
+int usb_middleware_scan_devices(device_info_t* devices, int max_devices) {
+    if (!g_initialized || !devices || max_devices <= 0) {
+        return 0;
+    }
+    
+    void** device_list = NULL;
+    int cnt = usb_device_get_device_list(g_libusb_context, &device_list);
+    if (cnt < 0) {
+        debug_printf("获取设备列表失败: %d", cnt);
+        return 0;
+    }
+    
+    int device_count = 0;
+    
+    for (int i = 0; i < cnt && device_count < max_devices; i++) {
+        void* dev = device_list[i];
+        usb_device_descriptor desc;
+        
+        if (usb_device_get_device_descriptor(dev, &desc) != 0) {
+            continue;
+        }
+        
+        if (desc.idVendor == 0xCCDD && desc.idProduct == 0xAABB) {
+            memset(&devices[device_count], 0, sizeof(device_info_t));
+            int found_in_opened = 0;
+            for (int j = 0; j < MAX_DEVICES; j++) {
+                if (g_devices[j].state == DEVICE_STATE_OPEN && g_devices[j].libusb_handle) {
+                    void* opened_dev = usb_device_get_device(g_devices[j].libusb_handle);
+                    if (opened_dev == dev) {
+                        strncpy(devices[device_count].serial, g_devices[j].serial, sizeof(devices[device_count].serial) - 1);
+                        strncpy(devices[device_count].description, "USB Device (Open)", sizeof(devices[device_count].description) - 1);
+                        strncpy(devices[device_count].manufacturer, "USB Device (Open)", sizeof(devices[device_count].manufacturer) - 1);
+                        found_in_opened = 1;
+                        debug_printf("找到已打开设备，序列号: %s", g_devices[j].serial);
+                        break;
+                    }
+                }
+            }
+            
+            if (!found_in_opened) {
+                void* handle = NULL;
+                int open_result = usb_device_open(dev, &handle);
+                if (open_result == 0 && handle != NULL) {
+                    if (desc.iSerialNumber > 0) {
+                        unsigned char serial_buffer[64] = {0};
+                        if (usb_device_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial_buffer, sizeof(serial_buffer)) > 0) {
+                            strncpy(devices[device_count].serial, (char*)serial_buffer, sizeof(devices[device_count].serial) - 1);
+                        }
+                    }
+                    
+                    if (desc.iProduct > 0) {
+                        unsigned char desc_buffer[256] = {0};
+                        if (usb_device_get_string_descriptor_ascii(handle, desc.iProduct, desc_buffer, sizeof(desc_buffer)) > 0) {
+                            strncpy(devices[device_count].description, (char*)desc_buffer, sizeof(devices[device_count].description) - 1);
+                        }
+                    }
+                    
+                    if (desc.iManufacturer > 0) {
+                        unsigned char manufacturer_buffer[256] = {0};
+                        if (usb_device_get_string_descriptor_ascii(handle, desc.iManufacturer, manufacturer_buffer, sizeof(manufacturer_buffer)) > 0) {
+                            strncpy(devices[device_count].manufacturer, (char*)manufacturer_buffer, sizeof(devices[device_count].manufacturer) - 1);
+                        }
+                    }
+                    
+                    usb_device_close(handle);
+                } else {
+                    snprintf(devices[device_count].serial, sizeof(devices[device_count].serial), "DEVICE_%04X_%04X", desc.idVendor, desc.idProduct);
+                    strncpy(devices[device_count].description, "USB Device (Access Denied)", sizeof(devices[device_count].description) - 1);
+                    strncpy(devices[device_count].manufacturer, "Unknown", sizeof(devices[device_count].manufacturer) - 1);
+                }
+            }
+            devices[device_count].vendor_id = desc.idVendor;
+            devices[device_count].product_id = desc.idProduct;
+            devices[device_count].device_id = device_count;
+            device_count++;
+        }
+    }
+    usb_device_free_device_list(device_list, 1);
+    debug_printf("扫描到 %d 个USB设备", device_count);
+    return device_count;
+}
+
+// 预分配时立即分配数据区，否则只创建同步对象，等解析线程写入第一包数据时再分配
+static void device_ring_init(ring_buffer_t* rb, unsigned int size, int mirrored, int preallocate) {
+    if (!preallocate) {
+        ring_buffer_init_lazy(rb, size, mirrored);
+    } else if (!mirrored || ring_buffer_init_mirrored(rb, size) != 0) {
+        ring_buffer_init(rb, size);
+    }
+}
+
+static void device_rings_init(device_handle_t* device, const usb_open_options_t* options) {
+    usb_open_options_t opt;
+    memset(&opt, 0, sizeof(opt));
+    if (options) {
+        opt = *options;
+    }
+    device->spi_ring_size = opt.spi_buffer_size ? opt.spi_buffer_size : SPI_BUFFER_SIZE;
+    device->spi_ring_mirrored = g_spi_mirror_enabled;
+    memset(device->spi_rings, 0, sizeof(device->spi_rings));
+    device_ring_init(&device->protocol_buffers[PROTOCOL_SPI],
+                     device->spi_ring_size, device->spi_ring_mirrored, opt.preallocate);
+    device_ring_init(&device->protocol_buffers[PROTOCOL_POWER],
+                     opt.power_buffer_size ? opt.power_buffer_size : POWER_BUFFER_SIZE, 0, opt.preallocate);
+    device_ring_init(&device->protocol_buffers[PROTOCOL_PWM],
+                     opt.pwm_buffer_size ? opt.pwm_buffer_size : PWM_BUFFER_SIZE, 0, opt.preallocate);
+    device_ring_init(&device->protocol_buffers[PROTOCOL_UART],
+                     opt.uart_buffer_size ? opt.uart_buffer_size : UART_BUFFER_SIZE, 0, opt.preallocate);
+    device_ring_init(&device->protocol_buffers[PROTOCOL_STATUS],
+                     opt.status_buffer_size ? opt.status_buffer_size : STATUS_BUFFER_SIZE, 0, opt.preallocate);
+    device_ring_init(&device->raw_buffer,
+                     opt.raw_buffer_size ? opt.raw_buffer_size : RAW_BUFFER_SIZE, 0, opt.preallocate);
+}
+
+int usb_middleware_open_device(const char* serial) {
+    return usb_middleware_open_device_ex(serial, NULL);
+}
+
+int usb_middleware_open_device_ex(const char* serial, const usb_open_options_t* options) {
+    if (!g_initialized) {
+        debug_printf("USB中间层未初始化");
+        return USB_ERROR_OTHER;
+    }
+    
+    // 先占住槽位，打开完成前查找不到它
+    int slot = -1;
+    EnterCriticalSection(&g_device_lock);
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (g_devices[i].state == DEVICE_STATE_CLOSED) {
+            slot = i;
+            g_devices[i].state = DEVICE_STATE_OPENING;
+            break;
+        }
+    }
+    LeaveCriticalSection(&g_device_lock);
+    
+    if (slot == -1) {
+        debug_printf("设备槽已满");
+        return USB_ERROR_OTHER;
+    }
+    
+    void** device_list = NULL;
+    int cnt = usb_device_get_device_list(g_libusb_context, &device_list);
+    if (cnt < 0) {
+        debug_printf("获取设备列表失败: %d", cnt);
+        g_devices[slot].state = DEVICE_STATE_CLOSED;
+        return USB_ERROR_OTHER;
+    }
+    
+    void* device_handle = NULL;
+    
+    for (int i = 0; i < cnt; i++) {
+        void* dev = device_list[i];
+        usb_device_descriptor desc;
+        
+        if (usb_device_get_device_descriptor(dev, &desc) != 0) {
+            continue;
+        }
+        
+        if (desc.idVendor == 0xCCDD && desc.idProduct == 0xAABB) {
+            if (serial) {
+                void* temp_handle = NULL;
+                if (usb_device_open(dev, &temp_handle) == 0) {
+                    unsigned char serial_buffer[64] = {0};
+                    if (usb_device_get_string_descriptor_ascii(temp_handle, desc.iSerialNumber, serial_buffer, sizeof(serial_buffer)) > 0) {
+                        if (strcmp((char*)serial_buffer, serial) == 0) {
+                            // 找到目标设备
+                            device_handle = temp_handle;
+                            break;
+                        }
+                    }
+                    usb_device_close(temp_handle);
+                }
+            } else {
+                // 打开第一个可用设备
+                if (usb_device_open(dev, &device_handle) == 0) {
+                    break;
+                }
+            }
+        }
+    }
+    
+    usb_device_free_device_list(device_list, 1);
+    
+    if (!device_handle) {
+        debug_printf("打开设备失败: %s", serial ? serial : "NULL");
+        g_devices[slot].state = DEVICE_STATE_CLOSED;
+        return USB_ERROR_ACCESS;
+    }
+    
+    if (usb_device_claim_interface(device_handle, 0) != 0) {
+        usb_device_close(device_handle);
+        debug_printf("申请接口失败");
+        g_devices[slot].state = DEVICE_STATE_CLOSED;
+        return USB_ERROR_ACCESS;
+    }
+    
+    g_devices[slot].libusb_handle = device_handle;
+    g_devices[slot].interface_claimed = 1;
+    g_devices[slot].ref_count = 1;
+    g_devices[slot].last_access = (unsigned int)time(NULL);
+    g_devices[slot].device_id = (int)(g_slot_generation[slot] * MAX_DEVICES + slot);
+    
+    if (serial) {
+        strncpy(g_devices[slot].serial, serial, sizeof(g_devices[slot].serial) - 1);
+    } else {
+        strcpy(g_devices[slot].serial, "UNKNOWN");
+    }
+    g_devices[slot].serial_hash = serial_hash(g_devices[slot].serial);
+    
+    g_device_count++;
+    
+    device_rings_init(&g_devices[slot], options);
+    pending_init(&g_devices[slot]);
+    tx_init(&g_devices[slot]);
+    queue_window_init(&g_devices[slot]);
+    spi_frames_init(&g_devices[slot]);
+    spi_file_init(&g_devices[slot]);
+
+    g_devices[slot].rx_cache = NULL;
+    g_devices[slot].rx_cache_head = 0;
+    g_devices[slot].rx_cache_size = 0;
+    g_devices[slot].rx_cache_capacity = 0;
+    g_devices[slot].rx_skipped_bytes = 0;
+    g_devices[slot].rx_resync_count = 0;
+    (void)ensure_rx_cache_capacity(&g_devices[slot], RX_CACHE_INITIAL_CAPACITY);
+    
+    g_devices[slot].stop_thread = FALSE;
+    g_devices[slot].thread_running = TRUE;
+
+    g_devices[slot].read_mode = USB_READ_MODE_SYNC;
+    if (g_read_mode == USB_READ_MODE_ASYNC || g_read_mode == USB_READ_MODE_SHARED) {
+        if (usb_device_async_supported() &&
+            rx_urbs_alloc(&g_devices[slot], g_async_transfer_count, g_async_transfer_size) == USB_SUCCESS) {
+            g_devices[slot].read_mode = g_read_mode;
+        } else {
+            debug_printf("异步读取不可用，退回同步读取: %s", g_devices[slot].serial);
+        }
+    }
+
+    int reader_started;
+    if (g_devices[slot].read_mode == USB_READ_MODE_SHARED) {
+        reader_started = event_loop_attach(&g_devices[slot]) == USB_SUCCESS;
+    } else {
+        if (g_devices[slot].read_mode == USB_READ_MODE_ASYNC) {
+            g_devices[slot].read_thread = CreateThread(NULL, 0, usb_device_async_read_thread_func, &g_devices[slot], 0, NULL);
+        } else {
+            g_devices[slot].read_thread = CreateThread(NULL, 0, usb_device_read_thread_func, &g_devices[slot], 0, NULL);
+        }
+        reader_started = g_devices[slot].read_thread != NULL;
+    }
+    if (!reader_started) {
+        rx_urbs_free(&g_devices[slot]);
+        if (g_devices[slot].rx_cache) {
+            free(g_devices[slot].rx_cache);
+            g_devices[slot].rx_cache = NULL;
+        }
+        g_devices[slot].rx_cache_head = 0;
+        g_devices[slot].rx_cache_size = 0;
+        g_devices[slot].rx_cache_capacity = 0;
+        for (int i = 0; i < MAX_PROTOCOL_TYPES; i++) {
+            ring_buffer_free(&g_devices[slot].protocol_buffers[i]);
+        }
+        ring_buffer_free(&g_devices[slot].raw_buffer);
+        spi_rings_free(&g_devices[slot]);
+        pending_shutdown(&g_devices[slot]);
+        queue_window_shutdown(&g_devices[slot]);
+        spi_frames_shutdown(&g_devices[slot]);
+        spi_file_shutdown(&g_devices[slot]);
+        tx_shutdown(&g_devices[slot]);
+        usb_device_release_interface(device_handle, 0);
         usb_device_close(device_handle);
-        debug_printf("申请接口失败");
+        g_devices[slot].libusb_handle = NULL;
+        g_devices[slot].interface_claimed = 0;
+        g_devices[slot].ref_count = 0;
+        g_devices[slot].last_access = 0;
+        g_devices[slot].device_id = -1;
+        g_device_count--;
+        g_devices[slot].state = DEVICE_STATE_CLOSED;
+        return USB_ERROR_OTHER;
+    }
+    
+    EnterCriticalSection(&g_device_lock);
+    g_devices[slot].state = DEVICE_STATE_OPEN;
+    serial_index_rebuild();
+    LeaveCriticalSection(&g_device_lock);
+    if (usb_capture_active()) {
+        usb_capture_record(USB_CAPTURE_DEVICE, slot, g_devices[slot].serial, (unsigned int)strlen(g_devices[slot].serial));
+    }
+    
+    debug_printf("成功打开设备: %s, 设备ID: %d", g_devices[slot].serial, g_devices[slot].device_id);
+    return g_devices[slot].device_id;
+}
+
+int usb_middleware_close_device(int device_id) {
+    debug_printf("开始关闭设备: %d", device_id);
+    
+    if (!g_initialized) {
+        debug_printf("中间层未初始化，无法关闭设备: %d", device_id);
+        return USB_ERROR_OTHER;
+    }
+    
+    int slot = find_slot_by_device_id(device_id);
+    
+    // 先从索引中摘除，之后的查找和按id访问都会失败；并发关闭同一设备只有一个能成功
+    EnterCriticalSection(&g_device_lock);
+    if (slot == -1 || g_devices[slot].state != DEVICE_STATE_OPEN || g_devices[slot].device_id != device_id) {
+        LeaveCriticalSection(&g_device_lock);
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    __atomic_store_n(&g_devices[slot].state, DEVICE_STATE_CLOSING, __ATOMIC_SEQ_CST);
+    serial_index_rebuild();
+    LeaveCriticalSection(&g_device_lock);
+    
+    debug_printf("找到设备槽位: %d, 序列号: %s", slot, g_devices[slot].serial);
+    
+    // 先关闭缓冲区：唤醒阻塞在读取上的线程，也让按阻塞/背压策略等待空间的读取线程返回
+    for (int i = 0; i < MAX_PROTOCOL_TYPES; i++) {
+        ring_buffer_shutdown(&g_devices[slot].protocol_buffers[i]);
+    }
+    ring_buffer_shutdown(&g_devices[slot].raw_buffer);
+    spi_rings_shutdown(&g_devices[slot]);
+    spi_frames_wake(&g_devices[slot]);
+    pending_wake(&g_devices[slot]);
+
+    // 已置CLOSING，不会再有新的接口调用进入；等正在执行的调用全部返回后才释放它们用到的资源
+    while (__atomic_load_n(&g_device_refs[slot], __ATOMIC_SEQ_CST) > 0) {
+        Sleep(1);
+    }
+    
+    if (g_devices[slot].read_mode == USB_READ_MODE_SHARED) {
+        debug_printf("从共用事件线程移除: 设备ID %d", device_id);
+        event_loop_detach(&g_devices[slot]);
+    } else if (g_devices[slot].read_thread) {
+        debug_printf("停止读取线程: 设备ID %d", device_id);
+        g_devices[slot].stop_thread = TRUE;
+        // 读取线程在一次传输超时内就会看到stop_thread，不强制终止，避免它持有的锁和传输被遗留
+        WaitForSingleObject(g_devices[slot].read_thread, INFINITE);
+        CloseHandle(g_devices[slot].read_thread);
+        g_devices[slot].read_thread = NULL;
+        debug_printf("线程已停止: 设备ID %d", device_id);
+    } else {
+        debug_printf("没有找到读取线程: 设备ID %d", device_id);
+    }
+    
+    tx_shutdown(&g_devices[slot]);
+    spi_frames_shutdown(&g_devices[slot]);
+    spi_file_shutdown(&g_devices[slot]);
+
+    debug_printf("释放环形缓冲区: 设备ID %d", device_id);
+
+    pending_shutdown(&g_devices[slot]);
+    queue_window_shutdown(&g_devices[slot]);
+
+    for (int i = 0; i < MAX_PROTOCOL_TYPES; i++) {
+        ring_buffer_free(&g_devices[slot].protocol_buffers[i]);
+    }
+    ring_buffer_free(&g_devices[slot].raw_buffer);
+    spi_rings_free(&g_devices[slot]);
+
+    if (g_devices[slot].rx_cache) {
+        free(g_devices[slot].rx_cache);
+        g_devices[slot].rx_cache = NULL;
+    }
+    g_devices[slot].rx_cache_head = 0;
+    g_devices[slot].rx_cache_size = 0;
+    g_devices[slot].rx_cache_capacity = 0;
+    rx_urbs_free(&g_devices[slot]);
+    
+    debug_printf("关闭设备句柄: 设备ID %d", device_id);
+    usb_device_close(g_devices[slot].libusb_handle);
+    
+    EnterCriticalSection(&g_device_lock);
+    memset(&g_devices[slot], 0, sizeof(device_handle_t));
+    g_slot_generation[slot] = (g_slot_generation[slot] + 1) % (0x7FFFFFFF / MAX_DEVICES);
+    g_device_count--;
+    LeaveCriticalSection(&g_device_lock);
+    
+    debug_printf("成功关闭设备: %d", device_id);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_set_read_mode(int mode, int transfer_count, int transfer_size) {
+    if (mode != USB_READ_MODE_SYNC && mode != USB_READ_MODE_ASYNC && mode != USB_READ_MODE_SHARED) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    if (transfer_count <= 0) {
+        transfer_count = USB_ASYNC_DEFAULT_TRANSFERS;
+    }
+    if (transfer_size <= 0) {
+        transfer_size = USB_ASYNC_DEFAULT_TRANSFER_SIZE;
+    }
+    if (transfer_count > USB_ASYNC_MAX_TRANSFERS) {
+        transfer_count = USB_ASYNC_MAX_TRANSFERS;
+    }
+    // 向上取整到512字节(高速批量端点包长)，避免传输中途出现短包
+    transfer_size = (transfer_size + 511) & ~511;
+    g_read_mode = mode;
+    g_async_transfer_count = transfer_count;
+    g_async_transfer_size = transfer_size;
+    debug_printf("读取模式: %s, 传输数: %d, 传输大小: %d",
+                 mode == USB_READ_MODE_SHARED ? "共用事件线程" : (mode == USB_READ_MODE_ASYNC ? "异步" : "同步"),
+                 transfer_count, transfer_size);
+    return USB_SUCCESS;
+}
+
+void usb_middleware_set_spi_mirror(int enable) {
+    g_spi_mirror_enabled = enable ? 1 : 0;
+}
+
+int usb_middleware_set_transport(const char* name) {
+    const usb_transport_t* transport = usb_device_find_transport(name);
+    if (!transport) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    if (g_device_count > 0) {
+        debug_printf("切换传输后端失败: 仍有%d个设备打开", g_device_count);
         return USB_ERROR_ACCESS;
     }
-    
-    g_devices[slot].libusb_handle = device_handle;
-    g_devices[slot].state = DEVICE_STATE_OPEN;
-    g_devices[slot].interface_claimed = 1;
-    g_devices[slot].ref_count = 1;
-    g_devices[slot].last_access = (unsigned int)time(NULL);
-    g_devices[slot].device_id = g_next_device_id++;
-    
-    if (serial) {
-        strncpy(g_devices[slot].serial, serial, sizeof(g_devices[slot].serial) - 1);
+    // 加载时的初始化可能因找不到libusb而失败，这里无论之前状态如何都重新初始化
+    usb_middleware_cleanup();
+    usb_device_set_transport(transport);
+    return usb_middleware_init();
+}
+
+int usb_middleware_start_capture(const char* path, unsigned int buffer_size) {
+    int ret = usb_capture_start(path, buffer_size);
+    if (ret != USB_SUCCESS) {
+        return ret;
+    }
+    // 已打开的设备先记一条序列号，回放时据此枚举设备
+    EnterCriticalSection(&g_device_lock);
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (g_devices[i].state == DEVICE_STATE_OPEN) {
+            usb_capture_record(USB_CAPTURE_DEVICE, i, g_devices[i].serial, (unsigned int)strlen(g_devices[i].serial));
+        }
+    }
+    LeaveCriticalSection(&g_device_lock);
+    return USB_SUCCESS;
+}
+
+void usb_middleware_stop_capture(void) {
+    usb_capture_stop();
+}
+
+int usb_middleware_find_device_by_serial(const char* serial) {
+    if (!g_initialized || !serial) {
+        return -1;
+    }
+    
+    unsigned int hash = serial_hash(serial);
+    for (;;) {
+        unsigned int seq = __atomic_load_n(&g_serial_index_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        int device_id = -1;
+        unsigned int pos = hash & (SERIAL_INDEX_SIZE - 1);
+        for (int n = 0; n < SERIAL_INDEX_SIZE; n++) {
+            unsigned char entry = __atomic_load_n(&g_serial_index[pos], __ATOMIC_RELAXED);
+            if (!entry) {
+                break;
+            }
+            const device_handle_t* device = &g_devices[entry - 1];
+            if (device->serial_hash == hash && strcmp(device->serial, serial) == 0) {
+                device_id = device->device_id;
+                break;
+            }
+            pos = (pos + 1) & (SERIAL_INDEX_SIZE - 1);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g_serial_index_seq, __ATOMIC_RELAXED) == seq) {
+            return device_id;
+        }
+    }
+}
+
+int usb_middleware_is_device_open(int device_id) {
+    if (!g_initialized) {
+        return 0;
+    }
+    
+    return find_slot_by_device_id(device_id) >= 0 ? 1 : 0;
+}
+
+int usb_middleware_read_data(int device_id, unsigned char* data, int length) {
+    if (!g_initialized || !data || length <= 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    
+    DEVICE_REF int slot = device_acquire(device_id);
+    
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    
+    usb_middleware_update_device_access(device_id);
+    int to_read = ring_buffer_read_latest(&g_devices[slot].raw_buffer, data, length);
+    
+    return to_read;
+}
+
+int usb_middleware_write_data(int device_id, unsigned char* data, int length) {
+    if (!g_initialized || !data || length <= 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    
+    DEVICE_REF int slot = device_acquire(device_id);
+    
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    
+    usb_middleware_update_device_access(device_id);
+    device_handle_t* device = &g_devices[slot];
+
+    int start_window = 0;
+    EnterCriticalSection(&device->tx_lock);
+    int ret = tx_submit_locked(device, data, length, &start_window);
+    LeaveCriticalSection(&device->tx_lock);
+    if (ret >= 0) {
+        STAT_ADD(device, tx_packets[0], 1);
+        STAT_ADD(device, tx_bytes[0], length);
+    }
+
+    if (start_window) {
+        tx_kick_flusher();
+    }
+    return ret;
+}
+
+int usb_middleware_send_frame(int device_id, GENERIC_CMD_HEADER* cmd_header,
+                              const void* param_data, size_t param_len,
+                              const void* data_payload, size_t data_len) {
+    if (!g_initialized || !cmd_header || (param_len > 0 && !param_data) || (data_len > 0 && !data_payload)) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    usb_middleware_update_device_access(device_id);
+    device_handle_t* device = &g_devices[slot];
+
+    int total_len = protocol_frame_prepare(cmd_header, param_len, data_len);
+    int ret;
+    int start_window = 0;
+    EnterCriticalSection(&device->tx_lock);
+    if (total_len <= USB_TX_FRAME_SIZE) {
+        // 小帧在设备发送缓冲区中组包，无需malloc
+        ret = build_protocol_frame_into(device->tx_frame, USB_TX_FRAME_SIZE, cmd_header,
+                                        param_data, param_len, data_payload, data_len);
+        if (ret >= 0) {
+            ret = tx_submit_locked(device, device->tx_frame, ret, &start_window);
+        } else {
+            ret = USB_ERROR_INVALID_PARAM;
+        }
+    } else {
+        ret = tx_flush_locked(device);
+        if (ret >= 0) {
+            ret = tx_send_scattered_locked(device, cmd_header, param_data, param_len,
+                                           (const unsigned char*)data_payload, data_len);
+        }
+    }
+    LeaveCriticalSection(&device->tx_lock);
+    if (ret >= 0 && cmd_header->protocol_type < MAX_PROTOCOL_TYPES) {
+        STAT_ADD(device, tx_packets[cmd_header->protocol_type], 1);
+        STAT_ADD(device, tx_bytes[cmd_header->protocol_type], total_len);
+    }
+
+    if (start_window) {
+        tx_kick_flusher();
+    }
+    return ret;
+}
+
+int usb_middleware_send_segmented(int device_id, const GENERIC_CMD_HEADER* cmd_header,
+                                  const void* data_payload, size_t data_len) {
+    if (!g_initialized || !cmd_header || !data_payload || data_len == 0 || data_len > INT_MAX) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    usb_middleware_update_device_access(device_id);
+    device_handle_t* device = &g_devices[slot];
+
+    EnterCriticalSection(&device->tx_lock);
+    int ret = tx_flush_locked(device);
+    if (ret >= 0) {
+        ret = tx_send_segmented_locked(device, cmd_header, (const unsigned char*)data_payload, data_len);
+    }
+    LeaveCriticalSection(&device->tx_lock);
+    if (ret < 0) {
+        return ret;
+    }
+    return (int)data_len;
+}
+
+int usb_middleware_begin_batch(int device_id) {
+    if (!g_initialized) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    EnterCriticalSection(&g_devices[slot].tx_lock);
+    g_devices[slot].tx_batch_active = 1;
+    LeaveCriticalSection(&g_devices[slot].tx_lock);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_flush_batch(int device_id) {
+    if (!g_initialized) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    EnterCriticalSection(&g_devices[slot].tx_lock);
+    g_devices[slot].tx_batch_active = 0;
+    int ret = tx_flush_locked(&g_devices[slot]);
+    LeaveCriticalSection(&g_devices[slot].tx_lock);
+    return ret;
+}
+
+// 等待设备应答前调用：合并缓冲区里的命令必须先发出去
+static void flush_before_wait(device_handle_t* device) {
+    if (!device->tx_ready) {
+        return;
+    }
+    EnterCriticalSection(&device->tx_lock);
+    if (device->tx_batch_len > 0) {
+        (void)tx_flush_locked(device);
+    }
+    LeaveCriticalSection(&device->tx_lock);
+}
+
+int usb_middleware_set_batch_window(int window_ms, int max_bytes) {
+    if (!g_initialized) {
+        return USB_ERROR_OTHER;
+    }
+    if (window_ms < 0) {
+        window_ms = 0;
+    }
+    if (max_bytes <= 0) {
+        max_bytes = USB_BATCH_DEFAULT_BYTES;
+    }
+    if (max_bytes > USB_BATCH_MAX_BYTES) {
+        max_bytes = USB_BATCH_MAX_BYTES;
+    }
+    EnterCriticalSection(&g_batch_lock);
+    // 缩小上限前先发出已有的合并帧
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        device_handle_t* device = &g_devices[i];
+        if (device->state == DEVICE_STATE_OPEN && device->tx_ready) {
+            EnterCriticalSection(&device->tx_lock);
+            (void)tx_flush_locked(device);
+            LeaveCriticalSection(&device->tx_lock);
+        }
+    }
+    g_batch_window_ms = window_ms;
+    g_batch_max_bytes = max_bytes;
+    if (window_ms > 0 && !g_batch_thread) {
+        g_batch_thread_stop = 0;
+        g_batch_thread = CreateThread(NULL, 0, batch_flush_thread_func, NULL, 0, NULL);
+        if (!g_batch_thread) {
+            g_batch_window_ms = 0;
+            LeaveCriticalSection(&g_batch_lock);
+            debug_printf("创建合并发送线程失败");
+            return USB_ERROR_OTHER;
+        }
+    }
+    WakeConditionVariable(&g_batch_cond);
+    LeaveCriticalSection(&g_batch_lock);
+    debug_printf("命令合并窗口: %d ms, 单次上限: %d 字节", window_ms, max_bytes);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_request_begin(int device_id, uint8_t protocol, uint8_t cmd_id, uint8_t device_index) {
+    if (!g_initialized) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    int request = USB_ERROR_BUSY;
+    EnterCriticalSection(&device->pending_lock);
+    for (int i = 0; i < USB_MAX_PENDING_REQUESTS; i++) {
+        pending_request_t* req = &device->pending[i];
+        if (!req->in_use) {
+            req->in_use = 1;
+            req->completed = 0;
+            req->protocol = protocol;
+            req->cmd_id = cmd_id;
+            req->device_index = device_index;
+            req->seq = device->pending_seq++;
+            req->response_len = 0;
+            __atomic_add_fetch(&device->pending_count, 1, __ATOMIC_RELEASE);
+            request = i;
+            break;
+        }
+    }
+    LeaveCriticalSection(&device->pending_lock);
+    if (request < 0) {
+        debug_printf("等待应答的命令过多: 设备ID %d", device_id);
+    }
+    return request;
+}
+
+int usb_middleware_request_wait(int device_id, int request, unsigned char* response, int length, int timeout_ms) {
+    if (!g_initialized || request < 0 || request >= USB_MAX_PENDING_REQUESTS) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    pending_request_t* req = &device->pending[request];
+    flush_before_wait(device);
+    unsigned long long deadline = monotonic_ms() + (unsigned long long)(timeout_ms > 0 ? timeout_ms : 0);
+
+    EnterCriticalSection(&device->pending_lock);
+    __atomic_add_fetch(&device->pending_waiters, 1, __ATOMIC_ACQ_REL);
+    while (!req->completed && !device->pending_closed) {
+        DWORD wait_ms = INFINITE;
+        if (timeout_ms >= 0) {
+            unsigned long long now = monotonic_ms();
+            if (now >= deadline) {
+                break;
+            }
+            wait_ms = (DWORD)(deadline - now);
+        }
+        SleepConditionVariableCS(&device->pending_cond, &device->pending_lock, wait_ms);
+    }
+    int result;
+    if (req->completed) {
+        result = req->response_len < length ? req->response_len : length;
+        if (response && result > 0) {
+            memcpy(response, req->response, result);
+        }
+    } else if (device->pending_closed) {
+        result = USB_ERROR_NOT_FOUND;
     } else {
-        strcpy(g_devices[slot].serial, "UNKNOWN");
+        result = USB_ERROR_TIMEOUT;
     }
-    
-    g_device_count++;
-    
-    ring_buffer_t* spi_rb = &g_devices[slot].protocol_buffers[PROTOCOL_SPI];
-    spi_rb->size = SPI_BUFFER_SIZE;
-    spi_rb->buffer = (unsigned char*)malloc(SPI_BUFFER_SIZE);
-    spi_rb->write_pos = 0;
-    spi_rb->read_pos = 0;
-    spi_rb->data_size = 0;
-    InitializeCriticalSection(&spi_rb->cs);
-    
-    ring_buffer_t* power_rb = &g_devices[slot].protocol_buffers[PROTOCOL_POWER];
-    power_rb->size = POWER_BUFFER_SIZE;
-    power_rb->buffer = (unsigned char*)malloc(POWER_BUFFER_SIZE);
-    power_rb->write_pos = 0;
-    power_rb->read_pos = 0;
-    power_rb->data_size = 0;
-    InitializeCriticalSection(&power_rb->cs);
-    
-    ring_buffer_t* pwm_rb = &g_devices[slot].protocol_buffers[PROTOCOL_PWM];
-    pwm_rb->size = PWM_BUFFER_SIZE;
-    pwm_rb->buffer = (unsigned char*)malloc(PWM_BUFFER_SIZE);
-    pwm_rb->write_pos = 0;
-    pwm_rb->read_pos = 0;
-    pwm_rb->data_size = 0;
-    InitializeCriticalSection(&pwm_rb->cs);
-    
-    ring_buffer_t* uart_rb = &g_devices[slot].protocol_buffers[PROTOCOL_UART];
-    uart_rb->size = UART_BUFFER_SIZE;
-    uart_rb->buffer = (unsigned char*)malloc(UART_BUFFER_SIZE);
-    uart_rb->write_pos = 0;
-    uart_rb->read_pos = 0;
-    uart_rb->data_size = 0;
-    InitializeCriticalSection(&uart_rb->cs);
-    
-    ring_buffer_t* status_rb = &g_devices[slot].protocol_buffers[PROTOCOL_STATUS];
-    status_rb->size = STATUS_BUFFER_SIZE;
-    status_rb->buffer = (unsigned char*)malloc(STATUS_BUFFER_SIZE);
-    status_rb->write_pos = 0;
-    status_rb->read_pos = 0;
-    status_rb->data_size = 0;
-    InitializeCriticalSection(&status_rb->cs);
-    
-    ring_buffer_t* raw_rb = &g_devices[slot].raw_buffer;
-    raw_rb->size = RAW_BUFFER_SIZE;
-    raw_rb->buffer = (unsigned char*)malloc(RAW_BUFFER_SIZE);
-    raw_rb->write_pos = 0;
-    raw_rb->read_pos = 0;
-    raw_rb->data_size = 0;
-    InitializeCriticalSection(&raw_rb->cs);
+    if (req->in_use) {
+        req->in_use = 0;
+        __atomic_sub_fetch(&device->pending_count, 1, __ATOMIC_RELEASE);
+    }
+    LeaveCriticalSection(&device->pending_lock);
+    // 最后一步才注销，pending_shutdown据此判断可以安全释放
+    __atomic_sub_fetch(&device->pending_waiters, 1, __ATOMIC_ACQ_REL);
+    return result;
+}
 
-    g_devices[slot].rx_cache = NULL;
-    g_devices[slot].rx_cache_size = 0;
-    g_devices[slot].rx_cache_capacity = 0;
-    (void)ensure_rx_cache_capacity(&g_devices[slot], RX_CACHE_INITIAL_CAPACITY);
-    
-    g_devices[slot].stop_thread = FALSE;
-    g_devices[slot].thread_running = TRUE;
-    
-    g_devices[slot].read_thread = CreateThread(NULL, 0, usb_device_read_thread_func, &g_devices[slot], 0, NULL);
-    if (!g_devices[slot].read_thread) {
-        if (g_devices[slot].rx_cache) {
-            free(g_devices[slot].rx_cache);
-            g_devices[slot].rx_cache = NULL;
+void usb_middleware_request_cancel(int device_id, int request) {
+    if (!g_initialized || request < 0 || request >= USB_MAX_PENDING_REQUESTS) {
+        return;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        return;
+    }
+    device_handle_t* device = &g_devices[slot];
+    EnterCriticalSection(&device->pending_lock);
+    if (device->pending[request].in_use) {
+        device->pending[request].in_use = 0;
+        __atomic_sub_fetch(&device->pending_count, 1, __ATOMIC_RELEASE);
+    }
+    LeaveCriticalSection(&device->pending_lock);
+}
+
+// 取出最早的在途条目并等它的应答，调用方持有qw_lock。
+// 应答按发送顺序到达，所以先到的入队应答累加估计值，随后深度查询的应答再以设备实际深度覆盖
+static int queue_reap_locked(device_handle_t* device, int device_id, int timeout_ms) {
+    queue_inflight_t entry = device->qw_fifo[device->qw_head];
+    device->qw_head = (device->qw_head + 1) % (USB_QUEUE_WINDOW_MAX + 1);
+    device->qw_count--;
+    if (entry.is_query) {
+        device->qw_query_pending = 0;
+    } else {
+        device->qw_frames--;
+        device->qw_inflight[entry.device_index]--;
+    }
+
+    unsigned char response[16];
+    int n = usb_middleware_request_wait(device_id, entry.request, response, sizeof(response), timeout_ms);
+    if (n == USB_ERROR_NOT_FOUND) {
+        return n;
+    }
+    int replied = n >= (int)sizeof(GENERIC_CMD_HEADER) + 1;
+    uint8_t value = replied ? response[sizeof(GENERIC_CMD_HEADER)] : 0;
+    if (entry.is_query) {
+        if (replied) {
+            device->qw_depth[entry.device_index] = value;
+            device->qw_stats.last_depth = value;
+        } else {
+            debug_printf("队列深度查询无应答: 设备ID %d, 索引 %d", device_id, entry.device_index);
         }
-        g_devices[slot].rx_cache_size = 0;
-        g_devices[slot].rx_cache_capacity = 0;
-        DeleteCriticalSection(&spi_rb->cs);
-        DeleteCriticalSection(&raw_rb->cs);
-        free(spi_rb->buffer);
-        free(raw_rb->buffer);
-        usb_device_release_interface(device_handle, 0);
-        usb_device_close(device_handle);
-        g_devices[slot].state = DEVICE_STATE_CLOSED;
-        g_devices[slot].libusb_handle = NULL;
-        g_devices[slot].interface_claimed = 0;
-        g_devices[slot].ref_count = 0;
-        g_devices[slot].last_access = 0;
-        g_devices[slot].device_id = -1;
-        return USB_ERROR_OTHER;
+        return USB_SUCCESS;
     }
-    
-    debug_printf("成功打开设备: %s, 设备ID: %d", g_devices[slot].serial, g_devices[slot].device_id);
-    return g_devices[slot].device_id;
+    if (!replied) {
+        device->qw_stats.timeouts++;
+        device->qw_failed++;
+        debug_printf("队列写入无应答: 设备ID %d, 索引 %d", device_id, entry.device_index);
+    } else if (value == 0) {
+        device->qw_stats.accepted++;
+        device->qw_depth[entry.device_index]++;
+    } else {
+        device->qw_stats.rejected++;
+        device->qw_failed++;
+        if (device->qw_capacity > 0) {
+            device->qw_depth[entry.device_index] = device->qw_capacity;
+        }
+    }
+    return USB_SUCCESS;
 }
 
-int usb_middleware_close_device(int device_id) {
-    debug_printf("开始关闭设备: %d", device_id);
-    
+// 登记应答、发出一帧并排进在途队列，调用方持有qw_lock
+static int queue_send_locked(device_handle_t* device, int device_id, GENERIC_CMD_HEADER* cmd_header,
+                             const void* data_payload, size_t data_len, int is_query) {
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_STATUS, cmd_header->cmd_id,
+                                               cmd_header->device_index);
+    if (request < 0) {
+        return request;
+    }
+    int ret = usb_middleware_send_frame(device_id, cmd_header, NULL, 0, data_payload, data_len);
+    if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
+        return ret;
+    }
+    int tail = (device->qw_head + device->qw_count) % (USB_QUEUE_WINDOW_MAX + 1);
+    device->qw_fifo[tail].request = request;
+    device->qw_fifo[tail].device_index = cmd_header->device_index;
+    device->qw_fifo[tail].is_query = (uint8_t)is_query;
+    device->qw_count++;
+    if (is_query) {
+        device->qw_query_pending = 1;
+    } else {
+        device->qw_frames++;
+        device->qw_inflight[cmd_header->device_index]++;
+    }
+    return USB_SUCCESS;
+}
+
+static int queue_drain_locked(device_handle_t* device, int device_id, int timeout_ms) {
+    int ret = USB_SUCCESS;
+    while (device->qw_count > 0 && ret == USB_SUCCESS) {
+        ret = queue_reap_locked(device, device_id, timeout_ms);
+    }
+    return ret;
+}
+
+int usb_middleware_set_queue_window(int device_id, int window, int capacity) {
+    if (!g_initialized || capacity < 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    if (window < 1) {
+        window = 1;
+    } else if (window > USB_QUEUE_WINDOW_MAX) {
+        window = USB_QUEUE_WINDOW_MAX;
+    }
+    EnterCriticalSection(&device->qw_lock);
+    int ret = queue_drain_locked(device, device_id, USB_QUEUE_REPLY_TIMEOUT_MS);
+    device->qw_window = window;
+    device->qw_capacity = capacity > 255 ? 255 : capacity;
+    // 设备队列当前深度未知，先当作已满，第一次写入前会查询
+    for (int i = 0; i < 256; i++) {
+        device->qw_depth[i] = device->qw_capacity;
+    }
+    LeaveCriticalSection(&device->qw_lock);
+    debug_printf("队列写入窗口: 设备ID %d, 窗口 %d, 队列容量 %d", device_id, window, capacity);
+    return ret;
+}
+
+int usb_middleware_get_queue_window(int device_id) {
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        return USB_ERROR_NOT_FOUND;
+    }
+    return __atomic_load_n(&g_devices[slot].qw_window, __ATOMIC_RELAXED);
+}
+
+int usb_middleware_queue_write(int device_id, GENERIC_CMD_HEADER* cmd_header, const void* data_payload,
+                               size_t data_len, uint8_t status_cmd_id) {
+    if (!g_initialized || !cmd_header || (data_len > 0 && !data_payload)) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    uint8_t index = cmd_header->device_index;
+    int ret = USB_SUCCESS;
+    // 设备一直应答队列满时不能无限查询下去，整个调用最多等一个应答超时
+    unsigned long long deadline = usb_now_us() + (unsigned long long)USB_QUEUE_REPLY_TIMEOUT_MS * 1000ULL;
+
+    EnterCriticalSection(&device->qw_lock);
+    while (ret == USB_SUCCESS) {
+        int window_full = device->qw_frames >= device->qw_window;
+        if (!window_full && (device->qw_capacity <= 0 ||
+            device->qw_depth[index] + device->qw_inflight[index] < device->qw_capacity)) {
+            break;
+        }
+        if (usb_now_us() >= deadline) {
+            ret = window_full ? USB_ERROR_TIMEOUT : USB_ERROR_BUSY;
+            break;
+        }
+        if (window_full) {
+            device->qw_stats.window_waits++;
+            ret = queue_reap_locked(device, device_id, USB_QUEUE_REPLY_TIMEOUT_MS);
+            continue;
+        }
+        // 估计设备队列已满：跟在在途帧后面发一个深度查询，它的应答反映这些帧处理后的实际深度
+        if (!device->qw_query_pending) {
+            if (device->qw_count == 0 && device->qw_stats.depth_queries > 0 &&
+                device->qw_depth[index] >= device->qw_capacity) {
+                Sleep(1);   // 上次查询仍是满的，等设备消耗一些再查
+            }
+            GENERIC_CMD_HEADER query;
+            query.protocol_type = cmd_header->protocol_type;
+            query.cmd_id = status_cmd_id;
+            query.device_index = index;
+            query.param_count = 0;
+            query.data_len = 0;
+            ret = queue_send_locked(device, device_id, &query, NULL, 0, 1);
+            if (ret == USB_SUCCESS) {
+                device->qw_stats.depth_queries++;
+            }
+            continue;
+        }
+        ret = queue_reap_locked(device, device_id, USB_QUEUE_REPLY_TIMEOUT_MS);
+    }
+    if (ret == USB_SUCCESS) {
+        ret = queue_send_locked(device, device_id, cmd_header, data_payload, data_len, 0);
+        if (ret == USB_SUCCESS) {
+            device->qw_stats.sent++;
+        }
+    }
+    LeaveCriticalSection(&device->qw_lock);
+    if (ret < 0) {
+        debug_printf("队列写入失败: 设备ID %d, 索引 %d, 错误 %d", device_id, index, ret);
+    }
+    return ret;
+}
+
+int usb_middleware_queue_drain(int device_id, int timeout_ms) {
     if (!g_initialized) {
-        debug_printf("中间层未初始化，无法关闭设备: %d", device_id);
-        return USB_ERROR_OTHER;
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    EnterCriticalSection(&device->qw_lock);
+    int ret = queue_drain_locked(device, device_id, timeout_ms);
+    if (ret == USB_SUCCESS) {
+        ret = device->qw_failed;
+        device->qw_failed = 0;
+    }
+    LeaveCriticalSection(&device->qw_lock);
+    return ret;
+}
+
+int usb_middleware_get_queue_stats(int device_id, usb_queue_stats_t* stats) {
+    if (!g_initialized || !stats) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    EnterCriticalSection(&device->qw_lock);
+    *stats = device->qw_stats;
+    stats->in_flight = device->qw_frames;
+    LeaveCriticalSection(&device->qw_lock);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_start_spi_frames(int device_id, int spi_index, const usb_frame_config_t* config) {
+    if (!g_initialized || !config || spi_index < 0 || spi_index > 255) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    usb_frame_capture_t* fc = usb_frame_create(config);
+    if (!fc) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    spi_frames_stop(device, -1);
+    EnterCriticalSection(&device->frame_lock);
+    device->spi_frame_index = (uint8_t)spi_index;
+    __atomic_store_n(&device->spi_frames, fc, __ATOMIC_SEQ_CST);
+    LeaveCriticalSection(&device->frame_lock);
+    debug_printf("开始SPI分帧采集: 设备ID %d, SPI索引 %d, 帧长 %u, 同步字 %u字节",
+                 device_id, spi_index, config->frame_size, config->sync_len);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_stop_spi_frames(int device_id, int spi_index) {
+    if (!g_initialized || spi_index < 0 || spi_index > 255) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    if (spi_frames_stop(&g_devices[slot], spi_index) < 0) {
+        debug_printf("停止SPI分帧采集失败: 设备ID %d 正在采集的不是SPI索引 %d", device_id, spi_index);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return USB_SUCCESS;
+}
+
+// 登记为读取方后返回当前的分帧采集，用完调用spi_frames_release
+static usb_frame_capture_t* spi_frames_acquire(device_handle_t* device, int spi_index) {
+    EnterCriticalSection(&device->frame_lock);
+    usb_frame_capture_t* fc = device->spi_frames;
+    // 关闭设备在frame_lock内唤醒读取方，之后开始的采集不会再被唤醒，所以关闭中不再登记
+    if (fc && (spi_index < 0 || device->spi_frame_index == spi_index) &&
+        __atomic_load_n(&device->state, __ATOMIC_SEQ_CST) == DEVICE_STATE_OPEN) {
+        __atomic_add_fetch(&device->spi_frame_users, 1, __ATOMIC_ACQ_REL);
+    } else {
+        fc = NULL;
+    }
+    LeaveCriticalSection(&device->frame_lock);
+    return fc;
+}
+
+static void spi_frames_release(device_handle_t* device) {
+    __atomic_sub_fetch(&device->spi_frame_users, 1, __ATOMIC_ACQ_REL);
+}
+
+int usb_middleware_read_spi_frame(int device_id, int spi_index, unsigned char* data, int length,
+                                  usb_frame_info_t* info, int timeout_ms) {
+    if (!g_initialized || !data || length <= 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    usb_frame_capture_t* fc = spi_frames_acquire(device, spi_index);
+    if (!fc) {
+        return USB_ERROR_NOT_FOUND;
+    }
+    int ret = usb_frame_read(fc, data, length, info, timeout_ms);
+    spi_frames_release(device);
+    return ret;
+}
+
+int usb_middleware_get_spi_frame_stats(int device_id, int spi_index, usb_frame_stats_t* stats) {
+    if (!g_initialized || !stats || spi_index < 0 || spi_index > 255) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    usb_frame_capture_t* fc = spi_frames_acquire(device, spi_index);
+    if (!fc) {
+        memset(stats, 0, sizeof(*stats));
+        return USB_ERROR_NOT_FOUND;
+    }
+    usb_frame_get_stats(fc, stats);
+    spi_frames_release(device);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_start_spi_file(int device_id, int spi_index, const char* path, const usb_ring_file_options_t* options) {
+    if (!g_initialized || !path || spi_index < 0 || spi_index > 255) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    ring_buffer_t* rb = spi_ring(device, spi_index, 1);
+    EnterCriticalSection(&device->file_lock);
+    if (device->spi_file) {
+        LeaveCriticalSection(&device->file_lock);
+        debug_printf("SPI数据已在落盘: 设备ID %d", device_id);
+        return USB_ERROR_ACCESS;
+    }
+    device->spi_file = usb_ring_file_start(rb, path, options);
+    int ret = device->spi_file ? USB_SUCCESS : USB_ERROR_IO;
+    if (device->spi_file) {
+        device->spi_file_index = spi_index;
+        memset(&device->spi_file_stats, 0, sizeof(device->spi_file_stats));
+    }
+    LeaveCriticalSection(&device->file_lock);
+    if (ret == USB_SUCCESS) {
+        debug_printf("开始SPI数据落盘: 设备ID %d, SPI索引 %d, %s", device_id, spi_index, path);
+    }
+    return ret;
+}
+
+int usb_middleware_stop_spi_file(int device_id, int spi_index, usb_ring_file_stats_t* stats) {
+    if (!g_initialized || spi_index < 0 || spi_index > 255) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    // 停止要等最后一块写完，期间读取统计的线程也在file_lock上等待
+    EnterCriticalSection(&device->file_lock);
+    if (device->spi_file && device->spi_file_index != spi_index) {
+        LeaveCriticalSection(&device->file_lock);
+        debug_printf("停止SPI数据落盘失败: 设备ID %d 正在落盘的不是SPI索引 %d", device_id, spi_index);
+        return USB_ERROR_NOT_FOUND;
+    }
+    if (device->spi_file) {
+        usb_ring_file_stop(device->spi_file, &device->spi_file_stats);
+        device->spi_file = NULL;
+    }
+    if (stats) {
+        *stats = device->spi_file_stats;
+    }
+    LeaveCriticalSection(&device->file_lock);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_get_spi_file_stats(int device_id, int spi_index, usb_ring_file_stats_t* stats) {
+    if (!g_initialized || !stats || spi_index < 0 || spi_index > 255) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        return USB_ERROR_NOT_FOUND;
+    }
+    device_handle_t* device = &g_devices[slot];
+    EnterCriticalSection(&device->file_lock);
+    if (device->spi_file_index >= 0 && device->spi_file_index != spi_index) {
+        LeaveCriticalSection(&device->file_lock);
+        memset(stats, 0, sizeof(*stats));
+        return USB_ERROR_NOT_FOUND;
+    }
+    if (device->spi_file) {
+        usb_ring_file_get_stats(device->spi_file, stats);
+    } else {
+        *stats = device->spi_file_stats;
+    }
+    LeaveCriticalSection(&device->file_lock);
+    return USB_SUCCESS;
+}
+
+void usb_middleware_update_device_access(int device_id) {
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot >= 0) {
+        g_devices[slot].last_access = (unsigned int)time(NULL);
+    }
+}
+
+int usb_middleware_get_device_count(void) {
+    return g_device_count;
+}
+
+int usb_middleware_get_resync_stats(int device_id, unsigned long long* skipped_bytes, unsigned long long* resync_count) {
+    if (!g_initialized) {
+        return USB_ERROR_INVALID_PARAM;
     }
-    
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot >= 0) {
+        if (skipped_bytes) {
+            *skipped_bytes = g_devices[slot].rx_skipped_bytes;
+        }
+        if (resync_count) {
+            *resync_count = g_devices[slot].rx_resync_count;
         }
+        return USB_SUCCESS;
     }
-    
+    debug_printf("设备未找到或未打开: %d", device_id);
+    return USB_ERROR_NOT_FOUND;
+}
+
+// protocol为协议类型(PROTOCOL_SPI等)，-1为原始数据缓冲区；该协议没有缓冲区时返回NULL
+static ring_buffer_t* device_ring(int slot, int protocol) {
+    if (protocol < 0) {
+        return &g_devices[slot].raw_buffer;
+    }
+    if (protocol >= MAX_PROTOCOL_TYPES || !g_devices[slot].protocol_buffers[protocol].initialized) {
+        return NULL;
+    }
+    return &g_devices[slot].protocol_buffers[protocol];
+}
+
+int usb_middleware_set_overflow_policy(int device_id, int protocol, int policy, int timeout_ms) {
+    if (!g_initialized || timeout_ms < 0) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
         return USB_ERROR_NOT_FOUND;
     }
-    
-    debug_printf("找到设备槽位: %d, 序列号: %s", slot, g_devices[slot].serial);
-    
-    if (g_devices[slot].read_thread) {
-        debug_printf("停止读取线程: 设备ID %d", device_id);
-        g_devices[slot].stop_thread = TRUE;
-        if (WaitForSingleObject(g_devices[slot].read_thread, 3000) == WAIT_TIMEOUT) {
-            debug_printf("线程等待超时，强制终止: 设备ID %d", device_id);
-            TerminateThread(g_devices[slot].read_thread, 0);
+    // 异步/共用事件线程模式下生产者是libusb传输回调，在回调里等待会停住事件处理，
+    // 所有设备的应答都跟着延迟，所以这两种策略只用于同步读取线程
+    if ((policy == RING_OVERFLOW_BLOCK || policy == RING_OVERFLOW_BACKPRESSURE) &&
+        g_devices[slot].read_mode != USB_READ_MODE_SYNC) {
+        debug_printf("设置溢出策略失败: 设备%d 读取模式%d 不支持阻塞/背压", device_id, g_devices[slot].read_mode);
+        return USB_ERROR_INVALID_PARAM;
+    }
+    ring_buffer_t* rb = device_ring(slot, protocol);
+    if (!rb || ring_buffer_set_overflow_policy(rb, policy, (unsigned int)timeout_ms) != 0) {
+        debug_printf("设置溢出策略失败: 协议%d, 策略%d", protocol, policy);
+        return USB_ERROR_INVALID_PARAM;
+    }
+    if (protocol == PROTOCOL_SPI) {
+        // 各SPI索引的独立缓冲区使用同一策略，之后建立的也沿用
+        for (int i = 1; i < USB_SPI_RING_INDEXES; i++) {
+            ring_buffer_t* index_rb = __atomic_load_n(&g_devices[slot].spi_rings[i], __ATOMIC_ACQUIRE);
+            if (index_rb) {
+                ring_buffer_set_overflow_policy(index_rb, policy, (unsigned int)timeout_ms);
+            }
         }
-        CloseHandle(g_devices[slot].read_thread);
-        g_devices[slot].read_thread = NULL;
-        debug_printf("线程已停止: 设备ID %d", device_id);
-    } else {
-        debug_printf("没有找到读取线程: 设备ID %d", device_id);
     }
-    
-    debug_printf("释放环形缓冲区: 设备ID %d", device_id);
+    debug_printf("设备%d 协议%d 溢出策略: %d, 超时%dms", device_id, protocol, policy, timeout_ms);
+    return USB_SUCCESS;
+}
 
-    ring_buffer_t* spi_rb = &g_devices[slot].protocol_buffers[PROTOCOL_SPI];
-    EnterCriticalSection(&spi_rb->cs);
-    if (spi_rb->buffer) {
-        free(spi_rb->buffer);
-        spi_rb->buffer = NULL;
+int usb_middleware_get_ring_stats(int device_id, int protocol, ring_buffer_stats_t* stats) {
+    if (!g_initialized || !stats) {
+        return USB_ERROR_INVALID_PARAM;
     }
-    LeaveCriticalSection(&spi_rb->cs);
-    DeleteCriticalSection(&spi_rb->cs);
-    
-    ring_buffer_t* power_rb = &g_devices[slot].protocol_buffers[PROTOCOL_POWER];
-    EnterCriticalSection(&power_rb->cs);
-    if (power_rb->buffer) {
-        free(power_rb->buffer);
-        power_rb->buffer = NULL;
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
     }
-    LeaveCriticalSection(&power_rb->cs);
-    DeleteCriticalSection(&power_rb->cs);
-    
-    ring_buffer_t* pwm_rb = &g_devices[slot].protocol_buffers[PROTOCOL_PWM];
-    EnterCriticalSection(&pwm_rb->cs);
-    if (pwm_rb->buffer) {
-        free(pwm_rb->buffer);
-        pwm_rb->buffer = NULL;
+    ring_buffer_t* rb = device_ring(slot, protocol);
+    if (!rb) {
+        return USB_ERROR_INVALID_PARAM;
     }
-    LeaveCriticalSection(&pwm_rb->cs);
-    DeleteCriticalSection(&pwm_rb->cs);
-    
-    ring_buffer_t* uart_rb = &g_devices[slot].protocol_buffers[PROTOCOL_UART];
-    EnterCriticalSection(&uart_rb->cs);
-    if (uart_rb->buffer) {
-        free(uart_rb->buffer);
-        uart_rb->buffer = NULL;
+    ring_buffer_get_stats(rb, stats);
+    return USB_SUCCESS;
+}
+
+void usb_middleware_record_latency(int device_id, int kind, unsigned long long start_us) {
+    if (!g_initialized || kind < 0 || kind >= USB_LATENCY_KINDS) {
+        return;
     }
-    LeaveCriticalSection(&uart_rb->cs);
-    DeleteCriticalSection(&uart_rb->cs);
-    
-    ring_buffer_t* status_rb = &g_devices[slot].protocol_buffers[PROTOCOL_STATUS];
-    EnterCriticalSection(&status_rb->cs);
-    if (status_rb->buffer) {
-        free(status_rb->buffer);
-        status_rb->buffer = NULL;
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        return;
     }
-    LeaveCriticalSection(&status_rb->cs);
-    DeleteCriticalSection(&status_rb->cs);
-    
-    ring_buffer_t* raw_rb = &g_devices[slot].raw_buffer;
-    EnterCriticalSection(&raw_rb->cs);
-    if (raw_rb->buffer) {
-        free(raw_rb->buffer);
-        raw_rb->buffer = NULL;
+    unsigned long long us = usb_now_us() - start_us;
+    int bucket = 0;
+    while (bucket < USB_LATENCY_BUCKETS - 1 && (us >> (bucket + 1)) != 0) {
+        bucket++;
     }
-    LeaveCriticalSection(&raw_rb->cs);
-    DeleteCriticalSection(&raw_rb->cs);
-
-    if (g_devices[slot].rx_cache) {
-        free(g_devices[slot].rx_cache);
-        g_devices[slot].rx_cache = NULL;
+    usb_latency_hist_t* hist = &g_devices[slot].stats.latency[kind];
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total_us, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+    unsigned long long max_us = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+    while (us > max_us &&
+           !__atomic_compare_exchange_n(&hist->max_us, &max_us, us, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
     }
-    g_devices[slot].rx_cache_size = 0;
-    g_devices[slot].rx_cache_capacity = 0;
-    
-    debug_printf("关闭设备句柄: 设备ID %d", device_id);
-    usb_device_close(g_devices[slot].libusb_handle);
-    
-    memset(&g_devices[slot], 0, sizeof(device_handle_t));
-    g_device_count--;
-    
-    debug_printf("成功关闭设备: %d", device_id);
-    return USB_SUCCESS;
 }
 
-int usb_middleware_find_device_by_serial(const char* serial) {
-    if (!g_initialized || !serial) {
-        return -1;
+int usb_middleware_get_stats(int device_id, usb_device_stats_t* stats) {
+    if (!g_initialized || !stats) {
+        return USB_ERROR_INVALID_PARAM;
     }
-    
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].state == DEVICE_STATE_OPEN && 
-            strcmp(g_devices[i].serial, serial) == 0) {
-            return g_devices[i].device_id;
-        }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
     }
-    
-    return -1;
+    device_handle_t* device = &g_devices[slot];
+    // 逐个原子读取，各计数之间不保证是同一时刻的快照
+    const unsigned long long* src = (const unsigned long long*)&device->stats;
+    unsigned long long* dst = (unsigned long long*)stats;
+    for (size_t i = 0; i < sizeof(usb_device_stats_t) / sizeof(unsigned long long); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < MAX_PROTOCOL_TYPES; i++) {
+        stats->ring_high_water[i] = device->protocol_buffers[i].initialized ?
+                                    __atomic_load_n(&device->protocol_buffers[i].high_water, __ATOMIC_RELAXED) : 0;
+    }
+    stats->resync_count = __atomic_load_n(&device->rx_resync_count, __ATOMIC_RELAXED);
+    stats->skipped_bytes = __atomic_load_n(&device->rx_skipped_bytes, __ATOMIC_RELAXED);
+    return USB_SUCCESS;
 }
 
-int usb_middleware_is_device_open(int device_id) {
+int usb_middleware_reset_stats(int device_id) {
     if (!g_initialized) {
-        return 0;
+        return USB_ERROR_INVALID_PARAM;
     }
-    
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id) {
-            return g_devices[i].state == DEVICE_STATE_OPEN ? 1 : 0;
-        }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
     }
-    
-    return 0;
+    device_handle_t* device = &g_devices[slot];
+    unsigned long long* counters = (unsigned long long*)&device->stats;
+    for (size_t i = 0; i < sizeof(usb_device_stats_t) / sizeof(unsigned long long); i++) {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < MAX_PROTOCOL_TYPES; i++) {
+        ring_buffer_reset_stats(&device->protocol_buffers[i]);
+    }
+    ring_buffer_reset_stats(&device->raw_buffer);
+    __atomic_store_n(&device->rx_resync_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&device->rx_skipped_bytes, 0, __ATOMIC_RELAXED);
+    return USB_SUCCESS;
 }
 
-int usb_middleware_read_data(int device_id, unsigned char* data, int length) {
+int usb_middleware_read_spi_data(int device_id, unsigned char* data, int length) {
     if (!g_initialized || !data || length <= 0) {
         return USB_ERROR_INVALID_PARAM;
     }
-    
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
-    
+    DEVICE_REF int slot = device_acquire(device_id);
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
         return USB_ERROR_NOT_FOUND;
     }
-    
     usb_middleware_update_device_access(device_id);
-    ring_buffer_t* rb = &g_devices[slot].raw_buffer;
-    EnterCriticalSection(&rb->cs);
-    int available = rb->data_size;
-    int to_read = (available < length) ? available : length;
-    if (to_read > 0) {
-        int start_pos;
-        if (available <= length) {
-            start_pos = rb->read_pos;
-        } else {
-            start_pos = (rb->write_pos - length + rb->size) % rb->size;
-        }
-        if (start_pos + to_read <= rb->size) {
-            memcpy(data, rb->buffer + start_pos, to_read);
-        } else {
-            int first_part = rb->size - start_pos;
-            memcpy(data, rb->buffer + start_pos, first_part);
-            memcpy(data + first_part, rb->buffer, to_read - first_part);
-        }
-        if (available <= length) {
-            rb->read_pos = rb->write_pos;
-            rb->data_size = 0;
-        }
-    }
-    LeaveCriticalSection(&rb->cs);
+    ring_buffer_t* spi_rb = &g_devices[slot].protocol_buffers[PROTOCOL_SPI];
+    int to_read = ring_buffer_read(spi_rb, data, length);
+    
+//     if (to_read > 0) {
+//         debug_printf("从SPI缓冲区读取了 %d 字节数据", to_read);
+//     }
     
     return to_read;
 }
 
-int usb_middleware_write_data(int device_id, unsigned char* data, int length) {
+// 等待指定缓冲区(protocol为-1时是原始数据缓冲区，PROTOCOL_SPI时按spi_index选择)至少有min_bytes字节或超时后读取
+static int read_ring_timeout(int device_id, int protocol, int spi_index, unsigned char* data, int length,
+                             int min_bytes, int timeout_ms) {
     if (!g_initialized || !data || length <= 0) {
         return USB_ERROR_INVALID_PARAM;
     }
-    
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
-    
+    DEVICE_REF int slot = device_acquire(device_id);
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
         return USB_ERROR_NOT_FOUND;
     }
-    
     usb_middleware_update_device_access(device_id);
-    
-    int transferred = 0;
-    int ret = usb_device_bulk_transfer(g_devices[slot].libusb_handle, 0x01, data, length, &transferred, 1000);
-    if (ret < 0) {
-        debug_printf("写入数据失败: %d", ret);
-        return USB_ERROR_IO;
+    ring_buffer_t* rb;
+    if (protocol < 0) {
+        rb = &g_devices[slot].raw_buffer;
+    } else if (protocol == PROTOCOL_SPI) {
+        rb = spi_ring(&g_devices[slot], spi_index, 1);
+    } else {
+        rb = &g_devices[slot].protocol_buffers[protocol];
     }
-    
-    return transferred;
+    if (min_bytes > length) {
+        min_bytes = length;
+    }
+    if (timeout_ms != 0) {
+        flush_before_wait(&g_devices[slot]);
+    }
+    unsigned int wait_ms = timeout_ms < 0 ? INFINITE : (unsigned int)timeout_ms;
+    if (ring_buffer_wait(rb, (unsigned int)min_bytes, wait_ms) < 0) {
+        debug_printf("设备已关闭，读取中止: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    if (protocol < 0) {
+        return ring_buffer_read_latest(rb, data, length);
+    }
+    return ring_buffer_read(rb, data, length);
 }
 
-void usb_middleware_update_device_access(int device_id) {
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id) {
-            g_devices[i].last_access = (unsigned int)time(NULL);
-            break;
-        }
-    }
+int usb_middleware_read_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms) {
+    return read_ring_timeout(device_id, -1, 0, data, length, min_bytes, timeout_ms);
 }
 
-int usb_middleware_get_device_count(void) {
-    return g_device_count;
+int usb_middleware_read_spi_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms) {
+    return read_ring_timeout(device_id, PROTOCOL_SPI, 0, data, length, min_bytes, timeout_ms);
 }
 
-int usb_middleware_read_spi_data(int device_id, unsigned char* data, int length) {
-    if (!g_initialized || !data || length <= 0) {
+int usb_middleware_read_spi_index_timeout(int device_id, int spi_index, unsigned char* data, int length,
+                                          int min_bytes, int timeout_ms) {
+    return read_ring_timeout(device_id, PROTOCOL_SPI, spi_index, data, length, min_bytes, timeout_ms);
+}
+
+int usb_middleware_enable_spi_index(int device_id, int spi_index) {
+    if (!g_initialized) {
         return USB_ERROR_INVALID_PARAM;
     }
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    (void)spi_ring(&g_devices[slot], spi_index, 1);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_get_spi_ring_stats(int device_id, int spi_index, ring_buffer_stats_t* stats) {
+    if (!g_initialized || !stats) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    ring_buffer_get_stats(spi_ring(&g_devices[slot], spi_index, 0), stats);
+    return USB_SUCCESS;
+}
+
+int usb_middleware_read_status_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms) {
+    return read_ring_timeout(device_id, PROTOCOL_STATUS, 0, data, length, min_bytes, timeout_ms);
+}
+
+int usb_middleware_read_uart_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms) {
+    return read_ring_timeout(device_id, PROTOCOL_UART, 0, data, length, min_bytes, timeout_ms);
+}
+
+int usb_middleware_read_pwm_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms) {
+    return read_ring_timeout(device_id, PROTOCOL_PWM, 0, data, length, min_bytes, timeout_ms);
+}
+
+int usb_middleware_peek_spi_data(int device_id, int spi_index, const unsigned char** data, int* length) {
+    if (!g_initialized || !data || !length) {
+        return USB_ERROR_INVALID_PARAM;
     }
+    *data = NULL;
+    *length = 0;
+    DEVICE_REF int slot = device_acquire(device_id);
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
         return USB_ERROR_NOT_FOUND;
     }
     usb_middleware_update_device_access(device_id);
-    ring_buffer_t* spi_rb = &g_devices[slot].protocol_buffers[PROTOCOL_SPI];
-    EnterCriticalSection(&spi_rb->cs);
-    int available = spi_rb->data_size;
-    int to_read = (available < length) ? available : length;
-    if (to_read > 0) {
-        if (spi_rb->read_pos + to_read <= spi_rb->size) {
-            memcpy(data, spi_rb->buffer + spi_rb->read_pos, to_read);
-        } else {
-            int first_part = spi_rb->size - spi_rb->read_pos;
-            memcpy(data, spi_rb->buffer + spi_rb->read_pos, first_part);
-            memcpy(data + first_part, spi_rb->buffer, to_read - first_part);
-        }
-        spi_rb->read_pos = (spi_rb->read_pos + to_read) % spi_rb->size;
-        spi_rb->data_size -= to_read;
+    unsigned int available = ring_buffer_peek(spi_ring(&g_devices[slot], spi_index, 1), data);
+    // 接口长度为int，超过部分留到下次peek
+    *length = available > 0x7FFFFFFFu ? 0x7FFFFFFF : (int)available;
+    return USB_SUCCESS;
+}
+
+int usb_middleware_commit_spi_data(int device_id, int spi_index, int length) {
+    if (!g_initialized || length < 0) {
+        return USB_ERROR_INVALID_PARAM;
     }
-    LeaveCriticalSection(&spi_rb->cs);
-    
-//     if (to_read > 0) {
-//         debug_printf("从SPI缓冲区读取了 %d 字节数据", to_read);
-//     }
-    
-    return to_read;
+    DEVICE_REF int slot = device_acquire(device_id);
+    if (slot == -1) {
+        debug_printf("设备未找到或未打开: %d", device_id);
+        return USB_ERROR_NOT_FOUND;
+    }
+    return (int)ring_buffer_commit(spi_ring(&g_devices[slot], spi_index, 0), (unsigned int)length);
 }
 
 int usb_middleware_read_status_data(int device_id, unsigned char* data, int length) {
@@ -794,13 +2805,7 @@ int usb_middleware_read_status_data(int device_id, unsigned char* data, int leng
         return USB_ERROR_INVALID_PARAM;
     }
     
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
+    DEVICE_REF int slot = device_acquire(device_id);
     
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
@@ -810,23 +2815,7 @@ int usb_middleware_read_status_data(int device_id, unsigned char* data, int leng
     usb_middleware_update_device_access(device_id);
     ring_buffer_t* status_rb = &g_devices[slot].protocol_buffers[PROTOCOL_STATUS];
     
-    EnterCriticalSection(&status_rb->cs);
-    int available = status_rb->data_size;
-    int to_read = (available < length) ? available : length;
-    
-    if (to_read > 0) {
-        if (status_rb->read_pos + to_read <= status_rb->size) {
-            memcpy(data, status_rb->buffer + status_rb->read_pos, to_read);
-        } else {
-            int first_part = status_rb->size - status_rb->read_pos;
-            memcpy(data, status_rb->buffer + status_rb->read_pos, first_part);
-            memcpy(data + first_part, status_rb->buffer, to_read - first_part);
-        }
-        status_rb->read_pos = (status_rb->read_pos + to_read) % status_rb->size;
-        status_rb->data_size -= to_read;
-    }
-    
-    LeaveCriticalSection(&status_rb->cs);
+    int to_read = ring_buffer_read(status_rb, data, length);
     return to_read;
 }
 
@@ -834,34 +2823,14 @@ int usb_middleware_read_uart_data(int device_id, unsigned char* data, int length
     if (!g_initialized || !data || length <= 0) {
         return USB_ERROR_INVALID_PARAM;
     }
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
+    DEVICE_REF int slot = device_acquire(device_id);
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
         return USB_ERROR_NOT_FOUND;
     }
     usb_middleware_update_device_access(device_id);
     ring_buffer_t* uart_rb = &g_devices[slot].protocol_buffers[PROTOCOL_UART];
-    EnterCriticalSection(&uart_rb->cs);
-    int available = uart_rb->data_size;
-    int to_read = (available < length) ? available : length;
-    if (to_read > 0) {
-        if (uart_rb->read_pos + to_read <= uart_rb->size) {
-            memcpy(data, uart_rb->buffer + uart_rb->read_pos, to_read);
-        } else {
-            int first_part = uart_rb->size - uart_rb->read_pos;
-            memcpy(data, uart_rb->buffer + uart_rb->read_pos, first_part);
-            memcpy(data + first_part, uart_rb->buffer, to_read - first_part);
-        }
-        uart_rb->read_pos = (uart_rb->read_pos + to_read) % uart_rb->size;
-        uart_rb->data_size -= to_read;
-    }
-    LeaveCriticalSection(&uart_rb->cs);
+    int to_read = ring_buffer_read(uart_rb, data, length);
     
     return to_read;
 }
@@ -871,13 +2840,7 @@ int usb_middleware_clear_uart_buffer(int device_id) {
         return USB_ERROR_INVALID_PARAM;
     }
     
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
+    DEVICE_REF int slot = device_acquire(device_id);
     
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
@@ -887,12 +2850,8 @@ int usb_middleware_clear_uart_buffer(int device_id) {
     usb_middleware_update_device_access(device_id);
     ring_buffer_t* uart_rb = &g_devices[slot].protocol_buffers[PROTOCOL_UART];
     
-    EnterCriticalSection(&uart_rb->cs);
     // 清空UART缓冲区
-    uart_rb->read_pos = 0;
-    uart_rb->write_pos = 0;
-    uart_rb->data_size = 0;
-    LeaveCriticalSection(&uart_rb->cs);
+    ring_buffer_clear(uart_rb);
     
     debug_printf("成功清除UART缓冲区，设备ID: %d", device_id);
     return USB_SUCCESS;
@@ -902,19 +2861,14 @@ int usb_middleware_wait_gpio_level(int device_id, int gpio_index, unsigned char*
     if (!g_initialized || !level || gpio_index < 0 || gpio_index >= 256) {
         return USB_ERROR_INVALID_PARAM;
     }
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
+    DEVICE_REF int slot = device_acquire(device_id);
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
         return USB_ERROR_NOT_FOUND;
     }
+    flush_before_wait(&g_devices[slot]);
     int waited = 0;
-    while (waited <= timeout_ms) {
+    while (waited <= timeout_ms && __atomic_load_n(&g_devices[slot].state, __ATOMIC_ACQUIRE) == DEVICE_STATE_OPEN) {
         if (g_devices[slot].gpio_level_valid[gpio_index]) {
             *level = g_devices[slot].gpio_level[gpio_index];
             g_devices[slot].gpio_level_valid[gpio_index] = 0;
@@ -923,7 +2877,7 @@ int usb_middleware_wait_gpio_level(int device_id, int gpio_index, unsigned char*
         Sleep(1);
         waited += 1;
     }
-    return USB_ERROR_TIMEOUT;
+    return g_devices[slot].state == DEVICE_STATE_OPEN ? USB_ERROR_TIMEOUT : USB_ERROR_NOT_FOUND;
 }
 
 int usb_middleware_read_power_data(int device_id, unsigned char* data, int length) {
@@ -931,13 +2885,7 @@ int usb_middleware_read_power_data(int device_id, unsigned char* data, int lengt
         return USB_ERROR_INVALID_PARAM;
     }
     
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
+    DEVICE_REF int slot = device_acquire(device_id);
     
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
@@ -947,25 +2895,9 @@ int usb_middleware_read_power_data(int device_id, unsigned char* data, int lengt
     usb_middleware_update_device_access(device_id);
     ring_buffer_t* power_rb = &g_devices[slot].protocol_buffers[PROTOCOL_POWER];
     
-    EnterCriticalSection(&power_rb->cs);
-    int available = power_rb->data_size;
-    int to_read = (available < length) ? available : length;
-    debug_printf("读取电流数据: 可用=%d字节, 请求=%d字节, 实际读取=%d字节", available, length, to_read);
-    
-    if (to_read > 0) {
-        if (power_rb->read_pos + to_read <= power_rb->size) {
-            memcpy(data, power_rb->buffer + power_rb->read_pos, to_read);
-        } else {
-            int first_part = power_rb->size - power_rb->read_pos;
-            memcpy(data, power_rb->buffer + power_rb->read_pos, first_part);
-            memcpy(data + first_part, power_rb->buffer, to_read - first_part);
-        }
-        // 更新读取位置，实现环形缓冲区
-        power_rb->read_pos = (power_rb->read_pos + to_read) % power_rb->size;
-        power_rb->data_size -= to_read;
-    }
-    
-    LeaveCriticalSection(&power_rb->cs);
+    unsigned int available = ring_buffer_available(power_rb);
+    int to_read = ring_buffer_read(power_rb, data, length);
+    debug_printf("读取电流数据: 可用=%u字节, 请求=%d字节, 实际读取=%d字节", available, length, to_read);
     return to_read;
 }
 
@@ -974,13 +2906,7 @@ int usb_middleware_read_pwm_data(int device_id, unsigned char* data, int length)
         return USB_ERROR_INVALID_PARAM;
     }
     
-    int slot = -1;
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        if (g_devices[i].device_id == device_id && g_devices[i].state == DEVICE_STATE_OPEN) {
-            slot = i;
-            break;
-        }
-    }
+    DEVICE_REF int slot = device_acquire(device_id);
     
     if (slot == -1) {
         debug_printf("设备未找到或未打开: %d", device_id);
@@ -990,22 +2916,6 @@ int usb_middleware_read_pwm_data(int device_id, unsigned char* data, int length)
     usb_middleware_update_device_access(device_id);
     ring_buffer_t* pwm_rb = &g_devices[slot].protocol_buffers[PROTOCOL_PWM];
     
-    EnterCriticalSection(&pwm_rb->cs);
-    int available = pwm_rb->data_size;
-    int to_read = (available < length) ? available : length;
-    
-    if (to_read > 0) {
-        if (pwm_rb->read_pos + to_read <= pwm_rb->size) {
-            memcpy(data, pwm_rb->buffer + pwm_rb->read_pos, to_read);
-        } else {
-            int first_part = pwm_rb->size - pwm_rb->read_pos;
-            memcpy(data, pwm_rb->buffer + pwm_rb->read_pos, first_part);
-            memcpy(data + first_part, pwm_rb->buffer, to_read - first_part);
-        }
-        pwm_rb->read_pos = (pwm_rb->read_pos + to_read) % pwm_rb->size;
-        pwm_rb->data_size -= to_read;
-    }
-    
-    LeaveCriticalSection(&pwm_rb->cs);
+    int to_read = ring_buffer_read(pwm_rb, data, length);
     return to_read;
 }
@@ -17,21 +17,17 @@ extern "C" {
 #else
 #include "platform_compat.h"
 #endif
+#include "usb_ring.h"
+#include "usb_protocol.h"
+#include "usb_frame.h"
+#include "usb_ring_file.h"
 
 
 #define PROTOCOL_SPI        0x01    // SPI协议
 #define PROTOCOL_GPIO       0x04    // GPIO协议
 #define PROTOCOL_POWER      0x05    // 电源协议
 #define PROTOCOL_STATUS     0x09    // 状态响应协议
-#define MAX_PROTOCOL_TYPES  10      // 最大协议类型数量(0=未使用, 1=SPI, 4=GPIO, 5=POWER, 9=STATUS)
-typedef struct {
-    unsigned char* buffer;     // 缓冲区指针
-    unsigned int size;         // 缓冲区大小
-    unsigned int write_pos;    // 写入位置
-    unsigned int read_pos;     // 读取位置
-    unsigned int data_size;    // 当前数据大小
-    CRITICAL_SECTION cs;       // 临界区，用于线程同步
-} ring_buffer_t;
+#define MAX_PROTOCOL_TYPES  13      // 按protocol_type直接索引，需覆盖到PROTOCOL_PWM(0x0C)
 
 
 typedef struct {
@@ -48,9 +44,118 @@ typedef enum {
     DEVICE_STATE_CLOSED = 0,   // 设备已关闭
     DEVICE_STATE_OPENING,      // 设备正在打开
     DEVICE_STATE_OPEN,         // 设备已打开
-    DEVICE_STATE_ERROR         // 设备错误状态
+    DEVICE_STATE_ERROR,        // 设备错误状态
+    DEVICE_STATE_CLOSING       // 设备正在关闭，已不能按序列号或ID找到
 } device_state_t;
 
+// 读取线程工作模式
+#define USB_READ_MODE_SYNC      0    // 同步批量读取(默认)
+#define USB_READ_MODE_ASYNC     1    // 多个异步传输同时挂起
+#define USB_READ_MODE_SHARED    2    // 异步传输，所有设备共用一个事件线程
+
+#define USB_ASYNC_DEFAULT_TRANSFERS      8
+#define USB_ASYNC_DEFAULT_TRANSFER_SIZE  (16 * 1024)
+#define USB_ASYNC_MAX_TRANSFERS          64
+
+// 命令合并发送：多个协议帧拼进一次批量OUT传输
+#define USB_BATCH_DEFAULT_BYTES   512          // 默认单次合并上限(高速批量端点包长)
+#define USB_BATCH_MAX_BYTES       (16 * 1024)
+
+// 发送组包
+#define USB_TX_FRAME_SIZE         4096         // 每设备发送缓冲区，不超过此长度的帧直接在其中组包
+#define USB_TX_PACKET_SIZE        512          // 高速批量端点包长，大帧分段按此对齐
+
+// 大块写入：data_len/total_packets是16位，超过一帧上限的数据拆成多帧连续发送。
+// 每帧取不超过上限的最大整包长度，帧与帧首尾相接后各次传输仍按整包对齐
+#define USB_SEGMENT_FRAME_SIZE    (127 * USB_TX_PACKET_SIZE)
+#define USB_SEGMENT_DATA_MAX      (USB_SEGMENT_FRAME_SIZE - 2 * sizeof(uint32_t) - sizeof(GENERIC_CMD_HEADER))
+#define USB_TX_PIPELINE_DEPTH     8            // 大块写入同时挂起的OUT传输数
+#define USB_TX_STAGE_SIZE         2048         // 每个挂起传输的组包区：上一帧剩余数据+帧尾+下一帧帧头和开头数据
+
+// 等待应答的命令表
+#define USB_MAX_PENDING_REQUESTS   16
+#define USB_PENDING_RESPONSE_MAX   64
+
+// 队列写入滑动窗口
+#define USB_QUEUE_WINDOW_MAX       12          // 同时等待应答的队列写入上限，给其他命令留出应答表位置
+#define USB_QUEUE_REPLY_TIMEOUT_MS 1000
+
+// SPI分索引缓冲区：索引1~USB_SPI_RING_INDEXES-1可各自建立缓冲区，容量与spi_buffer_size相同
+#define USB_SPI_RING_INDEXES       8
+
+// 打开设备选项：各协议环形缓冲区容量(字节，向上取整到2的幂)，0表示使用默认值
+typedef struct {
+    unsigned int spi_buffer_size;      // 默认16MB
+    unsigned int power_buffer_size;    // 默认512KB
+    unsigned int pwm_buffer_size;      // 默认4KB
+    unsigned int uart_buffer_size;     // 默认64KB
+    unsigned int status_buffer_size;   // 默认16KB
+    unsigned int raw_buffer_size;      // 默认512KB，固件信息等原始应答
+    int preallocate;                   // 0=收到该协议第一包数据时才分配(默认)，1=打开时全部分配
+} usb_open_options_t;
+
+// 命令往返延迟直方图：桶i统计[2^i, 2^(i+1))微秒的样本，桶0含1微秒以下，最后一桶含更长的
+#define USB_LATENCY_BUCKETS          24
+#define USB_LATENCY_SPI_QUEUE_STATUS 0      // SPI_GetQueueStatus
+#define USB_LATENCY_GPIO_READ        1      // GPIO_Read
+#define USB_LATENCY_PWM_RESULT       2      // PWM_GetResult
+#define USB_LATENCY_KINDS            3
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long total_us;
+    unsigned long long max_us;
+    unsigned long long buckets[USB_LATENCY_BUCKETS];
+} usb_latency_hist_t;
+
+// 设备统计，全部为64位计数；按protocol_type索引的数组中下标0是usb_middleware_write_data直接写入的数据
+typedef struct {
+    unsigned long long rx_bytes[MAX_PROTOCOL_TYPES];        // 收到的协议包数据字节数(不含协议头)
+    unsigned long long rx_packets[MAX_PROTOCOL_TYPES];
+    unsigned long long tx_bytes[MAX_PROTOCOL_TYPES];        // 发出的帧字节数(含帧头帧尾)
+    unsigned long long tx_packets[MAX_PROTOCOL_TYPES];
+    unsigned long long ring_high_water[MAX_PROTOCOL_TYPES]; // 各协议缓冲区最高水位(字节)
+    unsigned long long rx_transfers;        // 交给解析器的批量IN传输
+    unsigned long long rx_transfer_bytes;
+    unsigned long long rx_timeouts;
+    unsigned long long rx_errors;
+    unsigned long long tx_transfers;        // 批量OUT传输次数(合并、分段后)
+    unsigned long long tx_timeouts;
+    unsigned long long tx_errors;
+    unsigned long long resync_count;        // 协议失步重同步次数
+    unsigned long long skipped_bytes;       // 失步跳过的字节数
+    usb_latency_hist_t latency[USB_LATENCY_KINDS];
+} usb_device_stats_t;
+
+typedef struct {
+    unsigned long long sent;            // 以窗口方式发出的队列写入帧
+    unsigned long long accepted;        // 应答为已入队
+    unsigned long long rejected;        // 应答为队列满，该帧未入队
+    unsigned long long timeouts;        // 等不到应答
+    unsigned long long window_waits;    // 窗口满而等待最早应答的次数
+    unsigned long long depth_queries;   // 估计队列已满时查询队列深度的次数
+    int in_flight;                      // 当前等待应答的帧数
+    int last_depth;                     // 最近一次查询到的队列深度
+} usb_queue_stats_t;
+
+// 按发送顺序排队等待应答的队列写入帧或队列深度查询
+typedef struct {
+    int request;
+    uint8_t device_index;
+    uint8_t is_query;
+} queue_inflight_t;
+
+typedef struct {
+    int in_use;
+    int completed;
+    uint8_t protocol;          // 应答包的protocol_type(状态应答为PROTOCOL_STATUS)
+    uint8_t cmd_id;
+    uint8_t device_index;
+    unsigned long long seq;    // 登记顺序，同一键值按先进先出匹配
+    unsigned char response[USB_PENDING_RESPONSE_MAX];   // 完整应答包(协议头+数据)
+    int response_len;
+} pending_request_t;
+
 typedef struct {
     char serial[64];           
     void* libusb_handle;       
@@ -58,18 +163,78 @@ typedef struct {
     int interface_claimed;    
     unsigned int ref_count;    
     unsigned int last_access;  
-    int device_id;             
+    int device_id;             // 代数 * MAX_DEVICES + 槽位
+    unsigned int serial_hash;  // serial的散列值，序列号索引使用
     void* read_thread;        
     int thread_running;       
     int stop_thread;           
     unsigned char* rx_cache;
-    unsigned int rx_cache_size;
+    unsigned int rx_cache_head;            // 已消费位置(读偏移)
+    unsigned int rx_cache_size;            // 已写入位置(写偏移)
     unsigned int rx_cache_capacity;
+    unsigned long long rx_skipped_bytes;   // 失步时累计跳过的无效字节数
+    unsigned long long rx_resync_count;    // 失步重同步次数
+    int read_mode;             // 实际使用的读取模式
+    void* rx_urbs;             // 异步模式下的传输数组(rx_urb_t)
+    int rx_urb_count;
+    int rx_urb_size;
+    int rx_urb_next;           // 下一个按提交顺序应交给解析器的传输
+    int rx_urbs_in_flight;
+    int rx_pipeline_error;     // 出错后暂停重提交，等全部传输回来再重启
+    int rx_event_attached;     // 共用事件线程模式下已登记，只在g_event_lock内修改
+    unsigned long long rx_retry_at;        // 共用事件线程模式下出错后重新提交的时间(ms)
     ring_buffer_t protocol_buffers[MAX_PROTOCOL_TYPES]; 
     ring_buffer_t raw_buffer;  
+    // 各SPI索引的独立缓冲区，第一次用到该索引时建立(数据区仍在第一次写入时才分配)；
+    // 索引0和还没有独立缓冲区的索引的数据写入protocol_buffers[PROTOCOL_SPI]
+    ring_buffer_t* spi_rings[USB_SPI_RING_INDEXES];
+    unsigned int spi_ring_size;
+    int spi_ring_mirrored;
+    pending_request_t pending[USB_MAX_PENDING_REQUESTS];
+    CRITICAL_SECTION pending_lock;
+    CONDITION_VARIABLE pending_cond;       // 有应答完成或设备关闭时广播
+    unsigned long long pending_seq;
+    int pending_count;                     // 已登记的命令数，解析线程据此跳过查表
+    int pending_waiters;
+    int pending_closed;
+    CRITICAL_SECTION tx_lock;              // 串行化OUT端点写入与合并缓冲区
+    unsigned char* tx_frame;               // 组包缓冲区(USB_TX_FRAME_SIZE)，在tx_lock内使用
+    unsigned char* tx_batch;               // 待发送的合并帧
+    int tx_batch_len;
+    int tx_batch_active;                   // USB_BeginBatch后为1，直到USB_FlushBatch
+    unsigned long long tx_batch_deadline;  // 自动合并窗口到期时间(ms)，0表示未计时
+    int tx_ready;
+    void* tx_urbs;                         // 大块写入的异步传输(tx_urb_t[USB_TX_PIPELINE_DEPTH])，第一次使用时分配
+    unsigned char* tx_stage;               // 各传输的组包区，与tx_urbs一起分配
+    // 队列写入滑动窗口，qw_前缀的字段都在qw_lock内使用
+    CRITICAL_SECTION qw_lock;
+    int qw_window;                         // 同时在途的帧数上限，1=每帧等应答(默认)
+    int qw_capacity;                       // 设备队列容量(帧)，0=未知，只按窗口限制
+    queue_inflight_t qw_fifo[USB_QUEUE_WINDOW_MAX + 1];   // 最多再加一个深度查询
+    int qw_head;
+    int qw_count;                          // qw_fifo中的条目数
+    int qw_frames;                         // 其中的帧数(不含查询)
+    int qw_query_pending;
+    int qw_depth[256];                     // 按device_index估计的队列占用，不含在途帧
+    int qw_inflight[256];
+    int qw_failed;                         // 上次排空以来被拒或超时的帧数
+    usb_queue_stats_t qw_stats;
+    int qw_ready;
+    // SPI分帧采集，开启后该SPI索引的数据重组成帧，不再写入SPI字节缓冲区
+    CRITICAL_SECTION frame_lock;           // 保护spi_frames的开启/停止和读取方登记
+    usb_frame_capture_t* spi_frames;
+    uint8_t spi_frame_index;
+    int spi_frame_feeding;                 // 解析线程正在写入spi_frames
+    int spi_frame_users;                   // 正在读取帧的线程数
+    // SPI数据落盘，file_lock保护spi_file的开启/停止和统计读取
+    CRITICAL_SECTION file_lock;
+    usb_ring_file_t* spi_file;
+    int spi_file_index;                    // 正在或最近一次落盘的SPI索引，-1为还没有落盘过
+    usb_ring_file_stats_t spi_file_stats;  // 最近一次停止时的统计
     // GPIO电平缓存：按device_index存储最近一次读取的电平
     unsigned char gpio_level[256];
     unsigned char gpio_level_valid[256];
+    usb_device_stats_t stats;              // 各线程原子累加；缓冲区水位和失步计数在读取统计时填入
 } device_handle_t;
 
 // 错误代码定义
@@ -88,10 +253,25 @@ typedef struct {
 
 int usb_middleware_init(void);
 void usb_middleware_cleanup(void);
+// 在DllMain/析构函数中代替usb_middleware_cleanup：此时持有加载器锁，等待线程退出会死锁，
+// 只通知各内部线程停止，不等待也不释放
+void usb_middleware_detach(void);
 int usb_middleware_scan_devices(device_info_t* devices, int max_devices);
 int usb_middleware_open_device(const char* serial);
+// 按选项打开设备，options为NULL时与usb_middleware_open_device相同
+int usb_middleware_open_device_ex(const char* serial, const usb_open_options_t* options);
+// 可与其他线程对同一设备的调用并发：先让新调用失败、唤醒阻塞中的读取和等待，等已进入的调用全部返回后再释放资源
 int usb_middleware_close_device(int device_id);
 int usb_middleware_find_device_by_serial(const char* serial);
+// 设置之后打开的设备使用的读取模式；transfer_count/transfer_size<=0时使用默认值
+int usb_middleware_set_read_mode(int mode, int transfer_count, int transfer_size);
+// 之后打开的设备的SPI缓冲区是否使用镜像映射(默认开启，平台不支持时自动退回普通缓冲区)
+void usb_middleware_set_spi_mirror(int enable);
+// 切换底层传输后端("libusb"/"sim"/"replay")并重新初始化中间层，有设备打开时返回USB_ERROR_ACCESS
+int usb_middleware_set_transport(const char* name);
+// 录制所有设备的批量IN/OUT传输到path(见usb_capture.h)，buffer_size为内存缓冲区大小，0=默认
+int usb_middleware_start_capture(const char* path, unsigned int buffer_size);
+void usb_middleware_stop_capture(void);
 int usb_middleware_is_device_open(int device_id);
 
 // ==================== 统一数据读写接口 ====================
@@ -100,7 +280,17 @@ int usb_middleware_is_device_open(int device_id);
 int usb_middleware_read_data(int device_id, unsigned char* data, int length);
 
 
+// 读SPI索引0的缓冲区，其中也有还没有独立缓冲区的其他索引的数据(引导程序的应答就从这里读)
 int usb_middleware_read_spi_data(int device_id, unsigned char* data, int length);
+// 读指定SPI索引的数据，索引1~USB_SPI_RING_INDEXES-1第一次调用时为其建立独立缓冲区，之后该索引的数据只进入这个缓冲区
+int usb_middleware_read_spi_index_timeout(int device_id, int spi_index, unsigned char* data, int length,
+                                          int min_bytes, int timeout_ms);
+// 提前为SPI索引建立独立缓冲区(如SPI初始化时)，避免第一次读取前的数据进入索引0的缓冲区
+int usb_middleware_enable_spi_index(int device_id, int spi_index);
+// 原地借出该SPI索引缓冲区中的连续可读区域，处理完后用usb_middleware_commit_spi_data归还
+int usb_middleware_peek_spi_data(int device_id, int spi_index, const unsigned char** data, int* length);
+int usb_middleware_commit_spi_data(int device_id, int spi_index, int length);
+int usb_middleware_get_spi_ring_stats(int device_id, int spi_index, ring_buffer_stats_t* stats);
 
 // UART数据读取函数
 int usb_middleware_read_uart_data(int device_id, unsigned char* data, int length);
@@ -111,6 +301,18 @@ int usb_middleware_clear_uart_buffer(int device_id);
 // GPIO电平等待获取（从数组中取），timeout_ms毫秒
 int usb_middleware_wait_gpio_level(int device_id, int gpio_index, unsigned char* level, int timeout_ms);
 
+// 缓冲区写满时的处理(RING_OVERFLOW_xxx)，protocol为协议类型，-1为原始数据缓冲区；
+// timeout_ms为RING_OVERFLOW_BLOCK的最长等待。阻塞/背压会让读取线程停下，期间该设备的其他应答也收不到；
+// 只有同步读取模式的设备可以设置，异步/共用事件线程模式下写入发生在传输回调里，返回USB_ERROR_INVALID_PARAM
+int usb_middleware_set_overflow_policy(int device_id, int protocol, int policy, int timeout_ms);
+int usb_middleware_get_ring_stats(int device_id, int protocol, ring_buffer_stats_t* stats);
+
+// 读取/清零设备统计
+int usb_middleware_get_stats(int device_id, usb_device_stats_t* stats);
+int usb_middleware_reset_stats(int device_id);
+// 命令往返结束时用开始时间(usb_now_us)记一次延迟(kind为USB_LATENCY_xxx)
+void usb_middleware_record_latency(int device_id, int kind, unsigned long long start_us);
+
 // 专用状态数据读取函数
 int usb_middleware_read_status_data(int device_id, unsigned char* data, int length);
 
@@ -120,21 +322,95 @@ int usb_middleware_read_power_data(int device_id, unsigned char* data, int lengt
 // 专用PWM数据读取函数
 int usb_middleware_read_pwm_data(int device_id, unsigned char* data, int length);
 
+// 阻塞读取：等待缓冲区中至少有min_bytes字节(不超过length)或timeout_ms毫秒后再读取，
+// timeout_ms<0表示一直等待；等待期间不占用CPU，超时返回实际读到的字节数(可能为0)，
+// 设备在等待期间被关闭时返回USB_ERROR_NOT_FOUND
+int usb_middleware_read_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms);
+int usb_middleware_read_spi_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms);
+int usb_middleware_read_status_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms);
+int usb_middleware_read_uart_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms);
+int usb_middleware_read_pwm_data_timeout(int device_id, unsigned char* data, int length, int min_bytes, int timeout_ms);
+
 int usb_middleware_write_data(int device_id, unsigned char* data, int length);
 
+// 组包并发送一帧，不分配内存：小帧在设备发送缓冲区中组包，
+// 大帧的数据部分不拼接，直接从data_payload分段发送。返回发送(或暂存)的字节数
+int usb_middleware_send_frame(int device_id, GENERIC_CMD_HEADER* cmd_header,
+                              const void* param_data, size_t param_len,
+                              const void* data_payload, size_t data_len);
+
+// 大块写入：data_len超过一帧上限时按USB_SEGMENT_DATA_MAX拆成多帧(每帧的cmd_header相同，
+// 只有data_len和total_packets不同)，不分配内存，最多USB_TX_PIPELINE_DEPTH个OUT传输同时挂起。
+// 返回写入的数据字节数(即data_len)，失败时已发出的帧不会撤回
+int usb_middleware_send_segmented(int device_id, const GENERIC_CMD_HEADER* cmd_header,
+                                  const void* data_payload, size_t data_len);
+
+// 开始合并：之后的写入先放进合并缓冲区，满了或usb_middleware_flush_batch时一次发出
+int usb_middleware_begin_batch(int device_id);
+// 立即发出合并缓冲区并结束合并，返回发送的字节数
+int usb_middleware_flush_batch(int device_id);
+// 自动合并窗口：window_ms>0时，未显式合并的写入最多延迟window_ms毫秒后合并发送(0=关闭)；
+// max_bytes为单次合并上限(<=0取默认512)
+int usb_middleware_set_batch_window(int window_ms, int max_bytes);
+
+// 命令应答匹配：发送命令前先登记(应答的protocol_type, cmd_id, device_index)，
+// 解析线程收到匹配的应答后直接交给等待者，不再经过状态缓冲区。
+// 同一键值按登记顺序匹配；没有登记项匹配的应答照旧写入状态/PWM缓冲区。
+// 返回请求号(>=0)，表已满返回USB_ERROR_BUSY
+int usb_middleware_request_begin(int device_id, uint8_t protocol, uint8_t cmd_id, uint8_t device_index);
+// 等待应答并释放请求号，返回复制到response的完整应答包长度；超时返回USB_ERROR_TIMEOUT
+int usb_middleware_request_wait(int device_id, int request, unsigned char* response, int length, int timeout_ms);
+// 命令发送失败时释放请求号
+void usb_middleware_request_cancel(int device_id, int request);
+
+// 队列写入窗口：window<=1为每帧等待应答(默认)，最大USB_QUEUE_WINDOW_MAX；
+// capacity>0为设备队列容量(帧)，估计的队列占用达到容量时先查询实际深度，有空位才继续发，避免帧被拒。
+// 修改前先等在途帧全部应答
+int usb_middleware_set_queue_window(int device_id, int window, int capacity);
+int usb_middleware_get_queue_window(int device_id);
+// 按窗口发送一帧队列写入，窗口未满时发出即返回，满时先等最早的应答。
+// 应答按(PROTOCOL_STATUS, cmd_id, device_index)匹配，值0为入队、非0为队列满；
+// status_cmd_id为查询队列深度的命令(应答数据第一个字节为深度)。被拒和超时的帧只计数，由排空时报告。
+// 等待超过USB_QUEUE_REPLY_TIMEOUT_MS仍不能发送时不发出该帧：设备队列仍满返回USB_ERROR_BUSY，窗口仍满返回USB_ERROR_TIMEOUT
+int usb_middleware_queue_write(int device_id, GENERIC_CMD_HEADER* cmd_header, const void* data_payload,
+                               size_t data_len, uint8_t status_cmd_id);
+// 等待在途帧全部应答，返回上次排空以来被拒或超时的帧数
+int usb_middleware_queue_drain(int device_id, int timeout_ms);
+int usb_middleware_get_queue_stats(int device_id, usb_queue_stats_t* stats);
+
+// SPI分帧采集：spi_index的SPI数据按config重组成完整帧，由usb_middleware_read_spi_frame逐帧读取；
+// 已在采集时先停止旧的。停止后数据重新写入SPI字节缓冲区
+int usb_middleware_start_spi_frames(int device_id, int spi_index, const usb_frame_config_t* config);
+// 正在采集的是其他SPI索引时不停止，返回USB_ERROR_NOT_FOUND；没有在采集时直接返回成功
+int usb_middleware_stop_spi_frames(int device_id, int spi_index);
+// 读取一帧，返回拷贝的字节数(帧比length长时截断，info->length为完整长度)；未开启分帧采集返回USB_ERROR_NOT_FOUND
+int usb_middleware_read_spi_frame(int device_id, int spi_index, unsigned char* data, int length,
+                                  usb_frame_info_t* info, int timeout_ms);
+// 没有在采集spi_index时返回USB_ERROR_NOT_FOUND，stats清零
+int usb_middleware_get_spi_frame_stats(int device_id, int spi_index, usb_frame_stats_t* stats);
+
+// SPI数据落盘：后台线程取走SPI缓冲区中的数据写入path，期间不要再用SPI读取接口读同一缓冲区
+int usb_middleware_start_spi_file(int device_id, int spi_index, const char* path, const usb_ring_file_options_t* options);
+// 写完停止时缓冲区中已有的数据后返回，stats不为NULL时返回最终统计；
+// 正在落盘的是其他SPI索引时不停止，返回USB_ERROR_NOT_FOUND
+int usb_middleware_stop_spi_file(int device_id, int spi_index, usb_ring_file_stats_t* stats);
+// 正在落盘时返回当前统计，否则返回最近一次停止时的统计；spi_index与落盘的索引不同时返回USB_ERROR_NOT_FOUND
+int usb_middleware_get_spi_file_stats(int device_id, int spi_index, usb_ring_file_stats_t* stats);
+
 // ==================== 内部工具函数 ====================
 
 
 void parse_and_dispatch_protocol_data(device_handle_t* device, unsigned char* raw_data, int length);
 
 
-void write_to_ring_buffer(ring_buffer_t* rb, unsigned char* data, int length);
-
 void usb_middleware_update_device_access(int device_id);
 
 
 int usb_middleware_get_device_count(void);
 
+// 获取协议解析失步统计：累计跳过的无效字节数和重同步次数
+int usb_middleware_get_resync_stats(int device_id, unsigned long long* skipped_bytes, unsigned long long* resync_count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,15 +28,7 @@ WINAPI int POWER_SetVoltage(const char* target_serial, uint8_t channel, uint16_t
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, &voltage_mv, sizeof(uint16_t), NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, &voltage_mv, sizeof(uint16_t), NULL, 0);
     if (ret < 0) {
         debug_printf("发送设置电压命令失败: %d", ret);
         return POWER_ERROR_IO;
@@ -65,15 +57,7 @@ WINAPI int POWER_StartCurrentReading(const char* target_serial, uint8_t channel)
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送开始读取电流命令失败: %d", ret);
         return POWER_ERROR_IO;
@@ -105,15 +89,7 @@ WINAPI int POWER_PowerOn(const char* target_serial, uint8_t channel) {
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送开始读取电流命令失败: %d", ret);
         return POWER_ERROR_IO;
@@ -142,15 +118,7 @@ WINAPI int POWER_PowerOff(const char* target_serial, uint8_t channel) {
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送停止读取电流命令失败: %d", ret);
         return POWER_ERROR_IO;
@@ -192,15 +160,7 @@ WINAPI int POWER_StopCurrentReading(const char* target_serial, uint8_t channel)
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送停止读取电流命令失败: %d", ret);
         return POWER_ERROR_IO;
@@ -258,15 +218,7 @@ WINAPI int POWER_StartTestMode(const char* target_serial, uint8_t channel) {
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送启动电源测试模式命令失败: %d", ret);
         return POWER_ERROR_IO;
@@ -297,15 +249,7 @@ WINAPI int POWER_StopTestMode(const char* target_serial, uint8_t channel) {
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        debug_printf("构建协议帧失败");
-        return POWER_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送停止电源测试模式命令失败: %d", ret);
         return POWER_ERROR_IO;
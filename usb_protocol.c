@@ -4,12 +4,9 @@
 #include <string.h>
 #include <stdint.h>
 
-extern void debug_printf(const char *format, ...);
-
-int build_protocol_frame(unsigned char** buffer, GENERIC_CMD_HEADER* cmd_header, 
-                        void* param_data, size_t param_len, 
-                        void* data_payload, size_t data_len) {
+#include "usb_log.h"
 
+int protocol_frame_prepare(GENERIC_CMD_HEADER* cmd_header, size_t param_len, size_t data_len) {
     cmd_header->total_packets = sizeof(GENERIC_CMD_HEADER);
     if (param_len > 0) {
         cmd_header->total_packets += sizeof(PARAM_HEADER) + param_len;
@@ -18,40 +15,83 @@ int build_protocol_frame(unsigned char** buffer, GENERIC_CMD_HEADER* cmd_header,
         cmd_header->total_packets += data_len;
     }
     // 计算总长度：帧头 + 协议数据 + 帧尾
-    int total_len = sizeof(uint32_t) + cmd_header->total_packets + sizeof(uint32_t);
-    *buffer = (unsigned char*)malloc(total_len);
-    if (!*buffer) {
-        debug_printf("内存分配失败");
+    return (int)(sizeof(uint32_t) + sizeof(GENERIC_CMD_HEADER) +
+                 (param_len > 0 ? sizeof(PARAM_HEADER) + param_len : 0) + data_len + sizeof(uint32_t));
+}
+
+int build_protocol_frame_prefix(unsigned char* buffer, size_t buffer_size, const GENERIC_CMD_HEADER* cmd_header,
+                                const void* param_data, size_t param_len) {
+    size_t prefix_len = sizeof(uint32_t) + sizeof(GENERIC_CMD_HEADER) +
+                        (param_len > 0 ? sizeof(PARAM_HEADER) + param_len : 0);
+    if (!buffer || prefix_len > buffer_size || (param_len > 0 && !param_data)) {
         return -1;
     }
     int pos = 0;
     // -------添加帧头标识符-------
     uint32_t frame_header = FRAME_START_MARKER;
-    memcpy(*buffer + pos, &frame_header, sizeof(uint32_t));
+    memcpy(buffer + pos, &frame_header, sizeof(uint32_t));
     pos += sizeof(uint32_t);
     // -------添加协议头-------
-    memcpy(*buffer + pos, cmd_header, sizeof(GENERIC_CMD_HEADER));
+    memcpy(buffer + pos, cmd_header, sizeof(GENERIC_CMD_HEADER));
     pos += sizeof(GENERIC_CMD_HEADER);
     // -------添加参数-------
-    if (param_len > 0 && param_data) {
+    if (param_len > 0) {
         PARAM_HEADER param_header;
         param_header.param_len = param_len;
-        memcpy(*buffer + pos, &param_header, sizeof(PARAM_HEADER));
+        memcpy(buffer + pos, &param_header, sizeof(PARAM_HEADER));
         pos += sizeof(PARAM_HEADER);
-        memcpy(*buffer + pos, param_data, param_len);
+        memcpy(buffer + pos, param_data, param_len);
         pos += param_len;
     }
+    return pos;
+}
+
+int build_protocol_frame_trailer(unsigned char* buffer) {
+    // -------添加帧尾标识符-------
+    uint32_t end_marker = CMD_END_MARKER;
+    memcpy(buffer, &end_marker, sizeof(uint32_t));
+    return sizeof(uint32_t);
+}
+
+int build_protocol_frame_into(unsigned char* buffer, size_t buffer_size, GENERIC_CMD_HEADER* cmd_header,
+                              const void* param_data, size_t param_len,
+                              const void* data_payload, size_t data_len) {
+    if (data_len > 0 && !data_payload) {
+        return -1;
+    }
+    int total_len = protocol_frame_prepare(cmd_header, param_len, data_len);
+    if ((size_t)total_len > buffer_size) {
+        return -1;
+    }
+    int pos = build_protocol_frame_prefix(buffer, buffer_size, cmd_header, param_data, param_len);
+    if (pos < 0) {
+        return -1;
+    }
     // -------添加数据-------
-    if (data_len > 0 && data_payload) {
-        memcpy(*buffer + pos, data_payload, data_len);
+    if (data_len > 0) {
+        memcpy(buffer + pos, data_payload, data_len);
         pos += data_len;
     }
+    pos += build_protocol_frame_trailer(buffer + pos);
 
-    // -------添加帧尾标识符-------
-    uint32_t end_marker = CMD_END_MARKER;
-    memcpy(*buffer + pos, &end_marker, sizeof(uint32_t));
-    
     // debug_printf("[PC] Protocol frame built: header=0x%08X, type=%d, cmd=%d, total_len=%d", 
     //              FRAME_START_MARKER, cmd_header->protocol_type, cmd_header->cmd_id, total_len);
-    return total_len;
-}
\ No newline at end of file
+    return pos;
+}
+
+int build_protocol_frame(unsigned char** buffer, GENERIC_CMD_HEADER* cmd_header, 
+                        void* param_data, size_t param_len, 
+                        void* data_payload, size_t data_len) {
+    int total_len = protocol_frame_prepare(cmd_header, param_len, data_len);
+    *buffer = (unsigned char*)malloc(total_len);
+    if (!*buffer) {
+        debug_printf("内存分配失败");
+        return -1;
+    }
+    int ret = build_protocol_frame_into(*buffer, total_len, cmd_header, param_data, param_len, data_payload, data_len);
+    if (ret < 0) {
+        free(*buffer);
+        *buffer = NULL;
+    }
+    return ret;
+}
@@ -114,11 +114,29 @@ typedef struct _GENERIC_CMD_HEADER {
     uint16_t param_len;     
   } PARAM_HEADER, *PPARAM_HEADER;
   
-// 组包
+#define PROTOCOL_FRAME_TRAILER_SIZE  sizeof(uint32_t)   // 帧尾标识长度
+
+// 组包(内部malloc，调用方free)
 int build_protocol_frame(unsigned char** buffer, GENERIC_CMD_HEADER* cmd_header, 
                         void* param_data, size_t param_len, 
                         void* data_payload, size_t data_len);
 
+// 填写cmd_header->total_packets并返回整帧长度(帧头标识+协议头+参数+数据+帧尾标识)
+int protocol_frame_prepare(GENERIC_CMD_HEADER* cmd_header, size_t param_len, size_t data_len);
+
+// 组包到调用方提供的缓冲区，空间不足返回-1，成功返回整帧长度
+int build_protocol_frame_into(unsigned char* buffer, size_t buffer_size, GENERIC_CMD_HEADER* cmd_header,
+                              const void* param_data, size_t param_len,
+                              const void* data_payload, size_t data_len);
+
+// 只写数据之前的部分(帧头标识+协议头+参数)，用于数据不拼接、分段直接发送；
+// 需先调用protocol_frame_prepare，返回写入长度，空间不足返回-1
+int build_protocol_frame_prefix(unsigned char* buffer, size_t buffer_size, const GENERIC_CMD_HEADER* cmd_header,
+                                const void* param_data, size_t param_len);
+
+// 写帧尾标识，返回写入长度
+int build_protocol_frame_trailer(unsigned char* buffer);
+
 
 
 
@@ -6,12 +6,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include "usb_log.h"
+#include "usb_clock.h"
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include "platform_compat.h"
 #endif
 
+#define PWM_RESULT_TIMEOUT_MS  2000   // 等待测量结果的超时
+
 
 
 WINAPI int PWM_Init(const char* target_serial, int pwm_index, PWM_TimerConfig_t* config) {
@@ -43,14 +46,7 @@ WINAPI int PWM_Init(const char* target_serial, int pwm_index, PWM_TimerConfig_t*
     cmd_header.param_count = 0;
     cmd_header.data_len = sizeof(PWM_TimerConfig_t);
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, (unsigned char*)config, sizeof(PWM_TimerConfig_t));
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, config, sizeof(PWM_TimerConfig_t));
     
     debug_printf("PWM初始化结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -81,14 +77,7 @@ WINAPI int PWM_StartMeasure(const char* target_serial, int pwm_index) {
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     
     debug_printf("PWM开始测量结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -119,14 +108,7 @@ WINAPI int PWM_StopMeasure(const char* target_serial, int pwm_index) {
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     
     debug_printf("PWM停止测量结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -149,6 +131,7 @@ WINAPI int PWM_GetResult(const char* target_serial, int pwm_index, PWM_MeasureRe
         debug_printf("设备未打开: %s", target_serial);
         return USB_ERROR_OTHER;
     }
+    unsigned long long start_us = usb_now_us();
     
     // 发送获取结果命令
     GENERIC_CMD_HEADER cmd_header;
@@ -158,45 +141,34 @@ WINAPI int PWM_GetResult(const char* target_serial, int pwm_index, PWM_MeasureRe
     cmd_header.param_count = 0;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, NULL, 0, NULL, 0);
-    if (total_len < 0) {
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_PWM, PWM_CMD_GET_RESULT, (uint8_t)pwm_index);
+    if (request < 0) {
         return USB_ERROR_OTHER;
     }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     
     if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
         debug_printf("发送PWM获取结果命令失败: %d", ret);
         return USB_ERROR_OTHER;
     }
     
-    // 等待并读取PWM测量结果响应
+    // 等待PWM测量结果响应
     unsigned char response_buffer[64];  // 足够大的缓冲区
-    int max_loops = 2000;  // 最大等待2秒
-    
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_pwm_data(device_id, response_buffer, sizeof(response_buffer));
-        if (actual_read >= sizeof(GENERIC_CMD_HEADER) + sizeof(PWM_MeasureResult_t)) {
-            GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)response_buffer;
-            if (header->protocol_type == PROTOCOL_PWM && 
-                header->cmd_id == PWM_CMD_GET_RESULT &&
-                header->device_index == pwm_index) {
-                
-                // 复制PWM测量结果
-                memcpy(result, response_buffer + sizeof(GENERIC_CMD_HEADER), sizeof(PWM_MeasureResult_t));
-                
-                debug_printf("PWM CH%d 测量结果: Freq=%luHz, Duty=%lu.%02lu%%, Period=%luus, PulseWidth=%luus",
-                           pwm_index, result->frequency, 
-                           result->duty_cycle / 100, result->duty_cycle % 100,
-                           result->period_us, result->pulse_width_us);
-                
-                // 直接返回成功，不做业务判断
-                return USB_SUCCESS;
-            }
-        }
-        Sleep(1);
+    int actual_read = usb_middleware_request_wait(device_id, request, response_buffer, sizeof(response_buffer),
+                                                  PWM_RESULT_TIMEOUT_MS);
+    if (actual_read >= (int)(sizeof(GENERIC_CMD_HEADER) + sizeof(PWM_MeasureResult_t))) {
+        // 复制PWM测量结果
+        memcpy(result, response_buffer + sizeof(GENERIC_CMD_HEADER), sizeof(PWM_MeasureResult_t));
+        usb_middleware_record_latency(device_id, USB_LATENCY_PWM_RESULT, start_us);
+        
+        debug_printf("PWM CH%d 测量结果: Freq=%luHz, Duty=%lu.%02lu%%, Period=%luus, PulseWidth=%luus",
+                   pwm_index, result->frequency, 
+                   result->duty_cycle / 100, result->duty_cycle % 100,
+                   result->period_us, result->pulse_width_us);
+        
+        // 直接返回成功，不做业务判断
+        return USB_SUCCESS;
     }
     
     debug_printf("PWM获取结果超时");
@@ -0,0 +1,548 @@
+/**
+ * @file usb_replay.c
+ * @brief 录制文件回放
+ * 初始化时读入整个文件并为每个设备建立IN记录索引，之后只读；
+ * 各设备的读取位置和统计由g_replay_lock保护。
+ */
+
+#include "usb_replay.h"
+#include "usb_capture.h"
+#include "usb_clock.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#endif
+
+#define REPLAY_VENDOR_ID    0xCCDD
+#define REPLAY_PRODUCT_ID   0xAABB
+#define REPLAY_IDLE_WAIT_MS 100       // 记录已送完时读取提前超时，关闭设备不用等满读取超时
+
+typedef struct {
+    size_t offset;                     // 数据在g_replay_data中的位置
+    unsigned int length;
+    unsigned long long time_us;
+} replay_record_t;
+
+typedef struct {
+    int slot;                          // 录制时的槽位
+    int open_count;
+    int claimed;
+    char serial[64];
+    replay_record_t* records;          // 该设备的IN记录，按文件顺序
+    unsigned int record_count;
+    unsigned int record_capacity;
+    unsigned int cursor;               // 下一条要送出的记录
+    unsigned int cursor_offset;        // 读取方缓冲区较小时，当前记录已送出的字节数
+    unsigned long long base_us;        // 按原始间隔回放时，第一条记录对应的本地时间
+} replay_device_t;
+
+static char g_replay_path[MAX_PATH];
+static int g_replay_speed = USB_REPLAY_SPEED_MAX;
+static int g_replay_loop = 0;
+static int g_replay_initialized = 0;
+static unsigned char* g_replay_data = NULL;
+static size_t g_replay_size = 0;
+static replay_device_t g_replay_devices[USB_REPLAY_MAX_DEVICES];
+static int g_replay_device_count = 0;
+static usb_replay_stats_t g_replay_stats;
+static CRITICAL_SECTION g_replay_lock;
+static CONDITION_VARIABLE g_replay_cond;      // 释放接口、清理时唤醒等待中的读取
+
+int usb_replay_configure(const char* path, int speed, int loop) {
+    if (!path || !path[0] || strlen(path) >= sizeof(g_replay_path) ||
+        (speed != USB_REPLAY_SPEED_MAX && speed != USB_REPLAY_SPEED_ORIGINAL)) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    if (g_replay_initialized) {
+        debug_printf("回放配置失败: replay后端已初始化，请先切换到其他后端");
+        return USB_ERROR_ACCESS;
+    }
+    strcpy(g_replay_path, path);
+    g_replay_speed = speed;
+    g_replay_loop = loop ? 1 : 0;
+    return USB_SUCCESS;
+}
+
+void usb_replay_get_stats(usb_replay_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    if (!g_replay_initialized) {
+        *stats = g_replay_stats;
+        return;
+    }
+    EnterCriticalSection(&g_replay_lock);
+    *stats = g_replay_stats;
+    int finished = !g_replay_loop;
+    for (int i = 0; i < g_replay_device_count && finished; i++) {
+        finished = g_replay_devices[i].cursor >= g_replay_devices[i].record_count;
+    }
+    stats->finished = finished;
+    LeaveCriticalSection(&g_replay_lock);
+}
+
+static replay_device_t* replay_device_from(void* p) {
+    replay_device_t* dev = (replay_device_t*)p;
+    if (dev < &g_replay_devices[0] || dev >= &g_replay_devices[g_replay_device_count]) {
+        return NULL;
+    }
+    return dev;
+}
+
+static void replay_free_all(void) {
+    for (int i = 0; i < g_replay_device_count; i++) {
+        free(g_replay_devices[i].records);
+    }
+    memset(g_replay_devices, 0, sizeof(g_replay_devices));
+    g_replay_device_count = 0;
+    free(g_replay_data);
+    g_replay_data = NULL;
+    g_replay_size = 0;
+}
+
+static unsigned char* replay_read_file(const char* path, size_t* size) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    size_t capacity = 1024 * 1024;
+    size_t len = 0;
+    unsigned char* data = (unsigned char*)malloc(capacity);
+    while (data) {
+        if (len == capacity) {
+            unsigned char* grown = (unsigned char*)realloc(data, capacity * 2);
+            if (!grown) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        size_t n = fread(data + len, 1, capacity - len, fp);
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    fclose(fp);
+    *size = len;
+    return data;
+}
+
+// 槽位当前对应的设备；DEVICE记录的序列号与之前不同时(槽位被另一设备复用)新建一个
+static replay_device_t* replay_device_for_slot(int* slot_map, int slot, const char* serial) {
+    int index = slot_map[slot];
+    if (index >= 0 && (!serial || strcmp(g_replay_devices[index].serial, serial) == 0)) {
+        return &g_replay_devices[index];
+    }
+    for (int i = 0; serial && i < g_replay_device_count; i++) {
+        if (strcmp(g_replay_devices[i].serial, serial) == 0) {
+            slot_map[slot] = i;
+            return &g_replay_devices[i];
+        }
+    }
+    if (g_replay_device_count >= USB_REPLAY_MAX_DEVICES) {
+        return NULL;
+    }
+    replay_device_t* dev = &g_replay_devices[g_replay_device_count];
+    dev->slot = slot;
+    if (serial) {
+        snprintf(dev->serial, sizeof(dev->serial), "%s", serial);
+    } else {
+        snprintf(dev->serial, sizeof(dev->serial), "G2XRPL%02d", slot);
+    }
+    slot_map[slot] = g_replay_device_count++;
+    return dev;
+}
+
+static int replay_add_record(replay_device_t* dev, size_t offset, unsigned int length, unsigned long long time_us) {
+    if (dev->record_count == dev->record_capacity) {
+        unsigned int capacity = dev->record_capacity ? dev->record_capacity * 2 : 1024;
+        replay_record_t* grown = (replay_record_t*)realloc(dev->records, sizeof(replay_record_t) * capacity);
+        if (!grown) {
+            return USB_ERROR_OTHER;
+        }
+        dev->records = grown;
+        dev->record_capacity = capacity;
+    }
+    replay_record_t* rec = &dev->records[dev->record_count++];
+    rec->offset = offset;
+    rec->length = length;
+    rec->time_us = time_us;
+    return USB_SUCCESS;
+}
+
+// 建立各设备的IN记录索引；文件末尾不完整的记录(录制中断)忽略
+static int replay_index(void) {
+    usb_capture_file_header_t header;
+    if (g_replay_size < sizeof(header)) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    memcpy(&header, g_replay_data, sizeof(header));
+    if (memcmp(header.magic, USB_CAPTURE_MAGIC, sizeof(USB_CAPTURE_MAGIC)) != 0 ||
+        header.version != USB_CAPTURE_VERSION || header.header_size < sizeof(header) ||
+        header.header_size > g_replay_size) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+
+    int slot_map[256];
+    for (int i = 0; i < 256; i++) {
+        slot_map[i] = -1;
+    }
+    size_t pos = header.header_size;
+    while (g_replay_size - pos >= sizeof(usb_capture_record_t)) {
+        usb_capture_record_t rec;
+        memcpy(&rec, g_replay_data + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (rec.length > g_replay_size - pos) {
+            debug_printf("回放文件末尾记录不完整，已忽略");
+            break;
+        }
+        if (rec.type == USB_CAPTURE_DEVICE) {
+            char serial[64];
+            unsigned int n = rec.length < sizeof(serial) - 1 ? rec.length : (unsigned int)sizeof(serial) - 1;
+            memcpy(serial, g_replay_data + pos, n);
+            serial[n] = '\0';
+            (void)replay_device_for_slot(slot_map, rec.slot, serial);
+        } else if (rec.type == USB_CAPTURE_IN && rec.length > 0) {
+            replay_device_t* dev = replay_device_for_slot(slot_map, rec.slot, NULL);
+            if (dev && replay_add_record(dev, pos, rec.length, rec.time_us) != USB_SUCCESS) {
+                return USB_ERROR_OTHER;
+            }
+        }
+        pos += rec.length;
+    }
+    return USB_SUCCESS;
+}
+
+// ==================== 传输后端 ====================
+
+static int replay_init(void) {
+    if (g_replay_initialized) {
+        return USB_SUCCESS;
+    }
+    if (!g_replay_path[0]) {
+        const char* env = getenv("USB_G2X_REPLAY_FILE");
+        if (!env || usb_replay_configure(env, USB_REPLAY_SPEED_MAX, 0) != USB_SUCCESS) {
+            debug_printf("回放后端初始化失败: 未指定回放文件");
+            return USB_ERROR_INVALID_PARAM;
+        }
+    }
+    g_replay_data = replay_read_file(g_replay_path, &g_replay_size);
+    if (!g_replay_data) {
+        debug_printf("无法读取回放文件: %s", g_replay_path);
+        return USB_ERROR_NOT_FOUND;
+    }
+    memset(g_replay_devices, 0, sizeof(g_replay_devices));
+    g_replay_device_count = 0;
+    int ret = replay_index();
+    if (ret != USB_SUCCESS) {
+        debug_printf("回放文件格式错误: %s", g_replay_path);
+        replay_free_all();
+        return ret;
+    }
+    memset(&g_replay_stats, 0, sizeof(g_replay_stats));
+    g_replay_stats.device_count = g_replay_device_count;
+    InitializeCriticalSection(&g_replay_lock);
+    InitializeConditionVariable(&g_replay_cond);
+    g_replay_initialized = 1;
+    debug_printf("回放后端已初始化: %s, %llu字节, %d个设备", g_replay_path,
+                 (unsigned long long)g_replay_size, g_replay_device_count);
+    return USB_SUCCESS;
+}
+
+static void replay_cleanup(void) {
+    if (!g_replay_initialized) {
+        return;
+    }
+    EnterCriticalSection(&g_replay_lock);
+    g_replay_initialized = 0;
+    WakeAllConditionVariable(&g_replay_cond);
+    LeaveCriticalSection(&g_replay_lock);
+    DeleteCriticalSection(&g_replay_lock);
+#ifndef _WIN32
+    pthread_cond_destroy(&g_replay_cond);
+#endif
+    replay_free_all();
+}
+
+static int replay_get_device_list(void* ctx, void*** device_list) {
+    (void)ctx;
+    if (!g_replay_initialized || !device_list) {
+        return -1;
+    }
+    void** list = (void**)calloc((size_t)g_replay_device_count + 1, sizeof(void*));
+    if (!list) {
+        return -1;
+    }
+    for (int i = 0; i < g_replay_device_count; i++) {
+        list[i] = &g_replay_devices[i];
+    }
+    *device_list = list;
+    return g_replay_device_count;
+}
+
+static void replay_free_device_list(void** list, int unref_devices) {
+    (void)unref_devices;
+    free(list);
+}
+
+static int replay_get_device_descriptor(void* dev, usb_device_descriptor* desc) {
+    if (!g_replay_initialized || !replay_device_from(dev) || !desc) {
+        return -1;
+    }
+    memset(desc, 0, sizeof(*desc));
+    desc->bLength = 18;
+    desc->bDescriptorType = 1;
+    desc->bcdUSB = 0x0200;
+    desc->bMaxPacketSize0 = 64;
+    desc->idVendor = REPLAY_VENDOR_ID;
+    desc->idProduct = REPLAY_PRODUCT_ID;
+    desc->bcdDevice = 0x0100;
+    desc->iManufacturer = 1;
+    desc->iProduct = 2;
+    desc->iSerialNumber = 3;
+    desc->bNumConfigurations = 1;
+    return 0;
+}
+
+static int replay_open(void* dev, void** handle) {
+    replay_device_t* rd = replay_device_from(dev);
+    if (!g_replay_initialized || !rd || !handle) {
+        return -1;
+    }
+    EnterCriticalSection(&g_replay_lock);
+    rd->open_count++;
+    LeaveCriticalSection(&g_replay_lock);
+    *handle = rd;
+    return 0;
+}
+
+static void replay_close(void* handle) {
+    replay_device_t* rd = replay_device_from(handle);
+    if (!g_replay_initialized || !rd) {
+        return;
+    }
+    EnterCriticalSection(&g_replay_lock);
+    if (rd->open_count > 0) {
+        rd->open_count--;
+    }
+    LeaveCriticalSection(&g_replay_lock);
+}
+
+static int replay_get_string_descriptor_ascii(void* handle, uint8_t desc_index, unsigned char* data, int length) {
+    replay_device_t* rd = replay_device_from(handle);
+    if (!g_replay_initialized || !rd || !data || length <= 0) {
+        return -1;
+    }
+    const char* str;
+    switch (desc_index) {
+    case 1:
+        str = "G2X Replay";
+        break;
+    case 2:
+        str = "G2X-REPLAY";
+        break;
+    case 3:
+        str = rd->serial;
+        break;
+    default:
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    int n = (int)strlen(str);
+    if (n > length - 1) {
+        n = length - 1;
+    }
+    memcpy(data, str, (size_t)n);
+    data[n] = '\0';
+    return n;
+}
+
+// 每次打开设备都从文件开头回放
+static int replay_claim_interface(void* handle, int interface_number) {
+    replay_device_t* rd = replay_device_from(handle);
+    if (!g_replay_initialized || !rd || interface_number != 0) {
+        return -1;
+    }
+    EnterCriticalSection(&g_replay_lock);
+    rd->cursor = 0;
+    rd->cursor_offset = 0;
+    rd->base_us = usb_now_us();
+    rd->claimed = 1;
+    LeaveCriticalSection(&g_replay_lock);
+    return 0;
+}
+
+static int replay_release_interface(void* handle, int interface_number) {
+    replay_device_t* rd = replay_device_from(handle);
+    if (!g_replay_initialized || !rd || interface_number != 0) {
+        return -1;
+    }
+    EnterCriticalSection(&g_replay_lock);
+    rd->claimed = 0;
+    WakeAllConditionVariable(&g_replay_cond);
+    LeaveCriticalSection(&g_replay_lock);
+    return 0;
+}
+
+static DWORD replay_wait_ms(unsigned long long now, unsigned long long until) {
+    if (until <= now) {
+        return 0;
+    }
+    unsigned long long ms = (until - now + 999) / 1000;
+    return ms > 1000 ? 1000 : (DWORD)ms;
+}
+
+static int replay_bulk_transfer(void* handle, unsigned char endpoint, unsigned char* data, int length,
+                                int* transferred, unsigned int timeout) {
+    replay_device_t* rd = replay_device_from(handle);
+    if (!g_replay_initialized || !rd || !data || length <= 0 || !transferred) {
+        return -1;
+    }
+    *transferred = 0;
+    EnterCriticalSection(&g_replay_lock);
+    if (!rd->claimed) {
+        LeaveCriticalSection(&g_replay_lock);
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    if (!(endpoint & 0x80)) {
+        g_replay_stats.out_transfers++;
+        g_replay_stats.out_bytes += (unsigned long long)length;
+        LeaveCriticalSection(&g_replay_lock);
+        *transferred = length;
+        return LIBUSB_SUCCESS;
+    }
+
+    unsigned long long now = usb_now_us();
+    unsigned long long deadline = timeout ? now + (unsigned long long)timeout * 1000ULL : ~0ULL;
+    int ret = LIBUSB_ERROR_TIMEOUT;
+    while (g_replay_initialized && rd->claimed) {
+        if (rd->cursor >= rd->record_count && g_replay_loop && rd->record_count > 0) {
+            rd->cursor = 0;
+            rd->cursor_offset = 0;
+            rd->base_us = now;
+            g_replay_stats.loops++;
+        }
+        unsigned long long due = now;
+        if (rd->cursor < rd->record_count) {
+            const replay_record_t* rec = &rd->records[rd->cursor];
+            if (g_replay_speed == USB_REPLAY_SPEED_ORIGINAL) {
+                due = rd->base_us + (rec->time_us - rd->records[0].time_us);
+            }
+            if (due <= now) {
+                unsigned int n = rec->length - rd->cursor_offset;
+                if (n > (unsigned int)length) {
+                    n = (unsigned int)length;
+                }
+                memcpy(data, g_replay_data + rec->offset + rd->cursor_offset, n);
+                rd->cursor_offset += n;
+                if (rd->cursor_offset == rec->length) {
+                    rd->cursor++;
+                    rd->cursor_offset = 0;
+                    g_replay_stats.in_records++;
+                }
+                g_replay_stats.in_bytes += n;
+                *transferred = (int)n;
+                ret = LIBUSB_SUCCESS;
+                break;
+            }
+        } else {
+            unsigned long long idle_deadline = now + REPLAY_IDLE_WAIT_MS * 1000ULL;
+            if (idle_deadline < deadline) {
+                deadline = idle_deadline;
+            }
+            due = deadline;
+        }
+        if (now >= deadline) {
+            break;
+        }
+        SleepConditionVariableCS(&g_replay_cond, &g_replay_lock, replay_wait_ms(now, due < deadline ? due : deadline));
+        now = usb_now_us();
+    }
+    if (ret == LIBUSB_ERROR_TIMEOUT && (!g_replay_initialized || !rd->claimed)) {
+        ret = LIBUSB_ERROR_NO_DEVICE;
+    }
+    LeaveCriticalSection(&g_replay_lock);
+    return ret;
+}
+
+static void* replay_get_device(void* handle) {
+    if (!g_replay_initialized) {
+        return NULL;
+    }
+    return replay_device_from(handle);
+}
+
+static void* replay_open_device_with_vid_pid(void* ctx, unsigned short vid, unsigned short pid) {
+    (void)ctx;
+    void* handle = NULL;
+    if (!g_replay_initialized || g_replay_device_count == 0 ||
+        vid != REPLAY_VENDOR_ID || pid != REPLAY_PRODUCT_ID) {
+        return NULL;
+    }
+    return replay_open(&g_replay_devices[0], &handle) == 0 ? handle : NULL;
+}
+
+// 不支持异步传输，中间层退回同步读取
+static int replay_async_supported(void) {
+    return 0;
+}
+
+static usb_transfer_t* replay_alloc_transfer(int iso_packets) {
+    (void)iso_packets;
+    return NULL;
+}
+
+static void replay_free_transfer(usb_transfer_t* transfer) {
+    (void)transfer;
+}
+
+static int replay_submit_transfer(usb_transfer_t* transfer) {
+    (void)transfer;
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+static int replay_cancel_transfer(usb_transfer_t* transfer) {
+    (void)transfer;
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+static int replay_handle_events_timeout(void* ctx, int timeout_ms, int* completed) {
+    (void)ctx;
+    (void)timeout_ms;
+    (void)completed;
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+static const usb_transport_t g_replay_transport = {
+    "replay",
+    replay_init,
+    replay_cleanup,
+    replay_get_device_list,
+    replay_free_device_list,
+    replay_get_device_descriptor,
+    replay_open,
+    replay_close,
+    replay_get_string_descriptor_ascii,
+    replay_claim_interface,
+    replay_release_interface,
+    replay_bulk_transfer,
+    replay_get_device,
+    replay_open_device_with_vid_pid,
+    replay_async_supported,
+    replay_alloc_transfer,
+    replay_free_transfer,
+    replay_submit_transfer,
+    replay_cancel_transfer,
+    replay_handle_events_timeout,
+};
+
+const usb_transport_t* usb_replay_transport(void) {
+    return &g_replay_transport;
+}
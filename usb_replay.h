@@ -0,0 +1,46 @@
+/**
+ * @file usb_replay.h
+ * @brief 录制文件回放(传输后端)
+ * 把usb_capture录下的文件整体读进内存，每个录到的设备枚举为一个设备(序列号与录制时相同)，
+ * 批量IN读取按原来的传输边界依次返回录到的IN数据，可按原始时间间隔或尽快送出；OUT数据只计数后丢弃。
+ * 命令应答只是按录制顺序出现在IN数据中，不会与本次发出的命令对应，适合复现解析问题和测解析吞吐。
+ * 先调用usb_replay_configure，再通过usb_device_set_transport(usb_replay_transport())或
+ * USB_G2X_TRANSPORT=replay(文件由USB_G2X_REPLAY_FILE指定)启用。
+ */
+
+#ifndef USB_REPLAY_H
+#define USB_REPLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usb_device.h"
+
+#define USB_REPLAY_MAX_DEVICES  8
+
+#define USB_REPLAY_SPEED_MAX       0    // 读取方要多少给多少
+#define USB_REPLAY_SPEED_ORIGINAL  1    // 按录制时的时间间隔送出
+
+typedef struct {
+    unsigned long long in_records;      // 已送出的IN记录数
+    unsigned long long in_bytes;        // 已送出的IN字节数
+    unsigned long long out_transfers;   // 收到并丢弃的OUT传输
+    unsigned long long out_bytes;
+    unsigned int loops;                 // 各设备回到文件开头重放的总次数
+    int device_count;                   // 文件中的设备数
+    int finished;                       // 1=所有设备的IN记录都已送完(循环回放时始终为0)
+} usb_replay_stats_t;
+
+const usb_transport_t* usb_replay_transport(void);
+
+// 设置回放文件和速度，loop=1时送完后从头再来；在后端初始化(切换到replay)时读取文件
+int usb_replay_configure(const char* path, int speed, int loop);
+
+void usb_replay_get_stats(usb_replay_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_REPLAY_H
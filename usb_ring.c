@@ -0,0 +1,530 @@
+/**
+ * @file usb_ring.c
+ * @brief 无锁环形缓冲区实现
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+#include "usb_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define RING_LOAD(p)             __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v)         __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define RING_CAS(p, expected, v) __atomic_compare_exchange_n((p), (expected), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+static unsigned int round_up_pow2(unsigned int v) {
+    unsigned int n = 1;
+    while (n < v && n < 0x80000000u) {
+        n <<= 1;
+    }
+    return n;
+}
+
+static unsigned long long ring_now_ms(void) {
+#ifdef _WIN32
+    return (unsigned long long)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + (unsigned long long)(ts.tv_nsec / 1000000);
+#endif
+}
+
+static void ring_sync_init(ring_buffer_t* rb) {
+    rb->write_pos = 0;
+    rb->read_pos = 0;
+    rb->borrowed = 0;
+    rb->waiters = 0;
+    rb->closed = 0;
+    rb->overflow_policy = RING_OVERFLOW_DROP_OLDEST;
+    rb->block_timeout_ms = 0;
+    rb->writer_waiting = 0;
+    rb->written_bytes = 0;
+    rb->dropped_bytes = 0;
+    rb->dropped_packets = 0;
+    rb->blocked_count = 0;
+    rb->high_water = 0;
+    InitializeCriticalSection(&rb->lock);
+    InitializeConditionVariable(&rb->data_ready);
+    InitializeConditionVariable(&rb->space_ready);
+    rb->initialized = 1;
+}
+
+// 消费者推进read_pos后调用；与生产者"先登记writer_waiting再检查空间"配对
+static void ring_wake_writer(ring_buffer_t* rb) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rb->writer_waiting, __ATOMIC_RELAXED)) {
+        EnterCriticalSection(&rb->lock);
+        WakeAllConditionVariable(&rb->space_ready);
+        LeaveCriticalSection(&rb->lock);
+    }
+}
+
+static void ring_count_drop(ring_buffer_t* rb, unsigned int bytes) {
+    __atomic_fetch_add(&rb->dropped_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rb->dropped_packets, 1, __ATOMIC_RELAXED);
+}
+
+// 数据区指针最后发布，消费者看到非空buffer时size/mask已经可见
+static void ring_publish(ring_buffer_t* rb, unsigned char* buffer, unsigned int size, int mirrored) {
+    rb->size = size;
+    rb->mask = size - 1;
+    rb->mirrored = mirrored;
+    RING_STORE(&rb->buffer, buffer);
+}
+
+static int ring_alloc_plain(ring_buffer_t* rb, unsigned int size) {
+    size = round_up_pow2(size);
+    unsigned char* buffer = (unsigned char*)malloc(size);
+    if (!buffer) {
+        return -1;
+    }
+    ring_publish(rb, buffer, size, 0);
+    return 0;
+}
+
+static int ring_alloc_mirrored(ring_buffer_t* rb, unsigned int size) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0 && size < (unsigned int)page_size) {
+        size = (unsigned int)page_size;
+    }
+    size = round_up_pow2(size);
+    if (size > 0x40000000u) {
+        return -1;
+    }
+
+    int fd = (int)syscall(SYS_memfd_create, "usb_ring", 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return -1;
+    }
+    // 先保留2*size的连续地址空间，再把同一段物理页映射到前后两半
+    unsigned char* base = (unsigned char*)mmap(NULL, (size_t)size * 2, PROT_NONE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, (size_t)size * 2);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    ring_publish(rb, base, size, 1);
+    return 0;
+#else
+    (void)rb;
+    (void)size;
+    return -1;
+#endif
+}
+
+// 从环形下标pos开始复制length字节到dst，处理回绕
+static void ring_copy_out(const ring_buffer_t* rb, unsigned int pos, unsigned char* dst, unsigned int length) {
+    unsigned int offset = pos & rb->mask;
+    if (rb->mirrored) {
+        memcpy(dst, rb->buffer + offset, length);
+        return;
+    }
+    unsigned int first_part = rb->size - offset;
+    if (length <= first_part) {
+        memcpy(dst, rb->buffer + offset, length);
+    } else {
+        memcpy(dst, rb->buffer + offset, first_part);
+        memcpy(dst + first_part, rb->buffer, length - first_part);
+    }
+}
+
+int ring_buffer_init(ring_buffer_t* rb, unsigned int size) {
+    if (!rb || size == 0) {
+        return -1;
+    }
+    rb->buffer = NULL;
+    if (ring_alloc_plain(rb, size) != 0) {
+        rb->size = 0;
+        rb->mask = 0;
+        return -1;
+    }
+    rb->capacity = rb->size;
+    rb->lazy_mirrored = 0;
+    ring_sync_init(rb);
+    return 0;
+}
+
+int ring_buffer_init_mirrored(ring_buffer_t* rb, unsigned int size) {
+    if (!rb || size == 0) {
+        return -1;
+    }
+    rb->buffer = NULL;
+    if (ring_alloc_mirrored(rb, size) != 0) {
+        return -1;
+    }
+    rb->capacity = rb->size;
+    rb->lazy_mirrored = 1;
+    ring_sync_init(rb);
+    return 0;
+}
+
+int ring_buffer_init_lazy(ring_buffer_t* rb, unsigned int size, int mirrored) {
+    if (!rb || size == 0) {
+        return -1;
+    }
+    rb->buffer = NULL;
+    rb->size = 0;
+    rb->mask = 0;
+    rb->mirrored = 0;
+    rb->capacity = round_up_pow2(size);
+    rb->lazy_mirrored = mirrored;
+    ring_sync_init(rb);
+    return 0;
+}
+
+void ring_buffer_free(ring_buffer_t* rb) {
+    if (!rb) {
+        return;
+    }
+    if (rb->initialized) {
+        DeleteCriticalSection(&rb->lock);
+#ifndef _WIN32
+        pthread_cond_destroy(&rb->data_ready);
+        pthread_cond_destroy(&rb->space_ready);
+#endif
+        rb->initialized = 0;
+    }
+#if defined(__linux__)
+    if (rb->mirrored) {
+        if (rb->buffer) {
+            munmap(rb->buffer, (size_t)rb->size * 2);
+        }
+        rb->buffer = NULL;
+        rb->mirrored = 0;
+    }
+#endif
+    free(rb->buffer);
+    rb->buffer = NULL;
+    rb->size = 0;
+    rb->mask = 0;
+    rb->write_pos = 0;
+    rb->read_pos = 0;
+    rb->borrowed = 0;
+    rb->capacity = 0;
+}
+
+void write_to_ring_buffer(ring_buffer_t* rb, const unsigned char* data, int length) {
+    if (!rb || !rb->initialized || !data || length <= 0) {
+        return;
+    }
+    if (!rb->buffer) {
+        // 延迟分配：只有生产者会走到这里，分配失败时丢弃本次数据，下次写入再试
+        if (!(rb->lazy_mirrored && ring_alloc_mirrored(rb, rb->capacity) == 0) &&
+            ring_alloc_plain(rb, rb->capacity) != 0) {
+            return;
+        }
+    }
+    unsigned int len = (unsigned int)length;
+    unsigned int w = rb->write_pos;
+    unsigned int r = RING_LOAD(&rb->read_pos);
+    __atomic_fetch_add(&rb->written_bytes, len, __ATOMIC_RELAXED);
+
+    if ((w - r) + len > rb->size) {
+        // 空间不足走慢路径：与peek/commit互斥，保证借出区域不被覆盖
+        EnterCriticalSection(&rb->lock);
+        r = RING_LOAD(&rb->read_pos);
+        int policy = rb->overflow_policy;
+        if ((policy == RING_OVERFLOW_BLOCK || policy == RING_OVERFLOW_BACKPRESSURE) &&
+            len <= rb->size && !rb->closed) {
+            unsigned long long deadline = ring_now_ms() + rb->block_timeout_ms;
+            __atomic_fetch_add(&rb->blocked_count, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&rb->writer_waiting, 1, __ATOMIC_SEQ_CST);
+            for (;;) {
+                r = RING_LOAD(&rb->read_pos);
+                if ((w - r) + len <= rb->size || rb->closed) {
+                    break;
+                }
+                DWORD wait_ms = INFINITE;
+                if (policy == RING_OVERFLOW_BLOCK) {
+                    unsigned long long now = ring_now_ms();
+                    if (now >= deadline) {
+                        break;
+                    }
+                    wait_ms = (DWORD)(deadline - now);
+                }
+                SleepConditionVariableCS(&rb->space_ready, &rb->lock, wait_ms);
+            }
+            __atomic_store_n(&rb->writer_waiting, 0, __ATOMIC_RELAXED);
+        }
+        if ((w - r) + len > rb->size) {
+            if (rb->borrowed || policy != RING_OVERFLOW_DROP_OLDEST) {
+                // 只写入放得下的部分，丢弃多余的新数据
+                unsigned int space = rb->size - (w - r);
+                ring_count_drop(rb, len - space);
+                len = space;
+            } else {
+                unsigned int dropped = 0;
+                if (len > rb->size) {
+                    // 只保留最新的size字节
+                    dropped = len - rb->size;
+                    data += dropped;
+                    len = rb->size;
+                }
+                // 先推进read_pos丢弃最旧数据，再覆盖写入；
+                // 正在复制这段数据的消费者会因CAS失败而重读
+                while ((w - r) + len > rb->size) {
+                    unsigned int new_r = w + len - rb->size;
+                    if (RING_CAS(&rb->read_pos, &r, new_r)) {
+                        dropped += new_r - r;
+                        break;
+                    }
+                }
+                ring_count_drop(rb, dropped);
+            }
+        }
+        LeaveCriticalSection(&rb->lock);
+        if (len == 0) {
+            return;
+        }
+    }
+
+    unsigned int offset = w & rb->mask;
+    unsigned int first_part = rb->size - offset;
+    if (rb->mirrored || len <= first_part) {
+        memcpy(rb->buffer + offset, data, len);
+    } else {
+        memcpy(rb->buffer + offset, data, first_part);
+        memcpy(rb->buffer, data + first_part, len - first_part);
+    }
+    RING_STORE(&rb->write_pos, w + len);
+
+    unsigned int used = w + len - RING_LOAD(&rb->read_pos);
+    if (used > __atomic_load_n(&rb->high_water, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&rb->high_water, used, __ATOMIC_RELAXED);
+    }
+
+    // 与ring_buffer_wait中"先登记waiters再检查数据"配对，保证不会漏掉唤醒
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rb->waiters, __ATOMIC_RELAXED)) {
+        EnterCriticalSection(&rb->lock);
+        WakeAllConditionVariable(&rb->data_ready);
+        LeaveCriticalSection(&rb->lock);
+    }
+}
+
+int ring_buffer_read(ring_buffer_t* rb, unsigned char* data, int length) {
+    if (!rb || !RING_LOAD(&rb->buffer) || !data || length <= 0) {
+        return 0;
+    }
+    for (;;) {
+        unsigned int r = RING_LOAD(&rb->read_pos);
+        unsigned int w = RING_LOAD(&rb->write_pos);
+        unsigned int available = w - r;
+        unsigned int to_read = available < (unsigned int)length ? available : (unsigned int)length;
+        if (to_read == 0) {
+            return 0;
+        }
+        ring_copy_out(rb, r, data, to_read);
+        if (RING_CAS(&rb->read_pos, &r, r + to_read)) {
+            ring_wake_writer(rb);
+            return (int)to_read;
+        }
+    }
+}
+
+int ring_buffer_read_latest(ring_buffer_t* rb, unsigned char* data, int length) {
+    if (!rb || !RING_LOAD(&rb->buffer) || !data || length <= 0) {
+        return 0;
+    }
+    for (;;) {
+        unsigned int r = RING_LOAD(&rb->read_pos);
+        unsigned int w = RING_LOAD(&rb->write_pos);
+        unsigned int available = w - r;
+        if (available == 0) {
+            return 0;
+        }
+        if (available <= (unsigned int)length) {
+            ring_copy_out(rb, r, data, available);
+            if (RING_CAS(&rb->read_pos, &r, w)) {
+                ring_wake_writer(rb);
+                return (int)available;
+            }
+            continue;
+        }
+        unsigned int start = w - (unsigned int)length;
+        ring_copy_out(rb, start, data, (unsigned int)length);
+        // 复制期间生产者没有丢弃到start之后，数据才有效。获取屏障保证复制中的读取都在重读read_pos之前完成
+        // (同seqlock读端)；只靠获取读取，弱序CPU上复制的读取可以推迟到它之后
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        unsigned int r2 = RING_LOAD(&rb->read_pos);
+        if ((int)(r2 - start) <= 0) {
+            return length;
+        }
+    }
+}
+
+unsigned int ring_buffer_available(ring_buffer_t* rb) {
+    if (!rb || !RING_LOAD(&rb->buffer)) {
+        return 0;
+    }
+    unsigned int r = RING_LOAD(&rb->read_pos);
+    unsigned int w = RING_LOAD(&rb->write_pos);
+    return w - r;
+}
+
+void ring_buffer_clear(ring_buffer_t* rb) {
+    if (!rb || !RING_LOAD(&rb->buffer)) {
+        return;
+    }
+    unsigned int r = RING_LOAD(&rb->read_pos);
+    for (;;) {
+        unsigned int w = RING_LOAD(&rb->write_pos);
+        if (RING_CAS(&rb->read_pos, &r, w)) {
+            ring_wake_writer(rb);
+            return;
+        }
+    }
+}
+
+int ring_buffer_wait(ring_buffer_t* rb, unsigned int min_bytes, unsigned int timeout_ms) {
+    if (!rb || !rb->initialized) {
+        return -1;
+    }
+    if (min_bytes == 0) {
+        min_bytes = 1;
+    }
+    if (min_bytes > rb->capacity) {
+        min_bytes = rb->capacity;
+    }
+    unsigned int available = ring_buffer_available(rb);
+    if (available >= min_bytes || timeout_ms == 0) {
+        return (int)available;
+    }
+
+    unsigned long long deadline = ring_now_ms() + timeout_ms;
+    EnterCriticalSection(&rb->lock);
+    __atomic_add_fetch(&rb->waiters, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        available = RING_LOAD(&rb->write_pos) - RING_LOAD(&rb->read_pos);
+        if (available >= min_bytes || rb->closed) {
+            break;
+        }
+        DWORD wait_ms = INFINITE;
+        if (timeout_ms != INFINITE) {
+            unsigned long long now = ring_now_ms();
+            if (now >= deadline) {
+                break;
+            }
+            wait_ms = (DWORD)(deadline - now);
+        }
+        SleepConditionVariableCS(&rb->data_ready, &rb->lock, wait_ms);
+    }
+    int closed = rb->closed;
+    LeaveCriticalSection(&rb->lock);
+    // 最后一步才注销，ring_buffer_shutdown据此判断可以安全释放
+    __atomic_sub_fetch(&rb->waiters, 1, __ATOMIC_SEQ_CST);
+    return closed ? -1 : (int)available;
+}
+
+void ring_buffer_shutdown(ring_buffer_t* rb) {
+    if (!rb || !rb->initialized) {
+        return;
+    }
+    EnterCriticalSection(&rb->lock);
+    rb->closed = 1;
+    WakeAllConditionVariable(&rb->data_ready);
+    WakeAllConditionVariable(&rb->space_ready);
+    LeaveCriticalSection(&rb->lock);
+    while (__atomic_load_n(&rb->waiters, __ATOMIC_ACQUIRE)) {
+        Sleep(1);
+    }
+}
+
+unsigned int ring_buffer_peek(ring_buffer_t* rb, const unsigned char** ptr) {
+    if (!rb || !RING_LOAD(&rb->buffer) || !ptr) {
+        return 0;
+    }
+    EnterCriticalSection(&rb->lock);
+    unsigned int r = RING_LOAD(&rb->read_pos);
+    unsigned int w = RING_LOAD(&rb->write_pos);
+    unsigned int offset = r & rb->mask;
+    unsigned int length = w - r;
+    if (!rb->mirrored && length > rb->size - offset) {
+        length = rb->size - offset;
+    }
+    rb->borrowed = length;
+    *ptr = rb->buffer + offset;
+    LeaveCriticalSection(&rb->lock);
+    return length;
+}
+
+unsigned int ring_buffer_commit(ring_buffer_t* rb, unsigned int n) {
+    if (!rb || !RING_LOAD(&rb->buffer)) {
+        return 0;
+    }
+    EnterCriticalSection(&rb->lock);
+    if (n > rb->borrowed) {
+        n = rb->borrowed;
+    }
+    if (n > 0) {
+        __atomic_fetch_add(&rb->read_pos, n, __ATOMIC_ACQ_REL);
+    }
+    rb->borrowed = 0;
+    if (rb->writer_waiting) {
+        WakeAllConditionVariable(&rb->space_ready);
+    }
+    LeaveCriticalSection(&rb->lock);
+    return n;
+}
+
+int ring_buffer_set_overflow_policy(ring_buffer_t* rb, int policy, unsigned int timeout_ms) {
+    if (!rb || !rb->initialized || policy < RING_OVERFLOW_DROP_OLDEST || policy > RING_OVERFLOW_BACKPRESSURE) {
+        return -1;
+    }
+    EnterCriticalSection(&rb->lock);
+    rb->overflow_policy = policy;
+    rb->block_timeout_ms = timeout_ms;
+    LeaveCriticalSection(&rb->lock);
+    return 0;
+}
+
+void ring_buffer_get_stats(ring_buffer_t* rb, ring_buffer_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!rb || !rb->initialized) {
+        return;
+    }
+    stats->written_bytes = __atomic_load_n(&rb->written_bytes, __ATOMIC_RELAXED);
+    stats->dropped_bytes = __atomic_load_n(&rb->dropped_bytes, __ATOMIC_RELAXED);
+    stats->dropped_packets = __atomic_load_n(&rb->dropped_packets, __ATOMIC_RELAXED);
+    stats->blocked_count = __atomic_load_n(&rb->blocked_count, __ATOMIC_RELAXED);
+    stats->capacity = rb->capacity;
+    stats->available = ring_buffer_available(rb);
+    stats->high_water = __atomic_load_n(&rb->high_water, __ATOMIC_RELAXED);
+    stats->overflow_policy = rb->overflow_policy;
+}
+
+void ring_buffer_reset_stats(ring_buffer_t* rb) {
+    if (!rb || !rb->initialized) {
+        return;
+    }
+    __atomic_store_n(&rb->written_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&rb->dropped_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&rb->dropped_packets, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&rb->blocked_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&rb->high_water, ring_buffer_available(rb), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,124 @@
+/**
+ * @file usb_ring.h
+ * @brief 无锁环形缓冲区
+ * 单生产者(读取线程)写入，消费者通过CAS推进读位置，热路径上不加锁。
+ * 读写位置为单调递增的32位计数，容量为2的幂，下标取 pos & mask。
+ * ring_buffer_peek/commit 可把可读区域原地借给调用方，借出期间生产者不会覆盖该区域。
+ * ring_buffer_wait 让消费者睡眠等待数据，生产者只在有等待者时才进入锁唤醒。
+ * ring_buffer_init_lazy 只创建同步对象，数据区在生产者第一次写入时才分配，之前读到的都是空缓冲区。
+ * 写满时的处理由溢出策略决定(默认丢弃最旧数据)，丢弃的字节数和写入次数都有计数。
+ */
+
+#ifndef USB_RING_H
+#define USB_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#endif
+
+// 写满时的溢出策略
+#define RING_OVERFLOW_DROP_OLDEST   0   // 丢弃最旧的数据(默认)
+#define RING_OVERFLOW_DROP_NEWEST   1   // 丢弃放不下的新数据，已有数据保持连续
+#define RING_OVERFLOW_BLOCK         2   // 生产者等待消费者腾出空间，超时后丢弃放不下的新数据
+#define RING_OVERFLOW_BACKPRESSURE  3   // 生产者一直等到有空间或缓冲区关闭；读取线程停止从端点取数据，设备端随之受阻。
+                                        // 阻塞/背压的生产者不能是libusb传输回调，中间层只在同步读取模式下允许
+
+typedef struct {
+    unsigned long long written_bytes;   // 生产者交来的字节数(含被丢弃的)
+    unsigned long long dropped_bytes;   // 因写满丢弃的字节数(旧数据或新数据)
+    unsigned long long dropped_packets; // 发生丢弃的写入次数
+    unsigned long long blocked_count;   // 生产者因写满而等待的次数
+    unsigned int capacity;              // 容量
+    unsigned int available;             // 当前可读字节数
+    unsigned int high_water;            // 可读字节数的最高水位
+    int overflow_policy;
+} ring_buffer_stats_t;
+
+typedef struct {
+    unsigned char* buffer;     // 缓冲区指针
+    unsigned int size;         // 缓冲区大小(2的幂)
+    unsigned int mask;         // size - 1
+    unsigned int write_pos;    // 写入计数，只由生产者推进
+    unsigned int read_pos;     // 读取计数，消费者推进；写满丢弃旧数据时生产者也会推进
+    int mirrored;              // 1=同一物理页连续映射两次，任意可读区域都是连续内存
+    unsigned int borrowed;     // 已借出(peek未commit)的字节数，只在lock内修改
+    CRITICAL_SECTION lock;     // 只保护写满丢弃、peek/commit和等待这些慢路径
+    CONDITION_VARIABLE data_ready; // 有新数据写入时唤醒等待者
+    unsigned int waiters;      // 正在ring_buffer_wait中等待的线程数
+    int closed;                // 已关闭，等待者立即返回
+    int initialized;           // 同步对象已创建，数据区可能尚未分配
+    unsigned int capacity;     // 容量(2的幂)，延迟分配时数据区分配前即已确定
+    int lazy_mirrored;         // 延迟分配时优先使用镜像映射
+    int overflow_policy;       // RING_OVERFLOW_xxx
+    unsigned int block_timeout_ms;  // RING_OVERFLOW_BLOCK的最长等待
+    CONDITION_VARIABLE space_ready; // 消费者腾出空间时唤醒等待中的生产者
+    unsigned int writer_waiting;    // 生产者正在等待空间
+    unsigned long long written_bytes;
+    unsigned long long dropped_bytes;
+    unsigned long long dropped_packets;
+    unsigned long long blocked_count;
+    unsigned int high_water;        // 写入后可读字节数的最大值
+} ring_buffer_t;
+
+// 分配缓冲区，size向上取整到2的幂
+int ring_buffer_init(ring_buffer_t* rb, unsigned int size);
+
+// 分配镜像映射的缓冲区(memfd + 两次mmap)，size向上取整到2的幂且不小于页大小；
+// 平台不支持时返回-1，调用方可退回ring_buffer_init
+int ring_buffer_init_mirrored(ring_buffer_t* rb, unsigned int size);
+
+// 延迟分配：只记录容量，第一次write_to_ring_buffer时才分配数据区(mirrored=1时优先镜像映射)
+int ring_buffer_init_lazy(ring_buffer_t* rb, unsigned int size, int mirrored);
+
+void ring_buffer_free(ring_buffer_t* rb);
+
+// 生产者写入；空间不足时按溢出策略处理，有数据借出时丢弃最旧数据改为丢弃放不下的新数据
+void write_to_ring_buffer(ring_buffer_t* rb, const unsigned char* data, int length);
+
+// 消费者读取并移除最多length字节，返回实际读取的字节数
+int ring_buffer_read(ring_buffer_t* rb, unsigned char* data, int length);
+
+// 可用数据不超过length时全部读出并移除；否则只复制最新的length字节，不移除
+int ring_buffer_read_latest(ring_buffer_t* rb, unsigned char* data, int length);
+
+// 当前可读字节数
+unsigned int ring_buffer_available(ring_buffer_t* rb);
+
+// 丢弃当前全部可读数据(消费者侧调用)
+void ring_buffer_clear(ring_buffer_t* rb);
+
+// 等待可读数据达到min_bytes字节或超时(timeout_ms为INFINITE时一直等待)，
+// 返回当前可读字节数(超时时可能小于min_bytes)；缓冲区已关闭返回-1
+int ring_buffer_wait(ring_buffer_t* rb, unsigned int min_bytes, unsigned int timeout_ms);
+
+// 设置溢出策略，timeout_ms只用于RING_OVERFLOW_BLOCK；等待中的生产者不受影响
+int ring_buffer_set_overflow_policy(ring_buffer_t* rb, int policy, unsigned int timeout_ms);
+
+// 读取写入/丢弃计数
+void ring_buffer_get_stats(ring_buffer_t* rb, ring_buffer_stats_t* stats);
+
+// 计数和最高水位清零
+void ring_buffer_reset_stats(ring_buffer_t* rb);
+
+// 标记关闭并唤醒所有等待者(包括等待空间的生产者)，返回前等待它们全部退出；之后才能ring_buffer_free
+void ring_buffer_shutdown(ring_buffer_t* rb);
+
+// 借出从读位置开始的连续可读区域，返回其长度(非镜像缓冲区在回绕处截断)；
+// 调用方处理完后必须调用ring_buffer_commit，借出期间只允许一个消费者
+unsigned int ring_buffer_peek(ring_buffer_t* rb, const unsigned char** ptr);
+
+// 归还借出区域并移除前n字节(n不超过借出长度)，返回实际移除的字节数
+unsigned int ring_buffer_commit(ring_buffer_t* rb, unsigned int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_RING_H
@@ -0,0 +1,382 @@
+/**
+ * @file usb_ring_file.c
+ * @brief 环形缓冲区落盘
+ * 写入线程等缓冲区攒够一块，拷进对齐的块缓冲区后整块写出；写文件期间新数据继续留在环形缓冲区中。
+ * 停止时只写完停止那一刻缓冲区中已有的数据，避免数据源不停时停不下来。
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+#include "usb_ring_file.h"
+#include "usb_clock.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include "platform_compat.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define RING_FILE_WAIT_MS   100
+#define RING_FILE_PATH_MAX  512
+
+struct usb_ring_file {
+    ring_buffer_t* ring;
+    char path[RING_FILE_PATH_MAX];
+    unsigned int block_size;
+    unsigned long long rotate_bytes;
+    unsigned char* block;               // USB_RING_FILE_ALIGN对齐的块缓冲区
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+    unsigned long long file_bytes;      // 当前文件已写入的数据字节
+    int want_direct;
+    int stop;
+    HANDLE thread;
+    unsigned long long start_us;
+    unsigned long long ring_dropped_base; // 开始时缓冲区的丢弃计数
+    CRITICAL_SECTION lock;              // 保护stats
+    usb_ring_file_stats_t stats;
+};
+
+static unsigned char* aligned_block_alloc(unsigned int size) {
+#ifdef _WIN32
+    return (unsigned char*)_aligned_malloc(size, USB_RING_FILE_ALIGN);
+#else
+    void* p = NULL;
+    return posix_memalign(&p, USB_RING_FILE_ALIGN, size) == 0 ? (unsigned char*)p : NULL;
+#endif
+}
+
+static void aligned_block_free(unsigned char* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static int last_error(void) {
+#ifdef _WIN32
+    return (int)GetLastError();
+#else
+    return errno;
+#endif
+}
+
+// 分割文件时在扩展名前加序号：capture.bin -> capture_0000.bin
+static void ring_file_name(const usb_ring_file_t* rf, unsigned int index, char* name, size_t size) {
+    if (!rf->rotate_bytes) {
+        snprintf(name, size, "%s", rf->path);
+        return;
+    }
+    const char* dot = strrchr(rf->path, '.');
+    const char* sep = strrchr(rf->path, '/');
+    const char* bsep = strrchr(rf->path, '\\');
+    if (bsep > sep) {
+        sep = bsep;
+    }
+    if (!dot || (sep && dot < sep)) {
+        snprintf(name, size, "%s_%04u", rf->path, index);
+    } else {
+        snprintf(name, size, "%.*s_%04u%s", (int)(dot - rf->path), rf->path, index, dot);
+    }
+}
+
+static int ring_file_open(usb_ring_file_t* rf) {
+    char name[RING_FILE_PATH_MAX + 16];
+    ring_file_name(rf, rf->stats.files, name, sizeof(name));
+    int direct = rf->want_direct;
+#ifdef _WIN32
+    rf->file = INVALID_HANDLE_VALUE;
+    if (direct) {
+        rf->file = CreateFileA(name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    if (rf->file == INVALID_HANDLE_VALUE) {
+        direct = 0;
+        rf->file = CreateFileA(name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    int ok = rf->file != INVALID_HANDLE_VALUE;
+#else
+    rf->fd = -1;
+    if (direct) {
+        rf->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    }
+    if (rf->fd < 0) {
+        direct = 0;
+        rf->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    int ok = rf->fd >= 0;
+#endif
+    if (!ok) {
+        int err = last_error();
+        debug_printf("无法创建采集文件: %s, 错误 %d", name, err);
+        return err ? err : -1;
+    }
+    rf->file_bytes = 0;
+    EnterCriticalSection(&rf->lock);
+    rf->stats.files++;
+    rf->stats.direct_io = direct;
+    LeaveCriticalSection(&rf->lock);
+    debug_printf("开始写入采集文件: %s%s", name, direct ? " (直接I/O)" : "");
+    return 0;
+}
+
+// 关闭当前文件，最后一块补齐过时截断回实际长度
+static void ring_file_close(usb_ring_file_t* rf, int padded) {
+#ifdef _WIN32
+    if (rf->file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    if (padded) {
+        LARGE_INTEGER pos;
+        pos.QuadPart = (LONGLONG)rf->file_bytes;
+        if (!SetFilePointerEx(rf->file, pos, NULL, FILE_BEGIN) || !SetEndOfFile(rf->file)) {
+            debug_printf("截断采集文件失败: %d", (int)GetLastError());
+        }
+    }
+    CloseHandle(rf->file);
+    rf->file = INVALID_HANDLE_VALUE;
+#else
+    if (rf->fd < 0) {
+        return;
+    }
+    if (padded && ftruncate(rf->fd, (off_t)rf->file_bytes) != 0) {
+        debug_printf("截断采集文件失败: %d", errno);
+    }
+    close(rf->fd);
+    rf->fd = -1;
+#endif
+}
+
+// 写出length字节(直接I/O时已按USB_RING_FILE_ALIGN补齐)，成功返回0
+static int ring_file_write_raw(usb_ring_file_t* rf, unsigned int length) {
+#ifdef _WIN32
+    DWORD written = 0;
+    if (!WriteFile(rf->file, rf->block, length, &written, NULL) || written != length) {
+        return last_error() ? last_error() : -1;
+    }
+    return 0;
+#else
+    unsigned int done = 0;
+    while (done < length) {
+        ssize_t n = write(rf->fd, rf->block + done, length - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && rf->stats.direct_io && done == 0) {
+            // 打开时接受了O_DIRECT但写入不支持(如部分网络文件系统)，改为普通写入
+            int flags = fcntl(rf->fd, F_GETFL);
+            if (flags >= 0 && fcntl(rf->fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+                EnterCriticalSection(&rf->lock);
+                rf->stats.direct_io = 0;
+                LeaveCriticalSection(&rf->lock);
+                rf->want_direct = 0;
+                continue;
+            }
+        }
+        if (n <= 0) {
+            return n < 0 ? errno : -1;
+        }
+        done += (unsigned int)n;
+    }
+    return 0;
+#endif
+}
+
+// 写出块缓冲区中的length字节数据，需要时先换文件；出错后只计丢失。last为1时不论成败都关闭文件
+static void ring_file_write_block(usb_ring_file_t* rf, unsigned int length, int last) {
+    if (rf->stats.error) {
+        EnterCriticalSection(&rf->lock);
+        rf->stats.lost_bytes += length;
+        LeaveCriticalSection(&rf->lock);
+        if (last) {
+            ring_file_close(rf, 0);
+        }
+        return;
+    }
+    int err = 0;
+    if (rf->rotate_bytes && rf->file_bytes >= rf->rotate_bytes) {
+        ring_file_close(rf, 0);
+        err = ring_file_open(rf);
+    }
+    unsigned int out = length;
+    int padded = 0;
+    if (!err && rf->stats.direct_io && (length % USB_RING_FILE_ALIGN)) {
+        // 只有最后一块会不满，补零写出，关闭时截断
+        out = (length + USB_RING_FILE_ALIGN - 1) / USB_RING_FILE_ALIGN * USB_RING_FILE_ALIGN;
+        memset(rf->block + length, 0, out - length);
+        padded = 1;
+    }
+    if (!err) {
+        err = ring_file_write_raw(rf, out);
+    }
+    EnterCriticalSection(&rf->lock);
+    if (err) {
+        rf->stats.error = err;
+        rf->stats.lost_bytes += length;
+    } else {
+        rf->stats.bytes_written += length;
+    }
+    LeaveCriticalSection(&rf->lock);
+    if (err) {
+        debug_printf("写入采集文件失败，之后的数据丢弃: 错误 %d, 已写%llu字节", err, rf->stats.bytes_written);
+        if (last) {
+            ring_file_close(rf, padded);
+        }
+        return;
+    }
+    rf->file_bytes += length;
+    if (last) {
+        ring_file_close(rf, padded);
+    }
+}
+
+static DWORD WINAPI ring_file_thread_func(LPVOID lpParameter) {
+    usb_ring_file_t* rf = (usb_ring_file_t*)lpParameter;
+    unsigned int filled = 0;
+    unsigned long long stop_budget = 0;     // 停止后还要写出的字节
+    int stopping = 0;
+    for (;;) {
+        if (!stopping && __atomic_load_n(&rf->stop, __ATOMIC_ACQUIRE)) {
+            stopping = 1;
+            stop_budget = ring_buffer_available(rf->ring);
+        }
+        if (!stopping && ring_buffer_wait(rf->ring, rf->block_size - filled, RING_FILE_WAIT_MS) < 0) {
+            // 缓冲区已关闭(设备关闭)，写完剩余数据
+            stopping = 1;
+            stop_budget = ring_buffer_available(rf->ring);
+        }
+        unsigned int want = rf->block_size - filled;
+        if (stopping && want > stop_budget) {
+            want = (unsigned int)stop_budget;
+        }
+        int n = want > 0 ? ring_buffer_read(rf->ring, rf->block + filled, (int)want) : 0;
+        if (n > 0) {
+            filled += (unsigned int)n;
+            if (stopping) {
+                stop_budget -= (unsigned int)n;
+            }
+        }
+        unsigned int backlog = ring_buffer_available(rf->ring);
+        EnterCriticalSection(&rf->lock);
+        rf->stats.backlog = backlog;
+        if (backlog > rf->stats.backlog_high) {
+            rf->stats.backlog_high = backlog;
+        }
+        LeaveCriticalSection(&rf->lock);
+
+        if (filled == rf->block_size) {
+            ring_file_write_block(rf, filled, 0);
+            filled = 0;
+        } else if (stopping && (stop_budget == 0 || n <= 0)) {
+            break;
+        }
+    }
+    if (filled > 0) {
+        ring_file_write_block(rf, filled, 1);
+    } else {
+        ring_file_close(rf, 0);
+    }
+    return 0;
+}
+
+usb_ring_file_t* usb_ring_file_start(ring_buffer_t* rb, const char* path, const usb_ring_file_options_t* options) {
+    if (!rb || !path || !path[0] || strlen(path) >= RING_FILE_PATH_MAX) {
+        return NULL;
+    }
+    usb_ring_file_options_t opt;
+    if (options) {
+        opt = *options;
+    } else {
+        memset(&opt, 0, sizeof(opt));
+        opt.direct_io = 1;
+    }
+    unsigned int block = opt.block_size ? opt.block_size : USB_RING_FILE_DEFAULT_BLOCK;
+    if (block > 0x40000000u) {
+        block = 0x40000000u;
+    }
+    block = (block + USB_RING_FILE_ALIGN - 1) / USB_RING_FILE_ALIGN * USB_RING_FILE_ALIGN;
+
+    usb_ring_file_t* rf = (usb_ring_file_t*)calloc(1, sizeof(*rf));
+    if (!rf) {
+        return NULL;
+    }
+    rf->block = aligned_block_alloc(block);
+    if (!rf->block) {
+        free(rf);
+        return NULL;
+    }
+    rf->ring = rb;
+    strcpy(rf->path, path);
+    rf->block_size = block;
+    // 分割大小按块取整，每个文件都由整块组成
+    rf->rotate_bytes = opt.rotate_bytes ? (opt.rotate_bytes + block - 1) / block * block : 0;
+    rf->want_direct = opt.direct_io != 0;
+    InitializeCriticalSection(&rf->lock);
+    if (ring_file_open(rf) != 0) {
+        DeleteCriticalSection(&rf->lock);
+        aligned_block_free(rf->block);
+        free(rf);
+        return NULL;
+    }
+
+    ring_buffer_stats_t ring_stats;
+    ring_buffer_get_stats(rb, &ring_stats);
+    rf->ring_dropped_base = ring_stats.dropped_bytes;
+    rf->start_us = usb_now_us();
+    rf->stats.active = 1;
+    rf->thread = CreateThread(NULL, 0, ring_file_thread_func, rf, 0, NULL);
+    if (!rf->thread) {
+        ring_file_close(rf, 0);
+        DeleteCriticalSection(&rf->lock);
+        aligned_block_free(rf->block);
+        free(rf);
+        return NULL;
+    }
+    return rf;
+}
+
+void usb_ring_file_get_stats(usb_ring_file_t* rf, usb_ring_file_stats_t* stats) {
+    ring_buffer_stats_t ring_stats;
+    ring_buffer_get_stats(rf->ring, &ring_stats);
+    EnterCriticalSection(&rf->lock);
+    *stats = rf->stats;
+    LeaveCriticalSection(&rf->lock);
+    stats->lost_bytes += ring_stats.dropped_bytes - rf->ring_dropped_base;
+    stats->elapsed_us = usb_now_us() - rf->start_us;
+    stats->bytes_per_sec = stats->elapsed_us ? stats->bytes_written * 1000000ULL / stats->elapsed_us : 0;
+}
+
+void usb_ring_file_stop(usb_ring_file_t* rf, usb_ring_file_stats_t* stats) {
+    if (!rf) {
+        return;
+    }
+    __atomic_store_n(&rf->stop, 1, __ATOMIC_RELEASE);
+    WaitForSingleObject(rf->thread, INFINITE);
+    CloseHandle(rf->thread);
+    EnterCriticalSection(&rf->lock);
+    rf->stats.active = 0;
+    LeaveCriticalSection(&rf->lock);
+    usb_ring_file_stats_t final_stats;
+    usb_ring_file_get_stats(rf, &final_stats);
+    debug_printf("停止写入采集文件: %llu字节, %u个文件, 丢失%llu字节",
+                 final_stats.bytes_written, final_stats.files, final_stats.lost_bytes);
+    if (stats) {
+        *stats = final_stats;
+    }
+    DeleteCriticalSection(&rf->lock);
+    aligned_block_free(rf->block);
+    free(rf);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file usb_ring_file.h
+ * @brief 环形缓冲区落盘
+ * 后台线程把环形缓冲区中的数据攒成对齐的大块写入文件，调用方不用在脚本里循环读取再写文件。
+ * 尽量使用直接I/O(Linux O_DIRECT，Windows FILE_FLAG_NO_BUFFERING)绕过系统文件缓存，
+ * 文件系统不支持时自动退回普通写入；最后不足一块的数据补齐写出后再截断到实际长度。
+ * 可按大小分割文件，统计写入速率、缓冲区积压和丢失的字节数。
+ */
+
+#ifndef USB_RING_FILE_H
+#define USB_RING_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usb_ring.h"
+
+#define USB_RING_FILE_ALIGN          4096
+#define USB_RING_FILE_DEFAULT_BLOCK  (1024 * 1024)
+
+typedef struct {
+    unsigned int block_size;            // 每次写入的字节数，向上取整到4096的倍数，0=1MB
+    unsigned long long rotate_bytes;    // 单个文件的大小上限，达到后换新文件(文件名加_0000序号)，0=不分割
+    int direct_io;                      // 1=使用直接I/O，0=普通写入
+} usb_ring_file_options_t;
+
+typedef struct {
+    unsigned long long bytes_written;   // 写入文件的数据字节(不含补齐)
+    unsigned long long lost_bytes;      // 缓冲区写满丢弃的字节，加上写文件出错后丢弃的字节
+    unsigned long long elapsed_us;      // 已采集的时长
+    unsigned long long bytes_per_sec;   // 平均写入速率
+    unsigned int backlog;               // 缓冲区中尚未写出的字节
+    unsigned int backlog_high;          // 积压的最高值
+    unsigned int files;                 // 已创建的文件数
+    int direct_io;                      // 1=实际使用了直接I/O
+    int active;                         // 1=正在采集
+    int error;                          // 写文件失败时的系统错误码，0=无
+} usb_ring_file_stats_t;
+
+typedef struct usb_ring_file usb_ring_file_t;
+
+// 打开第一个文件并启动写入线程，options为NULL时用默认值(1MB块、不分割、直接I/O)；失败返回NULL
+usb_ring_file_t* usb_ring_file_start(ring_buffer_t* rb, const char* path, const usb_ring_file_options_t* options);
+
+// 写完停止时缓冲区中已有的数据后关闭文件并释放，stats不为NULL时返回最终统计
+void usb_ring_file_stop(usb_ring_file_t* rf, usb_ring_file_stats_t* stats);
+
+void usb_ring_file_get_stats(usb_ring_file_t* rf, usb_ring_file_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_RING_FILE_H
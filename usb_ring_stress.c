@@ -0,0 +1,196 @@
+/**
+ * @file usb_ring_stress.c
+ * @brief 环形缓冲区压力测试(./build_so.sh test 编译并运行)
+ * 一个生产者线程按随机长度写入，消费者按随机长度读取并逐字节校验顺序：
+ * 普通缓冲区与镜像缓冲区各跑一遍，再用peek/commit零拷贝读取跑一遍，生产者用背压策略所以不允许丢数据；
+ * 最后用默认的丢弃最旧策略写入递增的32位计数，检查读出的计数严格递增且没有被撕裂。
+ * 任何一项失败返回非0。
+ */
+
+#include "usb_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#endif
+
+#define STRESS_BYTES        (256ULL * 1024 * 1024)
+#define STRESS_RING_SIZE    (64 * 1024)
+#define STRESS_MAX_CHUNK    8192
+#define OVERFLOW_WRITES     2000000
+
+typedef struct {
+    ring_buffer_t* rb;
+    unsigned long long total;
+    volatile int done;
+} stress_ctx_t;
+
+// 第pos个字节的内容，周期不是2的幂，读错位置一定能发现
+static unsigned char pattern_at(unsigned long long pos) {
+    return (unsigned char)(pos % 251 + (pos / 251) * 7);
+}
+
+static unsigned int next_rand(unsigned int* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 8) & 0xFFFFFF;
+}
+
+static DWORD WINAPI ordered_producer(LPVOID param) {
+    stress_ctx_t* ctx = (stress_ctx_t*)param;
+    unsigned char buf[STRESS_MAX_CHUNK];
+    unsigned int seed = 1;
+    unsigned long long sent = 0;
+    while (sent < ctx->total) {
+        unsigned int n = next_rand(&seed) % STRESS_MAX_CHUNK + 1;
+        if (n > ctx->total - sent) {
+            n = (unsigned int)(ctx->total - sent);
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            buf[i] = pattern_at(sent + i);
+        }
+        write_to_ring_buffer(ctx->rb, buf, (int)n);
+        sent += n;
+    }
+    ctx->done = 1;
+    return 0;
+}
+
+// mode 0=ring_buffer_read，1=ring_buffer_peek/commit；返回错位字节数
+static unsigned long long run_ordered(ring_buffer_t* rb, int mode, const char* name) {
+    stress_ctx_t ctx = { rb, STRESS_BYTES, 0 };
+    ring_buffer_set_overflow_policy(rb, RING_OVERFLOW_BACKPRESSURE, 0);
+    HANDLE thread = CreateThread(NULL, 0, ordered_producer, &ctx, 0, NULL);
+    if (!thread) {
+        printf("  %s: 创建生产者线程失败\n", name);
+        return 1;
+    }
+
+    unsigned char buf[STRESS_MAX_CHUNK * 2];
+    unsigned int seed = 2;
+    unsigned long long got = 0;
+    unsigned long long bad = 0;
+    while (got < ctx.total) {
+        if (ring_buffer_wait(rb, 1, 100) <= 0) {
+            continue;
+        }
+        const unsigned char* data = buf;
+        int n;
+        if (mode == 0) {
+            n = ring_buffer_read(rb, buf, (int)(next_rand(&seed) % sizeof(buf)) + 1);
+        } else {
+            n = (int)ring_buffer_peek(rb, &data);
+            unsigned int limit = next_rand(&seed) % sizeof(buf) + 1;
+            if ((unsigned int)n > limit) {
+                n = (int)limit;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (data[i] != pattern_at(got + (unsigned long long)i)) {
+                bad++;
+            }
+        }
+        if (mode == 1) {
+            ring_buffer_commit(rb, (unsigned int)n);
+        }
+        got += (unsigned long long)n;
+    }
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    ring_buffer_stats_t stats;
+    ring_buffer_get_stats(rb, &stats);
+    printf("  %s: %llu字节, 错位%llu字节, 丢弃%llu字节, 生产者等待%llu次\n",
+           name, got, bad, stats.dropped_bytes, stats.blocked_count);
+    return bad + stats.dropped_bytes;
+}
+
+static DWORD WINAPI counter_producer(LPVOID param) {
+    stress_ctx_t* ctx = (stress_ctx_t*)param;
+    unsigned int buf[64];
+    unsigned int counter = 0;
+    for (int it = 0; it < OVERFLOW_WRITES; it++) {
+        int n = it % 64 + 1;
+        for (int i = 0; i < n; i++) {
+            buf[i] = counter++;
+        }
+        write_to_ring_buffer(ctx->rb, (const unsigned char*)buf, n * (int)sizeof(unsigned int));
+    }
+    __atomic_store_n(&ctx->done, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 丢弃最旧数据时读出的计数可以有间断，但必须严格递增、按4字节对齐
+static unsigned long long run_overflow(void) {
+    ring_buffer_t rb;
+    if (ring_buffer_init(&rb, 4096) != 0) {
+        printf("  丢弃最旧: 分配失败\n");
+        return 1;
+    }
+    stress_ctx_t ctx = { &rb, 0, 0 };
+    HANDLE thread = CreateThread(NULL, 0, counter_producer, &ctx, 0, NULL);
+    if (!thread) {
+        ring_buffer_free(&rb);
+        return 1;
+    }
+    unsigned int buf[100];
+    long long last = -1;
+    unsigned long long bad = 0;
+    unsigned long long gaps = 0;
+    while (!__atomic_load_n(&ctx.done, __ATOMIC_ACQUIRE) || ring_buffer_available(&rb) > 0) {
+        int n = ring_buffer_read(&rb, (unsigned char*)buf, sizeof(buf));
+        if (n % (int)sizeof(unsigned int)) {
+            bad++;
+            continue;
+        }
+        for (int i = 0; i < n / (int)sizeof(unsigned int); i++) {
+            if ((long long)buf[i] <= last) {
+                bad++;
+            } else if ((long long)buf[i] != last + 1) {
+                gaps++;
+            }
+            last = buf[i];
+        }
+    }
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    ring_buffer_stats_t stats;
+    ring_buffer_get_stats(&rb, &stats);
+    ring_buffer_free(&rb);
+    printf("  丢弃最旧: 间断%llu次, 丢弃%llu字节, 乱序或撕裂%llu次\n", gaps, stats.dropped_bytes, bad);
+    return bad;
+}
+
+int main(void) {
+    unsigned long long failures = 0;
+    ring_buffer_t rb;
+
+    printf("[环形缓冲区压力测试]\n");
+    if (ring_buffer_init(&rb, STRESS_RING_SIZE) != 0) {
+        printf("  分配失败\n");
+        return 1;
+    }
+    failures += run_ordered(&rb, 0, "普通缓冲区");
+    ring_buffer_free(&rb);
+
+    if (ring_buffer_init_mirrored(&rb, STRESS_RING_SIZE) == 0) {
+        failures += run_ordered(&rb, 0, "镜像缓冲区");
+        ring_buffer_free(&rb);
+    } else {
+        printf("  镜像缓冲区: 平台不支持，跳过\n");
+    }
+
+    // peek每次只借出连续的一段，普通缓冲区可以覆盖到回绕处的处理
+    if (ring_buffer_init(&rb, STRESS_RING_SIZE) != 0) {
+        return 1;
+    }
+    failures += run_ordered(&rb, 1, "peek/commit");
+    ring_buffer_free(&rb);
+
+    failures += run_overflow();
+
+    printf(failures ? "[FAIL]\n" : "[PASS]\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,993 @@
+/**
+ * @file usb_sim.c
+ * @brief 进程内模拟G2X设备
+ * 所有状态由g_sim_lock保护；IN方向的数据在读取时按当前时间即时生成，
+ * 直接写进调用方缓冲区，放不下的部分留在carry中等下一次读取。
+ */
+
+#include "usb_sim.h"
+#include "usb_protocol.h"
+#include "usb_log.h"
+#include "usb_clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include "platform_compat.h"
+#endif
+
+#define SIM_VENDOR_ID        0xCCDD
+#define SIM_PRODUCT_ID       0xAABB
+#define SIM_MAX_REPLIES      64
+#define SIM_REPLY_MAX        256                          // 单个应答包(协议头+数据)上限
+#define SIM_CARRY_SIZE       (sizeof(GENERIC_CMD_HEADER) + USB_SIM_MAX_PACKET_SIZE + SIM_REPLY_MAX)
+#define SIM_STREAM_COUNT     3
+#define SIM_QUEUE_SPI        0
+#define SIM_QUEUE_I2S        1
+#define SIM_PATTERN_PERIOD   251                          // 数据内容周期取素数，缓冲区按2的幂丢数据时能看出断点
+
+typedef struct {
+    unsigned long long due_us;
+    unsigned int len;
+    unsigned char data[SIM_REPLY_MAX];
+} sim_reply_t;
+
+typedef struct {
+    uint8_t protocol;
+    unsigned int rate;                 // 正在使用的速率，配置变化时重新计时
+    unsigned long long start_us;
+    unsigned long long generated;      // 从start_us起已产生的数据字节数
+    unsigned int seq;                  // 数据内容为逐字节递增的计数(模SIM_PATTERN_PERIOD)，便于校验
+} sim_stream_t;
+
+typedef struct {
+    int index;
+    int open_count;
+    int claimed;
+    char serial[32];
+    unsigned char* out_buf;            // 尚未凑成完整帧的OUT数据
+    unsigned int out_len;
+    unsigned int out_capacity;
+    unsigned char* carry;              // 上次读取放不下的IN数据
+    unsigned int carry_head;
+    unsigned int carry_len;
+    sim_reply_t* replies;              // 按到期时间排队的应答
+    unsigned int reply_head;
+    unsigned int reply_count;
+    unsigned int reply_seq;
+    sim_stream_t streams[SIM_STREAM_COUNT];
+    unsigned int stream_packets;
+    unsigned int spi_index_next;
+    unsigned int spi_index_seq[USB_SIM_MAX_SPI_INDEXES];   // 索引1以后各自的数据模式位置
+    int spi_write_seq;                 // 下一帧SPI写入数据应有的开头计数，-1=未知
+    unsigned int queue_depth[2];
+    unsigned long long queue_drain_us[2];
+    unsigned char gpio_level[256];
+} sim_device_t;
+
+// 与libusb传输共用前缀，usb_transfer_t*可直接转换
+typedef struct sim_transfer {
+    usb_transfer_t transfer;
+    struct sim_transfer* next;
+    unsigned long long submit_us;
+    int submitted;
+    int cancelled;
+} sim_transfer_t;
+
+// 与usb_application.c中的stm32_firmware_info_t布局一致
+typedef struct {
+    char FirmwareName[32];
+    char FirmwareBuildDate[32];
+    int HardwareVersion;
+    int FirmwareVersion;
+    int SerialNumber[3];
+    int Functions;
+} sim_firmware_info_t;
+
+static usb_sim_config_t g_sim_config;
+static int g_sim_config_set = 0;
+static usb_sim_stats_t g_sim_stats;
+static sim_device_t g_sim_devices[USB_SIM_MAX_DEVICES];
+static int g_sim_initialized = 0;
+static CRITICAL_SECTION g_sim_lock;
+static CONDITION_VARIABLE g_sim_cond;           // OUT命令、新传输、关闭时唤醒
+static CRITICAL_SECTION g_sim_events_lock;      // 同一时刻只有一个线程处理异步事件
+static sim_transfer_t* g_sim_transfers_head = NULL;
+static sim_transfer_t* g_sim_transfers_tail = NULL;
+static unsigned char g_sim_pattern[SIM_PATTERN_PERIOD + USB_SIM_MAX_PACKET_SIZE];
+static unsigned char g_sim_garbage[256];
+
+void usb_sim_default_config(usb_sim_config_t* config) {
+    if (!config) {
+        return;
+    }
+    memset(config, 0, sizeof(*config));
+    config->device_count = 1;
+    config->spi_packet_size = 4096;
+    config->current_packet_size = 256;
+    config->uart_packet_size = 64;
+    config->garbage_len = 16;
+    config->queue_capacity = 8;
+    config->queue_drain_per_sec = 1000;
+}
+
+static void sim_config_normalize(usb_sim_config_t* config) {
+    if (config->device_count < 1) {
+        config->device_count = 1;
+    }
+    if (config->device_count > USB_SIM_MAX_DEVICES) {
+        config->device_count = USB_SIM_MAX_DEVICES;
+    }
+    if (config->spi_index_count > USB_SIM_MAX_SPI_INDEXES) {
+        config->spi_index_count = USB_SIM_MAX_SPI_INDEXES;
+    }
+    unsigned int* sizes[SIM_STREAM_COUNT] = {
+        &config->spi_packet_size, &config->current_packet_size, &config->uart_packet_size
+    };
+    for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+        if (*sizes[i] == 0) {
+            *sizes[i] = 1;
+        }
+        if (*sizes[i] > USB_SIM_MAX_PACKET_SIZE) {
+            *sizes[i] = USB_SIM_MAX_PACKET_SIZE;
+        }
+    }
+    if (config->garbage_len > sizeof(g_sim_garbage)) {
+        config->garbage_len = sizeof(g_sim_garbage);
+    }
+}
+
+int usb_sim_configure(const usb_sim_config_t* config) {
+    if (!config) {
+        return USB_ERROR_INVALID_PARAM;
+    }
+    usb_sim_config_t normalized = *config;
+    sim_config_normalize(&normalized);
+    if (g_sim_initialized) {
+        EnterCriticalSection(&g_sim_lock);
+        g_sim_config = normalized;
+        WakeAllConditionVariable(&g_sim_cond);
+        LeaveCriticalSection(&g_sim_lock);
+    } else {
+        g_sim_config = normalized;
+    }
+    g_sim_config_set = 1;
+    debug_printf("模拟设备配置: 设备数=%d, SPI=%u B/s, 电流=%u B/s, UART=%u B/s, 无效数据每%u包, 丢应答每%u个",
+                 normalized.device_count, normalized.spi_bytes_per_sec, normalized.current_bytes_per_sec,
+                 normalized.uart_bytes_per_sec, normalized.garbage_every, normalized.drop_reply_every);
+    return USB_SUCCESS;
+}
+
+void usb_sim_get_stats(usb_sim_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    if (g_sim_initialized) {
+        EnterCriticalSection(&g_sim_lock);
+        *stats = g_sim_stats;
+        LeaveCriticalSection(&g_sim_lock);
+    } else {
+        *stats = g_sim_stats;
+    }
+}
+
+static sim_device_t* sim_device_from(void* p) {
+    sim_device_t* dev = (sim_device_t*)p;
+    if (dev < &g_sim_devices[0] || dev >= &g_sim_devices[USB_SIM_MAX_DEVICES]) {
+        return NULL;
+    }
+    return dev;
+}
+
+static void sim_device_free_buffers(sim_device_t* dev) {
+    free(dev->out_buf);
+    free(dev->carry);
+    free(dev->replies);
+    dev->out_buf = NULL;
+    dev->carry = NULL;
+    dev->replies = NULL;
+    dev->out_len = 0;
+    dev->out_capacity = 0;
+    dev->carry_head = 0;
+    dev->carry_len = 0;
+    dev->reply_head = 0;
+    dev->reply_count = 0;
+}
+
+// ==================== 队列模拟 ====================
+
+static unsigned int sim_queue_update(sim_device_t* dev, int q, unsigned long long now) {
+    unsigned int rate = g_sim_config.queue_drain_per_sec;
+    if (dev->queue_depth[q] == 0 || rate == 0) {
+        dev->queue_drain_us[q] = now;
+        return dev->queue_depth[q];
+    }
+    unsigned long long drained = (now - dev->queue_drain_us[q]) * rate / 1000000ULL;
+    if (drained > 0) {
+        if (drained >= dev->queue_depth[q]) {
+            dev->queue_depth[q] = 0;
+            dev->queue_drain_us[q] = now;
+        } else {
+            dev->queue_depth[q] -= (unsigned int)drained;
+            dev->queue_drain_us[q] += drained * 1000000ULL / rate;
+        }
+    }
+    return dev->queue_depth[q];
+}
+
+// 入队成功返回0，队列满返回1(固件的队列写入状态)
+static uint8_t sim_queue_push(sim_device_t* dev, int q, unsigned long long now) {
+    if (sim_queue_update(dev, q, now) >= g_sim_config.queue_capacity) {
+        return 1;
+    }
+    dev->queue_depth[q]++;
+    return 0;
+}
+
+// ==================== IN方向 ====================
+
+static void sim_queue_reply(sim_device_t* dev, uint8_t protocol, uint8_t cmd_id, uint8_t device_index,
+                            const void* data, unsigned int len, unsigned long long now) {
+    if (g_sim_config.drop_reply_every && ++dev->reply_seq % g_sim_config.drop_reply_every == 0) {
+        g_sim_stats.dropped_replies++;
+        return;
+    }
+    if (dev->reply_count >= SIM_MAX_REPLIES || len > SIM_REPLY_MAX - sizeof(GENERIC_CMD_HEADER)) {
+        g_sim_stats.dropped_replies++;
+        return;
+    }
+    sim_reply_t* reply = &dev->replies[(dev->reply_head + dev->reply_count) % SIM_MAX_REPLIES];
+    GENERIC_CMD_HEADER header;
+    header.protocol_type = protocol;
+    header.cmd_id = cmd_id;
+    header.device_index = device_index;
+    header.param_count = 0;
+    header.data_len = (uint16_t)len;
+    header.total_packets = 1;
+    memcpy(reply->data, &header, sizeof(header));
+    if (len > 0) {
+        memcpy(reply->data + sizeof(header), data, len);
+    }
+    reply->len = (unsigned int)sizeof(header) + len;
+    reply->due_us = now + g_sim_config.reply_delay_us;
+    dev->reply_count++;
+    g_sim_stats.replies++;
+}
+
+typedef struct {
+    unsigned char* out;
+    unsigned int capacity;
+    unsigned int len;
+} sim_sink_t;
+
+// 先写调用方缓冲区，放不下的部分进carry
+static void sim_emit(sim_device_t* dev, sim_sink_t* sink, const void* data, unsigned int len) {
+    unsigned int direct = sink->capacity - sink->len;
+    if (direct > len) {
+        direct = len;
+    }
+    memcpy(sink->out + sink->len, data, direct);
+    sink->len += direct;
+    if (direct < len) {
+        memcpy(dev->carry + dev->carry_head + dev->carry_len, (const unsigned char*)data + direct, len - direct);
+        dev->carry_len += len - direct;
+    }
+}
+
+static int sim_stream_config(int i, unsigned int* rate, unsigned int* packet, uint8_t* protocol) {
+    switch (i) {
+    case 0:
+        *rate = g_sim_config.spi_bytes_per_sec;
+        *packet = g_sim_config.spi_packet_size;
+        *protocol = PROTOCOL_SPI;
+        break;
+    case 1:
+        *rate = g_sim_config.current_bytes_per_sec;
+        *packet = g_sim_config.current_packet_size;
+        *protocol = PROTOCOL_CURRENT;
+        break;
+    default:
+        *rate = g_sim_config.uart_bytes_per_sec;
+        *packet = g_sim_config.uart_packet_size;
+        *protocol = PROTOCOL_UART;
+        break;
+    }
+    return *rate != 0;
+}
+
+// 产生一个数据包，返回1；还没到时间返回0并更新*next_due
+static int sim_stream_step(sim_device_t* dev, int i, sim_sink_t* sink, unsigned long long now,
+                           unsigned long long* next_due) {
+    sim_stream_t* stream = &dev->streams[i];
+    unsigned int rate, packet;
+    uint8_t protocol;
+    if (!sim_stream_config(i, &rate, &packet, &protocol)) {
+        return 0;
+    }
+    if (stream->rate != rate) {
+        stream->rate = rate;
+        stream->start_us = now;
+        stream->generated = 0;
+    }
+    if (rate != USB_SIM_RATE_UNLIMITED) {
+        unsigned long long due = stream->start_us + (stream->generated + packet) * 1000000ULL / rate;
+        if (due > now) {
+            if (due < *next_due) {
+                *next_due = due;
+            }
+            return 0;
+        }
+        // 积压超过100ms说明读取方跟不上，真实设备此时会丢数据
+        unsigned long long budget = (now - stream->start_us) * rate / 1000000ULL - stream->generated;
+        if (budget > rate / 10 + packet) {
+            g_sim_stats.stream_overruns++;
+            stream->start_us = now;
+            stream->generated = 0;
+        }
+    }
+
+    // 多个SPI索引时数据包轮流属于各索引，每个索引的数据模式单独接续
+    uint8_t index = 0;
+    unsigned int* seq = &stream->seq;
+    if (protocol == PROTOCOL_SPI && g_sim_config.spi_index_count > 1) {
+        index = (uint8_t)(dev->spi_index_next++ % g_sim_config.spi_index_count);
+        if (index > 0) {
+            seq = &dev->spi_index_seq[index];
+        }
+    }
+
+    GENERIC_CMD_HEADER header;
+    header.protocol_type = protocol;
+    header.cmd_id = protocol == PROTOCOL_CURRENT ? CURRENT_CMD_DATA : CMD_READ;
+    header.device_index = index;
+    header.param_count = 0;
+    header.data_len = (uint16_t)packet;
+    header.total_packets = 1;
+    sim_emit(dev, sink, &header, sizeof(header));
+    sim_emit(dev, sink, g_sim_pattern + *seq, packet);
+    *seq = (*seq + packet) % SIM_PATTERN_PERIOD;
+    stream->generated += packet;
+    g_sim_stats.stream_bytes += packet;
+
+    if (g_sim_config.garbage_every && ++dev->stream_packets % g_sim_config.garbage_every == 0) {
+        sim_emit(dev, sink, g_sim_garbage, g_sim_config.garbage_len);
+    }
+    return 1;
+}
+
+// 按时间产生IN数据写入out，返回写入字节数；没有数据时*next_due为下一次有数据的时间
+static unsigned int sim_fill_in(sim_device_t* dev, unsigned char* out, unsigned int capacity,
+                                unsigned long long now, unsigned long long* next_due) {
+    sim_sink_t sink = { out, capacity, 0 };
+    *next_due = ~0ULL;
+
+    if (dev->carry_len > 0) {
+        unsigned int n = dev->carry_len < capacity ? dev->carry_len : capacity;
+        memcpy(out, dev->carry + dev->carry_head, n);
+        dev->carry_head += n;
+        dev->carry_len -= n;
+        sink.len = n;
+        if (dev->carry_len > 0) {
+            g_sim_stats.in_bytes += sink.len;
+            return sink.len;
+        }
+    }
+    dev->carry_head = 0;
+
+    while (dev->reply_count > 0 && sink.len < capacity && dev->carry_len == 0) {
+        sim_reply_t* reply = &dev->replies[dev->reply_head];
+        if (reply->due_us > now) {
+            *next_due = reply->due_us;
+            break;
+        }
+        sim_emit(dev, &sink, reply->data, reply->len);
+        dev->reply_head = (dev->reply_head + 1) % SIM_MAX_REPLIES;
+        dev->reply_count--;
+    }
+
+    int progress = 1;
+    while (progress && sink.len < capacity && dev->carry_len == 0) {
+        progress = 0;
+        for (int i = 0; i < SIM_STREAM_COUNT && sink.len < capacity && dev->carry_len == 0; i++) {
+            progress |= sim_stream_step(dev, i, &sink, now, next_due);
+        }
+    }
+    g_sim_stats.in_bytes += sink.len;
+    return sink.len;
+}
+
+// ==================== OUT方向 ====================
+
+static void sim_handle_frame(sim_device_t* dev, const GENERIC_CMD_HEADER* header,
+                             const unsigned char* param, unsigned int param_len,
+                             const unsigned char* data, unsigned int data_len, unsigned long long now) {
+    uint8_t status;
+    uint8_t idx = header->device_index;
+    g_sim_stats.out_frames++;
+
+    switch (header->protocol_type) {
+    case PROTOCOL_SPI:
+        if (header->cmd_id == CMD_QUEUE_WRITE) {
+            status = sim_queue_push(dev, SIM_QUEUE_SPI, now);
+            sim_queue_reply(dev, PROTOCOL_STATUS, header->cmd_id, idx, &status, 1, now);
+        } else if (header->cmd_id == CMD_QUEUE_STATUS) {
+            status = (uint8_t)sim_queue_update(dev, SIM_QUEUE_SPI, now);
+            sim_queue_reply(dev, PROTOCOL_STATUS, header->cmd_id, idx, &status, 1, now);
+        } else if (header->cmd_id == CMD_WRITE && data_len > 0) {
+            g_sim_stats.spi_write_bytes += data_len;
+            unsigned int start = dev->spi_write_seq >= 0 ? (unsigned int)dev->spi_write_seq : data[0] % SIM_PATTERN_PERIOD;
+            for (unsigned int pos = 0; pos < data_len; pos += USB_SIM_MAX_PACKET_SIZE) {
+                unsigned int n = data_len - pos < USB_SIM_MAX_PACKET_SIZE ? data_len - pos : USB_SIM_MAX_PACKET_SIZE;
+                if (memcmp(data + pos, g_sim_pattern + (start + pos) % SIM_PATTERN_PERIOD, n) != 0) {
+                    g_sim_stats.spi_write_breaks++;
+                    break;
+                }
+            }
+            dev->spi_write_seq = (data[data_len - 1] + 1) % SIM_PATTERN_PERIOD;
+        }
+        break;
+    case PROTOCOL_AUDIO:
+        if (header->cmd_id == AUDIO_CMD_PLAY) {
+            status = sim_queue_push(dev, SIM_QUEUE_I2S, now);
+            sim_queue_reply(dev, PROTOCOL_STATUS, header->cmd_id, idx, &status, 1, now);
+        } else if (header->cmd_id == AUDIO_CMD_STATUS) {
+            status = (uint8_t)sim_queue_update(dev, SIM_QUEUE_I2S, now);
+            sim_queue_reply(dev, PROTOCOL_STATUS, header->cmd_id, idx, &status, 1, now);
+        }
+        break;
+    case PROTOCOL_GPIO:
+        if (header->cmd_id == GPIO_DIR_WRITE && param_len >= 1) {
+            dev->gpio_level[idx] = param[0];
+        } else if (header->cmd_id == GPIO_SCAN_DIR_WRITE && param_len >= 1) {
+            dev->gpio_level[idx] = param[0];
+            status = 0;
+            sim_queue_reply(dev, PROTOCOL_STATUS, GPIO_SCAN_MODE_WRITE, idx, &status, 1, now);
+        } else if (header->cmd_id == GPIO_DIR_READ) {
+            sim_queue_reply(dev, PROTOCOL_GPIO, GPIO_DIR_READ, idx, &dev->gpio_level[idx], 1, now);
+        }
+        break;
+    case PROTOCOL_PWM:
+        if (header->cmd_id == PWM_CMD_GET_RESULT) {
+            // 通道n测得(n+1)kHz、50%占空比
+            uint32_t result[4];
+            result[0] = 1000u * ((uint32_t)idx + 1);
+            result[1] = 5000;
+            result[2] = 1000000u / result[0];
+            result[3] = result[2] / 2;
+            sim_queue_reply(dev, PROTOCOL_PWM, PWM_CMD_GET_RESULT, idx, result, sizeof(result), now);
+        }
+        break;
+    case PROTOCOL_GET_FIRMWARE_INFO: {
+        sim_firmware_info_t info;
+        memset(&info, 0, sizeof(info));
+        strcpy(info.FirmwareName, "G2X_SIM");
+        snprintf(info.FirmwareBuildDate, sizeof(info.FirmwareBuildDate), "%s %s", __DATE__, __TIME__);
+        info.HardwareVersion = 0x0100;
+        info.FirmwareVersion = 0x0100;
+        info.SerialNumber[0] = 0x53494D00 + dev->index;
+        info.Functions = 0x000F;
+        sim_queue_reply(dev, PROTOCOL_GET_FIRMWARE_INFO, header->cmd_id, idx, &info, sizeof(info), now);
+        break;
+    }
+    case PROTOCOL_UART:
+        if (header->cmd_id == CMD_WRITE && g_sim_config.uart_loopback) {
+            const unsigned int chunk = SIM_REPLY_MAX - sizeof(GENERIC_CMD_HEADER);
+            for (unsigned int off = 0; off < data_len; off += chunk) {
+                unsigned int n = data_len - off < chunk ? data_len - off : chunk;
+                sim_queue_reply(dev, PROTOCOL_UART, CMD_READ, idx, data + off, n, now);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// 从out_buf中切出完整的命令帧；帧长由total_packets与data_len推出参数部分长度
+static void sim_parse_out(sim_device_t* dev, unsigned long long now) {
+    const unsigned int min_frame = sizeof(uint32_t) + sizeof(GENERIC_CMD_HEADER) + PROTOCOL_FRAME_TRAILER_SIZE;
+    unsigned int pos = 0;
+    while (dev->out_len - pos >= min_frame) {
+        uint32_t marker;
+        memcpy(&marker, dev->out_buf + pos, sizeof(marker));
+        if (marker != FRAME_START_MARKER) {
+            g_sim_stats.bad_frames++;
+            pos++;
+            while (dev->out_len - pos >= sizeof(marker)) {
+                memcpy(&marker, dev->out_buf + pos, sizeof(marker));
+                if (marker == FRAME_START_MARKER) {
+                    break;
+                }
+                pos++;
+            }
+            continue;
+        }
+        GENERIC_CMD_HEADER header;
+        memcpy(&header, dev->out_buf + pos + sizeof(uint32_t), sizeof(header));
+        unsigned int extra = (uint16_t)(header.total_packets - sizeof(header) - header.data_len);
+        unsigned int frame_len = min_frame + extra + header.data_len;
+        if (dev->out_len - pos < frame_len) {
+            break;
+        }
+        uint32_t trailer;
+        memcpy(&trailer, dev->out_buf + pos + frame_len - PROTOCOL_FRAME_TRAILER_SIZE, sizeof(trailer));
+        if (trailer != CMD_END_MARKER || (extra != 0 && extra < sizeof(PARAM_HEADER))) {
+            g_sim_stats.bad_frames++;
+            pos++;
+            continue;
+        }
+        const unsigned char* body = dev->out_buf + pos + sizeof(uint32_t) + sizeof(header);
+        const unsigned char* param = extra ? body + sizeof(PARAM_HEADER) : NULL;
+        unsigned int param_len = extra ? extra - (unsigned int)sizeof(PARAM_HEADER) : 0;
+        sim_handle_frame(dev, &header, param, param_len, body + extra, header.data_len, now);
+        pos += frame_len;
+    }
+    if (pos > 0) {
+        memmove(dev->out_buf, dev->out_buf + pos, dev->out_len - pos);
+        dev->out_len -= pos;
+    }
+}
+
+static int sim_write_out(sim_device_t* dev, const unsigned char* data, int length) {
+    if ((unsigned int)length > dev->out_capacity - dev->out_len) {
+        unsigned int capacity = dev->out_capacity ? dev->out_capacity : 64 * 1024;
+        while (capacity - dev->out_len < (unsigned int)length) {
+            capacity *= 2;
+        }
+        unsigned char* buf = (unsigned char*)realloc(dev->out_buf, capacity);
+        if (!buf) {
+            return LIBUSB_ERROR_IO;
+        }
+        dev->out_buf = buf;
+        dev->out_capacity = capacity;
+    }
+    memcpy(dev->out_buf + dev->out_len, data, (size_t)length);
+    dev->out_len += (unsigned int)length;
+    g_sim_stats.out_bytes += (unsigned long long)length;
+    unsigned int replies = dev->reply_count;
+    sim_parse_out(dev, usb_now_us());
+    if (dev->reply_count != replies) {
+        WakeAllConditionVariable(&g_sim_cond);
+    }
+    return LIBUSB_SUCCESS;
+}
+
+// ==================== 传输后端 ====================
+
+static int sim_init(void) {
+    if (g_sim_initialized) {
+        return USB_SUCCESS;
+    }
+    if (!g_sim_config_set) {
+        usb_sim_default_config(&g_sim_config);
+        g_sim_config_set = 1;
+    }
+    for (unsigned int i = 0; i < sizeof(g_sim_pattern); i++) {
+        g_sim_pattern[i] = (unsigned char)(i % SIM_PATTERN_PERIOD);
+    }
+    memset(g_sim_garbage, 0xFF, sizeof(g_sim_garbage));  // 0xFF不是合法protocol_type
+    memset(g_sim_devices, 0, sizeof(g_sim_devices));
+    for (int i = 0; i < USB_SIM_MAX_DEVICES; i++) {
+        g_sim_devices[i].index = i;
+        snprintf(g_sim_devices[i].serial, sizeof(g_sim_devices[i].serial), "G2XSIM%02d", i);
+    }
+    memset(&g_sim_stats, 0, sizeof(g_sim_stats));
+    g_sim_transfers_head = NULL;
+    g_sim_transfers_tail = NULL;
+    InitializeCriticalSection(&g_sim_lock);
+    InitializeCriticalSection(&g_sim_events_lock);
+    InitializeConditionVariable(&g_sim_cond);
+    g_sim_initialized = 1;
+    debug_printf("模拟设备后端已初始化: %d个设备", g_sim_config.device_count);
+    return USB_SUCCESS;
+}
+
+static void sim_cleanup(void) {
+    if (!g_sim_initialized) {
+        return;
+    }
+    EnterCriticalSection(&g_sim_lock);
+    for (int i = 0; i < USB_SIM_MAX_DEVICES; i++) {
+        g_sim_devices[i].claimed = 0;
+        sim_device_free_buffers(&g_sim_devices[i]);
+    }
+    g_sim_transfers_head = NULL;
+    g_sim_transfers_tail = NULL;
+    g_sim_initialized = 0;
+    WakeAllConditionVariable(&g_sim_cond);
+    LeaveCriticalSection(&g_sim_lock);
+    DeleteCriticalSection(&g_sim_events_lock);
+    DeleteCriticalSection(&g_sim_lock);
+#ifndef _WIN32
+    pthread_cond_destroy(&g_sim_cond);
+#endif
+}
+
+static int sim_get_device_list(void* ctx, void*** device_list) {
+    (void)ctx;
+    if (!g_sim_initialized || !device_list) {
+        return -1;
+    }
+    int count = g_sim_config.device_count;
+    void** list = (void**)calloc((size_t)count + 1, sizeof(void*));
+    if (!list) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        list[i] = &g_sim_devices[i];
+    }
+    *device_list = list;
+    return count;
+}
+
+static void sim_free_device_list(void** list, int unref_devices) {
+    (void)unref_devices;
+    free(list);
+}
+
+static int sim_get_device_descriptor(void* dev, usb_device_descriptor* desc) {
+    if (!g_sim_initialized || !sim_device_from(dev) || !desc) {
+        return -1;
+    }
+    memset(desc, 0, sizeof(*desc));
+    desc->bLength = 18;
+    desc->bDescriptorType = 1;
+    desc->bcdUSB = 0x0200;
+    desc->bMaxPacketSize0 = 64;
+    desc->idVendor = SIM_VENDOR_ID;
+    desc->idProduct = SIM_PRODUCT_ID;
+    desc->bcdDevice = 0x0100;
+    desc->iManufacturer = 1;
+    desc->iProduct = 2;
+    desc->iSerialNumber = 3;
+    desc->bNumConfigurations = 1;
+    return 0;
+}
+
+static int sim_open(void* dev, void** handle) {
+    sim_device_t* sim = sim_device_from(dev);
+    if (!g_sim_initialized || !sim || !handle) {
+        return -1;
+    }
+    EnterCriticalSection(&g_sim_lock);
+    sim->open_count++;
+    LeaveCriticalSection(&g_sim_lock);
+    *handle = sim;
+    return 0;
+}
+
+static void sim_close(void* handle) {
+    sim_device_t* sim = sim_device_from(handle);
+    if (!g_sim_initialized || !sim) {
+        return;
+    }
+    EnterCriticalSection(&g_sim_lock);
+    if (sim->open_count > 0) {
+        sim->open_count--;
+    }
+    LeaveCriticalSection(&g_sim_lock);
+}
+
+static int sim_get_string_descriptor_ascii(void* handle, uint8_t desc_index, unsigned char* data, int length) {
+    sim_device_t* sim = sim_device_from(handle);
+    if (!g_sim_initialized || !sim || !data || length <= 0) {
+        return -1;
+    }
+    const char* str;
+    switch (desc_index) {
+    case 1:
+        str = "G2X Simulator";
+        break;
+    case 2:
+        str = "G2X-SIM";
+        break;
+    case 3:
+        str = sim->serial;
+        break;
+    default:
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    int n = (int)strlen(str);
+    if (n > length - 1) {
+        n = length - 1;
+    }
+    memcpy(data, str, (size_t)n);
+    data[n] = '\0';
+    return n;
+}
+
+static int sim_claim_interface(void* handle, int interface_number) {
+    sim_device_t* sim = sim_device_from(handle);
+    if (!g_sim_initialized || !sim || interface_number != 0) {
+        return -1;
+    }
+    int ret = 0;
+    EnterCriticalSection(&g_sim_lock);
+    sim_device_free_buffers(sim);
+    sim->carry = (unsigned char*)malloc(SIM_CARRY_SIZE);
+    sim->replies = (sim_reply_t*)malloc(sizeof(sim_reply_t) * SIM_MAX_REPLIES);
+    if (!sim->carry || !sim->replies) {
+        sim_device_free_buffers(sim);
+        ret = LIBUSB_ERROR_IO;
+    } else {
+        memset(sim->streams, 0, sizeof(sim->streams));
+        memset(sim->queue_depth, 0, sizeof(sim->queue_depth));
+        sim->stream_packets = 0;
+        sim->spi_index_next = 0;
+        sim->spi_write_seq = -1;
+        memset(sim->spi_index_seq, 0, sizeof(sim->spi_index_seq));
+        sim->reply_seq = 0;
+        sim->claimed = 1;
+    }
+    LeaveCriticalSection(&g_sim_lock);
+    return ret;
+}
+
+static int sim_release_interface(void* handle, int interface_number) {
+    sim_device_t* sim = sim_device_from(handle);
+    if (!g_sim_initialized || !sim || interface_number != 0) {
+        return -1;
+    }
+    EnterCriticalSection(&g_sim_lock);
+    sim->claimed = 0;
+    sim_device_free_buffers(sim);
+    WakeAllConditionVariable(&g_sim_cond);
+    LeaveCriticalSection(&g_sim_lock);
+    return 0;
+}
+
+static DWORD sim_wait_ms(unsigned long long now, unsigned long long until) {
+    if (until <= now) {
+        return 0;
+    }
+    unsigned long long ms = (until - now + 999) / 1000;
+    return ms > 1000 ? 1000 : (DWORD)ms;
+}
+
+static int sim_bulk_transfer(void* handle, unsigned char endpoint, unsigned char* data, int length,
+                             int* transferred, unsigned int timeout) {
+    sim_device_t* sim = sim_device_from(handle);
+    if (!g_sim_initialized || !sim || !data || length <= 0 || !transferred) {
+        return -1;
+    }
+    *transferred = 0;
+    EnterCriticalSection(&g_sim_lock);
+    if (!sim->claimed) {
+        LeaveCriticalSection(&g_sim_lock);
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    if (!(endpoint & 0x80)) {
+        int ret = sim_write_out(sim, data, length);
+        LeaveCriticalSection(&g_sim_lock);
+        if (ret == LIBUSB_SUCCESS) {
+            *transferred = length;
+        }
+        return ret;
+    }
+
+    unsigned long long now = usb_now_us();
+    unsigned long long deadline = timeout ? now + (unsigned long long)timeout * 1000ULL : ~0ULL;
+    int ret = LIBUSB_ERROR_TIMEOUT;
+    while (g_sim_initialized && sim->claimed) {
+        unsigned long long next_due;
+        unsigned int n = sim_fill_in(sim, data, (unsigned int)length, now, &next_due);
+        if (n > 0) {
+            *transferred = (int)n;
+            ret = LIBUSB_SUCCESS;
+            break;
+        }
+        if (now >= deadline) {
+            break;
+        }
+        SleepConditionVariableCS(&g_sim_cond, &g_sim_lock, sim_wait_ms(now, next_due < deadline ? next_due : deadline));
+        now = usb_now_us();
+    }
+    if (ret == LIBUSB_ERROR_TIMEOUT && (!g_sim_initialized || !sim->claimed)) {
+        ret = LIBUSB_ERROR_NO_DEVICE;
+    }
+    LeaveCriticalSection(&g_sim_lock);
+    return ret;
+}
+
+static void* sim_get_device(void* handle) {
+    if (!g_sim_initialized) {
+        return NULL;
+    }
+    return sim_device_from(handle);
+}
+
+static void* sim_open_device_with_vid_pid(void* ctx, unsigned short vid, unsigned short pid) {
+    (void)ctx;
+    void* handle = NULL;
+    if (!g_sim_initialized || vid != SIM_VENDOR_ID || pid != SIM_PRODUCT_ID) {
+        return NULL;
+    }
+    return sim_open(&g_sim_devices[0], &handle) == 0 ? handle : NULL;
+}
+
+static int sim_async_supported(void) {
+    return 1;
+}
+
+static usb_transfer_t* sim_alloc_transfer(int iso_packets) {
+    (void)iso_packets;
+    if (!g_sim_initialized) {
+        return NULL;
+    }
+    sim_transfer_t* t = (sim_transfer_t*)calloc(1, sizeof(sim_transfer_t));
+    return t ? &t->transfer : NULL;
+}
+
+static void sim_free_transfer(usb_transfer_t* transfer) {
+    free(transfer);
+}
+
+static int sim_submit_transfer(usb_transfer_t* transfer) {
+    sim_transfer_t* t = (sim_transfer_t*)transfer;
+    if (!g_sim_initialized || !transfer || !sim_device_from(transfer->dev_handle)) {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    EnterCriticalSection(&g_sim_lock);
+    if (t->submitted) {
+        LeaveCriticalSection(&g_sim_lock);
+        return LIBUSB_ERROR_IO;
+    }
+    t->next = NULL;
+    t->submit_us = usb_now_us();
+    t->submitted = 1;
+    t->cancelled = 0;
+    transfer->status = LIBUSB_TRANSFER_COMPLETED;
+    transfer->actual_length = 0;
+    if (g_sim_transfers_tail) {
+        g_sim_transfers_tail->next = t;
+    } else {
+        g_sim_transfers_head = t;
+    }
+    g_sim_transfers_tail = t;
+    WakeAllConditionVariable(&g_sim_cond);
+    LeaveCriticalSection(&g_sim_lock);
+    return LIBUSB_SUCCESS;
+}
+
+static int sim_cancel_transfer(usb_transfer_t* transfer) {
+    sim_transfer_t* t = (sim_transfer_t*)transfer;
+    if (!g_sim_initialized || !transfer) {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    int ret = LIBUSB_ERROR_NOT_FOUND;
+    EnterCriticalSection(&g_sim_lock);
+    if (t->submitted && !t->cancelled) {
+        t->cancelled = 1;
+        WakeAllConditionVariable(&g_sim_cond);
+        ret = LIBUSB_SUCCESS;
+    }
+    LeaveCriticalSection(&g_sim_lock);
+    return ret;
+}
+
+// 按提交顺序完成能完成的传输，移出队列后串成链表返回；*next_due为下一次可能有进展的时间
+static sim_transfer_t* sim_collect_completed(unsigned long long now, unsigned long long* next_due) {
+    sim_transfer_t* done_head = NULL;
+    sim_transfer_t* done_tail = NULL;
+    sim_transfer_t* prev = NULL;
+    sim_transfer_t* t = g_sim_transfers_head;
+    *next_due = ~0ULL;
+    while (t) {
+        sim_transfer_t* next = t->next;
+        usb_transfer_t* xfer = &t->transfer;
+        sim_device_t* dev = sim_device_from(xfer->dev_handle);
+        int finished = 1;
+        if (t->cancelled) {
+            xfer->status = LIBUSB_TRANSFER_CANCELLED;
+        } else if (!dev || !dev->claimed) {
+            xfer->status = LIBUSB_TRANSFER_NO_DEVICE;
+        } else if (!(xfer->endpoint & 0x80)) {
+            xfer->status = sim_write_out(dev, xfer->buffer, xfer->length) == LIBUSB_SUCCESS ?
+                           LIBUSB_TRANSFER_COMPLETED : LIBUSB_TRANSFER_ERROR;
+            xfer->actual_length = xfer->status == LIBUSB_TRANSFER_COMPLETED ? xfer->length : 0;
+        } else {
+            unsigned long long due;
+            unsigned int n = sim_fill_in(dev, xfer->buffer, (unsigned int)xfer->length, now, &due);
+            if (n > 0) {
+                xfer->status = LIBUSB_TRANSFER_COMPLETED;
+                xfer->actual_length = (int)n;
+            } else if (xfer->timeout && now >= t->submit_us + (unsigned long long)xfer->timeout * 1000ULL) {
+                xfer->status = LIBUSB_TRANSFER_TIMED_OUT;
+            } else {
+                finished = 0;
+                if (xfer->timeout && t->submit_us + (unsigned long long)xfer->timeout * 1000ULL < due) {
+                    due = t->submit_us + (unsigned long long)xfer->timeout * 1000ULL;
+                }
+                if (due < *next_due) {
+                    *next_due = due;
+                }
+            }
+        }
+        if (finished) {
+            if (prev) {
+                prev->next = next;
+            } else {
+                g_sim_transfers_head = next;
+            }
+            if (g_sim_transfers_tail == t) {
+                g_sim_transfers_tail = prev;
+            }
+            t->next = NULL;
+            t->submitted = 0;
+            if (done_tail) {
+                done_tail->next = t;
+            } else {
+                done_head = t;
+            }
+            done_tail = t;
+        } else {
+            prev = t;
+        }
+        t = next;
+    }
+    return done_head;
+}
+
+static int sim_handle_events_timeout(void* ctx, int timeout_ms, int* completed) {
+    (void)ctx;
+    if (!g_sim_initialized) {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    EnterCriticalSection(&g_sim_events_lock);
+    EnterCriticalSection(&g_sim_lock);
+    unsigned long long now = usb_now_us();
+    unsigned long long deadline = now + (unsigned long long)(timeout_ms > 0 ? timeout_ms : 0) * 1000ULL;
+    sim_transfer_t* done = NULL;
+    while (g_sim_initialized) {
+        unsigned long long next_due;
+        done = sim_collect_completed(now, &next_due);
+        if (done || (completed && *completed) || now >= deadline) {
+            break;
+        }
+        SleepConditionVariableCS(&g_sim_cond, &g_sim_lock, sim_wait_ms(now, next_due < deadline ? next_due : deadline));
+        now = usb_now_us();
+    }
+    LeaveCriticalSection(&g_sim_lock);
+
+    // 回调里会重新提交传输，必须在g_sim_lock之外调用
+    while (done) {
+        sim_transfer_t* next = done->next;
+        done->next = NULL;
+        if (done->transfer.callback) {
+            done->transfer.callback(&done->transfer);
+        }
+        done = next;
+    }
+    LeaveCriticalSection(&g_sim_events_lock);
+    return LIBUSB_SUCCESS;
+}
+
+static const usb_transport_t g_sim_transport = {
+    "sim",
+    sim_init,
+    sim_cleanup,
+    sim_get_device_list,
+    sim_free_device_list,
+    sim_get_device_descriptor,
+    sim_open,
+    sim_close,
+    sim_get_string_descriptor_ascii,
+    sim_claim_interface,
+    sim_release_interface,
+    sim_bulk_transfer,
+    sim_get_device,
+    sim_open_device_with_vid_pid,
+    sim_async_supported,
+    sim_alloc_transfer,
+    sim_free_transfer,
+    sim_submit_transfer,
+    sim_cancel_transfer,
+    sim_handle_events_timeout,
+};
+
+const usb_transport_t* usb_sim_transport(void) {
+    return &g_sim_transport;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file usb_sim.h
+ * @brief 进程内模拟G2X设备(传输后端)
+ * 解析OUT方向的命令帧并按固件协议应答STATUS/GPIO/PWM/固件信息请求，
+ * 按配置速率产生SPI/电流/UART数据流，可注入无效字节、丢弃应答，用于无硬件测试和压测。
+ * 通过USB_G2X_TRANSPORT=sim或usb_device_set_transport(usb_sim_transport())启用。
+ */
+
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usb_device.h"
+
+#define USB_SIM_MAX_DEVICES     8
+#define USB_SIM_RATE_UNLIMITED  0xFFFFFFFFu   // 不限速：读取方要多少给多少
+#define USB_SIM_MAX_PACKET_SIZE 16384         // 数据流每包数据部分上限
+#define USB_SIM_MAX_SPI_INDEXES 8
+
+typedef struct {
+    int device_count;                   // 模拟设备数(1~USB_SIM_MAX_DEVICES)，下次枚举生效
+    unsigned int spi_bytes_per_sec;     // SPI从机数据速率，0=不产生
+    unsigned int spi_packet_size;       // 每个SPI数据包的数据字节数
+    unsigned int current_bytes_per_sec; // 电流数据速率，0=不产生
+    unsigned int current_packet_size;
+    unsigned int uart_bytes_per_sec;    // UART接收数据速率，0=不产生
+    unsigned int uart_packet_size;
+    unsigned int garbage_every;         // 每N个数据包后插入garbage_len字节无效数据，0=不插入
+    unsigned int garbage_len;           // 最大256
+    unsigned int drop_reply_every;      // 每N个命令应答丢弃一个，0=不丢
+    unsigned int reply_delay_us;        // 命令应答延迟
+    unsigned int queue_capacity;        // SPI/I2S队列深度，队列满时写入应答状态为1
+    unsigned int queue_drain_per_sec;   // 队列每秒消耗的帧数
+    int uart_loopback;                  // 1=UART写入的数据原样回送
+    unsigned int spi_index_count;       // SPI数据包轮流使用的device_index个数(1~USB_SIM_MAX_SPI_INDEXES)，
+                                        // 每个索引的数据各自连续，0和1都只用索引0
+} usb_sim_config_t;
+
+typedef struct {
+    unsigned long long out_frames;      // 收到的完整命令帧
+    unsigned long long out_bytes;       // OUT方向字节数
+    unsigned long long bad_frames;      // 帧头/帧尾不匹配而跳过重同步的次数
+    unsigned long long in_bytes;        // 交给读取方的字节数
+    unsigned long long stream_bytes;    // 数据流产生的数据字节数(不含协议头)
+    unsigned long long stream_overruns; // 读取方过慢，数据流丢弃积压的次数
+    unsigned long long replies;         // 发出的命令应答
+    unsigned long long dropped_replies; // 按drop_reply_every丢弃的应答
+    unsigned long long spi_write_bytes; // SPI写数据命令收到的数据字节
+    unsigned long long spi_write_breaks;// SPI写入数据不是接续上一帧的模251计数的帧数(压测用这种数据校验拆帧)
+} usb_sim_stats_t;
+
+const usb_transport_t* usb_sim_transport(void);
+
+// 填入默认配置：1个设备，不产生数据流，队列深度8，每秒消耗1000帧
+void usb_sim_default_config(usb_sim_config_t* config);
+
+// 修改配置，数据流速率立即生效
+int usb_sim_configure(const usb_sim_config_t* config);
+
+void usb_sim_get_stats(usb_sim_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_SIM_H
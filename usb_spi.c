@@ -7,6 +7,9 @@
 #include <string.h>
 
 #include "usb_log.h"
+#include "usb_clock.h"
+
+#define SPI_STATUS_TIMEOUT_MS  1000   // 等待状态应答的超时
 
 int SPI_Init(const char* target_serial, int SPIIndex, PSPI_CONFIG pConfig) {
     if (!target_serial || !pConfig) {
@@ -26,19 +29,13 @@ int SPI_Init(const char* target_serial, int SPIIndex, PSPI_CONFIG pConfig) {
     cmd_header.param_count = 1;                 // 参数数量：1个
     cmd_header.data_len = 0;                    // 数据部分长度为0
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   (unsigned char*)pConfig, sizeof(SPI_CONFIG), 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, pConfig, sizeof(SPI_CONFIG), NULL, 0);
     if (ret < 0) {
         debug_printf("发送SPI初始化命令失败: %d", ret);
         return SPI_ERROR_IO;
     }
+    // 之后该索引收到的数据进入它自己的缓冲区
+    usb_middleware_enable_spi_index(device_id, SPIIndex);
     debug_printf("成功发送SPI初始化命令，SPI索引: %d", SPIIndex);
     return SPI_SUCCESS;
 }
@@ -55,6 +52,15 @@ int SPI_WriteBytes(const char* target_serial, int SPIIndex, unsigned char* pWrit
         debug_printf("设备未打开: %s", target_serial);
         return SPI_ERROR_OTHER;
     }
+    return SPI_WriteBytesH(device_id, SPIIndex, pWriteBuffer, WriteLen);
+}
+
+int SPI_WriteBytesH(usb_handle_t handle, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen) {
+    if (!pWriteBuffer || WriteLen <= 0) {
+        debug_printf("参数无效: pWriteBuffer=%p, WriteLen=%d", pWriteBuffer, WriteLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = handle;
 
     GENERIC_CMD_HEADER cmd_header;
     cmd_header.protocol_type = PROTOCOL_SPI;    // SPI协议
@@ -63,18 +69,56 @@ int SPI_WriteBytes(const char* target_serial, int SPIIndex, unsigned char* pWrit
     cmd_header.param_count = 0;                // 参数数量，写操作不需要额外参数
     cmd_header.data_len = WriteLen;            // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
+    int ret;
+    if ((size_t)WriteLen > USB_SEGMENT_DATA_MAX) {
+        // data_len只有16位，大数据拆帧发送
+        ret = usb_middleware_send_segmented(device_id, &cmd_header, pWriteBuffer, WriteLen);
+    } else {
+        ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
+    }
+    if (ret < 0) {
+        debug_printf("发送SPI写数据命令失败: %d", ret);
+        return SPI_ERROR_IO;
     }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
     return SPI_SUCCESS;
 }
 
+int SPI_WriteBulk(const char* target_serial, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen) {
+    if (!target_serial || !pWriteBuffer || WriteLen <= 0) {
+        debug_printf("参数无效: target_serial=%p, pWriteBuffer=%p, WriteLen=%d", target_serial, pWriteBuffer, WriteLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    return SPI_WriteBulkH(device_id, SPIIndex, pWriteBuffer, WriteLen);
+}
+
+int SPI_WriteBulkH(usb_handle_t handle, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen) {
+    if (!pWriteBuffer || WriteLen <= 0) {
+        debug_printf("参数无效: pWriteBuffer=%p, WriteLen=%d", pWriteBuffer, WriteLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = handle;
+
+    GENERIC_CMD_HEADER cmd_header;
+    cmd_header.protocol_type = PROTOCOL_SPI;
+    cmd_header.cmd_id = CMD_WRITE;
+    cmd_header.device_index = (uint8_t)SPIIndex;
+    cmd_header.param_count = 0;
+    cmd_header.data_len = 0;                   // 每帧的长度在拆帧时填写
+
+    int ret = usb_middleware_send_segmented(device_id, &cmd_header, pWriteBuffer, WriteLen);
+    if (ret < 0) {
+        debug_printf("SPI大块写入失败: %d", ret);
+        return SPI_ERROR_IO;
+    }
+    return ret;
+}
+
 
 
 int SPI_Queue_WriteBytes(const char* target_serial, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen) {
@@ -88,6 +132,15 @@ int SPI_Queue_WriteBytes(const char* target_serial, int SPIIndex, unsigned char*
         debug_printf("设备未打开: %s", target_serial);
         return SPI_ERROR_OTHER;
     }
+    return SPI_Queue_WriteBytesH(device_id, SPIIndex, pWriteBuffer, WriteLen);
+}
+
+int SPI_Queue_WriteBytesH(usb_handle_t handle, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen) {
+    if (!pWriteBuffer || WriteLen <= 0) {
+        debug_printf("参数无效: pWriteBuffer=%p, WriteLen=%d", pWriteBuffer, WriteLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = handle;
 
     GENERIC_CMD_HEADER cmd_header;
     cmd_header.protocol_type = PROTOCOL_SPI;    // SPI协议
@@ -96,31 +149,38 @@ int SPI_Queue_WriteBytes(const char* target_serial, int SPIIndex, unsigned char*
     cmd_header.param_count = 0;                // 参数数量，写操作不需要额外参数
     cmd_header.data_len = WriteLen;            // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
+    if (usb_middleware_get_queue_window(device_id) > 1) {
+        // 窗口方式：发出即返回，应答在窗口满或排空时处理
+        int ret = usb_middleware_queue_write(device_id, &cmd_header, pWriteBuffer, WriteLen, CMD_QUEUE_STATUS);
+        if (ret == USB_ERROR_BUSY) {
+            return 1;   // 与逐帧等应答时一样，非0表示队列满、该帧未入队
+        }
+        if (ret < 0) {
+            return ret == USB_ERROR_NOT_FOUND ? SPI_ERROR_OTHER : SPI_ERROR_IO;
+        }
+        return SPI_SUCCESS;
+    }
+
+    // 先登记再发送，应答由解析线程直接交回，不会被其他命令取走
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_STATUS, CMD_QUEUE_WRITE, (uint8_t)SPIIndex);
+    if (request < 0) {
         return SPI_ERROR_OTHER;
     }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
-    // 使用专用状态缓冲区读取响应，支持完整协议头
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
+    if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
+        debug_printf("发送SPI队列写入命令失败: %d", ret);
+        return SPI_ERROR_IO;
+    }
+
     unsigned char response_buffer[16];  // 足够容纳完整状态响应
-    int max_loops = 1000000;
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_status_data(device_id, response_buffer, sizeof(response_buffer));
-        
-        if (actual_read >= sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
-            GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)response_buffer;
-            if (header->protocol_type == PROTOCOL_STATUS && 
-                header->cmd_id == CMD_QUEUE_WRITE ) {
-                uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
-                return queue_status;
-            }
-        }
+    int actual_read = usb_middleware_request_wait(device_id, request, response_buffer, sizeof(response_buffer),
+                                                  SPI_STATUS_TIMEOUT_MS);
+    if (actual_read >= (int)sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
+        uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
+        return queue_status;
     }
-    
+
     debug_printf("队列写入失败，未收到响应");
     return SPI_ERROR_IO; // 读取失败
 }
@@ -139,7 +199,7 @@ int SPI_SlaveReadBytes(const char* target_serial, int SPIIndex, unsigned char* p
         return SPI_ERROR_OTHER;
     }
     
-    int actual_read = usb_middleware_read_spi_data(device_id, pReadBuffer, ReadLen);
+    int actual_read = usb_middleware_read_spi_index_timeout(device_id, SPIIndex, pReadBuffer, ReadLen, 0, 0);
     if (actual_read < 0) {
         debug_printf("从SPI缓冲区读取数据失败: %d", actual_read);
         return SPI_ERROR_IO;
@@ -154,6 +214,216 @@ int SPI_SlaveReadBytes(const char* target_serial, int SPIIndex, unsigned char* p
 
 
 
+WINAPI int SPI_SlaveReadBytesTimeout(const char* target_serial, int SPIIndex, unsigned char* pReadBuffer, int ReadLen,
+                                     int MinLen, int TimeoutMs) {
+    if (!target_serial || !pReadBuffer || ReadLen <= 0) {
+        debug_printf("参数无效: target_serial=%p, pReadBuffer=%p, ReadLen=%d", target_serial, pReadBuffer, ReadLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+
+    int actual_read = usb_middleware_read_spi_index_timeout(device_id, SPIIndex, pReadBuffer, ReadLen, MinLen, TimeoutMs);
+    if (actual_read < 0) {
+        debug_printf("从SPI缓冲区读取数据失败: %d", actual_read);
+        return SPI_ERROR_IO;
+    }
+    return actual_read;
+}
+
+WINAPI int SPI_SlavePeek(const char* target_serial, int SPIIndex, const unsigned char** ppData, int* pLen) {
+    if (!target_serial || !ppData || !pLen) {
+        debug_printf("参数无效: target_serial=%p, ppData=%p, pLen=%p", target_serial, ppData, pLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+
+    int ret = usb_middleware_peek_spi_data(device_id, SPIIndex, ppData, pLen);
+    if (ret < 0) {
+        debug_printf("借出SPI缓冲区失败: %d", ret);
+        return SPI_ERROR_IO;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_SlaveCommit(const char* target_serial, int SPIIndex, int CommitLen) {
+    if (!target_serial || CommitLen < 0) {
+        debug_printf("参数无效: target_serial=%p, CommitLen=%d", target_serial, CommitLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+
+    int committed = usb_middleware_commit_spi_data(device_id, SPIIndex, CommitLen);
+    if (committed < 0) {
+        debug_printf("归还SPI缓冲区失败: %d", committed);
+        return SPI_ERROR_IO;
+    }
+    return committed;
+}
+
+WINAPI int SPI_SlaveGetBufferStats(const char* target_serial, int SPIIndex, SPI_BUFFER_STATS* pStats) {
+    if (!target_serial || !pStats) {
+        debug_printf("参数无效: target_serial=%p, pStats=%p", target_serial, pStats);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+
+    if (usb_middleware_get_spi_ring_stats(device_id, SPIIndex, pStats) < 0) {
+        return SPI_ERROR_OTHER;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_StartFrameCapture(const char* target_serial, int SPIIndex, SPI_FRAME_CONFIG* pConfig) {
+    if (!target_serial || !pConfig) {
+        debug_printf("参数无效: target_serial=%p, pConfig=%p", target_serial, pConfig);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_start_spi_frames(device_id, SPIIndex, pConfig);
+    if (ret < 0) {
+        debug_printf("开始SPI分帧采集失败: %d", ret);
+        return ret == USB_ERROR_INVALID_PARAM ? SPI_ERROR_INVALID_PARAM : SPI_ERROR_OTHER;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_StopFrameCapture(const char* target_serial, int SPIIndex) {
+    if (!target_serial) {
+        debug_printf("参数无效: target_serial=%p", target_serial);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_stop_spi_frames(device_id, SPIIndex);
+    if (ret < 0) {
+        debug_printf("停止SPI分帧采集失败: %d", ret);
+        return ret == USB_ERROR_INVALID_PARAM ? SPI_ERROR_INVALID_PARAM : SPI_ERROR_OTHER;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_ReadFrame(const char* target_serial, int SPIIndex, unsigned char* pReadBuffer, int ReadLen,
+                         SPI_FRAME_INFO* pInfo, int TimeoutMs) {
+    if (!target_serial || !pReadBuffer || ReadLen <= 0) {
+        debug_printf("参数无效: target_serial=%p, pReadBuffer=%p, ReadLen=%d", target_serial, pReadBuffer, ReadLen);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_read_spi_frame(device_id, SPIIndex, pReadBuffer, ReadLen, pInfo, TimeoutMs);
+    if (ret == USB_ERROR_TIMEOUT) {
+        return 0;
+    }
+    if (ret < 0) {
+        debug_printf("读取SPI帧失败: %d", ret);
+        return ret == USB_ERROR_NOT_FOUND ? SPI_ERROR_OTHER : SPI_ERROR_IO;
+    }
+    return ret;
+}
+
+WINAPI int SPI_GetFrameStats(const char* target_serial, int SPIIndex, SPI_FRAME_STATS* pStats) {
+    if (!target_serial || !pStats) {
+        debug_printf("参数无效: target_serial=%p, pStats=%p", target_serial, pStats);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_get_spi_frame_stats(device_id, SPIIndex, pStats);
+    if (ret < 0) {
+        return ret == USB_ERROR_INVALID_PARAM ? SPI_ERROR_INVALID_PARAM : SPI_ERROR_OTHER;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_StartCaptureToFile(const char* target_serial, int SPIIndex, const char* Path, SPI_FILE_OPTIONS* pOptions) {
+    if (!target_serial || !Path) {
+        debug_printf("参数无效: target_serial=%p, Path=%p", target_serial, Path);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_start_spi_file(device_id, SPIIndex, Path, pOptions);
+    if (ret < 0) {
+        debug_printf("开始SPI数据落盘失败: %d", ret);
+        if (ret == USB_ERROR_INVALID_PARAM) {
+            return SPI_ERROR_INVALID_PARAM;
+        }
+        return ret == USB_ERROR_ACCESS ? SPI_ERROR_ACCESS : SPI_ERROR_IO;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_StopCaptureToFile(const char* target_serial, int SPIIndex) {
+    if (!target_serial) {
+        debug_printf("参数无效: target_serial=%p", target_serial);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_stop_spi_file(device_id, SPIIndex, NULL);
+    if (ret < 0) {
+        debug_printf("停止SPI数据落盘失败: %d", ret);
+        return ret == USB_ERROR_INVALID_PARAM ? SPI_ERROR_INVALID_PARAM : SPI_ERROR_OTHER;
+    }
+    return SPI_SUCCESS;
+}
+
+WINAPI int SPI_GetCaptureToFileStats(const char* target_serial, int SPIIndex, SPI_FILE_STATS* pStats) {
+    if (!target_serial || !pStats) {
+        debug_printf("参数无效: target_serial=%p, pStats=%p", target_serial, pStats);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_get_spi_file_stats(device_id, SPIIndex, pStats);
+    if (ret < 0) {
+        return ret == USB_ERROR_INVALID_PARAM ? SPI_ERROR_INVALID_PARAM : SPI_ERROR_OTHER;
+    }
+    return SPI_SUCCESS;
+}
+
 WINAPI int SPI_GetQueueStatus(const char* target_serial, int SPIIndex) {
     if (!target_serial) {
         debug_printf("参数无效: target_serial=%p", target_serial);
@@ -165,6 +435,12 @@ WINAPI int SPI_GetQueueStatus(const char* target_serial, int SPIIndex) {
         debug_printf("设备未打开: %s", target_serial);
         return SPI_ERROR_OTHER;
     }
+    return SPI_GetQueueStatusH(device_id, SPIIndex);
+}
+
+WINAPI int SPI_GetQueueStatusH(usb_handle_t handle, int SPIIndex) {
+    int device_id = handle;
+    unsigned long long start_us = usb_now_us();
 
     // 组包协议头
     GENERIC_CMD_HEADER cmd_header;
@@ -174,18 +450,14 @@ WINAPI int SPI_GetQueueStatus(const char* target_serial, int SPIIndex) {
     cmd_header.param_count = 0;                  // 无参数
     cmd_header.data_len = 0;                     // 无数据
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   NULL, 0);
-    if (total_len < 0) {
+    int request = usb_middleware_request_begin(device_id, PROTOCOL_STATUS, CMD_QUEUE_STATUS, (uint8_t)SPIIndex);
+    if (request < 0) {
         return SPI_ERROR_OTHER;
     }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     
     if (ret < 0) {
+        usb_middleware_request_cancel(device_id, request);
         debug_printf("发送SPI队列状态查询命令失败: %d", ret);
         return SPI_ERROR_IO;
     }
@@ -194,17 +466,12 @@ WINAPI int SPI_GetQueueStatus(const char* target_serial, int SPIIndex) {
     
 
     unsigned char response_buffer[16];  
-    int max_loops = 1000000;
-    for (int i = 0; i < max_loops; i++) {
-        int actual_read = usb_middleware_read_status_data(device_id, response_buffer, sizeof(response_buffer));
-        if (actual_read >= sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
-            GENERIC_CMD_HEADER* header = (GENERIC_CMD_HEADER*)response_buffer;
-            if (header->protocol_type == PROTOCOL_STATUS && 
-                header->cmd_id == CMD_QUEUE_STATUS ) {
-                uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
-                return queue_status;
-            }
-        }
+    int actual_read = usb_middleware_request_wait(device_id, request, response_buffer, sizeof(response_buffer),
+                                                  SPI_STATUS_TIMEOUT_MS);
+    if (actual_read >= (int)sizeof(GENERIC_CMD_HEADER) + 1) {  // 至少包含协议头+状态数据
+        uint8_t queue_status = response_buffer[sizeof(GENERIC_CMD_HEADER)];
+        usb_middleware_record_latency(device_id, USB_LATENCY_SPI_QUEUE_STATUS, start_us);
+        return queue_status;
     }
     
     debug_printf("队列状态查询失败，未收到响应");
@@ -215,6 +482,58 @@ WINAPI int SPI_GetQueueStatus(const char* target_serial, int SPIIndex) {
 
 
 
+WINAPI int SPI_Queue_SetWindow(const char* target_serial, int Window, int QueueCapacity) {
+    if (!target_serial || QueueCapacity < 0) {
+        debug_printf("参数无效: target_serial=%p, QueueCapacity=%d", target_serial, QueueCapacity);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    int ret = usb_middleware_set_queue_window(device_id, Window, QueueCapacity);
+    return ret < 0 ? SPI_ERROR_IO : SPI_SUCCESS;
+}
+
+WINAPI int SPI_Queue_Drain(const char* target_serial, int TimeoutMs) {
+    if (!target_serial) {
+        debug_printf("参数无效: target_serial=%p", target_serial);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    return SPI_Queue_DrainH(device_id, TimeoutMs);
+}
+
+WINAPI int SPI_Queue_DrainH(usb_handle_t handle, int TimeoutMs) {
+    int failed = usb_middleware_queue_drain(handle, TimeoutMs);
+    if (failed < 0) {
+        debug_printf("等待队列写入应答失败: %d", failed);
+        return failed == USB_ERROR_NOT_FOUND ? SPI_ERROR_OTHER : SPI_ERROR_IO;
+    }
+    if (failed > 0) {
+        debug_printf("队列写入有%d帧被拒或无应答", failed);
+    }
+    return failed;
+}
+
+WINAPI int SPI_Queue_GetStats(const char* target_serial, SPI_QUEUE_STATS* pStats) {
+    if (!target_serial || !pStats) {
+        debug_printf("参数无效: target_serial=%p, pStats=%p", target_serial, pStats);
+        return SPI_ERROR_INVALID_PARAM;
+    }
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return SPI_ERROR_OTHER;
+    }
+    return usb_middleware_get_queue_stats(device_id, pStats) < 0 ? SPI_ERROR_IO : SPI_SUCCESS;
+}
+
 int SPI_StartQueue(const char* target_serial, int SPIIndex) {
 
     if (!target_serial) {
@@ -237,15 +556,7 @@ int SPI_StartQueue(const char* target_serial, int SPIIndex) {
     cmd_header.param_count = 0;                  // 无参数
     cmd_header.data_len = 0;                     // 无数据
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送SPI队列状态查询命令失败: %d", ret);
         return SPI_ERROR_IO;
@@ -274,15 +585,7 @@ int SPI_StopQueue(const char* target_serial, int SPIIndex) {
     cmd_header.device_index = (uint8_t)SPIIndex; // 设备索引
     cmd_header.param_count = 0;                  // 无参数
     cmd_header.data_len = 0;                     // 无数据
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   NULL, 0);
-    if (total_len < 0) {
-        return SPI_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, NULL, 0);
     if (ret < 0) {
         debug_printf("发送SPI队列状态查询命令失败: %d", ret);
         return SPI_ERROR_IO;
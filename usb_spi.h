@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include "usb_application.h"
+#include "usb_middleware.h"
 
 
 // 定义返回值
@@ -16,6 +17,21 @@ extern "C" {
 #define SPI_ERROR_INVALID_PARAM -4   // 参数无效
 #define SPI_ERROR_OTHER        -99   // 其他错误
 
+// 队列写入窗口统计，见SPI_Queue_GetStats
+typedef usb_queue_stats_t SPI_QUEUE_STATS;
+
+// SPI从机分帧采集的配置、帧信息和统计，见SPI_StartFrameCapture
+typedef usb_frame_config_t SPI_FRAME_CONFIG;
+typedef usb_frame_info_t SPI_FRAME_INFO;
+typedef usb_frame_stats_t SPI_FRAME_STATS;
+
+// SPI从机数据落盘的选项和统计，见SPI_StartCaptureToFile
+typedef usb_ring_file_options_t SPI_FILE_OPTIONS;
+typedef usb_ring_file_stats_t SPI_FILE_STATS;
+
+// SPI从机接收缓冲区统计，见SPI_SlaveGetBufferStats
+typedef ring_buffer_stats_t SPI_BUFFER_STATS;
+
 // SPI配置结构体
 typedef struct _SPI_CONFIG {
     char   Mode;            // SPI控制方式:0-硬件控制（全双工模式）,1-硬件控制（半双工模式），2-软件控制（半双工模式）,3-单总线模式，数据线输入输出都为MOSI,4-软件控制（全双工模式）  
@@ -39,14 +55,81 @@ typedef struct _CMD_HEADER {
 
 WINAPI int SPI_Init(const char* target_serial, int SPIIndex, PSPI_CONFIG pConfig);
 
+// 超过一帧上限(约64KB)的数据自动拆成多帧发送，见SPI_WriteBulk
 WINAPI int SPI_WriteBytes(const char* target_serial, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen);
 
+// 大块写入：任意长度的数据拆成最大帧首尾相接地发送，多个OUT传输同时挂起，不分配内存。
+// 返回写入的字节数，用于一次推送整幅显示图像等
+WINAPI int SPI_WriteBulk(const char* target_serial, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen);
+
+// 每个SPIIndex有独立的接收缓冲区：SPI_Init或第一次读取该索引时建立，之后设备按device_index上报的数据
+// 只进入对应索引的缓冲区。索引0(以及还没有缓冲区的索引)共用原来的SPI缓冲区
 WINAPI int SPI_SlaveReadBytes(const char* target_serial, int SPIIndex, unsigned char* pReadBuffer, int ReadLen);
 
+// 阻塞读取：等到至少MinLen字节或TimeoutMs毫秒(<0为一直等待)后返回，返回实际读取的字节数
+WINAPI int SPI_SlaveReadBytesTimeout(const char* target_serial, int SPIIndex, unsigned char* pReadBuffer, int ReadLen,
+                                     int MinLen, int TimeoutMs);
+
+// 零拷贝读取：*ppData指向缓冲区内的连续可读数据，*pLen为其长度；
+// 处理完后调用SPI_SlaveCommit移除已消费的字节，在此之前该区域不会被新数据覆盖
+WINAPI int SPI_SlavePeek(const char* target_serial, int SPIIndex, const unsigned char** ppData, int* pLen);
+
+WINAPI int SPI_SlaveCommit(const char* target_serial, int SPIIndex, int CommitLen);
+
+// 该SPIIndex接收缓冲区的统计(还没有独立缓冲区时为共用缓冲区的统计)
+WINAPI int SPI_SlaveGetBufferStats(const char* target_serial, int SPIIndex, SPI_BUFFER_STATS* pStats);
+
+// 分帧采集：SPIIndex收到的数据按pConfig(固定帧长、同步字+帧长或同步字分隔)在库内重组成完整帧，
+// 放进预分配的帧池，SPI_ReadFrame每次取一帧。采集期间该索引的数据不再进入SPI_SlaveReadBytes的缓冲区
+WINAPI int SPI_StartFrameCapture(const char* target_serial, int SPIIndex, SPI_FRAME_CONFIG* pConfig);
+
+// SPIIndex须与开始采集时相同，正在采集其他索引时返回SPI_ERROR_OTHER且不停止
+WINAPI int SPI_StopFrameCapture(const char* target_serial, int SPIIndex);
+
+// 等待一帧(TimeoutMs<0为一直等待)，返回拷贝的字节数，帧比ReadLen长时截断；
+// pInfo返回帧序号(丢弃的帧也占序号)、时间戳和完整长度，可为NULL。超时返回0
+WINAPI int SPI_ReadFrame(const char* target_serial, int SPIIndex, unsigned char* pReadBuffer, int ReadLen,
+                         SPI_FRAME_INFO* pInfo, int TimeoutMs);
+
+// 没有在采集SPIIndex时返回SPI_ERROR_OTHER
+WINAPI int SPI_GetFrameStats(const char* target_serial, int SPIIndex, SPI_FRAME_STATS* pStats);
+
+// 落盘采集：库内线程把SPI从机数据按对齐的大块写入Path(pOptions为NULL时1MB块、直接I/O、不分割文件)，
+// 设置了分割大小时文件名为Path加_0000序号。采集期间不要再调用SPI_SlaveReadBytes等读取同一数据
+WINAPI int SPI_StartCaptureToFile(const char* target_serial, int SPIIndex, const char* Path, SPI_FILE_OPTIONS* pOptions);
+
+// 写完停止时已收到的数据后返回；SPIIndex须与开始落盘时相同，否则返回SPI_ERROR_OTHER且不停止
+WINAPI int SPI_StopCaptureToFile(const char* target_serial, int SPIIndex);
+
+// 写入字节数和速率、缓冲区积压、丢失字节数；已停止时返回最后一次采集的统计，SPIIndex不是该次采集的索引时返回SPI_ERROR_OTHER
+WINAPI int SPI_GetCaptureToFileStats(const char* target_serial, int SPIIndex, SPI_FILE_STATS* pStats);
+
 WINAPI int SPI_Queue_WriteBytes(const char* target_serial, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen);
 
 WINAPI int SPI_GetQueueStatus(const char* target_serial, int SPIIndex);
 
+// 句柄版本：参数和返回值同上，用USB_GetHandle获得的句柄代替序列号，省去每次调用的查找
+WINAPI int SPI_WriteBytesH(usb_handle_t handle, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen);
+
+WINAPI int SPI_WriteBulkH(usb_handle_t handle, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen);
+
+WINAPI int SPI_Queue_WriteBytesH(usb_handle_t handle, int SPIIndex, unsigned char* pWriteBuffer, int WriteLen);
+
+WINAPI int SPI_GetQueueStatusH(usb_handle_t handle, int SPIIndex);
+
+// 队列写入窗口：Window<=1时每次SPI_Queue_WriteBytes都等设备应答并返回队列状态(默认)；
+// Window>1时最多Window帧在途，发出即返回SPI_SUCCESS，只在窗口满时等最早的应答。
+// QueueCapacity为设备队列容量(帧)，>0时估计队列已满会先查询实际深度，有空位再发；0=只按窗口限制。
+// 等待空位超过1秒时不发送该帧：队列仍满返回1，无应答返回SPI_ERROR_IO
+WINAPI int SPI_Queue_SetWindow(const char* target_serial, int Window, int QueueCapacity);
+
+// 等待在途的队列写入全部应答，返回上次排空以来被拒(队列满)或无应答的帧数，<0为错误
+WINAPI int SPI_Queue_Drain(const char* target_serial, int TimeoutMs);
+
+WINAPI int SPI_Queue_DrainH(usb_handle_t handle, int TimeoutMs);
+
+WINAPI int SPI_Queue_GetStats(const char* target_serial, SPI_QUEUE_STATS* pStats);
+
 WINAPI int SPI_StartQueue(const char* target_serial, int SPIIndex);
 
 WINAPI int SPI_StopQueue(const char* target_serial, int SPIIndex);
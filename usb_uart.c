@@ -41,14 +41,7 @@ WINAPI int UART_Init(const char* target_serial, int uart_index, UART_CONFIG* con
     cmd_header.param_count = 1;
     cmd_header.data_len = 0;
     
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, (unsigned char*)config, sizeof(UART_CONFIG), NULL, 0);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, config, sizeof(UART_CONFIG), NULL, 0);
     
     debug_printf("UART初始化结果: %d", ret);
     return (ret >= 0) ? USB_SUCCESS : USB_ERROR_OTHER;
@@ -78,6 +71,31 @@ WINAPI int UART_ReadBytes(const char* target_serial, int uart_index, unsigned ch
     return actual_read;
 }
 
+WINAPI int UART_ReadBytesTimeout(const char* target_serial, int uart_index, unsigned char* pReadBuffer, int ReadLen,
+                                 int MinLen, int TimeoutMs) {
+    if (!target_serial || !pReadBuffer || ReadLen <= 0) {
+        debug_printf("参数无效: target_serial=%p, pReadBuffer=%p, ReadLen=%d", target_serial, pReadBuffer, ReadLen);
+        return USB_ERROR_INVALID_PARAM;
+    }
+
+    int device_id = usb_middleware_find_device_by_serial(target_serial);
+    if (device_id < 0) {
+        debug_printf("设备未打开: %s", target_serial);
+        return USB_ERROR_OTHER;
+    }
+
+    int actual_read = usb_middleware_read_uart_data_timeout(device_id, pReadBuffer, ReadLen, MinLen, TimeoutMs);
+    if (actual_read < 0) {
+        debug_printf("从UART缓冲区读取数据失败: %d", actual_read);
+        return USB_ERROR_OTHER;
+    }
+
+    if (actual_read > 0) {
+        debug_printf("成功读取UART数据，UART索引: %d, 数据长度: %d字节", uart_index, actual_read);
+    }
+    return actual_read;
+}
+
 WINAPI int UART_WriteBytes(const char* target_serial, int uart_index, unsigned char* pWriteBuffer, int WriteLen) {
     if (!target_serial || !pWriteBuffer || WriteLen <= 0) {
         debug_printf("参数无效: target_serial=%p, pWriteBuffer=%p, WriteLen=%d", target_serial, pWriteBuffer, WriteLen);
@@ -97,15 +115,7 @@ WINAPI int UART_WriteBytes(const char* target_serial, int uart_index, unsigned c
     cmd_header.param_count = 0;                 // 参数数量，写操作不需要额外参数
     cmd_header.data_len = WriteLen;             // 数据部分长度
 
-    unsigned char* send_buffer;
-    int total_len = build_protocol_frame(&send_buffer, &cmd_header, 
-                                   NULL, 0, 
-                                   pWriteBuffer, WriteLen);
-    if (total_len < 0) {
-        return USB_ERROR_OTHER;
-    }
-    int ret = usb_middleware_write_data(device_id, send_buffer, total_len);
-    free(send_buffer);
+    int ret = usb_middleware_send_frame(device_id, &cmd_header, NULL, 0, pWriteBuffer, WriteLen);
     
     if (ret >= 0) {
         debug_printf("成功发送UART数据，UART索引: %d, 数据长度: %d字节", uart_index, WriteLen);
@@ -40,6 +40,13 @@ WINAPI int UART_Init(const char* target_serial, int uart_index, UART_CONFIG* con
 // @return 成功返回实际读取字节数，失败返回负数错误码
 WINAPI int UART_ReadBytes(const char* target_serial, int uart_index, unsigned char* pReadBuffer, int ReadLen);
 
+// UART阻塞读取数据
+// @param MinLen 至少等到的字节数
+// @param TimeoutMs 超时时间(毫秒)，小于0表示一直等待
+// @return 成功返回实际读取字节数(超时可能小于MinLen)，失败返回负数错误码
+WINAPI int UART_ReadBytesTimeout(const char* target_serial, int uart_index, unsigned char* pReadBuffer, int ReadLen,
+                                 int MinLen, int TimeoutMs);
+
 // UART发送数据
 // @param target_serial 设备序列号
 // @param uart_index UART索引 (1对应USART3/PD8/PD9)